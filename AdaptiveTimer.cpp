@@ -0,0 +1,188 @@
+/**************************************************************************/
+/*!
+    @file     AdaptiveTimer.cpp
+    @author   Masa
+
+        Adaptive timer-mode period from the level rate of recent single shots
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "AdaptiveTimer.h"
+
+#include <math.h>
+
+namespace{
+    //  1回計測の液面の雑音（標準偏差）の下限 [0.1%]  残差がこれより小さくても変化率の不確かさはこれで見積る
+    constexpr float LEVEL_NOISE_FLOOR = 1.0f;
+    //  変化率に足す不確かさ（標準偏差の倍数）
+    constexpr float RATE_SIGMA = 2.0f;
+    //  記録をやり直す予測からのずれ [0.1%]
+    constexpr float JUMP_LEVEL = 30.0f;
+}
+
+/*!
+    @brief  パラメタの既定値  固定の周期（従来の動作）
+*/
+AdaptiveConfig AdaptiveTimer::defaultConfig(void){
+    AdaptiveConfig config = {};
+    config.enabled = 0;
+    config.period_min = 300;
+    config.period_max = ADAPTIVE_PERIOD_UPPER;
+    config.uncertainty = 10;
+    config.alarm_level = 0;
+    return config;
+}
+
+/*!
+    @brief  パラメタが使える範囲か
+*/
+bool AdaptiveTimer::isValid(const AdaptiveConfig& config){
+    return config.enabled <= 1
+        && config.period_min >= ADAPTIVE_PERIOD_LOWER
+        && config.period_min <= config.period_max
+        && config.period_max <= ADAPTIVE_PERIOD_UPPER
+        && config.uncertainty > 0 && config.uncertainty <= 1000
+        && config.alarm_level <= 1000;
+}
+
+/*!
+    @brief  パラメタを設定する. 範囲外のパラメタなら既定値を使う. 記録は残す
+*/
+void AdaptiveTimer::configure(const AdaptiveConfig& new_config){
+    config = isValid(new_config) ? new_config : defaultConfig();
+}
+
+/*!
+    @brief  記録を捨てる. 次の計測から変化率を求め直す
+*/
+void AdaptiveTimer::reset(void){
+    f_jumped = false;
+    head = 0;
+    count = 0;
+    fit_level = 0.0f;
+    rate = 0.0f;
+    rate_sd = 0.0f;
+}
+
+/*!
+    @brief  1回計測の結果を記録して変化率を求め直す（センサエラーの結果は渡さない）
+            予測から JUMP_LEVEL 以上離れていれば、それまでの記録を捨ててこの計測から始める
+    @param level 液面 [0.1%]
+    @param time_s 計測した時刻 [s]  単調に増えること
+*/
+void AdaptiveTimer::addSample(uint16_t level, uint32_t time_s){
+    if (count >= 2){
+        const float predicted = fit_level + rate * (float)(time_s - times[newest()]);
+        if (fabsf((float)level - predicted) > JUMP_LEVEL){
+            reset();
+            restarts++;
+            f_jumped = true;
+        }
+    }
+
+    levels[head] = level;
+    times[head] = time_s;
+    head = (head + 1) % ADAPTIVE_HISTORY;
+    if (count < ADAPTIVE_HISTORY){
+        count++;
+    }
+    if (count >= ADAPTIVE_MIN_SAMPLES){
+        f_jumped = false;
+    }
+    fit();
+}
+
+/*!
+    @brief  次の計測までの周期
+    @param fixed_period 固定の周期 [s]  適応しない時・最初の記録が足りない時に使う
+    @return 周期 [s]
+*/
+uint16_t AdaptiveTimer::nextPeriod(uint16_t fixed_period) const {
+    if (!config.enabled){
+        return fixed_period;
+    }
+    //  液面が飛んだ後は速く変わっているので、記録がたまるまで period_min で追う
+    if (count < ADAPTIVE_MIN_SAMPLES){
+        return f_jumped ? config.period_min : fixed_period;
+    }
+
+    const float uncertainty = config.uncertainty;
+    float period = config.period_max;
+
+    //  変わりうる速さ  周期の間にこれで uncertainty だけ変わる
+    const float speed = fabsf(rate) + RATE_SIGMA * rate_sd;
+    if (speed * period > uncertainty){
+        period = uncertainty / speed;
+    }
+
+    //  警報液面に近づいている（下回った後は、もう分かっているので縮めない）
+    const float margin = fit_level - config.alarm_level;
+    if (config.alarm_level != 0 && margin > 0.0f){
+        const float falling = -rate + RATE_SIGMA * rate_sd;
+        if (margin <= uncertainty){
+            period = config.period_min;
+        } else if (falling > 0.0f && margin / falling * 0.5f < period){
+            period = margin / falling * 0.5f;
+        }
+    }
+
+    if (period < config.period_min){
+        return config.period_min;
+    }
+    return (period > config.period_max) ? config.period_max : (uint16_t)period;
+}
+
+/*!
+    @brief  記録に直線を当てはめる (private)
+            時刻は最新の計測からの差で計算する. 残差から液面の雑音を見積り、変化率の不確かさにする
+*/
+void AdaptiveTimer::fit(void){
+    const uint32_t t_last = times[newest()];
+
+    float mean_x = 0.0f;
+    float mean_y = 0.0f;
+    for (uint8_t i = 0; i < count; i++){
+        mean_x += -(float)(t_last - times[i]);
+        mean_y += levels[i];
+    }
+    mean_x /= count;
+    mean_y /= count;
+
+    float sxx = 0.0f;
+    float sxy = 0.0f;
+    for (uint8_t i = 0; i < count; i++){
+        const float dx = -(float)(t_last - times[i]) - mean_x;
+        sxx += dx * dx;
+        sxy += dx * (levels[i] - mean_y);
+    }
+
+    if (count < 2 || sxx <= 0.0f){
+        fit_level = levels[newest()];
+        rate = 0.0f;
+        rate_sd = 0.0f;
+        return;
+    }
+
+    rate = sxy / sxx;
+    fit_level = mean_y - rate * mean_x;
+
+    float noise = LEVEL_NOISE_FLOOR;
+    if (count > 2){
+        float sum_sq = 0.0f;
+        for (uint8_t i = 0; i < count; i++){
+            const float residual = levels[i] - (fit_level - rate * (float)(t_last - times[i]));
+            sum_sq += residual * residual;
+        }
+        noise = fmaxf(sqrtf(sum_sq / (count - 2)), LEVEL_NOISE_FLOOR);
+    }
+    rate_sd = noise / sqrtf(sxx);
+}
+
+/*!
+    @brief  最新の計測の位置 (private)
+*/
+uint8_t AdaptiveTimer::newest(void) const {
+    return (head + ADAPTIVE_HISTORY - 1) % ADAPTIVE_HISTORY;
+}
@@ -0,0 +1,104 @@
+/**************************************************************************/
+/*!
+    @file     AdaptiveTimer.h
+
+    タイマモードの計測周期を液面の変化の速さから決める（適応タイマ）
+        1回計測の液面と時刻を直近 ADAPTIVE_HISTORY 回分覚え、最小二乗の直線で変化率とその不確かさを求める.
+        次の計測までに液面が変わりうる量（変化率 + その不確かさの2倍）が
+        許容量 uncertainty を超えないように周期を決め、period_min〜period_max に収める.
+            液面がほとんど変わらない時は長い周期で計測してヒータの発熱（液体ヘリウムの蒸発）を減らし、
+            汲み出しや補充で変わっている時は短い周期で追う.
+        警報液面より上で液面が下がっている時は、警報液面に届くと見込む時刻の半分までに次を計測する
+        （近づくほど周期が短くなる）. 警報液面の上 uncertainty 以内なら period_min. 下回った後は縮めない.
+        予測から 3% 以上離れた液面（補充の開始など）が来たら、それまでの記録を捨ててやり直す.
+        記録が ADAPTIVE_MIN_SAMPLES 回分たまるまでは、最初は固定の周期（eh900 のタイマ周期）、
+        やり直した時は period_min を使う.
+    液面は [0.1%], 時刻と周期は [s]. 変化率の計算は浮動小数点（1回計測ごとに1回なので軽い）
+*/
+/**************************************************************************/
+
+#ifndef _ADAPTIVETIMER_H_
+#define _ADAPTIVETIMER_H_
+
+#include <stdint.h>
+
+//  変化率を求める計測の回数と、適応の周期を使い始める回数
+constexpr uint8_t ADAPTIVE_HISTORY = 4;
+constexpr uint8_t ADAPTIVE_MIN_SAMPLES = 3;
+//  設定できる周期の範囲 [s]  上限は表示（分2桁）に入る eh900 のタイマ周期の上限と同じ
+constexpr uint16_t ADAPTIVE_PERIOD_LOWER = 60;
+constexpr uint16_t ADAPTIVE_PERIOD_UPPER = 5400;
+
+/*!
+    @brief  適応タイマのパラメタ（eh900 に保存する）
+*/
+struct AdaptiveConfig {
+    //  0:固定の周期（従来の動作）, 1:適応
+    uint8_t enabled;
+    //  周期の下限・上限 [s]
+    uint16_t period_min;
+    uint16_t period_max;
+    //  計測の間に許す液面の変化 [0.1%]
+    uint16_t uncertainty;
+    //  警報液面 [0.1%]  0なら使わない
+    uint16_t alarm_level;
+};
+
+class AdaptiveTimer {
+
+  public:
+    AdaptiveTimer(void){};
+
+    void configure(const AdaptiveConfig& config);
+    void reset(void);
+
+    void addSample(uint16_t level, uint32_t time_s);
+    uint16_t nextPeriod(uint16_t fixed_period) const;
+
+    static AdaptiveConfig defaultConfig(void);
+    static bool isValid(const AdaptiveConfig& config);
+
+    /*!
+    @brief  記録している計測の回数
+    */
+    uint8_t getSamples(void) const {
+      return count;
+    };
+
+    /*!
+    @brief  液面の変化率 [0.1%/h]  記録が2回分以上ある時だけ求める（それ以外は0）
+    */
+    int32_t getRate(void) const {
+      return (int32_t)(rate * 3600.0f);
+    };
+
+    /*!
+    @brief  予測から離れた液面で記録をやり直した回数
+    */
+    uint32_t getRestarts(void) const {
+      return restarts;
+    };
+
+  private:
+    AdaptiveConfig config = defaultConfig();
+
+    //  直近の計測  head が次に書く位置
+    uint16_t levels[ADAPTIVE_HISTORY];
+    uint32_t times[ADAPTIVE_HISTORY];
+    uint8_t head = 0;
+    uint8_t count = 0;
+
+    //  直線の当てはめ  最新の計測時刻での液面 [0.1%], 変化率 [0.1%/s] とその標準偏差
+    float fit_level = 0.0f;
+    float rate = 0.0f;
+    float rate_sd = 0.0f;
+
+    uint32_t restarts = 0;
+    //  予測から離れた液面で記録をやり直し、まだ記録が足りない
+    bool f_jumped = false;
+
+    void fit(void);
+    uint8_t newest(void) const;
+};
+
+#endif // _ADAPTIVETIMER_H_
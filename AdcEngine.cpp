@@ -0,0 +1,391 @@
+/**************************************************************************/
+/*!
+    @file     AdcEngine.cpp
+    @author   Masa
+
+        Non-blocking acquisition engine for ADS1115/TI
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+
+#include "AdcEngine.h"
+
+namespace{
+    //  ADS1115 レジスタ
+    constexpr uint8_t REG_CONVERSION = 0x00;
+    constexpr uint8_t REG_CONFIG     = 0x01;
+
+    //  CONFIGレジスタのビット
+    constexpr uint16_t CONFIG_OS_SINGLE     = 0x8000; // W:変換開始  R:1=変換完了
+    constexpr uint16_t CONFIG_MUX_DIFF_0_1  = 0x0000;
+    constexpr uint16_t CONFIG_MUX_DIFF_2_3  = 0x3000;
+    constexpr uint16_t CONFIG_MODE_SINGLE   = 0x0100;
+    constexpr uint8_t  CONFIG_DR_SHIFT      = 5;
+    constexpr uint16_t CONFIG_CQUE_NONE     = 0x0003;
+
+    //  データレートごとの変換回数 [SPS]  DR[2:0]
+    constexpr uint16_t SAMPLES_PER_SECOND[AdcEngine::RATE_NUM] = {8, 16, 32, 64, 128, 250, 475, 860};
+
+    //  変換時間の待ち [%]  内部発振器のばらつき（±10%）の分だけ長く待つ
+    //      シングルショットは待った後にOSビットで完了を確かめるので少しだけ
+    constexpr uint32_t SINGLE_WAIT_PERCENT = 101;
+    constexpr uint32_t STREAM_WAIT_PERCENT = 110;
+    //  変換完了しない時のタイムアウト [us]  遅いデータレートでは変換時間の2倍
+    constexpr uint32_t CONVERSION_TIMEOUT = 50000;
+    //  1サンプルの読み出しにかかるI2Cの時間 [us]  400kHz で 2〜3トランザクション
+    constexpr uint32_t SAMPLE_BUS_TIME = 200;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Instantiates a new AdcEngine class
+*/
+/**************************************************************************/
+AdcEngine::AdcEngine() {}
+
+/**************************************************************************/
+/*!
+    @brief  Setups the hardware and checks the ADC was found
+    @param i2c_address The I2C address of the ADC, defaults to 0x48
+    @param bus The shared I2C bus to use, defaults to &i2c_bus
+    @returns True if ADC was found on the I2C address.
+*/
+/**************************************************************************/
+bool AdcEngine::begin(uint8_t i2c_address, I2cBus *bus) {
+  AdcEngine::bus = bus;
+  device = bus->addDevice(i2c_address, I2C_CLOCK_FAST, "ADC");
+
+  state = STATE_IDLE;
+
+  return bus->probe(device);
+}
+
+/**************************************************************************/
+/*!
+    @brief  PGAのゲインを両チャネルに設定する. 次の変換から有効
+    @param gain ゲイン設定
+*/
+/**************************************************************************/
+void AdcEngine::setGain(adsGain_t gain) {
+  for (uint8_t ch = 0; ch < CH_NUM; ch++) {
+    AdcEngine::gain[ch] = gain;
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief  チャネルのPGAのゲインを設定する. 次の変換から有効
+            シーケンスの途中で変えるとサンプルのゲインがそろわないので、start() の前に設定すること
+    @param ch チャネル
+    @param gain ゲイン設定
+*/
+/**************************************************************************/
+void AdcEngine::setGain(Channel ch, adsGain_t gain) {
+  if (ch < CH_NUM) {
+    AdcEngine::gain[ch] = gain;
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief  データレートを設定する. 次の変換から有効
+    @param rate データレート
+*/
+/**************************************************************************/
+void AdcEngine::setDataRate(DataRate rate) {
+  if (rate < RATE_NUM) {
+    data_rate = rate;
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief  ストリーミング（連続変換モード）の有効/無効を設定する. 次のシーケンスから有効
+    @param enable True:連続変換, False:シングルショット
+*/
+/**************************************************************************/
+void AdcEngine::setStreaming(bool enable) {
+  f_streaming = enable;
+}
+
+/**************************************************************************/
+/*!
+    @brief  変換シーケンスを打ち切って停止状態にする.
+            連続変換していれば、ADS1115 をパワーダウンさせる
+*/
+/**************************************************************************/
+void AdcEngine::stop(void) {
+  state = STATE_IDLE;
+  if (running_channel == CH_NUM) {
+    return;
+  }
+  //  OS=0 のシングルショットを書くと変換せずにパワーダウンする
+  write_register(REG_CONFIG, CONFIG_MODE_SINGLE | CONFIG_CQUE_NONE | (uint16_t)gain[running_channel]);
+  running_channel = CH_NUM;
+}
+
+/**************************************************************************/
+/*!
+    @brief  データレートの変換回数
+    @param rate データレート
+    @returns [SPS]
+*/
+/**************************************************************************/
+uint16_t AdcEngine::getSamplesPerSecond(DataRate rate) {
+  return SAMPLES_PER_SECOND[(rate < RATE_NUM) ? rate : RATE_128SPS];
+}
+
+/**************************************************************************/
+/*!
+    @brief  変換1回の待ち時間. これより前には結果を読まない
+    @returns [us]
+*/
+/**************************************************************************/
+uint32_t AdcEngine::getConversionTime(void) const {
+  const uint32_t percent = f_streaming ? STREAM_WAIT_PERCENT : SINGLE_WAIT_PERCENT;
+  return 10000 * percent / getSamplesPerSecond(data_rate);
+}
+
+/**************************************************************************/
+/*!
+    @brief  変換シーケンス1回（2チャネル x samples）にかかる時間の見積り
+            poll() は1回の呼び出しで1サンプルしか進めないので、
+            1サンプルの時間は poll() の周期の倍数に切り上がる
+    @param rate データレート
+    @param streaming 連続変換モードか
+    @param samples チャネルあたりのサンプル数
+    @param poll_period poll() を呼ぶ周期 [us]
+    @returns [us]
+*/
+/**************************************************************************/
+uint32_t AdcEngine::getSequenceTime(DataRate rate, bool streaming,
+                                    uint16_t samples, uint32_t poll_period) {
+  const uint32_t percent = streaming ? STREAM_WAIT_PERCENT : SINGLE_WAIT_PERCENT;
+  uint32_t sample_time = 10000 * percent / getSamplesPerSecond(rate) + SAMPLE_BUS_TIME;
+
+  if (poll_period > 0) {
+    sample_time = (sample_time + poll_period - 1) / poll_period * poll_period;
+  }
+  return sample_time * samples * CH_NUM;
+}
+
+/**************************************************************************/
+/*!
+    @brief  変換シーケンスを開始する.
+            SEQ_BLOCK : 電流(2-3)をsamples回、続けて電圧(0-1)をsamples回変換する
+            SEQ_INTERLEAVED : 電流(2-3)、電圧(0-1)の順に交互にsamples組変換する
+    @param samples チャネルあたりのサンプル数
+    @param seq 変換シーケンス
+    @returns True:開始した, False:変換中もしくは引数が不正
+*/
+/**************************************************************************/
+bool AdcEngine::start(uint16_t samples, Sequence seq) {
+  if (isBusy() || samples == 0) {
+    return false;
+  }
+
+  for (uint16_t ch = 0; ch < CH_NUM; ch++) {
+    head[ch] = 0;
+    count[ch] = 0;
+    sum[ch] = 0;
+    peak[ch] = 0;
+  }
+  target = samples;
+  sequence = seq;
+  channel = CH_DIFF_2_3;
+  state = STATE_START;
+
+  return true;
+}
+
+/**************************************************************************/
+/*!
+    @brief  ステートマシンを1ステップ進める. ブロックしない.
+            変換完了を確認したらその場で次の変換を開始する
+    @returns 処理後の状態
+*/
+/**************************************************************************/
+AdcEngine::State AdcEngine::poll(void) {
+  uint16_t config = 0;
+  uint16_t raw = 0;
+
+  switch (state) {
+  case STATE_START:
+    if (!start_conversion(channel)) {
+      state = STATE_ERROR;
+    }
+    break;
+
+  case STATE_CONVERTING:
+    if (micros() - conv_start < getConversionTime()) {
+      break;
+    }
+
+    //  連続変換は待ち時間の間に必ず次の変換が終わっているので、完了を確かめずに読む
+    if (!f_streaming) {
+      if (!read_register(REG_CONFIG, config)) {
+        state = STATE_ERROR;
+        break;
+      }
+
+      //  OS=0 なら変換中
+      if ((config & CONFIG_OS_SINGLE) == 0) {
+        if (micros() - conv_start > conversion_timeout()) {
+          state = STATE_ERROR;
+        }
+        break;
+      }
+    }
+
+    if (!read_register(REG_CONVERSION, raw)) {
+      state = STATE_ERROR;
+      break;
+    }
+    push_sample(channel, (int16_t)raw);
+
+    if (count[CH_DIFF_0_1] >= target && count[CH_DIFF_2_3] >= target) {
+      state = STATE_COMPLETE;
+    } else {
+      channel = next_channel();
+      if (f_streaming && channel == running_channel) {
+        //  同じチャネルの連続変換  読み出した時刻から次の変換を待つ
+        conv_start = micros();
+      } else if (!start_conversion(channel)) {
+        state = STATE_ERROR;
+      }
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  return state;
+}
+
+/**************************************************************************/
+/*!
+    @brief  取得した結果を読み終えたことを通知し、エンジンを停止状態にする
+*/
+/**************************************************************************/
+void AdcEngine::release(void) {
+  state = STATE_IDLE;
+}
+
+/**************************************************************************/
+/*!
+    @brief  リングバッファからサンプルを読む
+    @param ch チャネル
+    @param idx 取得順の番号（0が最も古い）
+    @returns サンプル値[LSB], 範囲外なら0
+*/
+/**************************************************************************/
+int16_t AdcEngine::getSample(Channel ch, uint16_t idx) const {
+  const uint16_t stored =
+      (count[ch] < ADC_RING_SIZE) ? count[ch] : ADC_RING_SIZE;
+
+  if (idx >= stored) {
+    return 0;
+  }
+  return ring[ch][(head[ch] + ADC_RING_SIZE - stored + idx) % ADC_RING_SIZE];
+}
+
+/**************************************************************************/
+/*!
+    @brief  変換を開始する (private)  シングルショット、もしくは連続変換のチャネル切り替え
+    @param ch 変換するチャネル
+    @returns True if able to write the config over I2C
+*/
+/**************************************************************************/
+bool AdcEngine::start_conversion(Channel ch) {
+  uint16_t config = ((uint16_t)data_rate << CONFIG_DR_SHIFT) | CONFIG_CQUE_NONE | (uint16_t)gain[ch];
+
+  //  連続変換はCONFIGを書いた時点から変換し直す
+  if (!f_streaming) {
+    config |= CONFIG_OS_SINGLE | CONFIG_MODE_SINGLE;
+  }
+  config |= (ch == CH_DIFF_0_1) ? CONFIG_MUX_DIFF_0_1 : CONFIG_MUX_DIFF_2_3;
+
+  if (!write_register(REG_CONFIG, config)) {
+    running_channel = CH_NUM;
+    return false;
+  }
+  running_channel = f_streaming ? ch : CH_NUM;
+  conv_start = micros();
+  state = STATE_CONVERTING;
+  return true;
+}
+
+/**************************************************************************/
+/*!
+    @brief  変換完了を待つ上限 (private)
+    @returns [us]
+*/
+/**************************************************************************/
+uint32_t AdcEngine::conversion_timeout(void) const {
+  const uint32_t timeout = 2 * getConversionTime();
+  return (timeout > CONVERSION_TIMEOUT) ? timeout : CONVERSION_TIMEOUT;
+}
+
+/**************************************************************************/
+/*!
+    @brief  次に変換するチャネルを決める (private)
+            SEQ_BLOCK : 電流チャネルを規定数取り終えたら電圧チャネルへ移る
+            SEQ_INTERLEAVED : 電流と電圧を交互に変換する
+*/
+/**************************************************************************/
+AdcEngine::Channel AdcEngine::next_channel(void) const {
+  if (sequence == SEQ_INTERLEAVED) {
+    return (channel == CH_DIFF_2_3) ? CH_DIFF_0_1 : CH_DIFF_2_3;
+  }
+  return (count[CH_DIFF_2_3] < target) ? CH_DIFF_2_3 : CH_DIFF_0_1;
+}
+
+/**************************************************************************/
+/*!
+    @brief  サンプルをリングバッファに入れ、合計値を更新する (private)
+*/
+/**************************************************************************/
+void AdcEngine::push_sample(Channel ch, int16_t value) {
+  ring[ch][head[ch]] = value;
+  head[ch] = (head[ch] + 1) % ADC_RING_SIZE;
+  count[ch]++;
+  sum[ch] += value;
+
+  const uint16_t magnitude = (value < 0) ? -(int32_t)value : value;
+  if (magnitude > peak[ch]) {
+    peak[ch] = magnitude;
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief  16bitレジスタを読む (private)
+*/
+/**************************************************************************/
+bool AdcEngine::read_register(uint8_t reg, uint16_t &value) {
+  uint8_t packet[2];
+
+  packet[0] = reg;
+  if (!bus->writeRead(device, packet, 1, packet, 2)) {
+    return false;
+  }
+  value = ((uint16_t)packet[0] << 8) | packet[1];
+  return true;
+}
+
+/**************************************************************************/
+/*!
+    @brief  16bitレジスタに書く (private)
+*/
+/**************************************************************************/
+bool AdcEngine::write_register(uint8_t reg, uint16_t value) {
+  uint8_t packet[3];
+
+  packet[0] = reg;
+  packet[1] = value >> 8;
+  packet[2] = value & 0xFF;
+  return bus->write(device, packet, 3);
+}
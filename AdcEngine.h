@@ -0,0 +1,168 @@
+/**************************************************************************/
+/*!
+    @file     AdcEngine.h
+*/
+/**************************************************************************/
+
+#ifndef _ADCENGINE_H_
+#define _ADCENGINE_H_
+
+#include <Adafruit_ADS1015.h>   // adsGain_t
+#include "I2cBus.h"
+
+constexpr uint8_t ADS1115_I2CADDR_DEFAULT = 0x48; ///< Default i2c address
+
+//  チャネルごとに保持するサンプル数（リングバッファの長さ）
+constexpr uint16_t ADC_RING_SIZE = 16;
+
+/*!
+    @brief  連続計測の高速ストリーミングの設定（eh900 に保存する）
+            ADS1115 を連続変換モードで動かし、変換完了の確認（CONFIGの読み出し）を省く
+*/
+struct AdcStreamConfig {
+  //  データレート  AdcEngine::DataRate
+  uint8_t data_rate;
+  //  液面1回あたりのチャネルごとのサンプル数（オーバーサンプリング比）  0:ストリーミングしない
+  uint8_t oversampling;
+};
+
+/**************************************************************************/
+/*!
+    @brief  ADS1115 をブロックせずに動かすためのAD変換エンジン
+            変換開始 -> 変換完了待ち -> 読み出し をステートマシンで進める.
+            poll() をループから頻繁に呼ぶことで変換が進み、
+            規定数のサンプルがそろうと isComplete() が true になる.
+            ストリーミング（連続変換モード）では、チャネルが変わる時だけCONFIGを書き、
+            同じチャネルが続く間は変換時間ごとに変換レジスタを読むだけにする.
+*/
+/**************************************************************************/
+class AdcEngine {
+public:
+  //  計測チャネル
+  enum Channel : uint8_t {
+    CH_DIFF_0_1,  // 0 : 差動 0-1  センサ電圧
+    CH_DIFF_2_3,  // 1 : 差動 2-3  センサ電流
+    CH_NUM
+  };
+
+  //  エンジンの状態
+  enum State : uint8_t {
+    STATE_IDLE,       // 0 : 停止中
+    STATE_START,      // 1 : 次の変換を開始する
+    STATE_CONVERTING, // 2 : 変換完了待ち
+    STATE_COMPLETE,   // 3 : 規定数のサンプルがそろった（release()待ち）
+    STATE_ERROR       // 4 : I2Cエラーもしくは変換タイムアウト
+  };
+
+  //  データレート  CONFIGレジスタの DR[2:0]
+  enum DataRate : uint8_t {
+    RATE_8SPS,    // 0
+    RATE_16SPS,   // 1
+    RATE_32SPS,   // 2
+    RATE_64SPS,   // 3
+    RATE_128SPS,  // 4 : 既定値
+    RATE_250SPS,  // 5
+    RATE_475SPS,  // 6
+    RATE_860SPS,  // 7
+    RATE_NUM
+  };
+
+  //  変換シーケンス
+  enum Sequence : uint8_t {
+    SEQ_BLOCK,        // 0 : 電流をN回 -> 電圧をN回
+    SEQ_INTERLEAVED   // 1 : 電流 -> 電圧 を交互にN組
+  };
+
+public:
+  AdcEngine();
+
+  bool begin(uint8_t i2c_address = ADS1115_I2CADDR_DEFAULT,
+             I2cBus *bus = &i2c_bus);
+
+  void setGain(adsGain_t gain);
+  void setGain(Channel ch, adsGain_t gain);
+  //  チャネルのPGAのゲイン
+  adsGain_t getGain(Channel ch) const { return gain[ch]; };
+
+  void setDataRate(DataRate rate);
+  DataRate getDataRate(void) const { return data_rate; };
+
+  void setStreaming(bool enable);
+  //  連続変換モードで変換するか
+  bool isStreaming(void) const { return f_streaming; };
+
+  void stop(void);
+
+  uint32_t getConversionTime(void) const;
+  static uint16_t getSamplesPerSecond(DataRate rate);
+  static uint32_t getSequenceTime(DataRate rate, bool streaming,
+                                  uint16_t samples, uint32_t poll_period);
+
+  bool start(uint16_t samples, Sequence seq = SEQ_BLOCK);
+  State poll(void);
+  void release(void);
+
+  //  変換シーケンスの種類を返す
+  Sequence getSequence(void) const { return sequence; };
+
+  //  現在の状態を返す
+  State getState(void) const { return state; };
+
+  //  変換シーケンスが動いているか
+  bool isBusy(void) const {
+    return (state == STATE_START) || (state == STATE_CONVERTING);
+  };
+
+  //  規定数のサンプルがそろったか
+  bool isComplete(void) const { return state == STATE_COMPLETE; };
+
+  //  エラーで止まったか
+  bool hasError(void) const { return state == STATE_ERROR; };
+
+  //  チャネルのサンプルの合計値 [LSB]
+  int32_t getSum(Channel ch) const { return sum[ch]; };
+
+  //  チャネルの取得済みサンプル数
+  uint16_t getCount(Channel ch) const { return count[ch]; };
+
+  int16_t getSample(Channel ch, uint16_t idx) const;
+
+  //  チャネルの取得済みサンプルの絶対値の最大値 [LSB]  32767以上なら振り切れている
+  uint16_t getPeak(Channel ch) const { return peak[ch]; };
+
+private:
+  bool start_conversion(Channel ch);
+  uint32_t conversion_timeout(void) const;
+  bool read_register(uint8_t reg, uint16_t &value);
+  bool write_register(uint8_t reg, uint16_t value);
+  void push_sample(Channel ch, int16_t value);
+  Channel next_channel(void) const;
+
+  I2cBus *bus = NULL;
+  int8_t device = -1;
+  //  チャネルごとのPGAのゲイン
+  adsGain_t gain[CH_NUM] = {GAIN_TWO, GAIN_TWO};
+  DataRate data_rate = RATE_128SPS;
+  bool f_streaming = false;
+
+  //  連続変換中のチャネル（連続変換していなければ CH_NUM）
+  Channel running_channel = CH_NUM;
+
+  volatile State state = STATE_IDLE;
+  Channel channel = CH_DIFF_2_3;
+  Sequence sequence = SEQ_BLOCK;
+
+  //  チャネルあたりの目標サンプル数
+  uint16_t target = 0;
+  //  変換開始時刻 [us]  連続変換では前回の読み出し時刻
+  uint32_t conv_start = 0;
+
+  //  取得したサンプルのリングバッファ
+  int16_t ring[CH_NUM][ADC_RING_SIZE] = {};
+  uint16_t head[CH_NUM] = {};
+  uint16_t count[CH_NUM] = {};
+  int32_t sum[CH_NUM] = {};
+  uint16_t peak[CH_NUM] = {};
+};
+
+#endif // _ADCENGINE_H_
@@ -0,0 +1,139 @@
+/**************************************************************************/
+/*!
+    @file     CommandParser.cpp
+    @author   Masa
+
+        Incremental, zero-heap line parser for gateway commands
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "CommandParser.h"
+
+#include <stdlib.h>
+
+/*!
+    @brief  受信した1バイトを渡す
+    @param c 受信したバイト
+    @return 行がそろったか、捨てたか  COMMAND_READY の時はトークンを次の feed() まで読める
+*/
+CommandParser::Status CommandParser::feed(uint8_t c){
+  if (c == '\r' || c == '\n'){
+    return finish_line();
+  }
+
+  if ((c < ' ' && c != '\t') || c >= 0x7F){
+    f_malformed = true;
+    return COMMAND_PENDING;
+  }
+  if (length >= COMMAND_LINE_MAX){
+    f_overflow = true;
+    return COMMAND_PENDING;
+  }
+  line[length++] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+  return COMMAND_PENDING;
+}
+
+/*!
+    @brief  受け取りかけの行を捨てる
+*/
+void CommandParser::reset(void){
+  length = 0;
+  f_overflow = false;
+  f_malformed = false;
+  token_num = 0;
+}
+
+/*!
+    @brief  コマンド（そろった行の最初のトークン）
+*/
+const char* CommandParser::getVerb(void) const {
+  return token_num ? tokens[0] : "";
+}
+
+/*!
+    @brief  引数
+    @param index 引数の番号（0から）
+    @return 引数. ない時は nullptr
+*/
+const char* CommandParser::getArg(uint8_t index) const {
+  return (index + 1 < token_num) ? tokens[index + 1] : nullptr;
+}
+
+/*!
+    @brief  引数を10進の整数として読む
+    @param index 引数の番号（0から）
+    @param value 読んだ値
+    @return True:読めた, False:引数がない、もしくは全体が整数ではない
+*/
+bool CommandParser::getNumber(uint8_t index, int32_t& value) const {
+  const char* arg = getArg(index);
+  if (!arg){
+    return false;
+  }
+  char* end = nullptr;
+  const long number = strtol(arg, &end, 10);
+  if (end == arg || *end != '\0' || number < INT32_MIN || number > INT32_MAX){
+    return false;
+  }
+  value = (int32_t)number;
+  return true;
+}
+
+/*!
+    @brief  改行が来た  行を調べてトークンに分ける (private)
+*/
+CommandParser::Status CommandParser::finish_line(void){
+  Status status = COMMAND_PENDING;
+
+  if (f_overflow){
+    status = COMMAND_OVERFLOW;
+  } else if (f_malformed){
+    status = COMMAND_MALFORMED;
+  } else if (length != 0){
+    line[length] = '\0';
+    if (!split()){
+      status = COMMAND_MALFORMED;
+    } else if (token_num != 0){
+      status = COMMAND_READY;
+    }
+  }
+
+  length = 0;
+  f_overflow = false;
+  f_malformed = false;
+  if (status == COMMAND_READY){
+    lines++;
+  } else if (status != COMMAND_PENDING){
+    errors++;
+  }
+  return status;
+}
+
+/*!
+    @brief  行を空白で区切る (private)  区切りは '\0' に書き換える
+    @return False:トークンが多すぎる
+*/
+bool CommandParser::split(void){
+  token_num = 0;
+
+  char* p = line;
+  while (*p != '\0'){
+    while (*p == ' ' || *p == '\t'){
+      *p++ = '\0';
+    }
+    if (*p == '\0'){
+      break;
+    }
+    if (token_num > COMMAND_ARG_MAX){
+      token_num = 0;
+      return false;
+    }
+    tokens[token_num++] = p;
+    while (*p != '\0' && *p != ' ' && *p != '\t'){
+      p++;
+    }
+  }
+  return true;
+}
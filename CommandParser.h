@@ -0,0 +1,90 @@
+/**************************************************************************/
+/*!
+    @file     CommandParser.h
+
+    IoTゲートウエイから届くコマンド行の逐次パーサ
+        受信したバイトを1つずつ feed() に渡す. 改行（CR / LF / CRLF）で1行が終わり、
+        空白で区切ったトークン（コマンドと引数）に分ける. バイトごとの処理は一定で、待つことはない.
+        ヒープを使わない. 英字は小文字にそろえる.
+
+        1行が長すぎる時は改行まで読み捨てて COMMAND_OVERFLOW,
+        印字できない文字（タブを除く制御文字・0x7F 以上）や多すぎる引数を含む行は COMMAND_MALFORMED になる.
+        行の途中でバイトが欠けても、次の改行で同期し直す.
+*/
+/**************************************************************************/
+
+#ifndef _COMMANDPARSER_H_
+#define _COMMANDPARSER_H_
+
+#include <Arduino.h>
+
+//  1行の最大の長さ（改行を含まない）[byte]と、コマンドの後に書ける引数の数
+constexpr size_t COMMAND_LINE_MAX = 40;
+constexpr uint8_t COMMAND_ARG_MAX = 3;
+
+class CommandParser {
+
+  public:
+    //  feed() の結果
+    enum Status{
+      COMMAND_PENDING,    //  行の途中（もしくは空行）
+      COMMAND_READY,      //  1行そろった  次の feed() まで getVerb() / getArg() で読める
+      COMMAND_MALFORMED,  //  不正な文字・多すぎる引数を含む行を捨てた
+      COMMAND_OVERFLOW    //  長すぎる行を捨てた
+    };
+
+    CommandParser(void){};
+
+    Status feed(uint8_t c);
+    void reset(void);
+
+    const char* getVerb(void) const;
+    const char* getArg(uint8_t index) const;
+    bool getNumber(uint8_t index, int32_t& value) const;
+
+    /*!
+    @brief  コマンドの後の引数の数
+    */
+    uint8_t getArgCount(void) const {
+      return token_num ? token_num - 1 : 0;
+    };
+
+    /*!
+    @brief  行の途中まで受け取っているか（次の改行を待っている）
+    */
+    bool isReceiving(void) const {
+      return length != 0 || f_overflow || f_malformed;
+    };
+
+    /*!
+    @brief  そろった行の数
+    */
+    uint32_t getLines(void) const {
+      return lines;
+    };
+
+    /*!
+    @brief  捨てた行の数（不正・長すぎ）
+    */
+    uint32_t getErrors(void) const {
+      return errors;
+    };
+
+  private:
+    char line[COMMAND_LINE_MAX + 1];
+    size_t length = 0;
+    bool f_overflow = false;
+    bool f_malformed = false;
+
+    //  トークンの先頭（line の中）  0番目がコマンド
+    const char* tokens[COMMAND_ARG_MAX + 1] = {};
+    uint8_t token_num = 0;
+
+    uint32_t lines = 0;
+    uint32_t errors = 0;
+
+    Status finish_line(void);
+    bool split(void);
+};
+
+#endif // _COMMANDPARSER_H_
@@ -23,22 +23,15 @@ DAC80501::DAC80501() {}
 /*!
     @brief  Setups the hardware and checks the DAC was found
     @param i2c_address The I2C address of the DAC, defaults to 0x90
-    @param wire The I2C TwoWire object to use, defaults to &Wire
+    @param bus The shared I2C bus to use, defaults to &i2c_bus
     @returns True if DAC was found on the I2C address.
 */
 /**************************************************************************/
-bool DAC80501::begin(uint8_t i2c_address, TwoWire *wire) {
-  if (i2c_dev) {
-    delete i2c_dev;
-  }
-
-  i2c_dev = new Adafruit_I2CDevice(i2c_address, wire);
-
-  if (!i2c_dev->begin()) {
-    return false;
-  }
+bool DAC80501::begin(uint8_t i2c_address, I2cBus *bus) {
+  DAC80501::bus = bus;
+  device = bus->addDevice(i2c_address, I2C_CLOCK_FAST_PLUS, "DAC-Vmon");
 
-  return true;
+  return bus->probe(device);
 }
 
 /**************************************************************************/
@@ -57,7 +50,7 @@ bool DAC80501::init(void) {
   packet[1] = 0x00;
   packet[2] = SOFT_RES ; //RESET command
   
-  if (!i2c_dev->write(packet, 3)) {
+  if (!bus->write(device, packet, 3)) {
     return false;
   }
 
@@ -66,7 +59,7 @@ bool DAC80501::init(void) {
   packet[0] = DAC80501::CMD::CMD_SYNC;
   packet[1] = 0x00;
   packet[2] = DAC80501::DAC_SYNC_EN::UPDATE_ASYNC; //the output is update immedietely
-  if (!i2c_dev->write(packet, 3)) {
+  if (!bus->write(device, packet, 3)) {
     return false;
   }
   
@@ -74,7 +67,7 @@ bool DAC80501::init(void) {
   packet[1] = DAC80501::REF_PWDWN::REFPWDWN_DISABLE; //use internal VREF 2.5V
   packet[2] = DAC80501::DAC_PWDWN::DACPWDN_DISABLE; //activate DAC
 
-  if (!i2c_dev->write(packet, 3)) {
+  if (!bus->write(device, packet, 3)) {
     return false;
   }
 
@@ -83,7 +76,7 @@ bool DAC80501::init(void) {
   packet[1] = DAC80501::REF_DIV::REFDIV_2;     // VREF divider = 1/2 
   packet[2] = DAC80501::BUFF_GAIN::BUFGAIN_2;  // DAC Buffer gain =2 ,thus VFS=2.5V
 
-  if (!i2c_dev->write(packet, 3)) {
+  if (!bus->write(device, packet, 3)) {
     return false;
   }
 
@@ -91,12 +84,12 @@ bool DAC80501::init(void) {
 
   // check the status
   packet[0] = DAC80501::CMD::CMD_STATUS;
-  if (!i2c_dev->write(packet, 1)) {
+  if (!bus->write(device, packet, 1)) {
     return false;
   }
 
   //  Read 2byte of spacified resigter.
-  if (!i2c_dev->read(packet,2,true)) {
+  if (!bus->read(device, packet, 2)) {
     return false;
   }
 
@@ -127,28 +120,36 @@ bool DAC80501::init(void) {
                 The 16-bit value representing the relationship between
                 the DAC's input voltage and its output voltage.
 
-    @param i2c_frequency What we should set the I2C clock to when writing
-    to the DAC, defaults to 400 KHz
     @returns True if able to write the value over I2C
+            The bus clock is owned by I2cBus and is not changed here.
 */
 /**************************************************************************/
-bool DAC80501::setVoltage(const uint16_t output, 
-                          const uint32_t i2c_frequency) {
-  i2c_dev->setSpeed(i2c_frequency); // Set I2C frequency to desired speed
-
+bool DAC80501::setVoltage(const uint16_t output) {
   uint8_t packet[3];
 
-
   packet[0] = DAC80501::CMD::CMD_DAC_BUF;
   packet[1] = output / 256;        // Upper data bits (D15.....D8)
   packet[2] = (output % 256);      // Lower data bits (D7......D0)
 
-  if (!i2c_dev->write(packet, 3)) {
-    return false;
-  }
+  return bus->write(device, packet, 3);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Queues the output value on the shared bus without waiting.
+            The write is done by the bus in the background; a queued value
+            that has not been sent yet is replaced by the new one.
+            Callable from an ISR or deferred context.
+
+    @param[in]  output
+                The 16-bit value (0..65535)
+    @returns True if the write was queued
+*/
+/**************************************************************************/
+bool DAC80501::postVoltage(const uint16_t output) {
+  const uint8_t packet[3] = {DAC80501::CMD::CMD_DAC_BUF, (uint8_t)(output / 256), (uint8_t)(output % 256)};
 
-  i2c_dev->setSpeed(100000); // reset to arduino default
-  return true;
+  return bus->post(device, packet, 3, I2C_MERGE_REPLACE);
 }
 
 
@@ -160,18 +161,15 @@ bool DAC80501::setVoltage(const uint16_t output,
     @param[in]  output
                 absolute voltage [V] to be output. Assuming VFS=2.5V
 
-    @param i2c_frequency What we should set the I2C clock to when writing
-    to the DAC, defaults to 400 KHz
     @returns True if able to write the value over I2C
 */
 /**************************************************************************/
-bool DAC80501::setVoltage(const float output, 
-                          const uint32_t i2c_frequency) {
+bool DAC80501::setVoltage(const float output) {
 
   if (  output < 0.0 || output > 2.5 ){
     return false;
   };
 
-  return DAC80501::setVoltage((uint16_t)(output * DAC80501::DAC_VOLT2LSB), i2c_frequency);
+  return DAC80501::setVoltage((uint16_t)(output * DAC80501::DAC_VOLT2LSB));
 
 }
\ No newline at end of file
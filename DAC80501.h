@@ -7,9 +7,7 @@
 #ifndef _DAC80501_H_
 #define _DAC80501_H_
 
-#include <Adafruit_BusIO_Register.h>
-#include <Adafruit_I2CDevice.h>
-#include <Wire.h>
+#include "I2cBus.h"
 
 
 constexpr uint8_t DAC80501_I2CADDR_DEFAULT=0x48; ///< Default i2c address
@@ -87,18 +85,17 @@ public:
 public:
   DAC80501();
   bool begin(uint8_t i2c_address = DAC80501_I2CADDR_DEFAULT,
-             TwoWire *wire = &Wire);
+             I2cBus *bus = &i2c_bus);
   
   bool init(void);
 
-  bool setVoltage(const uint16_t output,
-                  const uint32_t dac_frequency = 400000);
-
-  bool setVoltage(const float output,
-                  const uint32_t dac_frequency = 400000);
+  bool setVoltage(const uint16_t output);
+  bool setVoltage(const float output);
+  bool postVoltage(const uint16_t output);
 
 private:
-  Adafruit_I2CDevice *i2c_dev = NULL;
+  I2cBus *bus = NULL;
+  int8_t device = -1;
   float DAC_VOLT2LSB = 0.0;
   
 };
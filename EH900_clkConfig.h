@@ -3,6 +3,8 @@
 
 #include<Arduino.h>
 
+//  STM32 のHAL（RCC）を使うので実機のビルドだけ  ホストのシミュレーション（extras/sim）では使わない
+#ifdef ARDUINO_ARCH_STM32
 void SystemClock_Config(void){
 
   RCC_OscInitTypeDef RCC_OscInitStruct = {0};
@@ -45,6 +47,7 @@ void SystemClock_Config(void){
   HAL_RCC_MCOConfig(RCC_MCO, RCC_MCO1SOURCE_SYSCLK, RCC_MCODIV_128);
 
 };
+#endif // ARDUINO_ARCH_STM32
 
 
 #endif // __EH900_CLKCONFIG_H
@@ -6,9 +6,16 @@
 #include "switch_class.h"
 #include "eh900_class.h"
 #include "measurement.h"
+#include "MeasurementEngine.h"
 #include "display_class.h"
 #include "eh900_config.h"
 #include "IotGateway.h"
+#include "scheduler_class.h"
+#include "EventQueue.h"
+#include "I2cBus.h"
+#include "LowPower.h"
+#include "Log.h"
+#include "Profiler.h"
 
 constexpr char* REV = (char*)"REV1.1 #2022/02";
 
@@ -18,49 +25,122 @@ constexpr uint16_t MEAS_SWITCH = D3;
 constexpr uint16_t MEAS_LED = PA3;  
 // 長押しを判定する時間[ms]
 constexpr uint16_t DURATION_LONG_PRESS = 2000; 
-//  １秒のタイマ設定値（調整込み）  [us]
-// constexpr uint32_t ONE_SECOND = 999025; 
-constexpr uint32_t ONE_SECOND = 1000000; 
+//  計測タイマの１秒 [ms]  millis() で数える（STOPモードで眠った時間は low_power が millis() に足す）
+constexpr uint32_t ONE_SECOND = 1000;
+//  計測タイマの表示（分）の１分 [s]
+constexpr uint32_t ONE_MINUTE = 60;
+//  スイッチ操作や計測の後、STOPモードに入らずに起きている時間[ms]  この間は表示のブリンクが動く
+constexpr uint32_t AWAKE_AFTER_ACTIVITY = 10000;
+//  計測チャネルが複数ある時に、表示するチャネルを替える周期[ms]
+constexpr uint32_t CHANNEL_DISPLAY_PERIOD = 2000;
 //  手動計測時の表示アップデート周期[us]
 constexpr uint32_t UPDATE_CYCLE =300000;    
-//  連続計測時のデシメーション（10回ループを回ったら1回計測）
-constexpr uint16_t DECIMATION = 10; 
+//  連続計測の周期[us]
 constexpr uint32_t CONT_MEAS_PERIOD = 1000000;
+//  液面推定を使う連続計測の周期[us]  1回のAD変換を1/3にして3倍の頻度で計測する
+constexpr uint32_t CONT_STREAM_PERIOD = CONT_MEAS_PERIOD / 3;
 
-//  ループ1回ごとの時間待ち[ms] 実際のループ１周は  この時間＋処理時間
-constexpr uint16_t LOOP_WAIT = 97; 
+//  タスクの実行周期[ms]
+constexpr uint32_t DISPLAY_PERIOD = 100;    //  モード・タイマ表示
+constexpr uint32_t SWITCH_PERIOD = 20;      //  スイッチのサンプリング
+constexpr uint32_t TICK_PERIOD = 100;       //  計測タイマのタイムアップ確認
+constexpr uint32_t MEASURE_PERIOD = 5;      //  計測ステートマシン
+constexpr uint32_t UART_TX_PERIOD = 10;     //  IoTゲートウエイの送信キュー
+constexpr uint32_t COMMAND_PERIOD = 10;     //  IoTゲートウエイからのコマンドの受信
+
+//  タスクの優先度  大きいほど優先
+constexpr uint8_t PRIORITY_SWITCH = 4;
+constexpr uint8_t PRIORITY_TICK = 3;
+constexpr uint8_t PRIORITY_MEASURE = 2;
+constexpr uint8_t PRIORITY_DISPLAY = 1;
+constexpr uint8_t PRIORITY_UPLINK = 0;
+
+//  適応タイマのパラメタのコマンドでの名前  順は get_adaptive_param() / set_adaptive_param() の番号
+const char* const ADAPTIVE_PARAM_NAMES[] = {"adaptive", "period_min", "period_max", "uncertainty", "alarm"};
+//  液面推定のパラメタのコマンドでの名前  順は get_estimator_param() / set_estimator_param() の番号
+const char* const ESTIMATOR_PARAM_NAMES[] = {"filter", "median_window", "iir_alpha", "kalman_accel", "kalman_noise"};
+//  ストリーミングのパラメタのコマンドでの名前  順は get_stream_param() / set_stream_param() の番号
+const char* const STREAM_PARAM_NAMES[] = {"data_rate", "oversampling"};
+
+//  送信キューが空いた時に1回で送る計測履歴の最大件数  hist コマンドで返す最大件数も同じ
+constexpr uint16_t HISTORY_DRAIN_BATCH = 4;
 
 
 constexpr boolean DEBUG = false;  // デバグフラグ
+//  D12 で測る処理  false:ループのタスク実行時間, true:ISRの実行時間
+constexpr boolean PROFILE_ISR_ON_D12 = false;
+
+//  ISRからメインループに渡すイベント
+enum Events{
+    EVENT_SWITCH,       //  スイッチの状態が変化した
+    EVENT_DISP_UPDATE   //  手動計測中の液面表示の更新
+};
+
+//  共有I2Cバス  各デバイスのドライバより先に作る（ポートはバスより先）
+I2cPort i2c_port(&Wire);
+I2cBus i2c_bus(&i2c_port);
 
 eh900 level_meter;
-Measurement meas_unit(&level_meter);
+MeasurementEngine meas_unit(&level_meter);
 Eh_display lcd_display(&level_meter);
 
 Switch meas_sw(MEAS_SWITCH);
 
+//  IoTゲートウエイ  状態・計測履歴を送り、コマンドを受け付ける（execute_command()）
 IotGateway uart1(D0, D1);
 
 //  手動計測時の表示アップデート用タイマ
 HardwareTimer* disp_update_timer = new HardwareTimer(TIM1);
 
-//  １秒のクロック作成タイマ
-HardwareTimer* tick_tock_timer = new HardwareTimer(TIM3);
-boolean f_tick_tock = false;
+//  低消費電力  タイマモードで待っている間はSTOPモードで眠り、RTCかスイッチで起きる
+//      デバグ用シリアルに 'w' で起きていた時間・眠っていた時間を出力
+LowPower low_power;
+
+//  プロファイラ  DWTのサイクルカウンタで区間ごとの実行時間を計る
+//      デバグ用シリアルに 'p' で結果を出力, 'r' でクリア
+extern "C" void* _sbrk(ptrdiff_t increment);
+uint32_t dwt_cycles(void);
+void probe_memory(uint32_t& stack, uint32_t& heap);
+Profiler profiler(dwt_cycles, probe_memory);
+
+//  トレースのリングバッファ  LOG_LEVEL_TRACE の時にアイドル時間でシリアルへ出力する
+TraceRing trace_log;
+
+//  ISRからのイベント  ISRはイベントを入れるだけで、表示やシリアル出力はメインループで行う
+EventQueue isr_events;
+
+//  タスクスケジューラ
+Scheduler scheduler;
+int8_t task_continuous_id = -1;     //  連続計測タスクのID
+int8_t task_uplink_id = -1;         //  IoTゲートウエイ送信タスクのID
 
-uint16_t deci_counter = 0;      //  連続計測の時のループ回数カウント
 uint16_t system_error = 0;      //  起動時のエラーコード    
                                 //      0:ok 1:設定MEMORY 2:計測ユニット 4:表示 
 boolean f_timer_timeup=false;   //  計測タイマー用フラグ
 boolean f_cont_mode_status = false; // 連続計測モードフラグ（電流源の制御のために必要）
+boolean f_cont_starting = false;    // 連続計測の電流源を立ち上げ中（計測タスクが完了を待つ）
+boolean f_cont_reconfigure = false; // 連続計測のパラメタが変わった（計測タスクが変換の合間に読み直す）
 
 boolean f_mode_confirmed = false;   // スイッチ操作によるモード変更が確定（ボタンを離した時）したかどうかのフラグ
+boolean f_wait_release = false;     // 連続計測を終えたスイッチが離されるのを待っているフラグ
+uint32_t cont_uplink_time = 0;      // 連続計測で最後にゲートウエイへ送った時刻[ms]
+uint32_t timer_second_time = 0;     // 計測タイマが最後に1秒を数えた時刻[ms]
+uint32_t timer_seconds = 0;         // 計測タイマが数えた起動からの秒数[s]  適応タイマの時刻
+uint32_t activity_time = 0;         // 最後にスイッチ操作か1回計測、コマンドがあった時刻[ms]
+
+//  タイマモードの適応タイマ  チャネルごとに液面の変化率を求め、最も短い周期で計測する
+AdaptiveTimer adaptive_timers[METER_CHANNEL_MAX];
 
 void setup() {
     Serial.begin(115200);
     Serial.println("INIT:--");
 
     Serial.print("Firmware REV : "); Serial.println(REV);
+
+    //  プロファイラ用のサイクルカウンタを動かす
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
     
     pinMode(MEAS_LED, OUTPUT);
     pinMode(D12,OUTPUT);
@@ -75,14 +155,16 @@ void setup() {
     } else {
         system_error |= 1;
         //  メモリがない時の液面計パラメタの初期化
-        level_meter.setSensorLength(20);
         level_meter.setTimerPeriod(1800);
         level_meter.setMode(Timer);
-        level_meter.setAdcErrComp01(1.0);
-        level_meter.setAdcErrComp23(1.0);
-        level_meter.setAdcOfsComp01(0);
-        level_meter.setAdcOfsComp23(0);
-        level_meter.setCurrentSetting(750);
+        for (uint8_t ch = 0; ch < METER_CHANNEL_MAX; ch++){
+            level_meter.setSensorLength(20, ch);
+            level_meter.setAdcErrComp01(1.0, ch);
+            level_meter.setAdcErrComp23(1.0, ch);
+            level_meter.setAdcOfsComp01(0, ch);
+            level_meter.setAdcOfsComp23(0, ch);
+            level_meter.setCurrentSetting(750, ch);
+        }
     };
     Serial.println(system_error);
 
@@ -94,6 +176,7 @@ void setup() {
         system_error |= 2;
     };
     Serial.println(system_error);
+    lcd_display.setChannelCount(meas_unit.getChannelCount());
 
     //  画面初期化  型名の表示・エラー表示
     Serial.println("Disp : "); 
@@ -102,6 +185,10 @@ void setup() {
         system_error |= 4;
     };
 
+    //  I2Cのクロックを決める  ライブラリの begin() が 100kHz に戻すので、すべての初期化の後で1回だけ
+    i2c_bus.start();
+    Serial.print("I2C clock : "); Serial.println(i2c_bus.getClock());
+
     if (DEBUG){ 
         Serial.println("DEBUG MODE!!!");
         system_error = 0;
@@ -119,30 +206,33 @@ void setup() {
     disp_update_timer -> refresh();
     disp_update_timer -> attachInterrupt(isr_disp_update);
 
-    //  1s  タイマ  計測タイマーの動作カウント用
-    tick_tock_timer -> pause();
-    tick_tock_timer -> setOverflow(ONE_SECOND, MICROSEC_FORMAT); 
-    tick_tock_timer -> refresh();
-    tick_tock_timer -> attachInterrupt(isr_tick_tock);
+    //  STOPモードから起こすRTC  計測タイマは1秒の割り込みを使わず、時刻から数える
+    Serial.print("Low power : RTC ");
+    low_power.begin();
+    Serial.println(low_power.getRtcHz());
 
     Serial.println("IoT Gateway interface :");
     // initialize IoT Gateway port:
     uart1.begin(9600);
     uart1.clearPayload();
+    //  STOPモードで眠っている間に届いたコマンドも受信する
+    low_power.wakeOnReceive(uart1);
 
     //  設定モードへ移行するスイッチ操作の完了待ち[3s]
     delay(3000);
 
     //  この時点でスイッチが押されていれば設定モードへ移行
     if (meas_sw.isDepressed()){
-        menu_main();
+        menu_main(meas_unit.getChannelCount());
         iinfo(0);
 
         lcd_display.noDisplay();
         Serial.print("QUIT config: store parameters into FRAM...");
         level_meter.setTimerElasped(0);
-        level_meter.setLiquidLevel(0);
-        level_meter.clearSensorError();
+        for (uint8_t ch = 0; ch < meas_unit.getChannelCount(); ch++){
+            level_meter.setLiquidLevel(0, ch);
+            level_meter.clearSensorError(ch);
+        }
         //  変更されたパラメタを保存
         level_meter.storeParameter();        
         
@@ -152,10 +242,10 @@ void setup() {
         meas_unit.renew_sensor_parameter();
     }
 
-    Serial.print("Level Meter:"); Serial.print((uint32_t)&level_meter,HEX); Serial.print("/");Serial.println(sizeof(level_meter));
-    Serial.print("Meas Unit:"); Serial.print((uint32_t)&meas_unit,HEX); Serial.print("/");Serial.println(sizeof(meas_unit));
-    Serial.print("Meas_sw:"); Serial.print((uint32_t)&meas_sw,HEX); Serial.print("/");Serial.println(sizeof(meas_sw));
-    Serial.print("LCD-display:"); Serial.print((uint32_t)&lcd_display,HEX); Serial.print("/");Serial.println(sizeof(lcd_display));
+    Serial.print("Level Meter:"); Serial.print((uintptr_t)&level_meter,HEX); Serial.print("/");Serial.println(sizeof(level_meter));
+    Serial.print("Meas Unit:"); Serial.print((uintptr_t)&meas_unit,HEX); Serial.print("/");Serial.println(sizeof(meas_unit));
+    Serial.print("Meas_sw:"); Serial.print((uintptr_t)&meas_sw,HEX); Serial.print("/");Serial.println(sizeof(meas_sw));
+    Serial.print("LCD-display:"); Serial.print((uintptr_t)&lcd_display,HEX); Serial.print("/");Serial.println(sizeof(lcd_display));
 
     iinfo(0);
 
@@ -175,98 +265,745 @@ void setup() {
     lcd_display.showTimer();
     lcd_display.showLevel();
 
-    //測定用タイマ  動作開始
-    tick_tock_timer -> resume(); 
+    //  タスク登録  登録できなければ起動エラー（SCHEDULER_MAX_TASKS を増やす）
+    boolean f_task_added = true;
+    f_task_added &= scheduler.addTask(task_switch, SWITCH_PERIOD, PRIORITY_SWITCH) >= 0;
+    f_task_added &= scheduler.addTask(task_timer_tick, TICK_PERIOD, PRIORITY_TICK) >= 0;
+    f_task_added &= scheduler.addTask(task_measure, MEASURE_PERIOD, PRIORITY_MEASURE) >= 0;
+    task_continuous_id = scheduler.addTask(task_continuous, CONT_MEAS_PERIOD / 1000, PRIORITY_MEASURE);
+    f_task_added &= task_continuous_id >= 0;
+    f_task_added &= scheduler.addTask(task_display, DISPLAY_PERIOD, PRIORITY_DISPLAY) >= 0;
+    task_uplink_id = scheduler.addTask(task_uplink, 0, PRIORITY_UPLINK);
+    f_task_added &= task_uplink_id >= 0;
+    f_task_added &= scheduler.addTask(task_uart_tx, UART_TX_PERIOD, PRIORITY_UPLINK) >= 0;
+    f_task_added &= scheduler.addTask(task_command, COMMAND_PERIOD, PRIORITY_UPLINK) >= 0;
+    //  タスク表が足りなければ起動しない（起動時のエラーと同じ）
+    if (!f_task_added){
+        Serial.println("  Task table full. Increase SCHEDULER_MAX_TASKS.");
+        while(true){
+            delay(1000);
+        };
+    }
+
+    //  計測タイマ  ここから数える
+    configure_adaptive_timer();
+    timer_second_time = millis();
+    activity_time = millis();
 }
 
-// 100ms＋処理時間  でループ 2msぐらいの仕事量
+//  実行可能なタスクを1つずつ実行する  タスクがない時はAD変換を進め、次のタスクまで眠る
 void loop() {
-    digitalWrite(D12,HIGH); // 動作時間測定
-    //  モード表示リフレッシュ
+    dispatch_events();
+
+    if (!PROFILE_ISR_ON_D12){ digitalWrite(D12,HIGH); } // 動作時間測定
+    const boolean f_task_done = scheduler.run();
+    if (!PROFILE_ISR_ON_D12){ digitalWrite(D12,LOW); }
+
+    if (!f_task_done){
+        meas_unit.poll();
+        drain_trace();
+        check_debug_command();
+    }
+
+    //  終わったI2C転送の後処理（完了の callback）
+    i2c_bus.service();
+
+    if (!f_task_done){
+        sleep_until_next();
+    }
+}
+
+/*!
+    @brief  次のタスクまで眠る
+            タイマモードで待っている時は、次のタイムアップか表示の分が変わるまでSTOPモードで眠る（スイッチで起きる）.
+            それ以外は WFI で次の割り込みまで眠る
+*/
+void sleep_until_next(void){
+    if (!can_stop()){
+        low_power.idle(scheduler.timeToNext());
+        return;
+    }
+
+    //  眠っている間はブリンクできないので、止めた表示にしておく
+    lcd_display.showMode(false);
+    lcd_display.showTimer();
+    //  STOPモードではI2CとUARTのクロックも止まる
+    i2c_bus.flush();
+    Serial.flush();
+    uart1.flush();
+
+    low_power.stop(time_to_timer_event());
+    //  眠っていた間の周期は飛ばす
+    scheduler.resync();
+}
+
+/*!
+    @brief  STOPモードに入れるか
+            タイマモードで待っていて、操作・計測の後しばらく経ち、送信とI2C転送がすべて終わり、
+            コマンドを受信している途中でない時
+*/
+boolean can_stop(void){
+    return level_meter.getMode() == Timer && f_mode_confirmed && !f_wait_release && !f_timer_timeup
+        && !meas_unit.isSingleRunning() && meas_sw.isReleased()
+        && millis() - activity_time >= AWAKE_AFTER_ACTIVITY
+        && uart1.getTxPending() == 0 && !uart1.isReceiving() && level_meter.getHistory()->getUnsent() == 0
+        && trace_log.getCount() == 0 && i2c_bus.isIdle();
+}
+
+/*!
+    @brief  計測タイマがタイムアップするか、表示している分が変わるまでの時間
+    @return 時間[ms]
+*/
+uint32_t time_to_timer_event(void){
+    const uint32_t period = level_meter.getTimerPeriod() != 0 ? level_meter.getTimerInterval() : 0;
+    const uint32_t elapsed = level_meter.getTimerElasped();
+
+    uint32_t seconds = ONE_MINUTE - elapsed % ONE_MINUTE;
+    if (period != 0 && period - elapsed < seconds){
+        seconds = period - elapsed;
+    }
+
+    const uint32_t since = millis() - timer_second_time;
+    return (seconds * ONE_SECOND > since) ? seconds * ONE_SECOND - since : 0;
+}
+
+/*!
+    @brief  計測タイマの経過時間を、前に数えてから過ぎた秒の数だけ進める. タイムアップすればフラグを立てる
+            眠っていた後は何秒分もまとめて数える
+*/
+void update_timer_elapsed(void){
+    while (millis() - timer_second_time >= ONE_SECOND){
+        timer_second_time += ONE_SECOND;
+        timer_seconds++;
+        if (DEBUG){ iinfo(1); };
+
+        //  タイマ設定が0ならカウントしない：タイマ計測はしない
+        if (level_meter.getTimerPeriod() != 0 && level_meter.incTimeElasped()) {
+            f_timer_timeup = true;
+        };
+    }
+}
+
+/*!
+    @brief  表示タスク  モード・タイマ表示のリフレッシュ
+            計測チャネルが複数あれば、液面を表示するチャネルを CHANNEL_DISPLAY_PERIOD ごとに替える
+*/
+void task_display(void){
+    if (meas_unit.getChannelCount() > 1){
+        lcd_display.showChannel((millis() / CHANNEL_DISPLAY_PERIOD) % meas_unit.getChannelCount());
+    }
     lcd_display.showMode();
-    delay(2);
     lcd_display.showTimer();
+}
 
-    //  連続モードのとき
-    if (level_meter.getMode() == Continuous && f_mode_confirmed ){
-            //  タイマーを無視する 
+/*!
+    @brief  タイマタスク  タイマモードでタイムアップしていれば1回計測を開始する
+*/
+void task_timer_tick(void){
+
+    update_timer_elapsed();
+
+    if (!f_mode_confirmed || !f_timer_timeup){
+        return;
+    }
+
+    //  連続モードのときはタイマーを無視する 
+    if (level_meter.getMode() == Continuous){
         f_timer_timeup = false; 
-        ++deci_counter;
-        // DECIMATION 回ごとに1回計測   大体1秒ごと
-        if (deci_counter == DECIMATION - 1 ){
-            Serial.print("-");
-            deci_counter = 0;
-            //  電流源の動作確認
-            if ( meas_unit.getStatus() ){
-                //  動作していれば  1回計測、表示
-                level_meter.clearSensorError();
-                meas_unit.readLevel();
-                lcd_display.showLevel();
-                meas_unit.setVmon(level_meter.getLiquidLevel());
-                submit_status();
-            } else {
-                //  動作していなければ計測をターミネート
-                meas_unit.currentOff();
-                digitalWrite(MEAS_LED, LOW);
-                // エラー表示
-                level_meter.setSensorError();
-                lcd_display.showLevel();
-                // meas_unit.setVmon(level_meter.getLiquidLevel());
-                meas_unit.setVmonFailed();
-                // タイマーモードに移行
-                level_meter.setMode(Timer);
-                Serial.println("  Current Sorce Fail. Cont meas terminated...");
-            }
+        return;
+    }
+
+    //  タイムアップが起きれば計測する
+    if (level_meter.getMode() == Timer && !meas_unit.isSingleRunning()){
+        f_timer_timeup = false;
+        Serial.print("Timer UP - ");
+        begin_manual_meas();
+    }
+}
+
+/*!
+    @brief  計測タスク  1回計測のステートマシンを進め、連続モードでは完了したAD変換から液面を表示する
+*/
+void task_measure(void){
+
+    //  1回計測の途中
+    if (meas_unit.isSingleRunning()){
+        if (meas_unit.updateSingle()){
+            finish_meas_single();
         }
-        // }
-          
+        return;
     }
 
-    //  タイマモードの時
-    if (level_meter.getMode() == Timer && f_mode_confirmed){
+    //  連続計測の電流源を立ち上げ中
+    if (f_cont_starting){
+        update_continuous_start();
+        return;
+    }
 
-        if (f_timer_timeup) {  //  タイムアップが起きれば計測する
-            f_timer_timeup = false;
-            Serial.print("Timer UP - ");
-            level_meter.setMode(Manual);
-            digitalWrite(MEAS_LED, HIGH);
-            lcd_display.showMode();
-            wrapper_meas_single();
+    //  連続モードのとき  AD変換が完了していれば  液面計算、表示
+    if (level_meter.getMode() == Continuous && f_mode_confirmed ){
+        if ( meas_unit.readLevel(meas_unit.isEstimating()) ){
+            //  コマンドでパラメタが変わっていれば、次の変換を始める前に読み直す
+            if (f_cont_reconfigure){
+                configure_continuous();
+            }
+            //  ストリーミングでは間を空けずに次の変換を始める
+            if (meas_unit.isStreaming()){
+                meas_unit.startAcquisition(true);
+            }
             lcd_display.showLevel();
             meas_unit.setVmon(level_meter.getLiquidLevel());
-            level_meter.setMode(Timer);
-            submit_status();
-            digitalWrite(MEAS_LED, LOW);
+            //  ゲートウエイへは計測の頻度によらず CONT_MEAS_PERIOD ごとに送る
+            if (millis() - cont_uplink_time >= CONT_MEAS_PERIOD / 1000){
+                cont_uplink_time = millis();
+                scheduler.trigger(task_uplink_id);
+            }
         }
     }
-    
- 
+}
+
+/*!
+    @brief  連続計測タスク  CONT_MEAS_PERIOD ごとにAD変換を開始する
+            ストリーミングでは計測タスクが次々に変換を始めるので、ここでは止まっていた時だけ始まる
+*/
+void task_continuous(void){
+
+    if (level_meter.getMode() != Continuous || !f_mode_confirmed || f_cont_starting){
+        return;
+    }
+
+    LOG_DEBUG("-");
+    //  電流源の動作確認（止まっているチャネルはセンサエラーになる）
+    if ( meas_unit.checkSources() ){
+        //  動作していれば  AD変換を開始（結果は計測タスクで表示）
+        meas_unit.startAcquisition(true);
+    } else {
+        //  動作していなければ計測をターミネート
+        meas_unit.currentOff();
+        digitalWrite(MEAS_LED, LOW);
+        // エラー表示
+        lcd_display.showLevel();
+        // meas_unit.setVmon(level_meter.getLiquidLevel());
+        meas_unit.setVmonFailed();
+        // タイマーモードに移行
+        level_meter.setMode(Timer);
+        Serial.println("  Current Sorce Fail. Cont meas terminated...");
+    }
+}
+
+/*!
+    @brief  IoTゲートウエイ送信タスク  trigger() された時だけ実行
+*/
+void task_uplink(void){
+    const boolean f_delivered = submit_status();
+    record_history(f_delivered);
+}
+
+/*!
+    @brief  送信キュータスク  IoTゲートウエイの送信キューをUARTへ送り出す
+*/
+void task_uart_tx(void){
+    uart1.service();
+
+    //  送信キューが空いていれば、送れなかった計測履歴をまとめて送る
+    if (uart1.getTxPending() == 0 && level_meter.getHistory()->getUnsent() != 0){
+        drain_history(HISTORY_DRAIN_BATCH);
+    }
+}
+
+/*!
+    @brief  コマンドタスク  IoTゲートウエイから届いたコマンド行を実行する
+            受信バッファにある分だけパーサに渡し、待たない（行の途中なら続きは次回）
+*/
+void task_command(void){
+    CommandParser::Status status;
+
+    while ((status = uart1.receiveCommand()) != CommandParser::COMMAND_PENDING){
+        if (status == CommandParser::COMMAND_READY){
+            execute_command(uart1.getCommand());
+        } else {
+            reply_command_error("", (status == CommandParser::COMMAND_OVERFLOW) ? "overflow" : "syntax");
+        }
+        //  ここから AWAKE_AFTER_ACTIVITY の間は眠らない（続きのコマンドと応答の送信）
+        activity_time = millis();
+    }
+}
+
+/*!
+    @brief  コマンド1行を実行して応答を送る
+            get NAME [CH]        パラメタを読む  length current level error rate（CHごと）, period elapsed interval mode format channels,
+                                 適応タイマの adaptive period_min period_max uncertainty alarm,
+                                 液面推定の filter median_window iir_alpha kalman_accel kalman_noise, ストリーミングの data_rate oversampling
+            set NAME VALUE [CH]  パラメタを書く  length（CHごと）, period と適応タイマ・液面推定・ストリーミングのパラメタはFRAMにも保存する.
+                                 format は保存しない
+            meas                 1回計測を始める（タイマモードの時）
+            mode T|C             タイマモード・連続計測モードにする
+            hist [N]             新しい方から N件（1〜HISTORY_DRAIN_BATCH）の計測履歴を古い順に送る
+        応答は送信フォーマットによらずJSONの1行  {"ack":コマンド,...} か {"nak":理由,"cmd":コマンド}
+        バイナリフォーマット（set format 1）の時は行の後に 0x00 を送る. 0x00 で区切るデコーダには
+        CRCの合わないフレームとして読み飛ばされ、前後のバイナリフレーム（hist の履歴など）は壊れない
+        理由は unknown（コマンド・パラメタ名）, syntax（引数）, range（値・チャネル）, busy（計測中・スイッチ操作中）
+    @param command そろったコマンド行
+*/
+void execute_command(const CommandParser& command){
+    const char* verb = command.getVerb();
+    const char* error = "unknown";
+
+    if (strcmp(verb, "get") == 0){
+        error = command_get(command);
+    } else if (strcmp(verb, "set") == 0){
+        error = command_set(command);
+    } else if (strcmp(verb, "meas") == 0){
+        error = command_meas(command);
+    } else if (strcmp(verb, "mode") == 0){
+        error = command_mode(command);
+    } else if (strcmp(verb, "hist") == 0){
+        error = command_hist(command);
+    }
+    LOG_DEBUGLN("  command ", verb, error ? " nak " : " ack", error ? error : "");
+
+    if (error){
+        reply_command_error(verb, error);
+    }
+}
+
+/*!
+    @brief  get NAME [CH]
+    @return エラーの理由, nullptr:応答を送った
+*/
+const char* command_get(const CommandParser& command){
+    const char* name = command.getArg(0);
+    uint8_t ch = 0;
+
+    if (!name || command.getArgCount() > 2){
+        return "syntax";
+    }
+    if (!command_channel(command, 1, ch)){
+        return "range";
+    }
+
+    begin_command_reply("get", ch);
+    if (strcmp(name, "length") == 0){
+        uart1.addPayload(name, (int32_t)level_meter.getSensorLength(ch));
+    } else if (strcmp(name, "current") == 0){
+        uart1.addPayload(name, (int32_t)level_meter.getCurrentSetting(ch));
+    } else if (strcmp(name, "level") == 0){
+        uart1.addPayload(name, (int32_t)level_meter.getLiquidLevel(ch), (uint8_t)1);
+    } else if (strcmp(name, "error") == 0){
+        uart1.addPayload(name, (int32_t)level_meter.isSensorError(ch));
+    } else if (strcmp(name, "period") == 0){
+        uart1.addPayload(name, (int32_t)level_meter.getTimerPeriod());
+    } else if (strcmp(name, "elapsed") == 0){
+        uart1.addPayload(name, (int32_t)level_meter.getTimerElasped());
+    } else if (strcmp(name, "interval") == 0){
+        uart1.addPayload(name, (int32_t)level_meter.getTimerInterval());
+    } else if (strcmp(name, "rate") == 0){
+        uart1.addPayload(name, adaptive_timers[ch].getRate(), (uint8_t)1);
+    } else if (find_adaptive_param(name) >= 0){
+        uart1.addPayload(name, get_adaptive_param(level_meter.getAdaptiveConfig(), find_adaptive_param(name)));
+    } else if (find_estimator_param(name) >= 0){
+        uart1.addPayload(name, get_estimator_param(level_meter.getEstimatorConfig(), find_estimator_param(name)));
+    } else if (find_stream_param(name) >= 0){
+        uart1.addPayload(name, get_stream_param(level_meter.getStreamConfig(), find_stream_param(name)));
+    } else if (strcmp(name, "mode") == 0){
+        const char mode[2] = {ModeNames[level_meter.getMode()], '\0'};
+        uart1.addPayload(name, mode);
+    } else if (strcmp(name, "format") == 0){
+        uart1.addPayload(name, (int32_t)uart1.getFormat());
+    } else if (strcmp(name, "channels") == 0){
+        uart1.addPayload(name, (int32_t)meas_unit.getChannelCount());
+    } else {
+        uart1.clearPayload();
+        return "unknown";
+    }
+    send_command_reply();
+    return nullptr;
+}
+
+/*!
+    @brief  set NAME VALUE [CH]  範囲外の値は eh900 が丸めるので、応答には丸めた後の値を入れる
+    @return エラーの理由, nullptr:応答を送った
+*/
+const char* command_set(const CommandParser& command){
+    const char* name = command.getArg(0);
+    int32_t value = 0;
+    uint8_t ch = 0;
+
+    if (!name || command.getArgCount() < 2 || command.getArgCount() > 3 || !command.getNumber(1, value)){
+        return "syntax";
+    }
+    if (!command_channel(command, 2, ch) || value < 0 || value > UINT16_MAX){
+        return "range";
+    }
+
+    if (strcmp(name, "length") == 0){
+        //  計測の途中でセンサ長は変えない
+        if (command_busy() || level_meter.getMode() != Timer){
+            return "busy";
+        }
+        level_meter.setSensorLength((uint16_t)value, ch);
+        meas_unit.renew_sensor_parameter();
+        level_meter.storeParameter();
+        value = level_meter.getSensorLength(ch);
+    } else if (strcmp(name, "period") == 0){
+        level_meter.setTimerPeriod((uint16_t)value);
+        configure_adaptive_timer();
+        level_meter.storeParameter();
+        value = level_meter.getTimerPeriod();
+    } else if (strcmp(name, "format") == 0){
+        if (value > IotGateway::FORMAT_BINARY){
+            return "range";
+        }
+        uart1.setFormat((IotGateway::Formats)value);
+    } else if (find_adaptive_param(name) >= 0){
+        //  下限と上限の順が逆になるなど、組み合わせが使えない値は変えない
+        AdaptiveConfig adaptive = level_meter.getAdaptiveConfig();
+        set_adaptive_param(adaptive, find_adaptive_param(name), (uint16_t)value);
+        if (!level_meter.setAdaptiveConfig(adaptive)){
+            return "range";
+        }
+        configure_adaptive_timer();
+        level_meter.storeParameter();
+    } else if (find_estimator_param(name) >= 0){
+        //  中央値の窓が偶数など、推定に使えない値は変えない  連続計測中なら次の変換から使う
+        EstimatorConfig estimator = level_meter.getEstimatorConfig();
+        set_estimator_param(estimator, find_estimator_param(name), (uint16_t)value);
+        if (!level_meter.setEstimatorConfig(estimator)){
+            return "range";
+        }
+        f_cont_reconfigure = true;
+        level_meter.storeParameter();
+    } else if (find_stream_param(name) >= 0){
+        //  変換速度の番号・リングバッファを超えるサンプル数は変えない  連続計測中なら次の変換から使う
+        AdcStreamConfig stream = level_meter.getStreamConfig();
+        set_stream_param(stream, find_stream_param(name), (uint16_t)value);
+        if (!level_meter.setStreamConfig(stream)){
+            return "range";
+        }
+        f_cont_reconfigure = true;
+        level_meter.storeParameter();
+    } else {
+        return "unknown";
+    }
+
+    begin_command_reply("set", ch);
+    uart1.addPayload(name, value);
+    send_command_reply();
+    return nullptr;
+}
+
+/*!
+    @brief  適応タイマのパラメタの番号  コマンドでの名前は ADAPTIVE_PARAM_NAMES
+    @return 番号, -1:適応タイマのパラメタではない
+*/
+int8_t find_adaptive_param(const char* name){
+    return find_param_name(name, ADAPTIVE_PARAM_NAMES, sizeof(ADAPTIVE_PARAM_NAMES) / sizeof(ADAPTIVE_PARAM_NAMES[0]));
+}
+
+/*!
+    @brief  適応タイマのパラメタを1つ読む
+    @param index find_adaptive_param() の番号
+*/
+int32_t get_adaptive_param(const AdaptiveConfig& config, int8_t index){
+    switch (index){
+        case 0:     return config.enabled;
+        case 1:     return config.period_min;
+        case 2:     return config.period_max;
+        case 3:     return config.uncertainty;
+        default:    return config.alarm_level;
+    }
+}
+
+/*!
+    @brief  適応タイマのパラメタを1つ書く（範囲は確かめない）
+    @param index find_adaptive_param() の番号
+*/
+void set_adaptive_param(AdaptiveConfig& config, int8_t index, uint16_t value){
+    switch (index){
+        case 0:     config.enabled = (value > UINT8_MAX) ? UINT8_MAX : value;  break;
+        case 1:     config.period_min = value;      break;
+        case 2:     config.period_max = value;      break;
+        case 3:     config.uncertainty = value;     break;
+        default:    config.alarm_level = value;     break;
+    }
+}
+
+/*!
+    @brief  液面推定のパラメタの番号  コマンドでの名前は ESTIMATOR_PARAM_NAMES
+    @return 番号, -1:液面推定のパラメタではない
+*/
+int8_t find_estimator_param(const char* name){
+    return find_param_name(name, ESTIMATOR_PARAM_NAMES, sizeof(ESTIMATOR_PARAM_NAMES) / sizeof(ESTIMATOR_PARAM_NAMES[0]));
+}
+
+/*!
+    @brief  液面推定のパラメタを1つ読む
+    @param index find_estimator_param() の番号
+*/
+int32_t get_estimator_param(const EstimatorConfig& config, int8_t index){
+    switch (index){
+        case 0:     return config.filter;
+        case 1:     return config.median_window;
+        case 2:     return config.iir_alpha;
+        case 3:     return config.kalman_accel;
+        default:    return config.kalman_noise;
+    }
+}
+
+/*!
+    @brief  液面推定のパラメタを1つ書く（範囲は確かめない）
+    @param index find_estimator_param() の番号
+*/
+void set_estimator_param(EstimatorConfig& config, int8_t index, uint16_t value){
+    const uint8_t byte_value = (value > UINT8_MAX) ? UINT8_MAX : value;
+    switch (index){
+        case 0:     config.filter = byte_value;         break;
+        case 1:     config.median_window = byte_value;  break;
+        case 2:     config.iir_alpha = value;       break;
+        case 3:     config.kalman_accel = value;    break;
+        default:    config.kalman_noise = value;    break;
+    }
+}
+
+/*!
+    @brief  ストリーミングのパラメタの番号  コマンドでの名前は STREAM_PARAM_NAMES
+    @return 番号, -1:ストリーミングのパラメタではない
+*/
+int8_t find_stream_param(const char* name){
+    return find_param_name(name, STREAM_PARAM_NAMES, sizeof(STREAM_PARAM_NAMES) / sizeof(STREAM_PARAM_NAMES[0]));
+}
+
+/*!
+    @brief  ストリーミングのパラメタを1つ読む
+    @param index find_stream_param() の番号
+*/
+int32_t get_stream_param(const AdcStreamConfig& config, int8_t index){
+    switch (index){
+        case 0:     return config.data_rate;
+        default:    return config.oversampling;
+    }
+}
+
+/*!
+    @brief  ストリーミングのパラメタを1つ書く（範囲は確かめない）
+    @param index find_stream_param() の番号
+*/
+void set_stream_param(AdcStreamConfig& config, int8_t index, uint16_t value){
+    const uint8_t byte_value = (value > UINT8_MAX) ? UINT8_MAX : value;
+    switch (index){
+        case 0:     config.data_rate = byte_value;      break;
+        default:    config.oversampling = byte_value;   break;
+    }
+}
+
+/*!
+    @brief  パラメタの名前の表から番号を探す
+    @param names 名前の表
+    @param count 表の名前の数
+    @return 番号, -1:表にない
+*/
+int8_t find_param_name(const char* name, const char* const names[], uint8_t count){
+    for (uint8_t i = 0; i < count; i++){
+        if (strcmp(name, names[i]) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*!
+    @brief  meas  タイマモードで待っている時に1回計測を始める. 結果はいつもの状態の送信で届く
+    @return エラーの理由, nullptr:応答を送った
+*/
+const char* command_meas(const CommandParser& command){
+    if (command.getArgCount() != 0){
+        return "syntax";
+    }
+    if (command_busy() || level_meter.getMode() != Timer){
+        return "busy";
+    }
+
+    Serial.print("Command - ");
+    begin_manual_meas();
+    begin_command_reply("meas", 0);
+    send_command_reply();
+    return nullptr;
+}
+
+/*!
+    @brief  mode T|C  スイッチ操作と同じくモードを変える. 同じモードなら何もしない
+    @return エラーの理由, nullptr:応答を送った
+*/
+const char* command_mode(const CommandParser& command){
+    const char* mode = command.getArg(0);
+
+    if (!mode || command.getArgCount() != 1){
+        return "syntax";
+    }
+    if (command_busy()){
+        return "busy";
+    }
+
+    if (strcmp(mode, "t") == 0){
+        if (level_meter.getMode() == Continuous){
+            stop_continuous();
+            Serial.println("  Cont meas Finished.");
+        }
+    } else if (strcmp(mode, "c") == 0){
+        if (level_meter.getMode() != Continuous){
+            level_meter.setMode(Continuous);
+            start_continuous();
+        }
+    } else {
+        return "range";
+    }
+
+    const char current[2] = {ModeNames[level_meter.getMode()], '\0'};
+    begin_command_reply("mode", 0);
+    uart1.addPayload("mode", current);
+    send_command_reply();
+    return nullptr;
+}
+
+/*!
+    @brief  hist [N]  新しい方から N件の計測履歴を古い順に送る（送り方は未送信の履歴と同じ）
+            送信キューに入らなくなったところで止める. 応答の count は送った件数
+    @return エラーの理由, nullptr:応答を送った
+*/
+const char* command_hist(const CommandParser& command){
+    HistoryLog* history = level_meter.getHistory();
+    int32_t num = 1;
+
+    if (command.getArgCount() > 1 || (command.getArgCount() == 1 && !command.getNumber(0, num))){
+        return "syntax";
+    }
+    if (num < 1 || num > HISTORY_DRAIN_BATCH){
+        return "range";
+    }
+    if (num > history->getCount()){
+        num = history->getCount();
+    }
+
+    int32_t sent = 0;
+    HistoryRecord record;
+    for (int32_t age = num - 1; age >= 0; age--){
+        //  壊れた記録は読み飛ばす
+        if (!history->readRecent(age, record)){
+            continue;
+        }
+        if (!uart1.sendHistory(record)){
+            break;
+        }
+        sent++;
+    }
+
+    begin_command_reply("hist", 0);
+    uart1.addPayload("count", sent);
+    send_command_reply();
+    return nullptr;
+}
+
+/*!
+    @brief  コマンドの引数のチャネル番号を読む. 引数がなければチャネル0
+    @param index 引数の番号
+    @param ch 読んだチャネル番号
+    @return False:使っていないチャネルか、数ではない
+*/
+boolean command_channel(const CommandParser& command, uint8_t index, uint8_t& ch){
+    int32_t value = 0;
+
+    if (!command.getArg(index)){
+        ch = 0;
+        return true;
+    }
+    if (!command.getNumber(index, value) || value < 0 || value >= meas_unit.getChannelCount()){
+        return false;
+    }
+    ch = (uint8_t)value;
+    return true;
+}
+
+/*!
+    @brief  モードを変えられない時か  スイッチ操作の途中・1回計測の途中
+*/
+boolean command_busy(void){
+    return !f_mode_confirmed || f_wait_release || meas_unit.isSingleRunning();
+}
+
+/*!
+    @brief  コマンドの応答を始める  チャネルが複数ある時はチャネル番号を入れる
+*/
+void begin_command_reply(const char* verb, uint8_t ch){
+    uart1.clearPayload();
+    uart1.addPayload("ack", verb);
+    if (meas_unit.getChannelCount() > 1){
+        uart1.addPayload("ch", (int32_t)ch);
+    }
+}
+
+/*!
+    @brief  コマンドの応答を送信キューに入れる
+*/
+void send_command_reply(void){
+    if (!uart1.sendPayload()){
+        LOG_ERRORLN("  tx queue full, reply dropped");
+    }
+    uart1.clearPayload();
+}
+
+/*!
+    @brief  コマンドのエラーを応答する
+    @param verb コマンド（行を捨てた時は空）
+    @param reason 理由
+*/
+void reply_command_error(const char* verb, const char* reason){
+    uart1.clearPayload();
+    uart1.addPayload("nak", reason);
+    if (verb[0] != '\0'){
+        uart1.addPayload("cmd", verb);
+    }
+    send_command_reply();
+}
+
+/*!
+    @brief  スイッチタスク  スイッチの状態をサンプリングし、測定モードを変更する
+            Timer->>Cont or  Timer->>Manual or Cont ->> Timer
+*/
+void task_switch(void){
+
     // スイッチの状態をサンプリング
     meas_sw.updateStatus();
 
-    //  スイッチが押されていれば、測定モードの変更 Timer->>Cont or  Timer->>Manual or Cont ->> Timer
+    //  1回計測の間のスイッチ操作は無視（計測終了時にクリア）
+    if (meas_unit.isSingleRunning()){
+        return;
+    }
+
+    //  連続計測を終えたスイッチが離されるまでは何もしない
+    if (f_wait_release){
+        if (meas_sw.hasReleased()){
+            f_wait_release = false;
+            Serial.println("  Cont meas Finished.");
+        }
+        return;
+    }
+
+    //  スイッチが押されていれば、測定モードの変更
     if (meas_sw.isDepressed()){       // スイッチが押されている時、
         meas_sw.clearChangeStatus();
 
         //  モード遷移  Cont ->> Timer
         if (level_meter.getMode() == Continuous && f_mode_confirmed){
-            meas_unit.currentOff();
-            digitalWrite(MEAS_LED, LOW); 
-            level_meter.setMode(Timer); 
+            stop_continuous();
             
             //  スイッチが離されていることを確認して完了
-            while (! meas_sw.hasReleased()){
-                meas_sw.updateStatus();
-            }
-            Serial.println("  Cont meas Finished.");
+            f_wait_release = true;
         } else {
         
         //  モード遷移  Timer ->> Cont or Manual
             digitalWrite(MEAS_LED, HIGH);   
             f_mode_confirmed = false;  //   スイッチを離した時にモード確定なので、この時点ではモード未確定
-            // lcd.setCursor(0, 1);
             if(meas_sw.getDuration() > DURATION_LONG_PRESS){   //押されている時間が規定より長ければCモード
-                // lcd.print("C");
                 level_meter.setMode(Continuous);
 
             } else {                                    //そうでなければMモード
@@ -280,46 +1017,16 @@ void loop() {
     if (meas_sw.hasReleased() && !f_mode_confirmed){
         meas_sw.clearChangeStatus();
         f_mode_confirmed = true;        //  モード確定
-        //  スイッチ状態のモニタ
-        // Serial.print(meas_sw.getDuration()); Serial.print(":");
-        // Serial.println(ModeNames[level_meter.getMode()]);
 
         switch (level_meter.getMode()){
-            case Manual:    //1回計測を実行して完了
+            case Manual:    //1回計測を開始  完了は計測タスクで処理
                 digitalWrite(MEAS_LED, HIGH);   // LEDを点灯
                 lcd_display.showMode();
-                wrapper_meas_single();          //  計測
-                lcd_display.showLevel();        //  測定値表示（エラーを含む）
-                submit_status();                //  IoTゲートウエイ 送信
-                meas_unit.setVmon(level_meter.getLiquidLevel());    //  アナログモニタ出力更新（エラーを含む）
-                digitalWrite(MEAS_LED, LOW);    // LEDを消灯
-                level_meter.setMode(Timer);
-                lcd_display.showMode();
-
-                // 手動計測中にタイマがタイムアップした場合、それを無視する
-                f_timer_timeup = false;
-                //  測定している間のスイッチ操作を無視
-                meas_sw.clearChangeStatus();
-                
+                start_meas_single();
                 break;
         
             case Continuous:    // 連続計測モードの準備
-                Serial.print("Cont. Measureing... ");
-                digitalWrite(MEAS_LED, HIGH);
-                lcd_display.showMode();
-                //  電流をon
-                if ( !meas_unit.currentOn() ){ 
-                    //  電流源にエラーがあればエラー表示してタイマーモードへ移行
-                    level_meter.setSensorError();
-                    lcd_display.showLevel();
-                    meas_unit.setVmonFailed();
-                    level_meter.setMode(Timer);
-                } else {
-                    level_meter.clearSensorError();
-                    lcd_display.showLevel();
-                }
-                // cont_meas_timer -> resume();//    表示リフレッシュ用タイマ動作開始
-
+                start_continuous();
                 break;
 
             default:
@@ -329,108 +1036,444 @@ void loop() {
                 break;
         }
     }
+}
+
+/*!
+    @brief  連続計測を始める（モードは Continuous にしてから呼ぶ）
+            電流源を立ち上げるだけでブロックしない. 計測タスクが update_continuous_start() で完了を待つ
+*/
+void start_continuous(void){
+    Serial.print("Cont. Measureing... ");
+    digitalWrite(MEAS_LED, HIGH);
+    lcd_display.showMode();
+    //  電流をon（チャネルごとのセンサエラーは meas_unit が設定する）
+    meas_unit.startCurrent();
+    f_cont_starting = true;
+}
+
+/*!
+    @brief  連続計測の電流源の立ち上げを進める（計測タスクから呼ぶ）
+            電流が安定したら連続計測の周期を始め、電流源にエラーがあればエラーを表示してタイマモードに戻る
+*/
+void update_continuous_start(void){
+    //  立ち上げ中に連続モードでなくなった
+    if (level_meter.getMode() != Continuous){
+        f_cont_starting = false;
+        meas_unit.currentOff();
+        return;
+    }
 
-    // if (DEBUG) { 
-        digitalWrite(D12,LOW); 
-    // }
+    switch (meas_unit.updateCurrent()){
+        case CurrentFailed:
+            //  電流源にエラーがあればエラー表示してタイマーモードへ移行
+            f_cont_starting = false;
+            lcd_display.showLevel();
+            meas_unit.setVmonFailed();
+            level_meter.setMode(Timer);
+            break;
+
+        case CurrentReady:
+            f_cont_starting = false;
+            lcd_display.showLevel();
+            configure_continuous();
+            cont_uplink_time = millis() - CONT_MEAS_PERIOD / 1000;
+            //  ここから連続計測の周期を数える
+            scheduler.trigger(task_continuous_id);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*!
+    @brief  液面推定をやり直し、推定を使うかどうかで計測の周期を選ぶ
+            連続計測の開始時と、計測中にコマンドでパラメタが変わった時（変換の合間）に呼ぶ
+            ストリーミングは変換が終わるたびに次を始めるので、周期はAD変換の設定で決まる
+*/
+void configure_continuous(void){
+    f_cont_reconfigure = false;
+    meas_unit.resetEstimator();
+    meas_unit.configureStream();
+    scheduler.setPeriod(task_continuous_id,
+        (meas_unit.isEstimating() && !meas_unit.isStreaming() ? CONT_STREAM_PERIOD : CONT_MEAS_PERIOD) / 1000);
+    if (meas_unit.isStreaming()){
+        LOG_INFOLN(" stream: ", meas_unit.getUpdatePeriod(MEASURE_PERIOD * 1000), " us/update ");
+    }
+}
 
-    delay(LOOP_WAIT);
+/*!
+    @brief  連続計測を止めてタイマモードに戻る
+*/
+void stop_continuous(void){
+    f_cont_starting = false;
+    meas_unit.currentOff();
+    digitalWrite(MEAS_LED, LOW);
+    level_meter.setMode(Timer);
 }
 
+/*!
+    @brief  タイマモードから1回計測を始める（タイムアップとコマンド）
+*/
+void begin_manual_meas(void){
+    level_meter.setMode(Manual);
+    digitalWrite(MEAS_LED, HIGH);
+    lcd_display.showMode();
+    start_meas_single();
+}
 
 /*!
-    @brief  1回計測 measurement::measSingleのラッパ.  
-    測定結果、エラー共に装置の状態を示す構造体(eh900)の要素に反映されるので戻り値はない
+    @brief  1回計測を開始する. 計測の進行は計測タスクで行う
     @param 
     @return
 */
-void wrapper_meas_single(void){
+void start_meas_single(void){
     Serial.print("Single shot Measureing...");
-    // digitalWrite(MEAS_LED, HIGH);  // turn the LED
-    // lcd_display.showMode();
 
     Serial.print("timer start.. ");
-    
     disp_update_timer -> resume();//    表示リフレッシュ用タイマ動作開始
-    if (!meas_unit.measSingle()){
-        level_meter.setSensorError();
-    } else {
-        level_meter.clearSensorError();
+
+    if (!meas_unit.startSingle()){
+        finish_meas_single();
     }
+}
+
+/*!
+    @brief  1回計測の終了処理.  
+    測定結果、エラー共に装置の状態を示す構造体(eh900)の要素に反映し、表示・出力を更新する
+    @param 
+    @return
+*/
+void finish_meas_single(void){
     disp_update_timer -> pause();   //  表示リフレッシュ用タイマ動作終了
     disp_update_timer -> refresh(); //      同  リセット
 
+    //  チャネルごとのセンサエラーは meas_unit が計測の終わりに設定している
+    if (!meas_unit.hasSingleSucceeded()){
+        Serial.print("  sensor error");
+    }
     Serial.println("  Finished.");
 
-    // digitalWrite(MEAS_LED, LOW);  
-    // level_meter.setMode(Timer);
-    // lcd_display.showMode();
+    update_adaptive_timer();        //  次の計測までの周期
+    lcd_display.showLevel();        //  測定値表示（エラーを含む）
+    meas_unit.setVmon(level_meter.getLiquidLevel());    //  アナログモニタ出力更新（エラーを含む）
+    scheduler.trigger(task_uplink_id);  //  IoTゲートウエイ 送信
+    digitalWrite(MEAS_LED, LOW);    // LEDを消灯
+    level_meter.setMode(Timer);
+    lcd_display.showMode();
+
+    // 計測中にタイマがタイムアップした場合、それを無視する
+    f_timer_timeup = false;
+    //  ここから AWAKE_AFTER_ACTIVITY の間は眠らない
+    activity_time = millis();
+    //  測定している間のスイッチ操作を無視
+    meas_sw.clearChangeStatus();
+}
+
+/*!
+    @brief  適応タイマのパラメタを eh900 から読み、次の計測までの周期を決め直す（記録は残す）
+*/
+void configure_adaptive_timer(void){
+    for (AdaptiveTimer& timer : adaptive_timers){
+        timer.configure(level_meter.getAdaptiveConfig());
+    }
+    level_meter.setTimerInterval(adaptive_interval());
+}
+
+/*!
+    @brief  1回計測の結果を適応タイマに記録して、次の計測までの周期を決める
+            適応タイマを使う時は、計測したところから周期を数え直す（コマンドの計測の後も）
+*/
+void update_adaptive_timer(void){
+    for (uint8_t ch = 0; ch < meas_unit.getChannelCount(); ch++){
+        if (!level_meter.isSensorError(ch)){
+            adaptive_timers[ch].addSample(level_meter.getLiquidLevel(ch), timer_seconds);
+        }
+    }
+    level_meter.setTimerInterval(adaptive_interval());
+    if (level_meter.getAdaptiveConfig().enabled){
+        level_meter.setTimerElasped(0);
+        LOG_INFOLN("  next ", level_meter.getTimerInterval(), " s, rate ", adaptive_timers[0].getRate());
+    }
+}
+
+/*!
+    @brief  全チャネルの適応タイマの周期のうち最も短いもの
+            センサエラーのチャネルと、まだ記録のないチャネルは使わない
+    @return 周期[s]  0:使えるチャネルがない（タイマ周期を使う）
+*/
+uint16_t adaptive_interval(void){
+    uint16_t interval = 0;
+
+    for (uint8_t ch = 0; ch < meas_unit.getChannelCount(); ch++){
+        if (level_meter.isSensorError(ch) || adaptive_timers[ch].getSamples() == 0){
+            continue;
+        }
+        const uint16_t period = adaptive_timers[ch].nextPeriod(level_meter.getTimerPeriod());
+        if (interval == 0 || period < interval){
+            interval = period;
+        }
+    }
+    return interval;
 }
 
     /*!
-    @brief  IoTGatewayに対してデータを出力する  
+    @brief  IoTGatewayに対してデータを出力する  計測チャネルごとに1つ送る
     @param 
-    @return
+    @return True:送信キューに入れた, False:キューが一杯で送れなかった
     */
-void submit_status(void){
-    Serial.println("sumbit_status():");
-    String current_status = "ERROR";
-    if (!level_meter.isSensorError()){
-        current_status = "NORMAL";
+boolean submit_status(void){
+    PROFILE_SCOPE(PROF_SUBMIT_STATUS);
+    LOG_DEBUGLN("sumbit_status():");
+
+    boolean f_sent = true;
+    for (uint8_t ch = 0; ch < meas_unit.getChannelCount(); ch++){
+        f_sent = submit_channel_status(ch) && f_sent;
     }
+    return f_sent;
+}
+
+    /*!
+    @brief  1つの計測チャネルの状態をIoTGatewayに出力する
+            JSONでは、チャネルが複数ある時だけ "ch" にチャネル番号を入れる
+    @param ch チャネル番号
+    @return True:送信キューに入れた, False:キューが一杯で送れなかった
+    */
+boolean submit_channel_status(uint8_t ch){
+    //  バイナリフォーマットの時はレコード1つを送る
+    if (uart1.getFormat() == IotGateway::FORMAT_BINARY){
+        StatusRecord record = {};
+        record.flags = telemetry_flags(ch);
+        record.sensor_length = level_meter.getSensorLength(ch);
+        record.timer_period = level_meter.getTimerPeriod();
+        record.liquid_level = level_meter.getLiquidLevel(ch);
+        const boolean f_sent = uart1.sendRecord(record);
+        TRACE(TRACE_SUBMIT, f_sent);
+        if (!f_sent){
+            LOG_ERRORLN("  tx queue full, dropped ", uart1.getDroppedFrames());
+        }
+        LOG_DEBUGLN("  record ", record.seq);
+        return f_sent;
+    }
+
+    const char mode[2] = {ModeNames[level_meter.getMode()], '\0'};
+
     uart1.addPayload("status", "NORMAL");
-    Serial.print("  status ");Serial.println(current_status);
-    uart1.addPayload("mode",String(ModeNames[level_meter.getMode()]));
-    Serial.print("  mode "); Serial.println(String(ModeNames[level_meter.getMode()]));
-    uart1.addPayload("length", (int32_t) level_meter.getSensorLength());
-    Serial.print("  length "); Serial.println(level_meter.getSensorLength());
+    uart1.addPayload("mode", mode);
+    uart1.addPayload("length", (int32_t) level_meter.getSensorLength(ch));
     uart1.addPayload("period",(int32_t) level_meter.getTimerPeriod());
-    Serial.print("  period "); Serial.println(level_meter.getTimerPeriod());
-    uart1.addPayload("level",(float)level_meter.getLiquidLevel()/(float) 10.0, (uint8_t)1);
-    Serial.print("  level "); Serial.println((float)level_meter.getLiquidLevel()/(float)10.0);
-    // clear the string:
-    Serial.println("  sending data");
-    uart1.sendPayload();
+    uart1.addPayload("level",(int32_t)level_meter.getLiquidLevel(ch), (uint8_t)1);
+    if (meas_unit.getChannelCount() > 1){
+        uart1.addPayload("ch", (int32_t)ch);
+    }
+    LOG_DEBUGLN("  status ", level_meter.isSensorError(ch) ? "ERROR" : "NORMAL", " mode ", mode, " ch ", ch, " level ", level_meter.getLiquidLevel(ch));
+    if (uart1.hasOverflow()){
+        LOG_ERRORLN("  payload overflow");
+    }
+    const boolean f_sent = uart1.sendPayload();
+    TRACE(TRACE_SUBMIT, f_sent);
+    if (!f_sent){
+        LOG_ERRORLN("  tx queue full, dropped ", uart1.getDroppedFrames());
+    }
     uart1.clearPayload();
-    Serial.println("  finished.");
+    return f_sent;
 }
 
+/*!
+    @brief  ステータス・履歴のレコードの flags  センサエラー・モード・計測チャネル
+    @param ch チャネル番号
+*/
+uint8_t telemetry_flags(uint8_t ch){
+    return (level_meter.isSensorError(ch) ? TELEMETRY_FLAG_SENSOR_ERROR : 0)
+         | ((uint8_t)level_meter.getMode() << TELEMETRY_FLAG_MODE_SHIFT)
+         | ((ch << TELEMETRY_FLAG_CHANNEL_SHIFT) & TELEMETRY_FLAG_CHANNEL_MASK);
+}
+
+/*!
+    @brief  計測結果をFRAMの履歴に追記する  計測チャネルごとに1件
+    @param f_delivered True:ゲートウエイに送れた
+*/
+void record_history(boolean f_delivered){
+    for (uint8_t ch = 0; ch < meas_unit.getChannelCount(); ch++){
+        HistoryRecord record = {};
+        record.timestamp = millis() / 1000;
+        record.liquid_level = level_meter.getLiquidLevel(ch);
+        record.raw_voltage = meas_unit.getMeasurement(ch).getRawVoltage();
+        record.raw_current = meas_unit.getMeasurement(ch).getRawCurrent();
+        record.flags = telemetry_flags(ch);
+
+        if (!level_meter.getHistory()->append(record, f_delivered)){
+            LOG_ERRORLN("  history write failed");
+        }
+    }
+}
+
+/*!
+    @brief  送れなかった計測履歴を古い方から送信キューに入れる
+            キューに入らなくなったら止め、残りは次回に送る
+    @param max_records 1回に送る最大件数
+*/
+void drain_history(uint16_t max_records){
+    HistoryLog* history = level_meter.getHistory();
+    HistoryRecord record;
+    uint16_t done = 0;
+
+    while (done < max_records && done < history->getUnsent()){
+        //  壊れた記録は送らずに読み飛ばす
+        if (history->readUnsent(done, record) && !uart1.sendHistory(record)){
+            break;
+        }
+        done++;
+    }
+    history->acknowledge(done);
+}
+
+
+/*!
+    @brief  トレースのリングバッファをシリアルへ出力する. 送信バッファに入る分だけ出し、ブロックしない
+            フレームの前後に区切りの0x00を付けるので、文字のログと混ざってもデコーダで分けられる
+*/
+void drain_trace(void){
+    TraceEvent event;
+    uint8_t frame[TELEMETRY_FRAME_SIZE];
+
+    while (trace_log.getCount() != 0 && Serial.availableForWrite() > (int)TELEMETRY_FRAME_SIZE){
+        trace_log.pop(event);
+        const size_t length = telemetry_pack_trace(event, frame);
+        Serial.write((uint8_t)0x00);
+        Serial.write(frame, length);
+    }
+}
+
+/*!
+    @brief  ISRから届いたイベントを処理する. 表示の更新は何回分届いていても1回にまとめる
+*/
+void dispatch_events(void){
+    uint8_t event;
+    boolean f_render = false;
+
+    //  ここから後の割り込みは、次の low_power.stop() を止める
+    low_power.clearWake();
+
+    while (isr_events.take(event)){
+        switch (event){
+            case EVENT_SWITCH:
+                LOG_DEBUG("!");
+                activity_time = millis();
+                break;
+            case EVENT_DISP_UPDATE:
+                f_render = true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (f_render){
+        lcd_display.showLevel();
+        LOG_DEBUG("@"); // means 'measureing'
+        if (DEBUG){ iinfo(1); };
+    }
+}
 
 //  スイッチ操作のISR  スイッチクラスのラッパ 
 void isr_warpper_meas_sw(void){    
+    if (PROFILE_ISR_ON_D12){ digitalWrite(D12,HIGH); }
+    PROFILE_SCOPE(PROF_ISR_SWITCH);
     meas_sw.read_switch_status();
-    Serial.print("!");
+    isr_events.post(EVENT_SWITCH);
+    low_power.wake();
+    if (PROFILE_ISR_ON_D12){ digitalWrite(D12,LOW); }
 }
 
-// 液面表示アップデート用 ISR
+// 液面表示アップデート用 ISR  表示はメインループで行う
 void isr_disp_update(void){  
-    lcd_display.showLevel();
-    Serial.print("@"); // means 'measureing'
-    if (DEBUG){ iinfo(1); };
+    if (PROFILE_ISR_ON_D12){ digitalWrite(D12,HIGH); }
+    PROFILE_SCOPE(PROF_ISR_DISP_UPDATE);
+    isr_events.post(EVENT_DISP_UPDATE);
+    if (PROFILE_ISR_ON_D12){ digitalWrite(D12,LOW); }
 }
 
-// 毎秒のタイマー ISR
-void isr_tick_tock(void){  
-    if (DEBUG){
-        iinfo(1); 
-    };
+//  DWTのサイクルカウンタ（64MHzで約67秒で一周する. 区間の計測には十分）
+uint32_t dwt_cycles(void){
+    return DWT->CYCCNT;
+}
 
-    //  タイマ設定が0ならカウントしない：タイマ計測はしない
-    if (level_meter.getTimerPeriod() == 0){
+//  今のスタックポインタとヒープの先頭  ISRからも呼ばれる
+void probe_memory(uint32_t& stack, uint32_t& heap){
+    stack = __get_MSP();
+    heap = (uint32_t)(uintptr_t)_sbrk(0);
+}
+
+/*!
+    @brief  デバグ用シリアルからのコマンドを処理する
+            'p':プロファイルを出力, 'r':プロファイルをクリア, 'i':I2Cバスの使用量を出力,
+            'w':起きていた時間と眠っていた時間を出力
+*/
+void check_debug_command(void){
+    if (Serial.available() <= 0){
         return;
     }
+    switch (Serial.read()){
+        case 'p':
+            dump_profile();
+            break;
+        case 'r':
+            profiler.reset();
+            Serial.println("profile cleared");
+            break;
+        case 'i':
+            dump_i2c();
+            break;
+        case 'w':
+            dump_power();
+            break;
+        default:
+            break;
+    }
+}
 
-    if (level_meter.incTimeElasped()) {
-        f_timer_timeup = true;
-    };
+/*!
+    @brief  区間ごとの実行サイクル数と、スタック・ヒープの最大使用位置をシリアルに出力する
+*/
+void dump_profile(void){
+    Serial.println("section: count min avg max [cycles]");
+    for (uint8_t i = 0; i < PROF_SECTION_NUM; i++){
+        const ProfileStats& stats = profiler.getStats(i);
+        if (stats.count == 0){
+            continue;
+        }
+        Serial.print(profile_name(i)); Serial.print(": ");
+        Serial.print(stats.count); Serial.print(" ");
+        Serial.print(stats.min); Serial.print(" ");
+        Serial.print(profiler.getAverage(i)); Serial.print(" ");
+        Serial.println(stats.max);
+    }
+    Serial.print("Stack Low:"); Serial.println(profiler.getStackLow(), HEX);
+    Serial.print("Heap High:"); Serial.println(profiler.getHeapHigh(), HEX);
+    Serial.print("SRAM Free(min):"); Serial.println(profiler.getStackLow() - profiler.getHeapHigh(), DEC);
+}
+
+/*!
+    @brief  I2Cバスのクロックと、デバイスごとの転送回数・バイト数・エラー数・占有時間をシリアルに出力する
+*/
+void dump_i2c(void){
+    i2c_bus.dump(Serial);
+}
+
+/*!
+    @brief  起きていた時間の割合（CPUの負荷）と、WFI・STOPモードで眠っていた時間をシリアルに出力する
+*/
+void dump_power(void){
+    low_power.dump(Serial);
 }
 
 // メモリ利用状況の確認
 void iinfo(uint8_t mode) {
     char top = 't';
-    uint32_t adr = (uint32_t)&top;
+    uintptr_t adr = (uintptr_t)&top;
     uint8_t* tmp = (uint8_t*)malloc(1);
-    uint32_t hadr = (uint32_t)tmp;
+    uintptr_t hadr = (uintptr_t)tmp;
     free(tmp);
 
     if (mode==0){
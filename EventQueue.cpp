@@ -0,0 +1,51 @@
+/**************************************************************************/
+/*!
+    @file     EventQueue.cpp
+    @author   Masa
+
+        ISR to main-loop event queue
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "EventQueue.h"
+
+static_assert((EVENT_QUEUE_SIZE & (EVENT_QUEUE_SIZE - 1)) == 0, "EVENT_QUEUE_SIZE must be a power of 2");
+
+/*!
+    @brief  イベントをキューに入れる. ISRからも呼べる
+            優先度の違う割り込みが重なっても壊れないよう、書き込みの間だけ割り込みを止める
+    @param event イベント
+    @return True:入れた, False:キューが一杯で捨てた
+*/
+boolean EventQueue::post(uint8_t event){
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  const uint8_t next = (head + 1) & (EVENT_QUEUE_SIZE - 1);
+  const boolean f_posted = (next != tail);
+  if (f_posted){
+    queue[head] = event;
+    head = next;
+  } else {
+    dropped++;
+  }
+
+  __set_PRIMASK(primask);
+  return f_posted;
+}
+
+/*!
+    @brief  イベントをキューから1つ取り出す. メインループから呼ぶこと
+    @param event 取り出したイベント
+    @return True:取り出した, False:キューが空
+*/
+boolean EventQueue::take(uint8_t& event){
+  if (tail == head){
+    return false;
+  }
+  event = queue[tail];
+  tail = (tail + 1) & (EVENT_QUEUE_SIZE - 1);
+  return true;
+}
@@ -0,0 +1,35 @@
+#ifndef _EVENTQUEUE_H_
+#define _EVENTQUEUE_H_
+
+#include <Arduino.h>
+
+//  イベントキューの大きさ（2のべき乗）
+constexpr uint8_t EVENT_QUEUE_SIZE = 16;
+
+/*!
+    @brief  割り込みからメインループへイベントを渡すキュー
+            post() はISRから呼べる（割り込み禁止は数命令の間だけ）. take() はメインループから呼ぶ
+*/
+class EventQueue {
+
+  public:
+    EventQueue(void){};
+
+    boolean post(uint8_t event);
+    boolean take(uint8_t& event);
+
+    /*!
+    @brief  キューが一杯で捨てたイベントの数
+    */
+    uint32_t getDropped(void) const {
+      return dropped;
+    };
+
+  private:
+    volatile uint8_t queue[EVENT_QUEUE_SIZE];
+    volatile uint8_t head = 0;
+    volatile uint8_t tail = 0;
+    volatile uint32_t dropped = 0;
+};
+
+#endif // _EVENTQUEUE_H_
@@ -0,0 +1,252 @@
+/**************************************************************************/
+/*!
+    @file     HistoryLog.cpp
+    @author   Masa
+
+        Append-only circular measurement log on FRAM
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "HistoryLog.h"
+
+namespace{
+    //  ヘッダの識別子 "HL"
+    constexpr uint16_t HEADER_MAGIC = 0x4C48;
+    //  スロットの予備バイトの値
+    constexpr uint8_t SLOT_FILL = 0xA5;
+
+    void put16(uint8_t* p, uint16_t value){
+        p[0] = value & 0xFF;
+        p[1] = value >> 8;
+    }
+
+    uint16_t get16(const uint8_t* p){
+        return p[0] | ((uint16_t)p[1] << 8);
+    }
+}
+
+/*!
+    @brief  ログの領域を設定し、ヘッダを読み込んで書きかけの記録を取り込む
+            ヘッダが壊れている、または領域の大きさが変わった時は空のログにする
+    @param base_addr 領域の先頭アドレス
+    @param area_size 領域の大きさ[byte]
+    @return 保存されている記録の数
+*/
+uint16_t HistoryLog::begin(uint16_t base_addr, uint16_t area_size){
+  base = base_addr;
+  capacity = (area_size - HISTORY_HEADER_SIZE) / HISTORY_SLOT_SIZE;
+
+  if (!read_header()){
+    clear();
+    return 0;
+  }
+
+  //  ヘッダ更新前に書かれたスロットを順番に取り込む
+  uint16_t recovered = 0;
+  HistoryRecord record;
+  while (recovered < capacity && read_slot(head, record) && record.seq == next_seq){
+    head = (head + 1) % capacity;
+    next_seq++;
+    if (count < capacity){
+      count++;
+    }
+    if (unsent < count){
+      unsent++;
+    }
+    recovered++;
+  }
+  if (recovered != 0){
+    write_header();
+  }
+
+  return count;
+}
+
+/*!
+    @brief  ログを空にする
+*/
+void HistoryLog::clear(void){
+  head = 0;
+  count = 0;
+  unsent = 0;
+  next_seq = 0;
+  //  空にする前の記録が seq 0 から残っていても、続きとして取り込まない
+  invalidate_slot(0);
+  write_header();
+}
+
+/*!
+    @brief  記録を1件追記する. 一杯の時は一番古い記録を上書きする
+    @param record 記録（seqはここで付ける）
+    @param delivered True:この記録はゲートウエイに送れた
+                     未送信の記録が残っている時は、送れていても未送信として扱う
+                     （順番に送り直すため. 受け側はseqで重複を除ける）
+    @return True:書き込めた
+*/
+bool HistoryLog::append(HistoryRecord& record, bool delivered){
+  if (capacity == 0){
+    return false;
+  }
+
+  record.seq = next_seq;
+  //  一杯になるまでは次のスロットに前のログの記録が残っているかもしれない
+  //  先に無効にしておき、電源が切れても起動時に続きとして取り込まないようにする
+  const uint16_t next = (head + 1) % capacity;
+  if (count + 1 < capacity && !invalidate_slot(next)){
+    return false;
+  }
+  if (!write_slot(head, record)){
+    return false;
+  }
+
+  head = (head + 1) % capacity;
+  next_seq++;
+  if (count < capacity){
+    count++;
+  }
+  if (!delivered || unsent != 0){
+    unsent++;
+  }
+  //  未送信の記録が上書きされた分は失われる
+  if (unsent > count){
+    unsent = count;
+  }
+
+  return write_header();
+}
+
+/*!
+    @brief  未送信の記録を古い方から読み出す
+    @param offset 一番古い未送信の記録からの位置  0 -- getUnsent()-1
+    @param record 読み出し先
+    @return True:読めた, False:範囲外またはスロットが壊れている
+*/
+bool HistoryLog::readUnsent(uint16_t offset, HistoryRecord& record){
+  if (offset >= unsent){
+    return false;
+  }
+  return read_slot((head + capacity - unsent + offset) % capacity, record);
+}
+
+/*!
+    @brief  最近の記録を新しい方から読み出す
+    @param age 0:最新, 1:その前 ... getCount()-1
+    @param record 読み出し先
+    @return True:読めた, False:範囲外またはスロットが壊れている
+*/
+bool HistoryLog::readRecent(uint16_t age, HistoryRecord& record){
+  if (age >= count){
+    return false;
+  }
+  return read_slot((head + capacity - 1 - age) % capacity, record);
+}
+
+/*!
+    @brief  古い方から num 件の未送信の記録を送信済みにする
+    @param num 件数
+*/
+void HistoryLog::acknowledge(uint16_t num){
+  if (num == 0){
+    return;
+  }
+  unsent = (num < unsent) ? unsent - num : 0;
+  write_header();
+}
+
+/*!
+    @brief  スロットのアドレス (private)
+*/
+uint16_t HistoryLog::slot_addr(uint16_t slot) const {
+  return base + HISTORY_HEADER_SIZE + slot * HISTORY_SLOT_SIZE;
+}
+
+/*!
+    @brief  スロットに記録を書き込む (private)
+*/
+bool HistoryLog::write_slot(uint16_t slot, const HistoryRecord& record){
+  uint8_t raw[HISTORY_SLOT_SIZE];
+
+  telemetry_serialize_history(record, raw);
+  raw[TELEMETRY_HISTORY_SIZE] = SLOT_FILL;
+  put16(&raw[HISTORY_SLOT_SIZE - 2], telemetry_crc16(raw, HISTORY_SLOT_SIZE - 2));
+
+  return storage->write(slot_addr(slot), raw, sizeof(raw));
+}
+
+/*!
+    @brief  スロットを無効にする（CRCが合わない内容を書く） (private)
+*/
+bool HistoryLog::invalidate_slot(uint16_t slot){
+  uint8_t raw[HISTORY_SLOT_SIZE] = {};
+
+  put16(&raw[HISTORY_SLOT_SIZE - 2], ~telemetry_crc16(raw, HISTORY_SLOT_SIZE - 2));
+
+  return storage->write(slot_addr(slot), raw, sizeof(raw));
+}
+
+/*!
+    @brief  スロットから記録を読み込み、CRCを確認する (private)
+*/
+bool HistoryLog::read_slot(uint16_t slot, HistoryRecord& record){
+  uint8_t raw[HISTORY_SLOT_SIZE];
+
+  if (!storage->read(slot_addr(slot), raw, sizeof(raw))){
+    return false;
+  }
+  if (get16(&raw[HISTORY_SLOT_SIZE - 2]) != telemetry_crc16(raw, HISTORY_SLOT_SIZE - 2)){
+    return false;
+  }
+
+  telemetry_deserialize_history(raw, record);
+  return true;
+}
+
+/*!
+    @brief  ヘッダを書き込む (private)
+*/
+bool HistoryLog::write_header(void){
+  uint8_t raw[HISTORY_HEADER_SIZE] = {};
+
+  put16(&raw[0], HEADER_MAGIC);
+  put16(&raw[2], head);
+  put16(&raw[4], count);
+  put16(&raw[6], unsent);
+  put16(&raw[8], next_seq);
+  put16(&raw[10], capacity);
+  put16(&raw[HISTORY_HEADER_SIZE - 2], telemetry_crc16(raw, HISTORY_HEADER_SIZE - 2));
+
+  return storage->write(base, raw, sizeof(raw));
+}
+
+/*!
+    @brief  ヘッダを読み込み、内容を確認する (private)
+    @return True:正しいヘッダ
+*/
+bool HistoryLog::read_header(void){
+  uint8_t raw[HISTORY_HEADER_SIZE];
+
+  if (!storage->read(base, raw, sizeof(raw))){
+    return false;
+  }
+  if (get16(&raw[HISTORY_HEADER_SIZE - 2]) != telemetry_crc16(raw, HISTORY_HEADER_SIZE - 2)){
+    return false;
+  }
+  if (get16(&raw[0]) != HEADER_MAGIC || get16(&raw[10]) != capacity){
+    return false;
+  }
+
+  const uint16_t stored_head = get16(&raw[2]);
+  const uint16_t stored_count = get16(&raw[4]);
+  const uint16_t stored_unsent = get16(&raw[6]);
+  if (stored_head >= capacity || stored_count > capacity || stored_unsent > stored_count){
+    return false;
+  }
+
+  head = stored_head;
+  count = stored_count;
+  unsent = stored_unsent;
+  next_seq = get16(&raw[8]);
+  return true;
+}
@@ -0,0 +1,84 @@
+/**************************************************************************/
+/*!
+    @file     HistoryLog.h
+
+    FRAMに計測結果を追記していく循環ログ
+    ゲートウエイに送れなかった記録を残しておき、後でまとめて送る
+
+    領域の配置（先頭から）:
+        ヘッダ      16byte  magic, head, count, unsent, next_seq, crc
+        スロット    16byte × 容量  HistoryRecord(13byte) + 予備(1byte) + crc(2byte)
+
+    追記はスロット1つとヘッダの書き込みだけ（O(1)）.
+    スロットを書いた後、ヘッダを書く前に電源が切れた場合は
+    起動時に begin() がヘッダの次のスロットから続きを探して取り込む.
+    一杯になるまでは次のスロットを先に無効にしておく（前のログの記録を続きと間違えないため）.
+*/
+/**************************************************************************/
+
+#ifndef _HISTORYLOG_H_
+#define _HISTORYLOG_H_
+
+#include "NvStorage.h"
+#include "TelemetryFrame.h"
+
+//  ヘッダ、スロットの大きさ[byte]
+constexpr uint16_t HISTORY_HEADER_SIZE = 16;
+constexpr uint16_t HISTORY_SLOT_SIZE = 16;
+
+class HistoryLog {
+
+  public:
+    HistoryLog(NvStorage* storage) : storage(storage){};
+
+    uint16_t begin(uint16_t base_addr, uint16_t area_size);
+    void clear(void);
+
+    bool append(HistoryRecord& record, bool delivered);
+
+    bool readUnsent(uint16_t offset, HistoryRecord& record);
+    bool readRecent(uint16_t age, HistoryRecord& record);
+    void acknowledge(uint16_t num);
+
+    /*!
+    @brief  保存できる記録の数
+    */
+    uint16_t getCapacity(void) const {
+      return capacity;
+    };
+
+    /*!
+    @brief  保存されている記録の数
+    */
+    uint16_t getCount(void) const {
+      return count;
+    };
+
+    /*!
+    @brief  まだ送れていない記録の数
+    */
+    uint16_t getUnsent(void) const {
+      return unsent;
+    };
+
+  private:
+    NvStorage* storage;
+
+    uint16_t base = 0;
+    uint16_t capacity = 0;
+    //  次に書き込むスロット
+    uint16_t head = 0;
+    uint16_t count = 0;
+    uint16_t unsent = 0;
+    //  次の記録に付けるシーケンス番号
+    uint16_t next_seq = 0;
+
+    uint16_t slot_addr(uint16_t slot) const;
+    bool write_slot(uint16_t slot, const HistoryRecord& record);
+    bool read_slot(uint16_t slot, HistoryRecord& record);
+    bool invalidate_slot(uint16_t slot);
+    bool write_header(void);
+    bool read_header(void);
+};
+
+#endif // _HISTORYLOG_H_
@@ -0,0 +1,453 @@
+/**************************************************************************/
+/*!
+    @file     I2cBus.cpp
+    @author   Masa
+
+        Shared I2C bus manager: fixed bus clock, asynchronous request queue with
+        write coalescing, and per-device counters
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "I2cBus.h"
+
+#include <string.h>
+
+static_assert((I2C_BUS_QUEUE_SIZE & (I2C_BUS_QUEUE_SIZE - 1)) == 0, "I2C_BUS_QUEUE_SIZE must be a power of 2");
+
+namespace{
+    //  バスの最大クロック  STM32F3 の I2C は FM+ まで
+    constexpr uint32_t BUS_CLOCK_MAX = I2C_CLOCK_FAST_PLUS;
+
+    //  1回の転送のバイト数以外のビット数  スタート・ストップと、アドレス1byte（9bit）
+    constexpr uint32_t FRAME_OVERHEAD_BITS = 2 + 9;
+
+    constexpr uint8_t QUEUE_MASK = I2C_BUS_QUEUE_SIZE - 1;
+
+    //  同期転送の結果
+    struct SyncResult {
+        volatile bool f_done;
+        bool f_success;
+    };
+}
+
+/*!
+    @brief  デバイスを登録する. バスのクロックはデバイスの最大クロックを超えないようにする
+    @param address I2Cアドレス
+    @param max_clock デバイスが対応する最大クロック [Hz]
+    @param name 表示用の名前
+    @return デバイス番号, 登録できなければ -1
+*/
+int8_t I2cBus::addDevice(uint8_t address, uint32_t max_clock, const char* name){
+    for (uint8_t i = 0; i < device_num; i++){
+        if (devices[i].address == address){
+            return i;
+        }
+    }
+    if (device_num >= I2C_BUS_DEVICE_MAX){
+        return -1;
+    }
+
+    Device& device = devices[device_num];
+    device.address = address;
+    device.max_clock = max_clock;
+    device.name = name;
+    device.stats = {};
+    return device_num++;
+}
+
+/*!
+    @brief  バスのクロックを決めて設定し、割り込み転送を始める. すべてのデバイスの初期化の後に呼ぶ
+            （ライブラリの begin() が Wire.begin() で 100kHz と割り込みの設定を戻すため）
+*/
+void I2cBus::start(void){
+    uint32_t new_clock = BUS_CLOCK_MAX;
+
+    for (uint8_t i = 0; i < device_num; i++){
+        if (devices[i].max_clock < new_clock){
+            new_clock = devices[i].max_clock;
+        }
+    }
+    flush();
+    clock = new_clock;
+    port->start(clock);
+}
+
+/*!
+    @brief  デバイスが応答するか確かめる（キューの転送を終えてから）
+*/
+bool I2cBus::probe(int8_t device){
+    if (!is_valid(device)){
+        return false;
+    }
+    flush();
+
+    const bool f_success = port->probe(devices[device].address);
+    count(device, 0, f_success);
+    return f_success;
+}
+
+/*!
+    @brief  登録していないアドレスにデバイスが応答するか確かめる（キューの転送を終えてから）
+            つながっているかわからないデバイス（増設の計測チャネル）を登録する前に使う
+*/
+bool I2cBus::probeAddress(uint8_t address){
+    flush();
+    return port->probe(address);
+}
+
+/*!
+    @brief  書き込む（ストップで終わる）. 終わるまで待つ
+    @param device デバイス番号
+    @param data 書き込むデータ
+    @param length バイト数
+    @return True:ACKされた
+*/
+bool I2cBus::write(int8_t device, const uint8_t* data, size_t length){
+    return transfer(device, data, length, nullptr, 0);
+}
+
+/*!
+    @brief  読む. 終わるまで待つ
+    @param device デバイス番号
+    @param data 読んだデータ
+    @param length バイト数
+    @return True:length バイト読めた
+*/
+bool I2cBus::read(int8_t device, uint8_t* data, size_t length){
+    return transfer(device, nullptr, 0, data, length);
+}
+
+/*!
+    @brief  書き込んでからリピートスタートで読む（レジスタの読み出し）. 終わるまで待つ
+    @param device デバイス番号
+    @param data 書き込むデータ（レジスタ番号など）
+    @param length 書き込むバイト数
+    @param result 読んだデータ
+    @param result_length 読むバイト数
+    @return True:書き込みがACKされ、result_length バイト読めた
+*/
+bool I2cBus::writeRead(int8_t device, const uint8_t* data, size_t length, uint8_t* result, size_t result_length){
+    return transfer(device, data, length, result, result_length);
+}
+
+/*!
+    @brief  書き込みをキューに入れて、待たずに戻る. メインループから呼ぶ（キューが一杯なら空くまで待つ）
+    @param device デバイス番号
+    @param data 書き込むデータ  キューにコピーする
+    @param length バイト数  I2C_BUS_DATA_MAX まで
+    @param merge まだ始まっていない書き込みとのまとめ方
+    @param callback 終わった時に service() から呼ぶ関数  nullptr なら呼ばない
+    @param context callback に渡すもの
+    @return True:キューに入れた, False:引数が正しくない
+*/
+bool I2cBus::submit(int8_t device, const uint8_t* data, size_t length, I2cMerge merge, I2cCallback callback, void* context){
+    Request request;
+
+    if (!make_request(request, device, data, length, nullptr, 0, callback, context)){
+        return false;
+    }
+    request.merge = merge;
+    enqueue_wait(request);
+    return true;
+}
+
+/*!
+    @brief  書き込んでから読む要求をキューに入れて、待たずに戻る. メインループから呼ぶ
+    @param result 読んだデータを入れる先  callback が呼ばれるまで有効にしておくこと
+    @return True:キューに入れた, False:引数が正しくない
+*/
+bool I2cBus::submitRead(int8_t device, const uint8_t* data, size_t length, uint8_t* result, size_t result_length,
+                        I2cCallback callback, void* context){
+    Request request;
+
+    if (!make_request(request, device, data, length, result, result_length, callback, context)){
+        return false;
+    }
+    enqueue_wait(request);
+    return true;
+}
+
+/*!
+    @brief  書き込みをキューに入れる. ISRからも呼べる. 結果は数えるだけで返さない
+    @return True:入れた（まとめた）, False:キューが一杯もしくは引数が正しくなくて捨てた
+*/
+bool I2cBus::post(int8_t device, const uint8_t* data, size_t length, I2cMerge merge){
+    Request request;
+
+    if (!make_request(request, device, data, length, nullptr, 0, nullptr, nullptr)){
+        dropped++;
+        return false;
+    }
+    request.merge = merge;
+    if (!enqueue(request)){
+        dropped++;
+        return false;
+    }
+    kick();
+    return true;
+}
+
+/*!
+    @brief  完了した要求を片付けて callback を呼ぶ. メインループから呼ぶこと
+            callback の中から転送を要求してもよい
+*/
+void I2cBus::service(void){
+    //  続きを待っていた書き込みも送る
+    kick(true);
+
+    while (tail != issued){
+        const Request& request = queue[tail];
+        const I2cCallback callback = request.callback;
+        void* const context = request.context;
+        const bool f_success = request.f_success;
+
+        count(request.device, request.length + request.result_length, f_success);
+        tail = (tail + 1) & QUEUE_MASK;
+
+        if (callback){
+            callback(context, f_success);
+        }
+    }
+}
+
+/*!
+    @brief  キューの要求がすべて終わるまで待つ
+*/
+void I2cBus::flush(void){
+    const uint32_t start_time = micros();
+
+    service();
+    while (tail != head){
+        port->idle();
+        service();
+    }
+    wait_time += micros() - start_time;
+}
+
+/*!
+    @brief  デバイスごとの使用量を出力する
+*/
+void I2cBus::dump(Print& out) const {
+    out.print("I2C clock:"); out.print(clock);
+    out.print(" merged:"); out.print(merged);
+    out.print(" dropped:"); out.print(dropped);
+    out.print(" wait[us]:"); out.println(wait_time);
+    out.println("device: addr transactions bytes errors time[us]");
+    for (uint8_t i = 0; i < device_num; i++){
+        const Device& device = devices[i];
+        out.print(device.name); out.print(": ");
+        out.print(device.address, HEX); out.print(" ");
+        out.print(device.stats.transactions); out.print(" ");
+        out.print(device.stats.bytes); out.print(" ");
+        out.print(device.stats.errors); out.print(" ");
+        out.println(device.stats.bus_time);
+    }
+}
+
+/*!
+    @brief  登録したデバイス番号か (private)
+*/
+bool I2cBus::is_valid(int8_t device) const {
+    return 0 <= device && device < device_num;
+}
+
+/*!
+    @brief  要求を作る (private)
+    @return False:デバイス番号か長さが正しくない
+*/
+bool I2cBus::make_request(Request& request, int8_t device, const uint8_t* data, size_t length,
+                          uint8_t* result, size_t result_length, I2cCallback callback, void* context) const {
+    if (!is_valid(device) || length > I2C_BUS_DATA_MAX || result_length > UINT8_MAX
+            || (length == 0 && result_length == 0)){
+        return false;
+    }
+    request.device = device;
+    request.merge = I2C_MERGE_NONE;
+    request.length = length;
+    request.result_length = result_length;
+    memcpy(request.data, data, length);
+    request.result = result;
+    request.callback = callback;
+    request.context = context;
+    request.f_success = false;
+    return true;
+}
+
+/*!
+    @brief  要求をキューに入れる. まとめられる書き込みは最後の未着手の要求にまとめる (private)
+    @return False:キューが一杯
+*/
+bool I2cBus::enqueue(const Request& request){
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    //  最後の要求がまだ始まっていなければ、まとめられるか調べる
+    const uint8_t last_index = (head - 1) & QUEUE_MASK;
+    const bool f_pending = (head != issued) && !(f_busy && last_index == issued);
+    if (f_pending && request.result_length == 0){
+        Request& last = queue[last_index];
+        const bool f_same = (last.device == request.device) && (last.result_length == 0) && (last.callback == nullptr);
+
+        if (f_same && last.merge == I2C_MERGE_CONTINUE && last.length + request.length <= I2C_BUS_DATA_MAX){
+            memcpy(&last.data[last.length], request.data, request.length);
+            last.length += request.length;
+            last.merge = request.merge;
+            last.callback = request.callback;
+            last.context = request.context;
+            merged++;
+            __set_PRIMASK(primask);
+            return true;
+        }
+        if (f_same && last.merge == I2C_MERGE_REPLACE && request.merge == I2C_MERGE_REPLACE
+                && last.length == request.length && last.data[0] == request.data[0]){
+            memcpy(last.data, request.data, request.length);
+            last.callback = request.callback;
+            last.context = request.context;
+            merged++;
+            __set_PRIMASK(primask);
+            return true;
+        }
+    }
+
+    const uint8_t next = (head + 1) & QUEUE_MASK;
+    const bool f_queued = (next != tail);
+    if (f_queued){
+        queue[head] = request;
+        head = next;
+    }
+
+    __set_PRIMASK(primask);
+    return f_queued;
+}
+
+/*!
+    @brief  要求をキューに入れて転送を始める. 一杯なら空くまで待つ (private)
+*/
+void I2cBus::enqueue_wait(const Request& request){
+    if (!enqueue(request)){
+        const uint32_t start_time = micros();
+        //  完了して callback 待ちの要求で一杯の時は、片付ければ待たずに入る
+        service();
+        while (!enqueue(request)){
+            port->idle();
+            service();
+        }
+        wait_time += micros() - start_time;
+    }
+    kick();
+}
+
+/*!
+    @brief  要求を入れて、終わるまで待つ (private)  先に入っている要求もすべて終わる
+*/
+bool I2cBus::transfer(int8_t device, const uint8_t* data, size_t length, uint8_t* result, size_t result_length){
+    SyncResult sync = {false, false};
+    Request request;
+
+    if (!make_request(request, device, data, length, result, result_length, on_sync_complete, &sync)){
+        return false;
+    }
+    enqueue_wait(request);
+
+    const uint32_t start_time = micros();
+    service();
+    while (!sync.f_done){
+        port->idle();
+        service();
+    }
+    wait_time += micros() - start_time;
+    return sync.f_success;
+}
+
+/*!
+    @brief  転送中でなければ、次の要求の転送を始める (private)  ISRからも呼ばれる
+    @param f_force False ならキューの最後の I2C_MERGE_CONTINUE の書き込みは始めない（続きをまとめるため）
+*/
+void I2cBus::kick(bool f_force){
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    const bool f_hold = !f_force && (((issued + 1) & QUEUE_MASK) == head) && (queue[issued].merge == I2C_MERGE_CONTINUE);
+    const bool f_start = !f_busy && (issued != head) && !f_hold;
+    if (f_start){
+        f_busy = true;
+    }
+    __set_PRIMASK(primask);
+
+    //  転送は割り込みを許可して始める（start() の前は Wire が転送の終わりを割り込みで知るため）
+    if (f_start){
+        start_current();
+    }
+}
+
+/*!
+    @brief  issued の要求の転送を始める (private)
+*/
+void I2cBus::start_current(void){
+    Request& request = queue[issued];
+    const uint8_t address = devices[request.device].address;
+
+    if (request.length > 0){
+        f_reading = false;
+        port->startWrite(address, request.data, request.length, request.result_length == 0);
+    } else {
+        f_reading = true;
+        port->startRead(address, request.result, request.result_length);
+    }
+}
+
+/*!
+    @brief  ポートの転送が終わった (private)  ISRから呼ばれる
+            書き込みの後に読み出しがあれば続けて始め、なければ要求を完了して次を始める
+*/
+void I2cBus::complete(bool f_success){
+    //  転送していない時の完了は数えない（キューを進めない）
+    if (!f_busy){
+        return;
+    }
+    Request& request = queue[issued];
+
+    if (f_success && !f_reading && request.result_length > 0){
+        f_reading = true;
+        port->startRead(devices[request.device].address, request.result, request.result_length);
+        return;
+    }
+    if (!f_success && request.result){
+        memset(request.result, 0, request.result_length);
+    }
+    request.f_success = f_success;
+    issued = (issued + 1) & QUEUE_MASK;
+    f_busy = false;
+    kick();
+}
+
+/*!
+    @brief  1回の転送を数える (private)
+*/
+void I2cBus::count(int8_t device, size_t bytes, bool f_success){
+    I2cDeviceStats& stats = devices[device].stats;
+
+    stats.transactions++;
+    stats.bytes += bytes;
+    if (!f_success){
+        stats.errors++;
+    }
+    stats.bus_time += (FRAME_OVERHEAD_BITS + 9 * bytes) * 1000000 / clock;
+}
+
+/*!
+    @brief  I2cPort からの完了通知 (private)
+*/
+void I2cBus::on_port_complete(void* context, bool f_success){
+    static_cast<I2cBus*>(context)->complete(f_success);
+}
+
+/*!
+    @brief  同期転送の完了 (private)
+*/
+void I2cBus::on_sync_complete(void* context, bool f_success){
+    SyncResult* sync = static_cast<SyncResult*>(context);
+    sync->f_success = f_success;
+    sync->f_done = true;
+}
@@ -0,0 +1,203 @@
+/**************************************************************************/
+/*!
+    @file     I2cBus.h
+
+    共有I2Cバスの管理と非同期転送
+        バスのクロックはここだけが決める. つながっているデバイスの最大クロックのうち最も遅いもの
+        （全デバイスが FM+ 対応なら 1MHz, そうでなければ 400kHz）に、初期化の後で1回だけ設定する.
+        ドライバはクロックを変えない.
+
+        すべての転送は要求のキューに入れ、I2cPort が割り込みで順に実行する（順序はキューの順）.
+            submit() / submitRead()  メインループから. 待たずに戻り、終わると callback を呼ぶ
+            post()                   ISRからも呼べる. キューが一杯なら捨てる
+            write() / read() / writeRead()  終わるまで待つ（先に入っている要求もすべて終わる）
+        完了した要求の callback は service() がメインループで呼ぶ（ISRの中では呼ばない）.
+        まだ始まっていない同じデバイスへの書き込みはまとめる（I2cMerge）.
+        キューの最後の I2C_MERGE_CONTINUE の書き込みは、続きを待って service() まで始めない.
+        Wire を直接使うライブラリを呼ぶ前には flush() で転送を終えておくこと.
+        デバイスごとに転送回数・バイト数・エラー数・バスの占有時間を数える.
+*/
+/**************************************************************************/
+
+#ifndef _I2CBUS_H_
+#define _I2CBUS_H_
+
+#include <Arduino.h>
+#include "I2cPort.h"
+
+//  I2Cのクロック [Hz]
+constexpr uint32_t I2C_CLOCK_STANDARD = 100000;
+constexpr uint32_t I2C_CLOCK_FAST = 400000;
+constexpr uint32_t I2C_CLOCK_FAST_PLUS = 1000000;
+
+//  登録できるデバイスの数  計測チャネル1組（ADC・電流源DAC・PIO）ごとに3つ
+constexpr uint8_t I2C_BUS_DEVICE_MAX = 12;
+//  キューに入れられる要求の数（2のべき乗）と、1つの要求で書き込める最大バイト数
+//  （LCDのカーソル移動2byte + 1行分の表示データ17byte がまとめて入る大きさ）
+constexpr uint8_t I2C_BUS_QUEUE_SIZE = 8;
+constexpr uint8_t I2C_BUS_DATA_MAX = 20;
+
+//  要求の完了通知  メインループ（service()）から呼ばれる
+typedef void (*I2cCallback)(void* context, bool f_success);
+
+/*!
+    @brief  まだ始まっていない書き込みのまとめ方
+*/
+enum I2cMerge : uint8_t {
+    I2C_MERGE_NONE,     //  まとめない
+    I2C_MERGE_REPLACE,  //  同じデバイス・同じ先頭バイト（コマンド・レジスタ）・同じ長さの書き込みを上書きする（DACの設定値など）
+    I2C_MERGE_CONTINUE  //  次の同じデバイスへの書き込みを後ろにつなげてよい（LCDのCo=1のコマンドなど）
+};
+
+/*!
+    @brief  デバイスごとのバスの使用量
+*/
+struct I2cDeviceStats {
+    uint32_t transactions;
+    uint32_t bytes;
+    uint32_t errors;
+    //  バスの占有時間の見積り [us]  （アドレスとデータのビット数 / クロック）
+    uint32_t bus_time;
+};
+
+class I2cBus {
+
+  public:
+    I2cBus(I2cPort* port) : port(port){
+      port->setHandler(on_port_complete, this);
+    };
+
+    int8_t addDevice(uint8_t address, uint32_t max_clock, const char* name);
+    void start(void);
+
+    bool probe(int8_t device);
+    bool probeAddress(uint8_t address);
+    bool write(int8_t device, const uint8_t* data, size_t length);
+    bool read(int8_t device, uint8_t* data, size_t length);
+    bool writeRead(int8_t device, const uint8_t* data, size_t length, uint8_t* result, size_t result_length);
+
+    bool submit(int8_t device, const uint8_t* data, size_t length, I2cMerge merge = I2C_MERGE_NONE,
+                I2cCallback callback = nullptr, void* context = nullptr);
+    bool submitRead(int8_t device, const uint8_t* data, size_t length, uint8_t* result, size_t result_length,
+                    I2cCallback callback, void* context);
+    bool post(int8_t device, const uint8_t* data, size_t length, I2cMerge merge = I2C_MERGE_NONE);
+
+    void service(void);
+    void flush(void);
+
+    void dump(Print& out) const;
+
+    /*!
+    @brief  バスのクロック [Hz]  start() の前は Wire の既定値
+    */
+    uint32_t getClock(void) const {
+      return clock;
+    };
+
+    /*!
+    @brief  登録したデバイスの数
+    */
+    uint8_t getDeviceCount(void) const {
+      return device_num;
+    };
+
+    /*!
+    @brief  デバイスのI2Cアドレス
+    */
+    uint8_t getAddress(int8_t device) const {
+      return devices[device].address;
+    };
+
+    /*!
+    @brief  デバイスのバスの使用量
+    */
+    const I2cDeviceStats& getStats(int8_t device) const {
+      return devices[device].stats;
+    };
+
+    /*!
+    @brief  キューが空か（転送中・未着手・callback 待ちの要求がない）
+    */
+    bool isIdle(void) const {
+      return head == tail;
+    };
+
+    /*!
+    @brief  キューが一杯で捨てた post() の数
+    */
+    uint32_t getDropped(void) const {
+      return dropped;
+    };
+
+    /*!
+    @brief  前の要求にまとめた書き込みの数
+    */
+    uint32_t getMerged(void) const {
+      return merged;
+    };
+
+    /*!
+    @brief  CPUが転送の完了やキューの空きを待った時間の合計 [us]
+    */
+    uint32_t getWaitTime(void) const {
+      return wait_time;
+    };
+
+  private:
+    struct Device {
+      uint8_t address;
+      uint32_t max_clock;
+      const char* name;
+      I2cDeviceStats stats;
+    };
+
+    //  転送の要求  書き込み（length > 0）の後に読み出す（result_length > 0）
+    struct Request {
+      int8_t device;
+      uint8_t merge;
+      uint8_t length;
+      uint8_t result_length;
+      uint8_t data[I2C_BUS_DATA_MAX];
+      uint8_t* result;
+      I2cCallback callback;
+      void* context;
+      bool f_success;
+    };
+
+    I2cPort* port;
+    uint32_t clock = I2C_CLOCK_STANDARD;
+
+    Device devices[I2C_BUS_DEVICE_MAX] = {};
+    uint8_t device_num = 0;
+
+    //  tail <= issued <= head  tail〜issued は完了して callback 待ち, issued〜head は転送中と未着手
+    Request queue[I2C_BUS_QUEUE_SIZE];
+    volatile uint8_t head = 0;
+    volatile uint8_t issued = 0;
+    volatile uint8_t tail = 0;
+    volatile bool f_busy = false;
+    volatile bool f_reading = false;
+
+    volatile uint32_t dropped = 0;
+    volatile uint32_t merged = 0;
+    uint32_t wait_time = 0;
+
+    bool is_valid(int8_t device) const;
+    bool make_request(Request& request, int8_t device, const uint8_t* data, size_t length,
+                      uint8_t* result, size_t result_length, I2cCallback callback, void* context) const;
+    bool enqueue(const Request& request);
+    void enqueue_wait(const Request& request);
+    bool transfer(int8_t device, const uint8_t* data, size_t length, uint8_t* result, size_t result_length);
+    void kick(bool f_force = false);
+    void start_current(void);
+    void complete(bool f_success);
+    void count(int8_t device, size_t bytes, bool f_success);
+
+    static void on_port_complete(void* context, bool f_success);
+    static void on_sync_complete(void* context, bool f_success);
+};
+
+//  液面計の共有I2Cバス（EH900_main.ino で定義）
+extern I2cBus i2c_bus;
+
+#endif // _I2CBUS_H_
@@ -0,0 +1,100 @@
+/**************************************************************************/
+/*!
+    @file     I2cPort.cpp
+    @author   Masa
+
+        I2C port: Wire transfers before start(), interrupt transfers after
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "I2cPort.h"
+
+/*!
+    @brief  完了を通知する先を設定する
+    @param handler 完了した時に呼ぶ関数（割り込みから呼ばれる）
+    @param context handler に渡すもの
+*/
+void I2cPort::setHandler(I2cPortHandler handler, void* context){
+    I2cPort::handler = handler;
+    I2cPort::context = context;
+}
+
+/*!
+    @brief  クロックを設定して割り込み転送を始める. ライブラリの初期化（Wire.begin()）がすべて終わった後に呼ぶ
+    @param clock バスのクロック [Hz]
+*/
+void I2cPort::start(uint32_t clock){
+    wire->setClock(clock);
+    hw_start();
+    f_async = true;
+}
+
+/*!
+    @brief  デバイスが応答するか確かめる. 転送中でないときに呼ぶこと
+*/
+bool I2cPort::probe(uint8_t address){
+    wire->beginTransmission(address);
+    return wire->endTransmission() == 0;
+}
+
+/*!
+    @brief  書き込みを始める. 終わると handler を呼ぶ
+    @param f_stop False ならストップせず、続く startRead() をリピートスタートで始める
+*/
+void I2cPort::startWrite(uint8_t address, const uint8_t* data, size_t length, bool f_stop){
+    f_restart = !f_stop;
+
+    if (f_async){
+        f_pending = true;
+        if (!hw_write(address, data, length, f_stop)){
+            onComplete(false);
+        }
+        return;
+    }
+
+    wire->beginTransmission(address);
+    bool f_success = (wire->write(data, length) == length);
+    f_success = (wire->endTransmission(f_stop) == 0) && f_success;
+    onComplete(f_success);
+}
+
+/*!
+    @brief  読み出しを始める. 終わると handler を呼ぶ
+*/
+void I2cPort::startRead(uint8_t address, uint8_t* data, size_t length){
+    const bool f_after_write = f_restart;
+    f_restart = false;
+
+    if (f_async){
+        f_pending = true;
+        if (!hw_read(address, data, length, f_after_write)){
+            onComplete(false);
+        }
+        return;
+    }
+
+    const bool f_success = (wire->requestFrom(address, (uint8_t)length) == length);
+    for (size_t i = 0; i < length; i++){
+        data[i] = f_success ? (uint8_t)wire->read() : 0;
+    }
+    onComplete(f_success);
+}
+
+/*!
+    @brief  転送の完了を通知する. 割り込みから呼ばれる
+            start() の後は、このポートが始めた転送の完了だけを通知する.
+            Wire のライブラリが直接行った転送（LCDのライブラリ、probe() など）の完了は捨てる
+*/
+void I2cPort::onComplete(bool f_success){
+    if (f_async){
+        if (!f_pending){
+            return;
+        }
+        f_pending = false;
+    }
+    if (handler){
+        handler(context, f_success);
+    }
+}
@@ -0,0 +1,61 @@
+/**************************************************************************/
+/*!
+    @file     I2cPort.h
+
+    I2Cペリフェラルの非同期転送
+        start() の後は、転送を始めるとすぐに戻り、終わると割り込みから完了を通知する.
+        start() の前（ライブラリの初期化中）は Wire で転送し、その場で完了を通知する.
+        割り込み転送の部分（hw_ で始まるものと idle()）は、実機は I2cPortStm32.cpp（STM32 HAL）,
+        ホストのシミュレーションは extras/sim/SimI2cPort.cpp（仮想時計で転送時間の後に完了）が実装する.
+*/
+/**************************************************************************/
+
+#ifndef _I2CPORT_H_
+#define _I2CPORT_H_
+
+#include <Arduino.h>
+#include <Wire.h>
+
+//  転送の完了通知  割り込みから呼ばれる
+typedef void (*I2cPortHandler)(void* context, bool f_success);
+
+class I2cPort {
+
+  public:
+    I2cPort(TwoWire* wire = &Wire) : wire(wire){};
+
+    void setHandler(I2cPortHandler handler, void* context);
+    void start(uint32_t clock);
+
+    bool probe(uint8_t address);
+    void startWrite(uint8_t address, const uint8_t* data, size_t length, bool f_stop);
+    void startRead(uint8_t address, uint8_t* data, size_t length);
+    void idle(void);
+
+    void onComplete(bool f_success);
+
+    /*!
+    @brief  割り込みで転送しているか（start() の後）
+    */
+    bool isAsync(void) const {
+      return f_async;
+    };
+
+  private:
+    TwoWire* wire;
+    I2cPortHandler handler = nullptr;
+    void* context = nullptr;
+
+    volatile bool f_async = false;
+    //  このポートが始めた割り込み転送が終わっていない
+    //  （Wire のライブラリの転送も同じHALのコールバックを呼ぶので、自分の転送の完了だけを通知する）
+    volatile bool f_pending = false;
+    //  直前の書き込みをストップなしで終えた（次の読み出しはリピートスタート）
+    bool f_restart = false;
+
+    void hw_start(void);
+    bool hw_write(uint8_t address, const uint8_t* data, size_t length, bool f_stop);
+    bool hw_read(uint8_t address, uint8_t* data, size_t length, bool f_restart);
+};
+
+#endif // _I2CPORT_H_
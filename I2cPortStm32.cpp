@@ -0,0 +1,75 @@
+/**************************************************************************/
+/*!
+    @file     I2cPortStm32.cpp
+    @author   Masa
+
+        Interrupt-driven I2C transfers on the STM32 HAL (I2C v2, STM32F3)
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "I2cPort.h"
+
+#if !defined(USE_HAL_I2C_REGISTER_CALLBACKS) || (USE_HAL_I2C_REGISTER_CALLBACKS != 1U)
+#error "I2cPort needs USE_HAL_I2C_REGISTER_CALLBACKS (hal_conf_extra.h)"
+#endif
+
+namespace{
+    //  HALのコールバックから完了を通知するポート（I2Cバスは1つ）
+    I2cPort* active_port = nullptr;
+
+    void on_transfer_complete(I2C_HandleTypeDef* handle){
+        (void)handle;
+        active_port->onComplete(true);
+    }
+
+    void on_transfer_error(I2C_HandleTypeDef* handle){
+        (void)handle;
+        active_port->onComplete(false);
+    }
+}
+
+/*!
+    @brief  HALの完了・エラーのコールバックを登録する (private)
+            Wire（twi.c）も同じハンドルで HAL_I2C_Master_Seq_Transmit_IT / Seq_Receive_IT を使うので、
+            ライブラリが直接行った転送（LCDのクリアや設定メニューの表示など）でもこのコールバックが呼ばれる.
+            onComplete() は自分の転送が終わっていない時だけ通知するので、それらは捨てられる.
+            Wire.begin() は HAL_I2C_Init() でコールバックを既定に戻すので、その後で登録すること
+*/
+void I2cPort::hw_start(void){
+    I2C_HandleTypeDef* handle = wire->getHandle();
+
+    active_port = this;
+    HAL_I2C_RegisterCallback(handle, HAL_I2C_MASTER_TX_COMPLETE_CB_ID, on_transfer_complete);
+    HAL_I2C_RegisterCallback(handle, HAL_I2C_MASTER_RX_COMPLETE_CB_ID, on_transfer_complete);
+    HAL_I2C_RegisterCallback(handle, HAL_I2C_ERROR_CB_ID, on_transfer_error);
+    HAL_I2C_RegisterCallback(handle, HAL_I2C_ABORT_CB_ID, on_transfer_error);
+}
+
+/*!
+    @brief  割り込みで書き込みを始める (private)
+    @return False:始められなかった（完了は通知されない）
+*/
+bool I2cPort::hw_write(uint8_t address, const uint8_t* data, size_t length, bool f_stop){
+    const uint32_t options = f_stop ? I2C_FIRST_AND_LAST_FRAME : I2C_FIRST_FRAME;
+
+    return HAL_I2C_Master_Seq_Transmit_IT(wire->getHandle(), address << 1, const_cast<uint8_t*>(data), length, options) == HAL_OK;
+}
+
+/*!
+    @brief  割り込みで読み出しを始める (private)
+            書き込みに続く時は I2C_LAST_FRAME で、向きが変わるのでHALがリピートスタートを出す
+    @return False:始められなかった（完了は通知されない）
+*/
+bool I2cPort::hw_read(uint8_t address, uint8_t* data, size_t length, bool f_restart){
+    const uint32_t options = f_restart ? I2C_LAST_FRAME : I2C_FIRST_AND_LAST_FRAME;
+
+    return HAL_I2C_Master_Seq_Receive_IT(wire->getHandle(), address << 1, data, length, options) == HAL_OK;
+}
+
+/*!
+    @brief  転送の完了を待つ間に呼ばれる. 完了は割り込みで知らされるので何もしない
+*/
+void I2cPort::idle(void){
+}
@@ -3,7 +3,7 @@
     @file     IotGateway.cpp
     @author   Masa
 
-        UART drive + JSON data former
+        UART drive + JSON data former + command line receiver
 
         @section  HISTORY
 
@@ -15,22 +15,21 @@
 /*!
     @brief  payloadに直接JSONデータを書き込む（オーバーライト）
     @param json 大外の { } なしの形のJSONデータ
-    @return payloadの中身（文字列）
 
 */
-void IotGateway::setPayload(String json){
-  payload = json;
+void IotGateway::setPayload(const char* json_data){
+  json.setRaw(json_data);
 
 }
 
 /*!
-    @brief  payloadに引数のデータをノードして加える  
+    @brief  payloadの中身を { } で囲んで返す
     @param void
     @return payloadの中身（文字列）
 
 */
-String IotGateway::getPayload(void){
-  return("{" + payload + "}");
+const char* IotGateway::getPayload(void){
+  return json.finish();
 }
 
 /*!
@@ -39,11 +38,8 @@ String IotGateway::getPayload(void){
     @param value 値（文字列）
 
 */
-void IotGateway::addPayload(String key, String value){
-  String quote = "\"";
-  String node = quote + key + quote + ":" + quote + value + quote;
-
-  IotGateway::joinToPayload(node);
+void IotGateway::addPayload(const char* key, const char* value){
+  json.addString(key, value);
 
   return;
 
@@ -54,11 +50,8 @@ void IotGateway::addPayload(String key, String value){
     @param value 数値（整数）
 
 */
-void IotGateway::addPayload(String key, int32_t value){
-  String quote = "\"";
-  String node = quote + key + quote + ":" +  String(value) ;
-
-  IotGateway::joinToPayload(node);
+void IotGateway::addPayload(const char* key, int32_t value){
+  json.addInteger(key, value);
 
   return;
 }
@@ -66,30 +59,167 @@ void IotGateway::addPayload(String key, int32_t value){
 /*!
     @brief  payloadに引数のデータをノードして加える  
     @param key JSONのキー
-    @param value 数値（小数）
+    @param value 数値（10^deciPlac 倍した整数）  例：value=123, deciPlac=1 -> 12.3
     @param deciPlac 出力する小数点以下桁数
 
 */
-void IotGateway::addPayload(String key, float value, u_int8_t deciPlac){
-  String quote = "\"";
-  String node = quote + key + quote + ":"  + String(value, deciPlac) ;
-
-  IotGateway::joinToPayload(node);
+void IotGateway::addPayload(const char* key, int32_t value, uint8_t deciPlac){
+  json.addFixed(key, value, deciPlac);
 
   return;
 }
 
 /*!
-    @brief  データセパレータ(,)を入れながらpayloadにノードを足す   (private)
-    @param node JSONの情報単位
+    @brief  payloadを送信キューに入れる. ブロックしない
+            実際の送信は service() で行う
+            バイナリフォーマットの時は改行の後に 0x00 を送り、JSONの行を1つのフレームとして区切る
+            （0x00 で区切るデコーダが、続くバイナリフレームと一緒に捨てないように）
+    @param void
+    @return True:キューに入れた, False:キューが一杯でフレームを捨てた
 */
-void IotGateway::joinToPayload(String node){
-  if (payload.length() != 0)
-    // payloadに何か既に入っている場合
-    {payload = payload + "," + node ;} 
-  else
-    // payloadに何もない場合
-    {payload = node;}
-  
-  return;
-}
\ No newline at end of file
+bool IotGateway::sendPayload(void){
+  const char* frame = getPayload();
+  const size_t length = json.length();
+
+  const size_t delimiter = (tx_format == FORMAT_BINARY) ? 1 : 0;
+
+  //  フレームは分割せず、改行（と区切り）まで含めて入る時だけキューに入れる
+  if (IOT_TX_QUEUE_SIZE - tx_count < length + 2 + delimiter){
+    tx_dropped++;
+    return false;
+  }
+  enqueue((const uint8_t*)frame, length);
+  enqueue((const uint8_t*)"\r\n\0", 2 + delimiter);
+
+  service();
+  return true;
+}
+
+/*!
+    @brief  ステータスレコードをバイナリフレームにして送信キューに入れる. ブロックしない
+            シーケンス番号はここで付ける
+    @param record レコードの内容（seqは上書きされる）
+    @return True:キューに入れた, False:キューが一杯でフレームを捨てた
+*/
+bool IotGateway::sendRecord(StatusRecord& record){
+  uint8_t frame[TELEMETRY_FRAME_SIZE];
+
+  record.seq = tx_seq++;
+  const size_t length = telemetry_pack_status(record, frame);
+
+  if (!enqueue(frame, length)){
+    tx_dropped++;
+    return false;
+  }
+
+  service();
+  return true;
+}
+
+/*!
+    @brief  計測履歴の記録1件を送信キューに入れる. ブロックしない
+            JSONの時は {"hist":seq,"time":秒,"level":液面,"v":LSB,"i":LSB,"flags":flags} の形
+    @param record 履歴の記録
+    @return True:キューに入れた, False:キューが一杯で入れなかった
+*/
+bool IotGateway::sendHistory(const HistoryRecord& record){
+  if (tx_format == FORMAT_BINARY){
+    uint8_t frame[TELEMETRY_FRAME_SIZE];
+    const size_t length = telemetry_pack_history(record, frame);
+    //  履歴は後で送り直せるので、入らない時は捨てた数に数えない
+    if (!enqueue(frame, length)){
+      return false;
+    }
+    service();
+    return true;
+  }
+
+  char buf[IOT_PAYLOAD_SIZE];
+  JsonWriter writer(buf, sizeof(buf));
+  writer.addInteger("hist", record.seq);
+  writer.addInteger("time", (int32_t)record.timestamp);
+  writer.addFixed("level", record.liquid_level, 1);
+  writer.addInteger("v", record.raw_voltage);
+  writer.addInteger("i", record.raw_current);
+  writer.addInteger("flags", record.flags);
+  writer.finish();
+
+  const size_t length = writer.length();
+  if (IOT_TX_QUEUE_SIZE - tx_count < length + 2){
+    return false;
+  }
+  enqueue((const uint8_t*)buf, length);
+  enqueue((const uint8_t*)"\r\n", 2);
+
+  service();
+  return true;
+}
+
+/*!
+    @brief  送信キューからUARTの送信バッファに空きの分だけ移す. ブロックしない
+            UARTの送信バッファは送信割り込みで出力される. ループから頻繁に呼ぶこと
+    @param void
+    @return 移したバイト数
+*/
+size_t IotGateway::service(void){
+  size_t moved = 0;
+
+  while (tx_count != 0){
+    const int room = HardwareSerial::availableForWrite();
+    if (room <= 0){
+      break;
+    }
+
+    //  リングバッファの末尾で折り返さない連続部分を書く
+    const size_t tail = (tx_head + IOT_TX_QUEUE_SIZE - tx_count) % IOT_TX_QUEUE_SIZE;
+    size_t chunk = IOT_TX_QUEUE_SIZE - tail;
+    if (chunk > tx_count){
+      chunk = tx_count;
+    }
+    if (chunk > (size_t)room){
+      chunk = room;
+    }
+
+    HardwareSerial::write(&tx_queue[tail], chunk);
+    tx_count -= chunk;
+    moved += chunk;
+  }
+
+  return moved;
+}
+
+/*!
+    @brief  受信バッファのバイトをコマンドのパーサに渡す. ブロックしない
+            受信バッファはUARTの受信割り込みで埋まる（STM32コアのリングバッファ 64byte）ので、
+            溢れないうちに（9600bpsで 60ms 以内に）ループから呼ぶこと
+    @param void
+    @return 行がそろったら COMMAND_READY（残りのバイトは次の呼び出しで読む）,
+            行を捨てたら COMMAND_MALFORMED / COMMAND_OVERFLOW, 受信バッファが空になったら COMMAND_PENDING
+*/
+CommandParser::Status IotGateway::receiveCommand(void){
+  while (HardwareSerial::available() > 0){
+    const CommandParser::Status status = command.feed((uint8_t)HardwareSerial::read());
+    if (status != CommandParser::COMMAND_PENDING){
+      return status;
+    }
+  }
+  return CommandParser::COMMAND_PENDING;
+}
+
+/*!
+    @brief  送信キューにデータを入れる (private)
+    @param data データ
+    @param length 長さ[byte]
+    @return True:入れた, False:入りきらない
+*/
+bool IotGateway::enqueue(const uint8_t* data, size_t length){
+  if (IOT_TX_QUEUE_SIZE - tx_count < length){
+    return false;
+  }
+  for (size_t i = 0; i < length; i++){
+    tx_queue[tx_head] = data[i];
+    tx_head = (tx_head + 1) % IOT_TX_QUEUE_SIZE;
+  }
+  tx_count += length;
+  return true;
+}
@@ -2,23 +2,47 @@
 #define _IOTGATEWAY_H_
 
 #include "HardwareSerial.h"
+#include "JsonWriter.h"
+#include "TelemetryFrame.h"
+#include "CommandParser.h"
+
+//  payloadのバッファの大きさ[byte]
+constexpr size_t IOT_PAYLOAD_SIZE = 128;
+
+//  送信キューの大きさ[byte]  payload 3フレーム分
+constexpr size_t IOT_TX_QUEUE_SIZE = 384;
 
 class IotGateway : public HardwareSerial{
 
   public:
+    //  送信フォーマット
+    enum Formats{
+      FORMAT_JSON,    // 0 : JSONテキスト + 改行
+      FORMAT_BINARY   // 1 : COBSフレームのバイナリレコード（TelemetryFrame.h）  JSONの行は改行の後に 0x00 で区切る
+    };
+
     /*!
     @brief  コンストラクタ unit32タイプのピン指定だけを受け付けます
     */
-    IotGateway(uint32_t pin_rx, uint32_t pin_tx) : HardwareSerial(pin_rx, pin_tx){
+    IotGateway(uint32_t pin_rx, uint32_t pin_tx) : HardwareSerial(pin_rx, pin_tx), json(payload, sizeof(payload)){
 
     };
 
-    void setPayload(String json);
-    String getPayload(void);
+    void setPayload(const char* json_data);
+    const char* getPayload(void);
+
+    void addPayload(const char* key, const char* value);
+    void addPayload(const char* key, int32_t value);
+    void addPayload(const char* key, int32_t value, uint8_t deciPlac);
 
-    void addPayload(String key, String value);
-    void addPayload(String key, int32_t value);
-    void addPayload(String key, float value, u_int8_t deciPlac);
+    /*!
+    @brief  前回のclearPayload()以降に入りきらなかったノードがあるか
+    @param void
+    @return True:入りきらなかったノードがある
+    */
+    bool hasOverflow(void) const {
+      return json.hasOverflow();
+    };
     
     
     /*!
@@ -27,21 +51,89 @@ class IotGateway : public HardwareSerial{
     @return void
     */
     void clearPayload(void){
-      payload="";
+      json.clear();
     };
     
+    bool sendPayload(void);
+    bool sendRecord(StatusRecord& record);
+    bool sendHistory(const HistoryRecord& record);
+
     /*!
-    @brief  payloadをUARTに出力
-    @param void
+    @brief  送信フォーマットを設定
+    @param format フォーマット
     @return void
     */
-    void sendPayload(void){
-      HardwareSerial::println(getPayload());
+    void setFormat(Formats format){
+      tx_format = format;
+    };
+
+    /*!
+    @brief  送信フォーマットを返す
+    @param void
+    @return フォーマット
+    */
+    Formats getFormat(void) const {
+      return tx_format;
+    };
+    size_t service(void);
+
+    /*!
+    @brief  送信キューに残っているバイト数
+    @param void
+    @return バイト数
+    */
+    size_t getTxPending(void) const {
+      return tx_count;
+    };
+
+    /*!
+    @brief  送信キューが一杯で送れなかったフレーム数
+    @param void
+    @return フレーム数
+    */
+    uint32_t getDroppedFrames(void) const {
+      return tx_dropped;
+    };
+
+    CommandParser::Status receiveCommand(void);
+
+    /*!
+    @brief  receiveCommand() が COMMAND_READY を返した行
+    @param void
+    @return パーサ（次の receiveCommand() まで有効）
+    */
+    const CommandParser& getCommand(void) const {
+      return command;
+    };
+
+    /*!
+    @brief  コマンド行の途中まで受信しているか
+    @param void
+    @return True:行の終わりを待っている
+    */
+    bool isReceiving(void) const {
+      return command.isReceiving();
     };
 
   private:
-    String payload;
-    void joinToPayload(String node);
+    //  payloadの実体（静的に確保）とその書き込み
+    char payload[IOT_PAYLOAD_SIZE];
+    JsonWriter json;
+
+    //  送信キュー（リングバッファ）
+    uint8_t tx_queue[IOT_TX_QUEUE_SIZE];
+    size_t tx_head = 0;
+    size_t tx_count = 0;
+    uint32_t tx_dropped = 0;
+
+    Formats tx_format = FORMAT_JSON;
+    //  バイナリレコードのシーケンス番号
+    uint8_t tx_seq = 0;
+
+    //  受信したコマンド行のパーサ
+    CommandParser command;
+
+    bool enqueue(const uint8_t* data, size_t length);
 };
 
 #endif // _IOTGATEWAY_H_
\ No newline at end of file
@@ -0,0 +1,208 @@
+/**************************************************************************/
+/*!
+    @file     JsonWriter.cpp
+    @author   Masa
+
+        Zero-heap JSON object writer into a fixed buffer
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "JsonWriter.h"
+
+namespace{
+    //  閉じ括弧と終端文字のために残しておく長さ
+    constexpr size_t RESERVED_TAIL = 2;
+    //  小数点以下桁数の上限
+    constexpr uint8_t DECIMALS_MAX = 9;
+}
+
+/*!
+    @brief  コンストラクタ
+    @param buffer 書き込み先のバッファ（呼び出し側で確保）
+    @param size バッファの大きさ[byte]  4以上であること
+*/
+JsonWriter::JsonWriter(char* buffer, size_t size) : buf(buffer), size(size) {
+  clear();
+}
+
+/*!
+    @brief  中身を空のオブジェクトにする
+*/
+void JsonWriter::clear(void){
+  len = 0;
+  overflow = false;
+  put_char('{');
+}
+
+/*!
+    @brief  中身を直接書き込む（オーバーライト）
+    @param json 大外の { } なしの形のJSONデータ
+    @return True:書き込めた, False:入りきらない（中身は空になる）
+*/
+bool JsonWriter::setRaw(const char* json){
+  clear();
+  if (!put_string(json)){
+    clear();
+    overflow = true;
+    return false;
+  }
+  return true;
+}
+
+/*!
+    @brief  文字列のノードを加える
+    @param key JSONのキー
+    @param value 値（文字列）
+    @return True:書き込めた, False:入りきらない
+*/
+bool JsonWriter::addString(const char* key, const char* value){
+  const size_t rollback = len;
+
+  if (begin_node(key) && put_char('"') && put_escaped(value) && put_char('"')){
+    return true;
+  }
+  return cancel_node(rollback);
+}
+
+/*!
+    @brief  整数のノードを加える
+    @param key JSONのキー
+    @param value 値（整数）
+    @return True:書き込めた, False:入りきらない
+*/
+bool JsonWriter::addInteger(const char* key, int32_t value){
+  return addFixed(key, value, 0);
+}
+
+/*!
+    @brief  固定小数点数のノードを加える  例：value=-123, decimals=1 -> -12.3
+    @param key JSONのキー
+    @param value 値（10^decimals 倍した整数）
+    @param decimals 小数点以下桁数
+    @return True:書き込めた, False:入りきらない
+*/
+bool JsonWriter::addFixed(const char* key, int32_t value, uint8_t decimals){
+  const size_t rollback = len;
+
+  if (decimals > DECIMALS_MAX){
+    decimals = DECIMALS_MAX;
+  }
+
+  uint32_t divisor = 1;
+  for (uint8_t i = 0; i < decimals; i++){
+    divisor *= 10;
+  }
+
+  //  負数は絶対値にして符号を付ける（INT32_MINも扱えるようにuint32で計算）
+  const bool negative = value < 0;
+  const uint32_t magnitude = negative ? (uint32_t)0 - (uint32_t)value : (uint32_t)value;
+
+  bool ok = begin_node(key);
+  if (ok && negative){
+    ok = put_char('-');
+  }
+  if (ok){
+    ok = put_unsigned(magnitude / divisor, 1);
+  }
+  if (ok && decimals > 0){
+    ok = put_char('.') && put_unsigned(magnitude % divisor, decimals);
+  }
+
+  return ok || cancel_node(rollback);
+}
+
+/*!
+    @brief  閉じ括弧を付けて文字列として返す. この後もノードを加えられる
+    @return 終端文字付きのJSON文字列
+*/
+const char* JsonWriter::finish(void){
+  buf[len] = '}';
+  buf[len + 1] = '\0';
+  return buf;
+}
+
+/*!
+    @brief  セパレータ(,)とキーを書き込む (private)
+*/
+bool JsonWriter::begin_node(const char* key){
+  if (len > 1 && !put_char(',')){
+    return false;
+  }
+  return put_char('"') && put_escaped(key) && put_char('"') && put_char(':');
+}
+
+/*!
+    @brief  書き込みに失敗したノードを取り消す (private)
+    @return つねにFalse
+*/
+bool JsonWriter::cancel_node(size_t rollback){
+  len = rollback;
+  return false;
+}
+
+/*!
+    @brief  1文字書き込む (private)
+*/
+bool JsonWriter::put_char(char c){
+  if (len + 1 + RESERVED_TAIL > size){
+    overflow = true;
+    return false;
+  }
+  buf[len++] = c;
+  return true;
+}
+
+/*!
+    @brief  文字列をそのまま書き込む (private)
+*/
+bool JsonWriter::put_string(const char* str){
+  while (*str){
+    if (!put_char(*str++)){
+      return false;
+    }
+  }
+  return true;
+}
+
+/*!
+    @brief  文字列を " と \ をエスケープして書き込む (private)
+*/
+bool JsonWriter::put_escaped(const char* str){
+  while (*str){
+    if ((*str == '"' || *str == '\\') && !put_char('\\')){
+      return false;
+    }
+    if (!put_char(*str++)){
+      return false;
+    }
+  }
+  return true;
+}
+
+/*!
+    @brief  符号なし整数を10進で書き込む (private)
+    @param value 値
+    @param min_digits 最小桁数  足りない桁は0で埋める
+*/
+bool JsonWriter::put_unsigned(uint32_t value, uint8_t min_digits){
+  char digits[10];
+  uint8_t n = 0;
+
+  do {
+    digits[n++] = '0' + (value % 10);
+    value /= 10;
+  } while (value != 0 && n < sizeof(digits));
+
+  while (n < min_digits && n < sizeof(digits)){
+    digits[n++] = '0';
+  }
+
+  while (n > 0){
+    if (!put_char(digits[--n])){
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,53 @@
+#ifndef _JSONWRITER_H_
+#define _JSONWRITER_H_
+
+#include <Arduino.h>
+
+/*!
+    @brief  呼び出し側が用意したバッファにJSONオブジェクトを書き込むクラス
+            ヒープを使わない. バッファに入りきらないノードは書き込まず、オーバーフローを記録する
+*/
+class JsonWriter {
+
+  public:
+    JsonWriter(char* buffer, size_t size);
+
+    void clear(void);
+    bool setRaw(const char* json);
+
+    bool addString(const char* key, const char* value);
+    bool addInteger(const char* key, int32_t value);
+    bool addFixed(const char* key, int32_t value, uint8_t decimals);
+
+    const char* finish(void);
+
+    /*!
+    @brief  書き込んだJSONの長さ（閉じ括弧を含む）
+    */
+    size_t length(void) const {
+      return len + 1;
+    };
+
+    /*!
+    @brief  clear()してから書き込めなかったノードがあるか
+    */
+    bool hasOverflow(void) const {
+      return overflow;
+    };
+
+  private:
+    char* buf;
+    size_t size;
+    //  書き込み済みの長さ（先頭の { を含む）
+    size_t len;
+    bool overflow;
+
+    bool begin_node(const char* key);
+    bool cancel_node(size_t rollback);
+    bool put_char(char c);
+    bool put_string(const char* str);
+    bool put_escaped(const char* str);
+    bool put_unsigned(uint32_t value, uint8_t min_digits);
+};
+
+#endif // _JSONWRITER_H_
@@ -0,0 +1,198 @@
+/**************************************************************************/
+/*!
+    @file     LevelEstimator.cpp
+    @author   Masa
+
+        Streaming level estimator (IIR / median / Kalman) for continuous mode
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "LevelEstimator.h"
+
+namespace{
+    //  液面の上限 [0.1%]
+    constexpr int32_t LEVEL_MAX = 1000;
+
+    //  IIRの状態の固定小数点
+    constexpr uint8_t IIR_SHIFT = 16;
+
+    //  カルマンフィルタ  最初の計測値の変化率の不確かさ（標準偏差） [0.1%/s]
+    //      補充中は数%/s で変わるので大きめにしておく
+    constexpr float KALMAN_INITIAL_RATE_SD = 10.0f;
+
+    //  パラメタの単位から [0.1%] 単位への換算
+    constexpr float KALMAN_ACCEL_UNIT = 0.001f;    //  [0.0001%/s^2] -> [0.1%/s^2]
+    constexpr float KALMAN_NOISE_UNIT = 0.1f;      //  [0.01%] -> [0.1%]
+
+    uint16_t clamp_level(int32_t level){
+        if (level < 0){
+            return 0;
+        }
+        return (level > LEVEL_MAX) ? LEVEL_MAX : (uint16_t)level;
+    }
+}
+
+/*!
+    @brief  パラメタの既定値  フィルタなし（従来の動作）
+*/
+EstimatorConfig LevelEstimator::defaultConfig(void){
+    EstimatorConfig config = {};
+    config.filter = FILTER_NONE;
+    config.median_window = 5;
+    config.iir_alpha = 250;
+    config.kalman_accel = 100;
+    config.kalman_noise = 20;
+    return config;
+}
+
+/*!
+    @brief  パラメタが使える範囲か
+*/
+bool LevelEstimator::isValid(const EstimatorConfig& config){
+    return config.filter < FILTER_NUM
+        && config.median_window >= 3 && config.median_window <= ESTIMATOR_MEDIAN_MAX
+        && (config.median_window % 2) == 1
+        && config.iir_alpha > 0 && config.iir_alpha <= 1000
+        && config.kalman_accel > 0
+        && config.kalman_noise > 0;
+}
+
+/*!
+    @brief  パラメタを設定して状態をリセットする. 範囲外のパラメタなら既定値を使う
+*/
+void LevelEstimator::configure(const EstimatorConfig& new_config){
+    config = isValid(new_config) ? new_config : defaultConfig();
+    reset();
+}
+
+/*!
+    @brief  状態をリセットする. 次の計測値から推定をやり直す（連続計測の開始時に呼ぶ）
+*/
+void LevelEstimator::reset(void){
+    estimate = 0;
+    rate = 0;
+    samples = 0;
+    window_head = 0;
+}
+
+/*!
+    @brief  計測値を1つ加えて推定値を更新する
+    @param level 計測した液面 [0.1%]
+    @param time_ms 計測した時刻 [ms]
+    @return 推定した液面 [0.1%]
+*/
+uint16_t LevelEstimator::update(uint16_t level, uint32_t time_ms){
+    const float dt = (samples == 0) ? 0.0f : (float)(time_ms - last_time) * 0.001f;
+    last_time = time_ms;
+
+    switch (config.filter){
+        case FILTER_IIR:
+            estimate = update_iir(level);
+            break;
+
+        case FILTER_MEDIAN:
+            estimate = update_median(level);
+            break;
+
+        case FILTER_KALMAN:
+            estimate = update_kalman(level, dt);
+            break;
+
+        default:
+            estimate = level;
+            break;
+    }
+    samples++;
+
+    return estimate;
+}
+
+/*!
+    @brief  IIRローパス (private)  最初の計測値で初期化する
+*/
+uint16_t LevelEstimator::update_iir(uint16_t level){
+    const int32_t input = (int32_t)level << IIR_SHIFT;
+
+    if (samples == 0){
+        iir_state = input;
+    } else {
+        const int64_t alpha = ((int64_t)config.iir_alpha << IIR_SHIFT) / 1000;
+        iir_state += (int32_t)(((int64_t)(input - iir_state) * alpha) >> IIR_SHIFT);
+    }
+    return clamp_level((iir_state + (1 << (IIR_SHIFT - 1))) >> IIR_SHIFT);
+}
+
+/*!
+    @brief  直近の計測値の中央値 (private)  そろうまでは、あるだけの中央値
+*/
+uint16_t LevelEstimator::update_median(uint16_t level){
+    window[window_head] = level;
+    window_head = (window_head + 1) % config.median_window;
+
+    const uint8_t num = (samples + 1 < config.median_window) ? samples + 1 : config.median_window;
+
+    //  挿入ソートで昇順に並べる
+    uint16_t sorted[ESTIMATOR_MEDIAN_MAX];
+    for (uint8_t i = 0; i < num; i++){
+        const uint16_t value = window[i];
+        uint8_t j = i;
+        while (j > 0 && sorted[j-1] > value){
+            sorted[j] = sorted[j-1];
+            j--;
+        }
+        sorted[j] = value;
+    }
+    return sorted[num / 2];
+}
+
+/*!
+    @brief  カルマンフィルタ (private)  状態は液面と変化率, 観測は液面
+    @param dt 前回の計測からの時間 [s]
+*/
+uint16_t LevelEstimator::update_kalman(uint16_t level, float dt){
+    const float z = (float)level;
+    const float r = (float)config.kalman_noise * KALMAN_NOISE_UNIT;
+
+    if (samples == 0){
+        kf_level = z;
+        kf_rate = 0.0f;
+        kf_p[0][0] = r * r;
+        kf_p[0][1] = 0.0f;
+        kf_p[1][0] = 0.0f;
+        kf_p[1][1] = KALMAN_INITIAL_RATE_SD * KALMAN_INITIAL_RATE_SD;
+        rate = 0;
+        return clamp_level((int32_t)(z + 0.5f));
+    }
+
+    //  予測  x = F x,  P = F P F' + Q    F = [1 dt; 0 1]
+    const float a = (float)config.kalman_accel * KALMAN_ACCEL_UNIT;
+    const float q = a * a;
+    const float dt2 = dt * dt;
+
+    kf_level += kf_rate * dt;
+    kf_p[0][0] += dt * (kf_p[0][1] + kf_p[1][0]) + dt2 * kf_p[1][1] + q * dt2 * dt2 / 4.0f;
+    kf_p[0][1] += dt * kf_p[1][1] + q * dt2 * dt / 2.0f;
+    kf_p[1][0] += dt * kf_p[1][1] + q * dt2 * dt / 2.0f;
+    kf_p[1][1] += q * dt2;
+
+    //  更新  観測 H = [1 0]
+    const float s = kf_p[0][0] + r * r;
+    const float k0 = kf_p[0][0] / s;
+    const float k1 = kf_p[1][0] / s;
+    const float innovation = z - kf_level;
+
+    kf_level += k0 * innovation;
+    kf_rate += k1 * innovation;
+
+    const float p00 = kf_p[0][0];
+    const float p01 = kf_p[0][1];
+    kf_p[0][0] -= k0 * p00;
+    kf_p[0][1] -= k0 * p01;
+    kf_p[1][0] -= k1 * p00;
+    kf_p[1][1] -= k1 * p01;
+
+    rate = (int32_t)(kf_rate * 3600.0f);
+    return clamp_level((int32_t)(kf_level + 0.5f));
+}
@@ -0,0 +1,114 @@
+/**************************************************************************/
+/*!
+    @file     LevelEstimator.h
+
+    連続計測の液面の推定  AD変換1回分の液面を受け取り、前回までの結果と合わせて推定値を出す
+        FILTER_NONE     そのまま（従来の動作）
+        FILTER_IIR      1次のIIRローパス  y += α(x - y)
+        FILTER_MEDIAN   直近N回の中央値（外れ値を捨てる）
+        FILTER_KALMAN   液面とその変化率を状態とする1次元カルマンフィルタ
+                        変化率は加速度の白色雑音で変わるとする（等速度モデル）
+    液面は [0.1%] の整数. カルマンフィルタだけ浮動小数点で計算する（1秒に数回なのでFPUがなくても軽い）
+*/
+/**************************************************************************/
+
+#ifndef _LEVELESTIMATOR_H_
+#define _LEVELESTIMATOR_H_
+
+#include <stdint.h>
+
+//  中央値を取る回数の最大
+constexpr uint8_t ESTIMATOR_MEDIAN_MAX = 9;
+
+/*!
+    @brief  推定のパラメタ（eh900 に保存する）
+*/
+struct EstimatorConfig {
+    //  フィルタの種類  LevelEstimator::Filters
+    uint8_t filter;
+    //  中央値を取る回数（奇数 3〜ESTIMATOR_MEDIAN_MAX）
+    uint8_t median_window;
+    //  IIRの係数 α [1/1000]
+    uint16_t iir_alpha;
+    //  カルマンフィルタ  液面の加速度の雑音（標準偏差） [0.0001%/s^2]
+    uint16_t kalman_accel;
+    //  カルマンフィルタ  1回の計測の雑音（標準偏差） [0.01%]
+    uint16_t kalman_noise;
+};
+
+class LevelEstimator {
+
+  public:
+    //  フィルタの種類
+    enum Filters : uint8_t {
+      FILTER_NONE,    // 0 : そのまま
+      FILTER_IIR,     // 1 : IIRローパス
+      FILTER_MEDIAN,  // 2 : 中央値
+      FILTER_KALMAN,  // 3 : カルマンフィルタ
+      FILTER_NUM
+    };
+
+    LevelEstimator(void){};
+
+    void configure(const EstimatorConfig& config);
+    void reset(void);
+
+    uint16_t update(uint16_t level, uint32_t time_ms);
+
+    static EstimatorConfig defaultConfig(void);
+    static bool isValid(const EstimatorConfig& config);
+
+    /*!
+    @brief  フィルタの種類
+    */
+    Filters getFilter(void) const {
+      return (Filters)config.filter;
+    };
+
+    /*!
+    @brief  直前の推定値 [0.1%]
+    */
+    uint16_t getLevel(void) const {
+      return estimate;
+    };
+
+    /*!
+    @brief  液面の変化率 [0.1%/h]  カルマンフィルタの時だけ推定する（それ以外は0）
+    */
+    int32_t getRate(void) const {
+      return rate;
+    };
+
+    /*!
+    @brief  reset() 以降に受け取った計測値の数
+    */
+    uint32_t getSamples(void) const {
+      return samples;
+    };
+
+  private:
+    EstimatorConfig config = defaultConfig();
+
+    uint16_t estimate = 0;
+    int32_t rate = 0;
+    uint32_t samples = 0;
+    uint32_t last_time = 0;
+
+    //  IIRの状態 [0.1%] Q16
+    int32_t iir_state = 0;
+
+    //  中央値用の直近の計測値
+    uint16_t window[ESTIMATOR_MEDIAN_MAX];
+    uint8_t window_head = 0;
+
+    //  カルマンフィルタの状態  液面 [0.1%], 変化率 [0.1%/s] と共分散
+    float kf_level = 0.0f;
+    float kf_rate = 0.0f;
+    float kf_p[2][2] = {};
+
+    uint16_t update_iir(uint16_t level);
+    uint16_t update_median(uint16_t level);
+    uint16_t update_kalman(uint16_t level, float dt);
+};
+
+#endif // _LEVELESTIMATOR_H_
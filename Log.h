@@ -0,0 +1,77 @@
+/**************************************************************************/
+/*!
+    @file     Log.h
+
+    シリアルへのログ出力とトレースの記録
+    LOG_LEVEL より詳しいレベルの文はコンパイルされない（引数も評価されない）
+
+    LOG_ERROR / LOG_INFO / LOG_DEBUG (..LN)  : 引数を順に Serial.print する
+    TRACE(id, value)                         : トレースのリングバッファに記録する
+                                               （LOG_LEVEL_TRACE の時だけ）
+*/
+/**************************************************************************/
+
+#ifndef _LOG_H_
+#define _LOG_H_
+
+#include <Arduino.h>
+#include "TraceLog.h"
+
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_DEBUG 3
+#define LOG_LEVEL_TRACE 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+//  トレースのリングバッファ（EH900_main.ino で定義）
+extern TraceRing trace_log;
+
+inline void log_print(void){}
+
+template <typename T, typename... Rest>
+inline void log_print(const T& value, const Rest&... rest){
+    Serial.print(value);
+    log_print(rest...);
+}
+
+template <typename... Args>
+inline void log_println(const Args&... args){
+    log_print(args...);
+    Serial.println();
+}
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...)      log_print(__VA_ARGS__)
+#define LOG_ERRORLN(...)    log_println(__VA_ARGS__)
+#else
+#define LOG_ERROR(...)      ((void)0)
+#define LOG_ERRORLN(...)    ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...)       log_print(__VA_ARGS__)
+#define LOG_INFOLN(...)     log_println(__VA_ARGS__)
+#else
+#define LOG_INFO(...)       ((void)0)
+#define LOG_INFOLN(...)     ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...)      log_print(__VA_ARGS__)
+#define LOG_DEBUGLN(...)    log_println(__VA_ARGS__)
+#else
+#define LOG_DEBUG(...)      ((void)0)
+#define LOG_DEBUGLN(...)    ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_TRACE
+#define TRACE(id, value)    trace_log.push((id), (int32_t)(value), micros())
+#else
+#define TRACE(id, value)    ((void)0)
+#endif
+
+#endif // _LOG_H_
@@ -0,0 +1,109 @@
+/**************************************************************************/
+/*!
+    @file     LowPower.cpp
+    @author   Masa
+
+        CPU sleep (WFI) and STOP mode with wake-up bookkeeping
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "LowPower.h"
+
+/*!
+    @brief  RTCを動かし、システムクロックと比べてRTCの周波数を求める. 眠った時間の統計もここから数える
+*/
+void LowPower::begin(void){
+    rtc_hz = hw_begin();
+    begin_time = millis();
+    idle_time = 0;
+    stop_time = 0;
+    stops = 0;
+    wakeups = 0;
+}
+
+/*!
+    @brief  次の割り込みまで眠る（WFI）. 周辺とタイマは動いたまま
+    @param ms 眠ってよい最長の時間 [ms]  0なら眠らない
+*/
+void LowPower::idle(uint32_t ms){
+    if (ms == 0){
+        return;
+    }
+    const uint32_t start = micros();
+    hw_idle(ms);
+    idle_time += micros() - start;
+}
+
+/*!
+    @brief  STOPモードで眠る. 時間が来るか、スイッチなどの割り込みで起きる
+            入る前に I2C・UARTの転送を終えておくこと（クロックが止まる）
+            割り込みを禁止したまま眠るので、起きてクロックを戻してからISRが走る
+    @param ms 眠る時間 [ms]  LOW_POWER_STOP_MAX で切る
+    @return 眠った時間 [ms]  millis() はこの分だけ進んでいる
+*/
+uint32_t LowPower::stop(uint32_t ms){
+    if (ms == 0){
+        return 0;
+    }
+    if (ms > LOW_POWER_STOP_MAX){
+        ms = LOW_POWER_STOP_MAX;
+    }
+
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    //  前の clearWake() の後で割り込みがあれば、そのイベントを先に処理する
+    if (f_wake){
+        __set_PRIMASK(primask);
+        return 0;
+    }
+    const uint32_t slept = hw_stop(ms);
+    __set_PRIMASK(primask);
+
+    stops++;
+    stop_time += (uint64_t)slept * 1000;
+    if (f_wake){
+        wakeups++;
+    }
+    return slept;
+}
+
+/*!
+    @brief  眠っているCPUを起こす. ISRから呼ぶ
+*/
+void LowPower::wake(void){
+    f_wake = true;
+}
+
+/*!
+    @brief  起こされたことを忘れる. ISRからのイベントを取り出す前に呼ぶ
+*/
+void LowPower::clearWake(void){
+    f_wake = false;
+}
+
+/*!
+    @brief  UARTが受信したらSTOPモードから起きるようにする. STOPの間に届いたバイトも受信バッファに入る
+    @param serial 受信で起こすUART（begin() の後で呼ぶ）
+*/
+void LowPower::wakeOnReceive(HardwareSerial& serial){
+    hw_wake_on_receive(serial);
+}
+
+/*!
+    @brief  起きていた時間の割合（CPUの負荷）と眠った時間を出力する
+*/
+void LowPower::dump(Print& out) const {
+    const uint64_t up = (uint64_t)(millis() - begin_time) * 1000;
+    const uint64_t sleep = idle_time + stop_time;
+    const uint64_t run = (up > sleep) ? up - sleep : 0;
+
+    out.print("RTC: "); out.print(rtc_hz); out.println(" Hz");
+    out.print("up: "); out.print((uint32_t)(up / 1000)); out.println(" ms");
+    out.print("run: "); out.print((uint32_t)(run / 1000)); out.print(" ms ");
+    out.print(up ? (uint32_t)(run * 1000 / up) : 0); out.println(" permil");
+    out.print("idle: "); out.print((uint32_t)(idle_time / 1000)); out.println(" ms");
+    out.print("stop: "); out.print((uint32_t)(stop_time / 1000)); out.print(" ms ");
+    out.print(stops); out.print(" times, woken "); out.println(wakeups);
+}
@@ -0,0 +1,95 @@
+/**************************************************************************/
+/*!
+    @file     LowPower.h
+
+    CPUの低消費電力モード
+        idle()  次の割り込みまで WFI で眠る（SysTick は動き続けるので 1ms 以内に起きる）
+        stop()  STOPモードで眠る. RTCのウェイクアップタイマかスイッチのEXTI、
+                wakeOnReceive() で選んだUARTの受信で起きる
+                SysTick もタイマも止まるので、眠った時間は戻る時に millis() に足す
+        眠っていた時間を数えるので、CPUの負荷（起きていた時間の割合）がわかる.
+        ハードウエアの部分（hw_ で始まるもの）は、実機は LowPowerStm32.cpp（STM32 HAL と RTC）,
+        ホストのシミュレーションは extras/sim/SimLowPower.cpp（仮想時計を次のイベントまで進める）が実装する.
+*/
+/**************************************************************************/
+
+#ifndef _LOWPOWER_H_
+#define _LOWPOWER_H_
+
+#include <Arduino.h>
+
+//  1回の stop() で眠る最長の時間 [ms]  RTCのウェイクアップタイマ（LSI/16, 16bit）で数えられる長さ
+constexpr uint32_t LOW_POWER_STOP_MAX = 26000;
+//  RTCの秒以下のカウンタの周波数 [Hz]（設計値）  LSI 40kHz / 2
+constexpr uint32_t LOW_POWER_RTC_HZ = 20000;
+
+class LowPower {
+
+  public:
+    LowPower(void){};
+
+    void begin(void);
+
+    void idle(uint32_t ms);
+    uint32_t stop(uint32_t ms);
+
+    void wake(void);
+    void clearWake(void);
+    void wakeOnReceive(HardwareSerial& serial);
+
+    void dump(Print& out) const;
+
+    /*!
+    @brief  RTCの秒以下のカウンタの周波数 [Hz]  begin() でシステムクロックと比べた値
+    */
+    uint32_t getRtcHz(void) const {
+      return rtc_hz;
+    };
+
+    /*!
+    @brief  WFI で眠っていた時間の合計 [us]
+    */
+    uint64_t getIdleTime(void) const {
+      return idle_time;
+    };
+
+    /*!
+    @brief  STOPモードで眠っていた時間の合計 [us]
+    */
+    uint64_t getStopTime(void) const {
+      return stop_time;
+    };
+
+    /*!
+    @brief  STOPモードに入った回数
+    */
+    uint32_t getStops(void) const {
+      return stops;
+    };
+
+    /*!
+    @brief  STOPモードから割り込み（スイッチ・UARTの受信）で起きた回数
+    */
+    uint32_t getWakeups(void) const {
+      return wakeups;
+    };
+
+  private:
+    //  ISRが起こした  stop() に入らない・すぐに戻る
+    volatile bool f_wake = false;
+    uint32_t rtc_hz = LOW_POWER_RTC_HZ;
+
+    //  begin() の時刻 [ms]
+    uint32_t begin_time = 0;
+    uint64_t idle_time = 0;
+    uint64_t stop_time = 0;
+    uint32_t stops = 0;
+    uint32_t wakeups = 0;
+
+    uint32_t hw_begin(void);
+    void hw_idle(uint32_t ms);
+    uint32_t hw_stop(uint32_t ms);
+    void hw_wake_on_receive(HardwareSerial& serial);
+};
+
+#endif // _LOWPOWER_H_
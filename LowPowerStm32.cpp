@@ -0,0 +1,171 @@
+/**************************************************************************/
+/*!
+    @file     LowPowerStm32.cpp
+    @author   Masa
+
+        WFI / STOP mode and the RTC wake-up timer on the STM32 HAL (STM32F3)
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "LowPower.h"
+
+namespace{
+    //  RTCの分周  LSI 40kHz / (ASYNC+1) / (SYNC+1) = 1Hz
+    constexpr uint32_t RTC_ASYNC_PREDIV = 1;
+    constexpr uint32_t RTC_SYNC_PREDIV = (LOW_POWER_RTC_HZ - 1);
+    constexpr uint32_t SECONDS_PER_DAY = 86400;
+    //  RTCの周波数をシステムクロックと比べる時間 [ms]
+    constexpr uint32_t CALIBRATION_TIME = 250;
+
+    RTC_HandleTypeDef rtc_handle;
+    //  受信で起こすUART（wakeOnReceive() で設定）
+    UART_HandleTypeDef* wake_uart = nullptr;
+
+    uint32_t bcd_to_bin(uint32_t bcd){
+        return (bcd >> 4) * 10 + (bcd & 0x0F);
+    }
+
+    /*!
+        @brief  RTCの1日の中の時刻 [1/LOW_POWER_RTC_HZ s]
+                SSR を読むと TR と DR がロックされるので、DR まで読んで外す
+    */
+    uint32_t rtc_ticks(void){
+        uint32_t ssr;
+        uint32_t tr;
+        do {
+            ssr = RTC->SSR;
+            tr = RTC->TR;
+            (void)RTC->DR;
+        } while (ssr != RTC->SSR);
+
+        const uint32_t seconds = bcd_to_bin((tr & (RTC_TR_HT | RTC_TR_HU)) >> RTC_TR_HU_Pos) * 3600
+                               + bcd_to_bin((tr & (RTC_TR_MNT | RTC_TR_MNU)) >> RTC_TR_MNU_Pos) * 60
+                               + bcd_to_bin((tr & (RTC_TR_ST | RTC_TR_SU)) >> RTC_TR_SU_Pos);
+        return seconds * (RTC_SYNC_PREDIV + 1) + (RTC_SYNC_PREDIV - ssr);
+    }
+
+    /*!
+        @brief  rtc_ticks() の差  日付の変わり目をまたいでもよい
+    */
+    uint32_t rtc_elapsed(uint32_t from, uint32_t to){
+        const uint32_t day = SECONDS_PER_DAY * (RTC_SYNC_PREDIV + 1);
+        return (to >= from) ? to - from : day - from + to;
+    }
+}
+
+//  RTCのウェイクアップ割り込み  STOPモードから起こすだけ
+//  （STM32RTC ライブラリも同じハンドラを持つので、そのライブラリとは一緒に使わない）
+extern "C" void RTC_WKUP_IRQHandler(void){
+    HAL_RTCEx_WakeUpTimerIRQHandler(&rtc_handle);
+}
+
+/*!
+    @brief  LSIでRTCを動かし、秒以下のカウンタの周波数をシステムクロック（HSE）と比べて求める (private)
+            LSI は個体差が大きい（30〜50kHz）ので、眠った時間はこの周波数で換算する
+    @return RTCの秒以下のカウンタの周波数 [Hz]
+*/
+uint32_t LowPower::hw_begin(void){
+    RCC_OscInitTypeDef osc = {0};
+    RCC_PeriphCLKInitTypeDef clock = {0};
+
+    __HAL_RCC_PWR_CLK_ENABLE();
+    HAL_PWR_EnableBkUpAccess();
+
+    osc.OscillatorType = RCC_OSCILLATORTYPE_LSI;
+    osc.LSIState = RCC_LSI_ON;
+    osc.PLL.PLLState = RCC_PLL_NONE;
+    HAL_RCC_OscConfig(&osc);
+
+    clock.PeriphClockSelection = RCC_PERIPHCLK_RTC;
+    clock.RTCClockSelection = RCC_RTCCLKSOURCE_LSI;
+    HAL_RCCEx_PeriphCLKConfig(&clock);
+    __HAL_RCC_RTC_ENABLE();
+
+    rtc_handle.Instance = RTC;
+    rtc_handle.Init.HourFormat = RTC_HOURFORMAT_24;
+    rtc_handle.Init.AsynchPrediv = RTC_ASYNC_PREDIV;
+    rtc_handle.Init.SynchPrediv = RTC_SYNC_PREDIV;
+    rtc_handle.Init.OutPut = RTC_OUTPUT_DISABLE;
+    HAL_RTC_Init(&rtc_handle);
+
+    HAL_NVIC_SetPriority(RTC_WKUP_IRQn, 0, 0);
+    HAL_NVIC_EnableIRQ(RTC_WKUP_IRQn);
+
+    const uint32_t rtc_start = rtc_ticks();
+    const uint32_t start = micros();
+    delay(CALIBRATION_TIME);
+    const uint32_t rtc_end = rtc_ticks();
+    const uint32_t end = micros();
+
+    return (uint32_t)((uint64_t)rtc_elapsed(rtc_start, rtc_end) * 1000000 / (end - start));
+}
+
+/*!
+    @brief  WFI で次の割り込みまで眠る. SysTick が 1ms ごとに起こすので時間は見ない (private)
+*/
+void LowPower::hw_idle(uint32_t ms){
+    (void)ms;
+    HAL_PWR_EnterSLEEPMode(PWR_MAINREGULATOR_ON, PWR_SLEEPENTRY_WFI);
+}
+
+/*!
+    @brief  RTCのウェイクアップタイマを掛けてSTOPモードに入る (private)
+            起きるとクロックはHSIに戻っているので SystemClock_Config() をやり直す.
+            眠った時間はRTCで測り、HALのティック（millis()）に足す
+    @return 眠った時間 [ms]
+*/
+uint32_t LowPower::hw_stop(uint32_t ms){
+    //  ウェイクアップタイマは RTCCLK/16 = LSI/16 = rtc_hz/8 で数える
+    uint32_t count = (uint32_t)((uint64_t)ms * (rtc_hz / 8) / 1000);
+    if (count == 0){
+        count = 1;
+    }
+    if (count > 0x10000){
+        count = 0x10000;
+    }
+
+    const uint32_t rtc_start = rtc_ticks();
+    HAL_RTCEx_SetWakeUpTimer_IT(&rtc_handle, count - 1, RTC_WAKEUPCLOCK_RTCCLK_DIV16);
+
+    HAL_SuspendTick();
+    HAL_PWR_EnterSTOPMode(PWR_LOWPOWERREGULATOR_ON, PWR_STOPENTRY_WFI);
+    SystemClock_Config();
+    HAL_ResumeTick();
+
+    HAL_RTCEx_DeactivateWakeUpTimer(&rtc_handle);
+    __HAL_RTC_WAKEUPTIMER_CLEAR_FLAG(&rtc_handle, RTC_FLAG_WUTF);
+    __HAL_RTC_WAKEUPTIMER_EXTI_CLEAR_FLAG();
+    HAL_NVIC_ClearPendingIRQ(RTC_WKUP_IRQn);
+
+    //  STOPの後はカレンダーのシャドウレジスタが古いので、同期を待ってから読む
+    HAL_RTC_WaitForSynchro(&rtc_handle);
+    const uint32_t slept = (uint32_t)((uint64_t)rtc_elapsed(rtc_start, rtc_ticks()) * 1000 / rtc_hz);
+    uwTick += slept;
+
+    //  受信で起きた時は、割り込みを許可するとUARTのISRがバイトを受信バッファに移す
+    if (wake_uart && __HAL_UART_GET_FLAG(wake_uart, UART_FLAG_RXNE)){
+        f_wake = true;
+    }
+
+    return slept;
+}
+
+/*!
+    @brief  UARTのクロックをHSIにして、STOPの間も受信できるようにする (private)
+            受信データが入ると（RXNE）UARTのウェイクアップのEXTIでSTOPから起きる
+*/
+void LowPower::hw_wake_on_receive(HardwareSerial& serial){
+    //  STOPの間はHSEとPLLが止まるので、ボーレートはHSIから作る
+    serial.configForLowPower();
+    wake_uart = serial.getHandle();
+
+    UART_WakeUpTypeDef wakeup = {0};
+    wakeup.WakeUpEvent = UART_WAKEUP_ON_READDATA_NONEMPTY;
+    HAL_UARTEx_StopModeWakeUpSourceConfig(wake_uart, wakeup);
+    HAL_UARTEx_EnableStopMode(wake_uart);
+
+    //  USART1 のウェイクアップは EXTI 25
+    EXTI->IMR |= EXTI_IMR_MR25;
+}
@@ -0,0 +1,89 @@
+/**************************************************************************/
+/*!
+    @file     MCP23008.cpp
+    @author   Masa
+
+        MCP23008 I/O expander driver on the shared I2C bus
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "MCP23008.h"
+
+/*!
+    @brief  バスに登録してレジスタを既定値にする
+    @param i2c_address I2Cアドレス
+    @param bus 共有I2Cバス
+    @return True:デバイスが応答した
+*/
+bool MCP23008::begin(uint8_t i2c_address, I2cBus *bus){
+    MCP23008::bus = bus;
+    device = bus->addDevice(i2c_address, I2C_CLOCK_FAST_PLUS, "PIO");
+
+    if (!bus->probe(device)){
+        return false;
+    }
+
+    iodir = 0xFF;
+    gppu = 0x00;
+    olat = 0x00;
+    return write_register(REG_IODIR, iodir)
+        && write_register(REG_GPPU, gppu)
+        && write_register(REG_OLAT, olat);
+}
+
+/*!
+    @brief  ピンの入出力を設定する
+    @param mode INPUT or OUTPUT
+*/
+bool MCP23008::pinMode(uint8_t pin, uint8_t mode){
+    iodir = set_bit(iodir, pin, mode == INPUT);
+    return write_register(REG_IODIR, iodir);
+}
+
+/*!
+    @brief  入力ピンのプルアップ（100kΩ）を設定する
+*/
+bool MCP23008::pullUp(uint8_t pin, uint8_t level){
+    gppu = set_bit(gppu, pin, level == HIGH);
+    return write_register(REG_GPPU, gppu);
+}
+
+/*!
+    @brief  出力ピンのレベルを設定する. 出力ラッチの控えを使うので書き込み1回
+*/
+bool MCP23008::digitalWrite(uint8_t pin, uint8_t level){
+    olat = set_bit(olat, pin, level == HIGH);
+    return write_register(REG_OLAT, olat);
+}
+
+/*!
+    @brief  ピンのレベルを読む
+    @return HIGH or LOW  読めなければ LOW
+*/
+uint8_t MCP23008::digitalRead(uint8_t pin){
+    const uint8_t reg = REG_GPIO;
+    uint8_t value = 0;
+
+    if (!bus->writeRead(device, &reg, 1, &value, 1)){
+        return LOW;
+    }
+    return (value >> (pin & 0x07)) & 0x01;
+}
+
+/*!
+    @brief  レジスタに書き込む (private)
+*/
+bool MCP23008::write_register(uint8_t reg, uint8_t value){
+    const uint8_t packet[2] = {reg, value};
+    return bus->write(device, packet, 2);
+}
+
+/*!
+    @brief  ビットを立てる・落とす (private)
+*/
+uint8_t MCP23008::set_bit(uint8_t value, uint8_t pin, bool f_set){
+    const uint8_t mask = 1 << (pin & 0x07);
+    return f_set ? (value | mask) : (value & ~mask);
+}
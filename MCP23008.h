@@ -0,0 +1,51 @@
+/**************************************************************************/
+/*!
+    @file     MCP23008.h
+
+    8bit I/O エクスパンダ MCP23008 のドライバ
+        共有I2Cバス（I2cBus）を使う. IODIR・GPPU・OLAT はここに控えを持ち、
+        pinMode / pullUp / digitalWrite はレジスタを読まずに1回の書き込みで済ませる.
+*/
+/**************************************************************************/
+
+#ifndef _MCP23008_H_
+#define _MCP23008_H_
+
+#include "I2cBus.h"
+
+constexpr uint8_t MCP23008_I2CADDR_DEFAULT = 0x20;
+
+class MCP23008 {
+
+  public:
+    //  レジスタ
+    enum Registers : uint8_t {
+      REG_IODIR = 0x00,
+      REG_GPPU = 0x06,
+      REG_GPIO = 0x09,
+      REG_OLAT = 0x0A
+    };
+
+    MCP23008(void){};
+
+    bool begin(uint8_t i2c_address = MCP23008_I2CADDR_DEFAULT, I2cBus *bus = &i2c_bus);
+
+    bool pinMode(uint8_t pin, uint8_t mode);
+    bool pullUp(uint8_t pin, uint8_t level);
+    bool digitalWrite(uint8_t pin, uint8_t level);
+    uint8_t digitalRead(uint8_t pin);
+
+  private:
+    I2cBus *bus = nullptr;
+    int8_t device = -1;
+
+    //  レジスタの控え  電源投入時の値
+    uint8_t iodir = 0xFF;
+    uint8_t gppu = 0x00;
+    uint8_t olat = 0x00;
+
+    bool write_register(uint8_t reg, uint8_t value);
+    static uint8_t set_bit(uint8_t value, uint8_t pin, bool f_set);
+};
+
+#endif // _MCP23008_H_
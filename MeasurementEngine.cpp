@@ -0,0 +1,280 @@
+/**************************************************************************/
+/*!
+    @file     MeasurementEngine.cpp
+    @author   Masa
+
+        Multi-channel measurement: simultaneous single shots and parallel continuous acquisition
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "MeasurementEngine.h"
+
+/*!
+    @brief  計測チャネルを探して初期化する
+            チャネル0は必ず初期化する. 増設のチャネルはADコンバータが応答しなくなったところで終わる
+    @return True:使うチャネルのデバイスがすべて初期化された
+*/
+boolean MeasurementEngine::init(void){
+    boolean f_init_succeed = true;
+
+    for (uint8_t ch = 0; ch < channel_num; ch++){
+        delete units[ch];
+        units[ch] = nullptr;
+    }
+    channel_num = 0;
+
+    for (uint8_t ch = 0; ch < METER_CHANNEL_MAX; ch++){
+        Measurement* unit = new Measurement(LevelMeter, ch);
+
+        if (ch != 0 && !unit->isConnected()){
+            delete unit;
+            break;
+        }
+        if (!unit->init()){
+            f_init_succeed = false;
+        }
+        units[channel_num++] = unit;
+    }
+
+    Serial.print("Meas channels: "); Serial.println(channel_num);
+    return f_init_succeed;
+}
+
+/*!
+    @brief  全チャネルのセンサ長から抵抗値やディレイを設定し直す
+*/
+void MeasurementEngine::renew_sensor_parameter(void){
+    for (uint8_t ch = 0; ch < channel_num; ch++){
+        units[ch]->renew_sensor_parameter();
+    }
+}
+
+/*!
+    @brief  全チャネルの電流源をOnにする. ブロックしない
+            全チャネル同時に立ち上げるので、待ち時間は1チャネル分. 以降は updateCurrent() を頻繁に呼ぶ
+*/
+void MeasurementEngine::startCurrent(void){
+    for (uint8_t ch = 0; ch < channel_num; ch++){
+        units[ch]->startCurrent();
+    }
+}
+
+/*!
+    @brief  全チャネルの電流源の立ち上げを1ステップ進める. ブロックしない
+            負荷に異常のあるチャネルはセンサエラーにし、その時は全チャネルOffにする
+    @return CurrentReady:全チャネル安定した, CurrentFailed:負荷に異常のあるチャネルがあった, それ以外:立ち上げ中
+*/
+CurrentStates MeasurementEngine::updateCurrent(void){
+    CurrentStates state = CurrentReady;
+    boolean f_failed = false;
+
+    for (uint8_t ch = 0; ch < channel_num; ch++){
+        const CurrentStates unit_state = units[ch]->updateCurrent();
+        if (unit_state == CurrentFailed){
+            f_failed = true;
+        } else if (unit_state < state){
+            state = unit_state;
+        }
+    }
+
+    if (f_failed){
+        for (uint8_t ch = 0; ch < channel_num; ch++){
+            if (units[ch]->getCurrentState() == CurrentFailed){
+                LevelMeter->setSensorError(ch);
+            } else {
+                LevelMeter->clearSensorError(ch);
+            }
+        }
+        MeasurementEngine::currentOff();
+        return CurrentFailed;
+    }
+    if (state == CurrentReady){
+        for (uint8_t ch = 0; ch < channel_num; ch++){
+            LevelMeter->clearSensorError(ch);
+        }
+    }
+    return state;
+}
+
+/*!
+    @brief  全チャネルの電流源をOffにする
+*/
+void MeasurementEngine::currentOff(void){
+    for (uint8_t ch = 0; ch < channel_num; ch++){
+        units[ch]->currentOff();
+    }
+}
+
+/*!
+    @brief  全チャネルの電流源の状態を確かめ、電流を供給していないチャネルをセンサエラーにする
+    @return True:全チャネルが正常に電流を供給している
+*/
+boolean MeasurementEngine::checkSources(void){
+    boolean f_success = true;
+
+    for (uint8_t ch = 0; ch < channel_num; ch++){
+        if (!units[ch]->getStatus()){
+            LevelMeter->setSensorError(ch);
+            f_success = false;
+        }
+    }
+    return f_success;
+}
+
+/*!
+    @brief  全チャネルの1回計測を同時に開始する. 以降は updateSingle() を頻繁に呼んで進める
+            全チャネルの電流を先にOnにし、負荷の判定と電流の安定待ちは1回分の時間で済ませる
+    @return True:開始した, False:計測中で開始できなかった
+*/
+boolean MeasurementEngine::startSingle(void){
+    if (single_started != 0){
+        return false;
+    }
+    for (uint8_t ch = 0; ch < channel_num; ch++){
+        if (units[ch]->startSingle()){
+            single_started++;
+        }
+    }
+    return single_started != 0;
+}
+
+/*!
+    @brief  全チャネルの1回計測のステートマシンを1ステップ進める. ブロックしない
+    @return True:このステップで全チャネルの計測が終了した, False:計測中もしくは計測していない
+*/
+boolean MeasurementEngine::updateSingle(void){
+    if (single_started == 0){
+        return false;
+    }
+
+    boolean f_running = false;
+    for (uint8_t ch = 0; ch < channel_num; ch++){
+        if (units[ch]->isSingleRunning()){
+            if (units[ch]->updateSingle()){
+                MeasurementEngine::finish_channel(ch);
+            } else {
+                f_running = true;
+            }
+        }
+    }
+
+    if (f_running){
+        return false;
+    }
+    single_started = 0;
+    return true;
+}
+
+/*!
+    @brief  直前の1回計測が全チャネルで正常に終了したか
+*/
+boolean MeasurementEngine::hasSingleSucceeded(void) const {
+    for (uint8_t ch = 0; ch < channel_num; ch++){
+        if (!units[ch]->hasSingleSucceeded()){
+            return false;
+        }
+    }
+    return true;
+}
+
+/*!
+    @brief  1チャネルの1回計測が終わった  結果のエラーを eh900 に記録する (private)
+*/
+void MeasurementEngine::finish_channel(uint8_t ch){
+    if (units[ch]->hasSingleSucceeded()){
+        LevelMeter->clearSensorError(ch);
+    } else {
+        LevelMeter->setSensorError(ch);
+    }
+}
+
+/*!
+    @brief  全チャネルのAD変換シーケンスを開始する. 結果は readLevel() で受け取る
+    @param f_continuous True:連続計測の変換
+    @return True:どれかのチャネルで開始した, False:全チャネルが変換中で開始できなかった
+*/
+boolean MeasurementEngine::startAcquisition(boolean f_continuous){
+    boolean f_started = false;
+
+    for (uint8_t ch = 0; ch < channel_num; ch++){
+        if (units[ch]->startAcquisition(f_continuous)){
+            f_started = true;
+        }
+    }
+    return f_started;
+}
+
+/*!
+    @brief  全チャネルのAD変換シーケンスを進める. ブロックしないのでループから頻繁に呼ぶこと
+*/
+void MeasurementEngine::poll(void){
+    for (uint8_t ch = 0; ch < channel_num; ch++){
+        units[ch]->poll();
+    }
+}
+
+/*!
+    @brief  完了したチャネルから液面を計算して保存する. ブロックしない
+            変換中のチャネルがなくなった時に、1つでも更新したチャネルがあれば1回分の計測の完了とする
+            （エラーで止まったチャネルは待たない）
+    @param f_estimate True:液面推定を通した値を保存する（連続計測）
+    @return True:全チャネルの今回の計測が終わり、新しい液面を保存した, False:変換中もしくはエラー
+*/
+boolean MeasurementEngine::readLevel(boolean f_estimate){
+    boolean f_pending = false;
+
+    for (uint8_t ch = 0; ch < channel_num; ch++){
+        if (units[ch]->readLevel(f_estimate)){
+            LevelMeter->clearSensorError(ch);
+            f_updated[ch] = true;
+        } else if (units[ch]->isAcquiring()){
+            f_pending = true;
+        }
+    }
+    if (f_pending){
+        return false;
+    }
+
+    boolean f_new = false;
+    for (uint8_t ch = 0; ch < channel_num; ch++){
+        f_new = f_new || f_updated[ch];
+        f_updated[ch] = false;
+    }
+    return f_new;
+}
+
+/*!
+    @brief  全チャネルの液面推定のパラメタを eh900 から読み、推定をやり直す
+*/
+void MeasurementEngine::resetEstimator(void){
+    for (uint8_t ch = 0; ch < channel_num; ch++){
+        units[ch]->resetEstimator();
+    }
+}
+
+/*!
+    @brief  全チャネルのストリーミングのパラメタを eh900 から読む  変換の合間に呼ぶ
+*/
+void MeasurementEngine::configureStream(void){
+    for (uint8_t ch = 0; ch < channel_num; ch++){
+        units[ch]->configureStream();
+        f_updated[ch] = false;
+    }
+}
+
+/*!
+    @brief  アナログモニタ出力の電圧をチャネル0の液面に設定する
+    @param value 液面 [0.1%]
+*/
+void MeasurementEngine::setVmon(uint16_t value){
+    units[0]->setVmon(value);
+}
+
+/*!
+    @brief  アナログモニタ出力を0Vに設定して、計測不能状態を示す
+*/
+void MeasurementEngine::setVmonFailed(void){
+    units[0]->setVmonFailed();
+}
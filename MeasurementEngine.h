@@ -0,0 +1,133 @@
+/**************************************************************************/
+/*!
+    @file     MeasurementEngine.h
+
+    複数の計測チャネル（ADコンバータ・電流源の組とセンサ）をまとめて計測する
+        チャネルごとに Measurement を1つ持ち、I2Cアドレスでデバイスの組を選ぶ.
+        センサ長と補正値は eh900 のチャネルごとのパラメタを使う.
+        チャネル0は必ずあり、増設のチャネルは起動時にADコンバータが応答したものを番号順に使う.
+
+        1回計測は全チャネルの電流を同時にOnにし、負荷の判定と電流の安定待ち（110ms）を1回で済ませる.
+        熱伝導待ちとAD変換もチャネルごとに並んで進むので、Nチャネルでも1チャネルとほぼ同じ時間で終わる.
+        連続計測は全チャネルのAD変換を同時に始め、全チャネルがそろったところで1回分とする.
+        センサエラーはチャネルごとに eh900 に記録する. アナログモニタ出力はチャネル0の液面.
+*/
+/**************************************************************************/
+
+#ifndef _MEASUREMENTENGINE_H_
+#define _MEASUREMENTENGINE_H_
+
+#include <Arduino.h>
+#include "measurement.h"
+#include "eh900_class.h"
+
+class MeasurementEngine {
+
+  public:
+    MeasurementEngine(eh900* pModel) : LevelMeter(pModel){};
+
+    ~MeasurementEngine(){
+      for (uint8_t ch = 0; ch < channel_num; ch++){
+        delete units[ch];
+      }
+    }
+
+    boolean init(void);
+    void renew_sensor_parameter(void);
+
+    /*!
+    @brief  使っている計測チャネルの数
+    */
+    uint8_t getChannelCount(void) const {
+      return channel_num;
+    };
+
+    /*!
+    @brief  チャネルの計測ユニット
+    @param ch チャネル番号（getChannelCount() 未満）
+    */
+    Measurement& getMeasurement(uint8_t ch){
+      return *units[ch];
+    };
+
+  //  電流源制御（全チャネル）
+
+    void startCurrent(void);
+    CurrentStates updateCurrent(void);
+    void currentOff(void);
+    boolean checkSources(void);
+
+  //  計測
+
+    boolean startSingle(void);
+    boolean updateSingle(void);
+
+    /*!
+    @brief  1回計測の途中かどうか（どれかのチャネルが計測中）
+    */
+    boolean isSingleRunning(void) const {
+      return single_started != 0;
+    };
+
+    boolean hasSingleSucceeded(void) const;
+
+    boolean startAcquisition(boolean f_continuous = false);
+    void poll(void);
+    boolean readLevel(boolean f_estimate = false);
+
+  //  連続計測の液面推定・高速ストリーミング（全チャネル同じ設定）
+
+    void resetEstimator(void);
+    void configureStream(void);
+
+    /*!
+    @brief  液面推定を使うか
+    */
+    boolean isEstimating(void) const {
+      return units[0]->isEstimating();
+    };
+
+    /*!
+    @brief  ストリーミングを使うか
+    */
+    boolean isStreaming(void) const {
+      return units[0]->isStreaming();
+    };
+
+    /*!
+    @brief  連続計測の液面の更新周期の見積り [us]  チャネルごとのADコンバータは並んで変換する
+    */
+    uint32_t getUpdatePeriod(uint32_t poll_period) const {
+      return units[0]->getUpdatePeriod(poll_period);
+    };
+
+    /*!
+    @brief  チャネル0の直前の液面の雑音の見積り [0.01%]
+    */
+    uint16_t getLevelNoise(void) const {
+      return units[0]->getLevelNoise();
+    };
+
+  //  モニタ出力制御（チャネル0）
+
+    void setVmon(uint16_t value);
+    void setVmonFailed(void);
+
+  private:
+    //  液面計パラメタクラス
+    eh900* LevelMeter = nullptr;
+
+    //  チャネルごとの計測ユニット
+    Measurement* units[METER_CHANNEL_MAX] = {};
+    uint8_t channel_num = 0;
+
+    //  1回計測を始めたチャネルの数  0なら1回計測をしていない
+    uint8_t single_started = 0;
+
+    //  連続計測の今回の回で、液面を更新したチャネル
+    boolean f_updated[METER_CHANNEL_MAX] = {};
+
+    void finish_channel(uint8_t ch);
+};
+
+#endif // _MEASUREMENTENGINE_H_
@@ -0,0 +1,44 @@
+/**************************************************************************/
+/*!
+    @file     NvStorage.h
+
+    不揮発メモリ（FRAM）への読み書きの窓口
+    Arduinoに依存しないので、ホストでは配列で模擬したメモリに差し替えて使える
+*/
+/**************************************************************************/
+
+#ifndef _NVSTORAGE_H_
+#define _NVSTORAGE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*!
+    @brief  不揮発メモリの読み書きのインターフェース
+            連続した領域をまとめて（バースト）読み書きする
+*/
+class NvStorage {
+
+  public:
+    virtual ~NvStorage(){};
+
+    /*!
+    @brief  連続した領域を書き込む
+    @param addr 書き込み開始アドレス
+    @param data データ
+    @param length 長さ[byte]
+    @return True:書き込めた
+    */
+    virtual bool write(uint16_t addr, const uint8_t* data, size_t length) = 0;
+
+    /*!
+    @brief  連続した領域を読み込む
+    @param addr 読み込み開始アドレス
+    @param data 読み込み先
+    @param length 長さ[byte]
+    @return True:読み込めた
+    */
+    virtual bool read(uint16_t addr, uint8_t* data, size_t length) = 0;
+};
+
+#endif // _NVSTORAGE_H_
@@ -0,0 +1,234 @@
+/**************************************************************************/
+/*!
+    @file     ParamStore.cpp
+    @author   Masa
+
+        A/B slot parameter store with CRC, version and dirty-range writes
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include <string.h>
+#include "ParamStore.h"
+#include "TelemetryFrame.h"
+
+namespace{
+    //  スロットの識別子 "PS"
+    constexpr uint16_t SLOT_MAGIC = 0x5350;
+    //  変更のない部分がこれより短ければ、前後の変更とまとめて1回で書く[byte]
+    constexpr uint16_t MERGE_GAP = 4;
+
+    void put16(uint8_t* p, uint16_t value){
+        p[0] = value & 0xFF;
+        p[1] = value >> 8;
+    }
+
+    uint16_t get16(const uint8_t* p){
+        return p[0] | ((uint16_t)p[1] << 8);
+    }
+
+    uint32_t get32(const uint8_t* p){
+        return get16(p) | ((uint32_t)get16(p + 2) << 16);
+    }
+
+    //  ヘッダとパラメタのCRC（crcの欄は除く）
+    uint16_t slot_crc(const uint8_t* slot, uint16_t length){
+        constexpr uint16_t CRC_OFFSET = PARAM_STORE_HEADER_SIZE - 2;
+        uint8_t buf[PARAM_STORE_SLOT_SIZE];
+
+        memcpy(buf, slot, CRC_OFFSET);
+        memcpy(buf + CRC_OFFSET, slot + PARAM_STORE_HEADER_SIZE, length);
+        return telemetry_crc16(buf, CRC_OFFSET + length);
+    }
+}
+
+/*!
+    @brief  両方のスロットを読み込み、新しい方の有効なスロットを選ぶ
+    @param addr_a スロットAのアドレス
+    @param addr_b スロットBのアドレス
+    @return True:有効なパラメタがある
+*/
+bool ParamStore::begin(uint16_t addr_a, uint16_t addr_b){
+  slot_addr[0] = addr_a;
+  slot_addr[1] = addr_b;
+  active = -1;
+  seq = 0;
+
+  for (uint8_t slot = 0; slot < 2; slot++){
+    read_slot(slot);
+
+    uint32_t slot_seq = 0;
+    if (check_slot(slot, slot_seq)){
+      if (active < 0 || (int32_t)(slot_seq - seq) > 0){
+        active = slot;
+        seq = slot_seq;
+      }
+    }
+  }
+  return active >= 0;
+}
+
+/*!
+    @brief  最新のパラメタを取り出す
+    @param image 出力先  PARAM_STORE_IMAGE_MAX byte
+    @param length パラメタの長さ[byte]
+    @param version パラメタの形式の版
+    @return True:取り出せた, False:有効なパラメタがない
+*/
+bool ParamStore::load(uint8_t* image, uint16_t& length, uint16_t& version) const {
+  if (active < 0){
+    return false;
+  }
+  const uint8_t* slot = shadow[active];
+  version = get16(&slot[2]);
+  length = get16(&slot[8]);
+  memcpy(image, &slot[PARAM_STORE_HEADER_SIZE], length);
+  return true;
+}
+
+/*!
+    @brief  パラメタを古い方のスロットに保存する. 
+            変わった範囲のパラメタを書いてから、最後にヘッダを書く
+            最新のスロットと同じ内容なら何も書かない
+    @param image パラメタ
+    @param length パラメタの長さ[byte]  PARAM_STORE_IMAGE_MAX 以下
+    @param version パラメタの形式の版
+    @return True:保存できた
+*/
+bool ParamStore::save(const uint8_t* image, uint16_t length, uint16_t version){
+  if (length > PARAM_STORE_IMAGE_MAX){
+    return false;
+  }
+
+  last_write_bytes = 0;
+
+  //  最新のスロットと同じ内容なら何も書かない（seq も進めない）
+  if (isSameAsActive(image, length, version)){
+    return true;
+  }
+
+  //  有効なスロットがなければ B から使う（A には旧形式のデータが残っていることがある）
+  const uint8_t target = (active < 0) ? 1 : 1 - active;
+  const uint32_t next_seq = seq + 1;
+
+  uint8_t slot[PARAM_STORE_SLOT_SIZE];
+  put16(&slot[0], SLOT_MAGIC);
+  put16(&slot[2], version);
+  put16(&slot[4], next_seq & 0xFFFF);
+  put16(&slot[6], next_seq >> 16);
+  put16(&slot[8], length);
+  memcpy(&slot[PARAM_STORE_HEADER_SIZE], image, length);
+  put16(&slot[10], slot_crc(slot, length));
+
+  //  パラメタ：スロットの写しと違う範囲だけ書く
+  const uint16_t end = PARAM_STORE_HEADER_SIZE + length;
+  uint16_t i = PARAM_STORE_HEADER_SIZE;
+  while (i < end){
+    if (i < shadow_len[target] && slot[i] == shadow[target][i]){
+      i++;
+      continue;
+    }
+    //  変更の範囲を、短い隙間は含めて広げる
+    uint16_t run_end = i + 1;
+    uint16_t gap = 0;
+    while (run_end + gap < end && gap < MERGE_GAP){
+      if (run_end + gap >= shadow_len[target] || slot[run_end + gap] != shadow[target][run_end + gap]){
+        run_end += gap + 1;
+        gap = 0;
+      } else {
+        gap++;
+      }
+    }
+    if (!write_diff(target, slot, i, run_end)){
+      return false;
+    }
+    i = run_end;
+  }
+
+  //  ヘッダ：最後に書いてスロットを有効にする
+  if (!write_diff(target, slot, 0, PARAM_STORE_HEADER_SIZE)){
+    return false;
+  }
+
+  if (shadow_len[target] < end){
+    shadow_len[target] = end;
+  }
+  active = target;
+  seq = next_seq;
+  return true;
+}
+
+/*!
+    @brief  最新のスロットのパラメタと同じか（写しと比べる. FRAMは読まない）
+    @param image パラメタ
+    @param length パラメタの長さ[byte]
+    @param version パラメタの形式の版
+    @return True:版・長さ・内容が同じ
+*/
+bool ParamStore::isSameAsActive(const uint8_t* image, uint16_t length, uint16_t version) const {
+  if (active < 0){
+    return false;
+  }
+  const uint8_t* slot = shadow[active];
+  return get16(&slot[2]) == version && get16(&slot[8]) == length
+      && memcmp(&slot[PARAM_STORE_HEADER_SIZE], image, length) == 0;
+}
+
+/*!
+    @brief  スロットのヘッダと、ヘッダが示す長さのパラメタを写しに読み込む (private)
+*/
+void ParamStore::read_slot(uint8_t slot){
+  uint8_t* data = shadow[slot];
+
+  shadow_len[slot] = 0;
+  if (!storage->read(slot_addr[slot], data, PARAM_STORE_HEADER_SIZE)){
+    return;
+  }
+  shadow_len[slot] = PARAM_STORE_HEADER_SIZE;
+
+  const uint16_t length = get16(&data[8]);
+  if (get16(&data[0]) != SLOT_MAGIC || length > PARAM_STORE_IMAGE_MAX){
+    return;
+  }
+  if (storage->read(slot_addr[slot] + PARAM_STORE_HEADER_SIZE, &data[PARAM_STORE_HEADER_SIZE], length)){
+    shadow_len[slot] += length;
+  }
+}
+
+/*!
+    @brief  スロットの写しのヘッダとCRCを確認する (private)
+*/
+bool ParamStore::check_slot(uint8_t slot, uint32_t& slot_seq) const {
+  const uint8_t* data = shadow[slot];
+  const uint16_t length = get16(&data[8]);
+
+  if (shadow_len[slot] < PARAM_STORE_HEADER_SIZE || get16(&data[0]) != SLOT_MAGIC){
+    return false;
+  }
+  if (length > PARAM_STORE_IMAGE_MAX || shadow_len[slot] < PARAM_STORE_HEADER_SIZE + length){
+    return false;
+  }
+  if (get16(&data[10]) != slot_crc(data, length)){
+    return false;
+  }
+  slot_seq = get32(&data[4]);
+  return true;
+}
+
+/*!
+    @brief  スロットの一部を書き込み、写しを更新する (private)
+    @param slot スロット
+    @param data スロット全体の新しい内容
+    @param from 書き込む範囲の先頭
+    @param to 書き込む範囲の終わり（含まない）
+*/
+bool ParamStore::write_diff(uint8_t slot, const uint8_t* data, uint16_t from, uint16_t to){
+  if (!storage->write(slot_addr[slot] + from, &data[from], to - from)){
+    shadow_len[slot] = 0;
+    return false;
+  }
+  memcpy(&shadow[slot][from], &data[from], to - from);
+  last_write_bytes += to - from;
+  return true;
+}
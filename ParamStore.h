@@ -0,0 +1,89 @@
+/**************************************************************************/
+/*!
+    @file     ParamStore.h
+
+    パラメタを A/B 2つのスロットに交互に保存する不揮発ストア
+    新しい方のスロットが壊れていても（書き込み中の電源断など）古い方から読み出せる
+
+    スロットの形式（リトルエンディアン）:
+        [0-1]   magic       "PS"
+        [2-3]   version     パラメタの形式の版
+        [4-7]   seq         保存するたびに増える番号  大きい方が新しい
+        [8-9]   length      パラメタの長さ[byte]
+        [10-11] crc         CRC-16/CCITT-FALSE ([0]〜[9] とパラメタに対して)
+        [12-]   パラメタ
+
+    保存時は書き込み先のスロットの内容と比べ、変わったバイトの範囲だけを書く.
+    最新のスロットと同じ内容の時は何も書かない.
+    ヘッダは最後に書くので、途中で電源が切れたスロットはCRCで無効になる.
+*/
+/**************************************************************************/
+
+#ifndef _PARAMSTORE_H_
+#define _PARAMSTORE_H_
+
+#include "NvStorage.h"
+
+//  スロットのヘッダ長[byte]
+constexpr uint16_t PARAM_STORE_HEADER_SIZE = 12;
+//  パラメタの最大長[byte]
+constexpr uint16_t PARAM_STORE_IMAGE_MAX = 116;
+//  スロットの大きさ[byte]
+constexpr uint16_t PARAM_STORE_SLOT_SIZE = PARAM_STORE_HEADER_SIZE + PARAM_STORE_IMAGE_MAX;
+
+class ParamStore {
+
+  public:
+    ParamStore(NvStorage* storage) : storage(storage){};
+
+    bool begin(uint16_t addr_a, uint16_t addr_b);
+    bool load(uint8_t* image, uint16_t& length, uint16_t& version) const;
+    bool save(const uint8_t* image, uint16_t length, uint16_t version);
+    bool isSameAsActive(const uint8_t* image, uint16_t length, uint16_t version) const;
+
+    /*!
+    @brief  有効なパラメタがあるか
+    */
+    bool isValid(void) const {
+      return active >= 0;
+    };
+
+    /*!
+    @brief  最新のパラメタのスロット  0:A, 1:B, -1:なし
+    */
+    int8_t getActiveSlot(void) const {
+      return active;
+    };
+
+    /*!
+    @brief  最新のパラメタのシーケンス番号
+    */
+    uint32_t getSequence(void) const {
+      return seq;
+    };
+
+    /*!
+    @brief  直前の save() で書き込んだバイト数（ヘッダを含む）
+    */
+    uint16_t getLastWriteBytes(void) const {
+      return last_write_bytes;
+    };
+
+  private:
+    NvStorage* storage;
+    uint16_t slot_addr[2] = {0, 0};
+
+    //  各スロットのFRAM上の内容の写し（差分書き込み用）と、写しが正しい範囲[byte]
+    uint8_t shadow[2][PARAM_STORE_SLOT_SIZE];
+    uint16_t shadow_len[2] = {0, 0};
+
+    int8_t active = -1;
+    uint32_t seq = 0;
+    uint16_t last_write_bytes = 0;
+
+    void read_slot(uint8_t slot);
+    bool check_slot(uint8_t slot, uint32_t& slot_seq) const;
+    bool write_diff(uint8_t slot, const uint8_t* data, uint16_t from, uint16_t to);
+};
+
+#endif // _PARAMSTORE_H_
@@ -0,0 +1,100 @@
+/**************************************************************************/
+/*!
+    @file     Profiler.cpp
+    @author   Masa
+
+        Per-section cycle count profiler with stack / heap high-water marks
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "Profiler.h"
+
+namespace{
+    //  区間の名前  ProfileSections と順番を合わせること
+    const char* const PROFILE_NAMES[PROF_SECTION_NUM] = {
+        "readLevel",
+        "read_voltage",
+        "read_current",
+        "setVmon",
+        "showMeter",
+        "showLevel",
+        "showMode",
+        "showTimer",
+        "submit_status",
+        "isr_meas_sw",
+        "isr_disp_update",
+        "fram",
+    };
+}
+
+/*!
+    @brief  統計とメモリの最大使用位置をクリアする
+*/
+void Profiler::reset(void){
+  for (uint8_t i = 0; i < PROF_SECTION_NUM; i++){
+    stats[i] = ProfileStats{0, UINT32_MAX, 0, 0};
+  }
+  stack_low = UINT32_MAX;
+  heap_high = 0;
+}
+
+/*!
+    @brief  区間の実行1回分を記録する. あわせてメモリの使用位置も記録する
+    @param section 区間
+    @param cycles サイクル数
+*/
+void Profiler::record(uint8_t section, uint32_t cycles){
+  if (section >= PROF_SECTION_NUM){
+    return;
+  }
+  ProfileStats& s = stats[section];
+  s.count++;
+  s.total += cycles;
+  if (cycles < s.min){
+    s.min = cycles;
+  }
+  if (cycles > s.max){
+    s.max = cycles;
+  }
+
+  sampleMemory();
+}
+
+/*!
+    @brief  今のスタックポインタとヒープの先頭を読み、最大使用位置を更新する
+*/
+void Profiler::sampleMemory(void){
+  if (!memory_probe){
+    return;
+  }
+  uint32_t stack = 0;
+  uint32_t heap = 0;
+  memory_probe(stack, heap);
+  if (stack < stack_low){
+    stack_low = stack;
+  }
+  if (heap > heap_high){
+    heap_high = heap;
+  }
+}
+
+/*!
+    @brief  区間の平均サイクル数
+    @param section 区間
+    @return 平均  記録がなければ0
+*/
+uint32_t Profiler::getAverage(uint8_t section) const {
+  const ProfileStats& s = getStats(section);
+  return s.count ? (uint32_t)(s.total / s.count) : 0;
+}
+
+/*!
+    @brief  区間の名前
+    @param section 区間
+    @return 名前, 不明な区間なら "?"
+*/
+const char* profile_name(uint8_t section){
+  return (section < PROF_SECTION_NUM) ? PROFILE_NAMES[section] : "?";
+}
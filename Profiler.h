@@ -0,0 +1,136 @@
+/**************************************************************************/
+/*!
+    @file     Profiler.h
+
+    処理区間ごとの実行サイクル数（最小・平均・最大・回数）と
+    スタック・ヒープの最大使用位置を記録するプロファイラ
+    サイクル数とメモリの読み取りは関数で与える（実機はDWTのサイクルカウンタ, ホストでは仮想の値）
+
+    PROFILE_SCOPE(section) をブロックの先頭に置くと、ブロックを抜けるまでを1回として記録する
+    PROFILE_ENABLE を 0 にすると何もコンパイルされない
+*/
+/**************************************************************************/
+
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef PROFILE_ENABLE
+#define PROFILE_ENABLE 1
+#endif
+
+//  計測する区間  PROFILE_NAMES と順番を合わせること
+enum ProfileSections : uint8_t {
+    PROF_READ_LEVEL,
+    PROF_READ_VOLTAGE,
+    PROF_READ_CURRENT,
+    PROF_SET_VMON,
+    PROF_SHOW_METER,
+    PROF_SHOW_LEVEL,
+    PROF_SHOW_MODE,
+    PROF_SHOW_TIMER,
+    PROF_SUBMIT_STATUS,
+    PROF_ISR_SWITCH,
+    PROF_ISR_DISP_UPDATE,
+    PROF_FRAM,
+    PROF_SECTION_NUM
+};
+
+//  サイクル数を返す関数
+typedef uint32_t (*CycleFunction)(void);
+
+//  スタックポインタとヒープの先頭を返す関数
+typedef void (*MemoryFunction)(uint32_t& stack, uint32_t& heap);
+
+/*!
+    @brief  区間ごとの統計
+*/
+struct ProfileStats {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+};
+
+class Profiler {
+
+  public:
+    Profiler(CycleFunction cycles, MemoryFunction memory = nullptr) : cycle_source(cycles), memory_probe(memory){
+      reset();
+    };
+
+    void reset(void);
+    void record(uint8_t section, uint32_t cycles);
+    void sampleMemory(void);
+
+    /*!
+    @brief  今のサイクル数
+    */
+    uint32_t now(void) const {
+      return cycle_source ? cycle_source() : 0;
+    };
+
+    /*!
+    @brief  区間の統計
+    */
+    const ProfileStats& getStats(uint8_t section) const {
+      return stats[section < PROF_SECTION_NUM ? section : 0];
+    };
+
+    uint32_t getAverage(uint8_t section) const;
+
+    /*!
+    @brief  これまでで一番低いスタックポインタ（スタックの最大使用位置）
+    */
+    uint32_t getStackLow(void) const {
+      return stack_low;
+    };
+
+    /*!
+    @brief  これまでで一番高いヒープの先頭（ヒープの最大使用位置）
+    */
+    uint32_t getHeapHigh(void) const {
+      return heap_high;
+    };
+
+  private:
+    CycleFunction cycle_source;
+    MemoryFunction memory_probe;
+
+    ProfileStats stats[PROF_SECTION_NUM];
+    uint32_t stack_low;
+    uint32_t heap_high;
+};
+
+/*!
+    @brief  生成から破棄までのサイクル数を記録する（PROFILE_SCOPE で使う）
+*/
+class ProfileScope {
+
+  public:
+    ProfileScope(Profiler& profiler, uint8_t section) : profiler(profiler), section(section), start(profiler.now()){};
+
+    ~ProfileScope(){
+      profiler.record(section, profiler.now() - start);
+    };
+
+  private:
+    Profiler& profiler;
+    const uint8_t section;
+    const uint32_t start;
+};
+
+const char* profile_name(uint8_t section);
+
+//  プロファイラの実体（EH900_main.ino で定義）
+extern Profiler profiler;
+
+#if PROFILE_ENABLE
+#define PROFILE_SCOPE(section)  ProfileScope profile_scope_(profiler, (section))
+#else
+#define PROFILE_SCOPE(section)  ((void)0)
+#endif
+
+#endif // _PROFILER_H_
@@ -0,0 +1,301 @@
+/**************************************************************************/
+/*!
+    @file     TelemetryFrame.cpp
+    @author   Masa
+
+        COBS framed binary telemetry record (encoder / decoder)
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "TelemetryFrame.h"
+
+/*!
+    @brief  CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) を計算する
+    @param data データ
+    @param length 長さ[byte]
+    @return CRC
+*/
+uint16_t telemetry_crc16(const uint8_t* data, size_t length){
+  uint16_t crc = 0xFFFF;
+
+  for (size_t i = 0; i < length; i++){
+    crc ^= (uint16_t)data[i] << 8;
+    for (uint8_t bit = 0; bit < 8; bit++){
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+/*!
+    @brief  COBSで符号化する. 出力に0x00は含まれない（区切りは付けない）
+    @param src 元データ
+    @param length 元データの長さ[byte]
+    @param dst 出力先  length + length/254 + 1 byte 以上
+    @return 出力の長さ[byte]
+*/
+size_t cobs_encode(const uint8_t* src, size_t length, uint8_t* dst){
+  size_t read = 0;
+  size_t write = 1;
+  size_t code_pos = 0;
+  uint8_t code = 1;
+
+  while (read < length){
+    if (src[read] == 0){
+      dst[code_pos] = code;
+      code_pos = write++;
+      code = 1;
+    } else {
+      dst[write++] = src[read];
+      code++;
+      if (code == 0xFF){
+        dst[code_pos] = code;
+        code_pos = write++;
+        code = 1;
+      }
+    }
+    read++;
+  }
+  dst[code_pos] = code;
+
+  return write;
+}
+
+/*!
+    @brief  COBSを復号する
+    @param src 符号化データ（区切りの0x00は含まない）
+    @param length 符号化データの長さ[byte]
+    @param dst 出力先  length byte 以上
+    @return 出力の長さ[byte], 不正なデータなら0
+*/
+size_t cobs_decode(const uint8_t* src, size_t length, uint8_t* dst){
+  size_t read = 0;
+  size_t write = 0;
+
+  while (read < length){
+    const uint8_t code = src[read++];
+    if (code == 0 || read + code - 1 > length){
+      return 0;
+    }
+    for (uint8_t i = 1; i < code; i++){
+      dst[write++] = src[read++];
+    }
+    if (code != 0xFF && read < length){
+      dst[write++] = 0;
+    }
+  }
+  return write;
+}
+
+/*!
+    @brief  レコード（type + 内容 + crc）を組み立ててフレームにする
+    @param type レコード種別
+    @param payload 内容
+    @param length 内容の長さ[byte]  TELEMETRY_RECORD_MAX - 3 以下
+    @param frame 出力先  TELEMETRY_FRAME_SIZE byte 以上
+    @return フレームの長さ[byte]（区切りの0x00を含む）
+*/
+static size_t pack_record(uint8_t type, const uint8_t* payload, size_t length, uint8_t* frame){
+  uint8_t raw[TELEMETRY_RECORD_MAX];
+
+  raw[0] = type;
+  for (size_t i = 0; i < length; i++){
+    raw[1 + i] = payload[i];
+  }
+
+  const uint16_t crc = telemetry_crc16(raw, length + 1);
+  raw[length + 1] = crc & 0xFF;
+  raw[length + 2] = crc >> 8;
+
+  size_t frame_length = cobs_encode(raw, length + 3, frame);
+  frame[frame_length++] = 0x00;
+
+  return frame_length;
+}
+
+/*!
+    @brief  フレームを復号し、長さ・種別・CRCを確認して内容を取り出す
+    @param frame フレーム（区切りの0x00はあってもなくてもよい）
+    @param length フレームの長さ[byte]
+    @param type 期待するレコード種別
+    @param payload 内容の出力先
+    @param payload_length 期待する内容の長さ[byte]
+    @return True:正しいレコード
+*/
+static bool unpack_record(const uint8_t* frame, size_t length, uint8_t type, uint8_t* payload, size_t payload_length){
+  uint8_t raw[TELEMETRY_FRAME_SIZE];
+
+  if (length > 0 && frame[length - 1] == 0x00){
+    length--;
+  }
+  if (length > TELEMETRY_FRAME_SIZE){
+    return false;
+  }
+  if (cobs_decode(frame, length, raw) != payload_length + 3){
+    return false;
+  }
+  if (raw[0] != type){
+    return false;
+  }
+
+  const uint16_t crc = raw[payload_length + 1] | ((uint16_t)raw[payload_length + 2] << 8);
+  if (crc != telemetry_crc16(raw, payload_length + 1)){
+    return false;
+  }
+
+  for (size_t i = 0; i < payload_length; i++){
+    payload[i] = raw[1 + i];
+  }
+  return true;
+}
+
+/*!
+    @brief  ステータスレコードをフレームにする
+    @param record レコードの内容
+    @param frame 出力先  TELEMETRY_FRAME_SIZE byte 以上
+    @return フレームの長さ[byte]（区切りの0x00を含む）
+*/
+size_t telemetry_pack_status(const StatusRecord& record, uint8_t* frame){
+  uint8_t payload[TELEMETRY_RECORD_SIZE - 3];
+
+  payload[0] = record.seq;
+  payload[1] = record.flags;
+  payload[2] = record.sensor_length;
+  payload[3] = record.timer_period & 0xFF;
+  payload[4] = record.timer_period >> 8;
+  payload[5] = record.liquid_level & 0xFF;
+  payload[6] = record.liquid_level >> 8;
+
+  return pack_record(TELEMETRY_TYPE_STATUS, payload, sizeof(payload), frame);
+}
+
+/*!
+    @brief  フレームからステータスレコードを取り出す
+    @param frame フレーム（区切りの0x00はあってもなくてもよい）
+    @param length フレームの長さ[byte]
+    @param record 出力先
+    @return True:正しいレコード, False:長さ・種別・CRCのいずれかが不正
+*/
+bool telemetry_unpack_status(const uint8_t* frame, size_t length, StatusRecord& record){
+  uint8_t payload[TELEMETRY_RECORD_SIZE - 3];
+
+  if (!unpack_record(frame, length, TELEMETRY_TYPE_STATUS, payload, sizeof(payload))){
+    return false;
+  }
+
+  record.seq = payload[0];
+  record.flags = payload[1];
+  record.sensor_length = payload[2];
+  record.timer_period = payload[3] | ((uint16_t)payload[4] << 8);
+  record.liquid_level = payload[5] | ((uint16_t)payload[6] << 8);
+
+  return true;
+}
+
+/*!
+    @brief  履歴レコードを13byteの形式に並べる
+    @param record 履歴レコード
+    @param data 出力先  TELEMETRY_HISTORY_SIZE byte
+*/
+void telemetry_serialize_history(const HistoryRecord& record, uint8_t* data){
+  data[0] = record.seq & 0xFF;
+  data[1] = record.seq >> 8;
+  data[2] = record.timestamp & 0xFF;
+  data[3] = (record.timestamp >> 8) & 0xFF;
+  data[4] = (record.timestamp >> 16) & 0xFF;
+  data[5] = record.timestamp >> 24;
+  data[6] = record.liquid_level & 0xFF;
+  data[7] = record.liquid_level >> 8;
+  data[8] = (uint16_t)record.raw_voltage & 0xFF;
+  data[9] = (uint16_t)record.raw_voltage >> 8;
+  data[10] = (uint16_t)record.raw_current & 0xFF;
+  data[11] = (uint16_t)record.raw_current >> 8;
+  data[12] = record.flags;
+}
+
+/*!
+    @brief  13byteの形式から履歴レコードを取り出す
+    @param data 入力  TELEMETRY_HISTORY_SIZE byte
+    @param record 出力先
+*/
+void telemetry_deserialize_history(const uint8_t* data, HistoryRecord& record){
+  record.seq = data[0] | ((uint16_t)data[1] << 8);
+  record.timestamp = data[2] | ((uint32_t)data[3] << 8) | ((uint32_t)data[4] << 16) | ((uint32_t)data[5] << 24);
+  record.liquid_level = data[6] | ((uint16_t)data[7] << 8);
+  record.raw_voltage = (int16_t)(data[8] | ((uint16_t)data[9] << 8));
+  record.raw_current = (int16_t)(data[10] | ((uint16_t)data[11] << 8));
+  record.flags = data[12];
+}
+
+/*!
+    @brief  履歴レコードをフレームにする
+    @param record 履歴レコード
+    @param frame 出力先  TELEMETRY_FRAME_SIZE byte 以上
+    @return フレームの長さ[byte]（区切りの0x00を含む）
+*/
+size_t telemetry_pack_history(const HistoryRecord& record, uint8_t* frame){
+  uint8_t payload[TELEMETRY_HISTORY_SIZE];
+
+  telemetry_serialize_history(record, payload);
+  return pack_record(TELEMETRY_TYPE_HISTORY, payload, sizeof(payload), frame);
+}
+
+/*!
+    @brief  フレームから履歴レコードを取り出す
+    @param frame フレーム（区切りの0x00はあってもなくてもよい）
+    @param length フレームの長さ[byte]
+    @param record 出力先
+    @return True:正しいレコード, False:長さ・種別・CRCのいずれかが不正
+*/
+bool telemetry_unpack_history(const uint8_t* frame, size_t length, HistoryRecord& record){
+  uint8_t payload[TELEMETRY_HISTORY_SIZE];
+
+  if (!unpack_record(frame, length, TELEMETRY_TYPE_HISTORY, payload, sizeof(payload))){
+    return false;
+  }
+  telemetry_deserialize_history(payload, record);
+  return true;
+}
+
+/*!
+    @brief  トレースイベントをフレームにする
+    @param event イベント
+    @param frame 出力先  TELEMETRY_FRAME_SIZE byte 以上
+    @return フレームの長さ[byte]（区切りの0x00を含む）
+*/
+size_t telemetry_pack_trace(const TraceEvent& event, uint8_t* frame){
+  uint8_t payload[TELEMETRY_TRACE_SIZE];
+
+  payload[0] = event.time & 0xFF;
+  payload[1] = (event.time >> 8) & 0xFF;
+  payload[2] = (event.time >> 16) & 0xFF;
+  payload[3] = event.time >> 24;
+  payload[4] = event.id;
+  payload[5] = (uint32_t)event.value & 0xFF;
+  payload[6] = ((uint32_t)event.value >> 8) & 0xFF;
+  payload[7] = ((uint32_t)event.value >> 16) & 0xFF;
+  payload[8] = (uint32_t)event.value >> 24;
+
+  return pack_record(TELEMETRY_TYPE_TRACE, payload, sizeof(payload), frame);
+}
+
+/*!
+    @brief  フレームからトレースイベントを取り出す
+    @param frame フレーム（区切りの0x00はあってもなくてもよい）
+    @param length フレームの長さ[byte]
+    @param event 出力先
+    @return True:正しいレコード, False:長さ・種別・CRCのいずれかが不正
+*/
+bool telemetry_unpack_trace(const uint8_t* frame, size_t length, TraceEvent& event){
+  uint8_t payload[TELEMETRY_TRACE_SIZE];
+
+  if (!unpack_record(frame, length, TELEMETRY_TYPE_TRACE, payload, sizeof(payload))){
+    return false;
+  }
+  event.time = payload[0] | ((uint32_t)payload[1] << 8) | ((uint32_t)payload[2] << 16) | ((uint32_t)payload[3] << 24);
+  event.id = payload[4];
+  event.value = (int32_t)(payload[5] | ((uint32_t)payload[6] << 8) | ((uint32_t)payload[7] << 16) | ((uint32_t)payload[8] << 24));
+  return true;
+}
@@ -0,0 +1,119 @@
+/**************************************************************************/
+/*!
+    @file     TelemetryFrame.h
+
+    IoTゲートウエイ向けバイナリフレームの定義
+    Arduinoに依存しないので、ゲートウエイ側（ホスト）のデコーダとしてもそのまま使える
+
+    フレーム : COBS(レコード) + 0x00(区切り)
+    レコード（リトルエンディアン）: type(1byte) + 内容 + crc(2byte)
+        crc は CRC-16/CCITT-FALSE (type と内容に対して)
+
+    ステータスレコード TELEMETRY_TYPE_STATUS（10byte）:
+        [0]     type        0x01
+        [1]     seq         シーケンス番号 (0-255で周回)
+        [2]     flags       bit0: センサエラー, bit1-2: モード(0:M 1:T 2:C), bit3-4: 計測チャネル
+        （計測チャネルが複数あれば、チャネルごとに1つ送る. センサ長・液面はそのチャネルのもの）
+        [3]     length      センサ長 [inch]
+        [4-5]   period      タイマ周期 [s]
+        [6-7]   level       液面 [0.1%]
+        [8-9]   crc
+
+    履歴レコード TELEMETRY_TYPE_HISTORY（16byte）:
+        [0]     type        0x02
+        [1-13]  history     HistoryRecord（telemetry_serialize_history の形式）
+        [14-15] crc
+
+    トレースレコード TELEMETRY_TYPE_TRACE（12byte, デバグ用シリアルへ出力）:
+        [0]     type        0x03
+        [1-4]   time        発生時刻 [us]
+        [5]     id          イベントの種類 (TraceLog.h)
+        [6-9]   value       値
+        [10-11] crc
+
+    HistoryRecord の形式（13byte, FRAMの履歴にも同じ形で保存する）:
+        [0-1]   seq         履歴のシーケンス番号
+        [2-5]   timestamp   起動からの時間 [s]
+        [6-7]   level       液面 [0.1%]
+        [8-9]   raw_v       電圧チャネルの平均値 [LSB]
+        [10-11] raw_i       電流チャネルの平均値 [LSB]
+        [12]    flags       ステータスレコードと同じ
+*/
+/**************************************************************************/
+
+#ifndef _TELEMETRYFRAME_H_
+#define _TELEMETRYFRAME_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+//  レコード種別
+constexpr uint8_t TELEMETRY_TYPE_STATUS = 0x01;
+constexpr uint8_t TELEMETRY_TYPE_HISTORY = 0x02;
+constexpr uint8_t TELEMETRY_TYPE_TRACE = 0x03;
+
+//  レコード長[byte]
+constexpr size_t TELEMETRY_RECORD_SIZE = 10;
+constexpr size_t TELEMETRY_HISTORY_SIZE = 13;
+constexpr size_t TELEMETRY_TRACE_SIZE = 9;
+constexpr size_t TELEMETRY_RECORD_MAX = TELEMETRY_HISTORY_SIZE + 3;
+
+//  COBSで符号化したフレームの最大長（区切りの0x00を含む）
+constexpr size_t TELEMETRY_FRAME_SIZE = TELEMETRY_RECORD_MAX + TELEMETRY_RECORD_MAX / 254 + 2;
+
+//  flags のビット
+constexpr uint8_t TELEMETRY_FLAG_SENSOR_ERROR = 0x01;
+constexpr uint8_t TELEMETRY_FLAG_MODE_SHIFT = 1;
+constexpr uint8_t TELEMETRY_FLAG_MODE_MASK = 0x06;
+constexpr uint8_t TELEMETRY_FLAG_CHANNEL_SHIFT = 3;
+constexpr uint8_t TELEMETRY_FLAG_CHANNEL_MASK = 0x18;
+
+/*!
+    @brief  ステータスレコードの内容
+*/
+struct StatusRecord {
+    uint8_t seq;
+    uint8_t flags;
+    uint8_t sensor_length;
+    uint16_t timer_period;
+    uint16_t liquid_level;
+};
+
+/*!
+    @brief  計測履歴1件の内容
+*/
+struct HistoryRecord {
+    uint16_t seq;
+    uint32_t timestamp;
+    uint16_t liquid_level;
+    int16_t raw_voltage;
+    int16_t raw_current;
+    uint8_t flags;
+};
+
+/*!
+    @brief  トレースイベント1件の内容
+*/
+struct TraceEvent {
+    uint32_t time;
+    uint8_t id;
+    int32_t value;
+};
+
+uint16_t telemetry_crc16(const uint8_t* data, size_t length);
+
+size_t cobs_encode(const uint8_t* src, size_t length, uint8_t* dst);
+size_t cobs_decode(const uint8_t* src, size_t length, uint8_t* dst);
+
+size_t telemetry_pack_status(const StatusRecord& record, uint8_t* frame);
+bool telemetry_unpack_status(const uint8_t* frame, size_t length, StatusRecord& record);
+
+void telemetry_serialize_history(const HistoryRecord& record, uint8_t* data);
+void telemetry_deserialize_history(const uint8_t* data, HistoryRecord& record);
+size_t telemetry_pack_history(const HistoryRecord& record, uint8_t* frame);
+bool telemetry_unpack_history(const uint8_t* frame, size_t length, HistoryRecord& record);
+
+size_t telemetry_pack_trace(const TraceEvent& event, uint8_t* frame);
+bool telemetry_unpack_trace(const uint8_t* frame, size_t length, TraceEvent& event);
+
+#endif // _TELEMETRYFRAME_H_
@@ -0,0 +1,87 @@
+/**************************************************************************/
+/*!
+    @file     TraceLog.cpp
+    @author   Masa
+
+        Compact binary trace ring buffer
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "TraceLog.h"
+
+static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "TRACE_RING_SIZE must be a power of 2");
+
+namespace{
+    //  トレースイベントの名前（デコーダ用）  TraceIds と順番を合わせること
+    const char* const TRACE_NAMES[TRACE_ID_NUM] = {
+        "dropped",
+        "current_on",
+        "current_off",
+        "current_set",
+        "single_start",
+        "settled_ms",
+        "single_fin",
+        "adc_error",
+        "raw_v",
+        "raw_i",
+        "voltage_uV",
+        "current_uA",
+        "pair_mohm",
+        "resistance_mohm",
+        "level",
+        "submit",
+        "estimate",
+        "pga_range",
+    };
+}
+
+/*!
+    @brief  イベントを記録する
+    @param id イベントの種類
+    @param value 値
+    @param time 時刻 [us]
+    @return True:記録した, False:一杯で捨てた
+*/
+bool TraceRing::push(uint8_t id, int32_t value, uint32_t time){
+  //  捨てた件数の記録のために1件分は空けておく
+  if (dropped != 0 && count < TRACE_RING_SIZE - 1){
+    ring[head] = TraceEvent{time, TRACE_DROPPED, (int32_t)dropped};
+    head = (head + 1) & (TRACE_RING_SIZE - 1);
+    count++;
+    dropped = 0;
+  }
+  if (count >= TRACE_RING_SIZE - 1){
+    dropped++;
+    return false;
+  }
+
+  ring[head] = TraceEvent{time, id, value};
+  head = (head + 1) & (TRACE_RING_SIZE - 1);
+  count++;
+  return true;
+}
+
+/*!
+    @brief  一番古いイベントを取り出す
+    @param event 出力先
+    @return True:取り出した, False:空
+*/
+bool TraceRing::pop(TraceEvent& event){
+  if (count == 0){
+    return false;
+  }
+  event = ring[(head - count) & (TRACE_RING_SIZE - 1)];
+  count--;
+  return true;
+}
+
+/*!
+    @brief  イベントの名前
+    @param id イベントの種類
+    @return 名前, 不明なIDなら "?"
+*/
+const char* trace_name(uint8_t id){
+  return (id < TRACE_ID_NUM) ? TRACE_NAMES[id] : "?";
+}
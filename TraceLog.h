@@ -0,0 +1,70 @@
+/**************************************************************************/
+/*!
+    @file     TraceLog.h
+
+    計測の途中経過などを、シリアルに文字で出す代わりに記録するトレースのリングバッファ
+    記録は (時刻, ID, 値) の9byteだけで、アイドル時に TELEMETRY_TYPE_TRACE のフレームで出力する
+    Arduinoに依存しないので、ホスト側のデコーダ（extras/trace_decode.cpp）でもそのまま使う
+*/
+/**************************************************************************/
+
+#ifndef _TRACELOG_H_
+#define _TRACELOG_H_
+
+#include "TelemetryFrame.h"
+
+//  リングバッファの大きさ[件]（2のべき乗）
+constexpr uint16_t TRACE_RING_SIZE = 64;
+
+//  トレースイベントの種類  TRACE_NAMES と順番を合わせること
+enum TraceIds : uint8_t {
+    TRACE_DROPPED,          //  バッファが一杯で捨てた件数
+    TRACE_CURRENT_ON,       //  電流源On  1:OK 0:FAIL
+    TRACE_CURRENT_OFF,      //  電流源Off
+    TRACE_CURRENT_SET,      //  電流源の設定 [0.1mA]
+    TRACE_SINGLE_START,     //  1回計測の開始
+    TRACE_SETTLED,          //  熱伝導待ちが収束した [ms]
+    TRACE_SINGLE_FIN,       //  1回計測の終了  1:正常 0:エラー
+    TRACE_ADC_ERROR,        //  AD変換のエラー  1:シーケンス 2:タイムアウト
+    TRACE_RAW_V,            //  電圧チャネルの読み取り値 [LSB]
+    TRACE_RAW_I,            //  電流チャネルの読み取り値 [LSB]
+    TRACE_VOLTAGE,          //  電圧 [uV]
+    TRACE_CURRENT,          //  電流 [uA]
+    TRACE_PAIR_RESISTANCE,  //  組ごとの抵抗値 [mohm]
+    TRACE_RESISTANCE,       //  抵抗値 [mohm]  0は電流が流れていない
+    TRACE_LEVEL,            //  液面 [0.1%]
+    TRACE_SUBMIT,           //  ゲートウエイ送信  1:キューに入れた 0:捨てた
+    TRACE_ESTIMATE,         //  連続計測の液面推定値 [0.1%]
+    TRACE_PGA_RANGE,        //  自動レンジのゲインの変更  ADのチャネル x 16 + PGA_RANGES の添字
+    TRACE_ID_NUM
+};
+
+/*!
+    @brief  トレースイベントのリングバッファ
+            一杯の時は新しいイベントを捨て、捨てた数を次に入れられた時に TRACE_DROPPED で記録する
+*/
+class TraceRing {
+
+  public:
+    TraceRing(void){};
+
+    bool push(uint8_t id, int32_t value, uint32_t time);
+    bool pop(TraceEvent& event);
+
+    /*!
+    @brief  バッファにある件数
+    */
+    uint16_t getCount(void) const {
+      return count;
+    };
+
+  private:
+    TraceEvent ring[TRACE_RING_SIZE];
+    uint16_t head = 0;
+    uint16_t count = 0;
+    uint32_t dropped = 0;
+};
+
+const char* trace_name(uint8_t id);
+
+#endif // _TRACELOG_H_
@@ -3,6 +3,12 @@
 
 #include <rgb_lcd.h>
 #include "eh900_class.h"
+#include "I2cBus.h"
+#include "Profiler.h"
+
+//  LCDの桁数・行数
+constexpr uint8_t LCD_COLS = 16;
+constexpr uint8_t LCD_ROWS = 2;
 
 /*! @class Eh_display
     @brief  ディスプレイを操作するためのクラス rgb_lcdクラスを継承
@@ -21,15 +27,36 @@ class Eh_display : public rgb_lcd {
 
         void showMeter(void);
         void showLevel(void);
-        void showMode(void);
+        void setChannelCount(uint8_t count);
+        void showChannel(uint8_t ch);
+        void showMode(boolean f_blink = true);
         void showTimer(void);
         void flashDisplay(void);
 
+        void flush(void);
+
     private:
         eh900* LevelMeter = nullptr;
 
+        //  表示している計測チャネルと、計測チャネルの数
+        uint8_t channel = 0;
+        uint8_t channel_count = 1;
+
+        //  表示したい内容と、LCDに表示されている内容
+        uint8_t frame[LCD_ROWS][LCD_COLS];
+        uint8_t shown[LCD_ROWS][LCD_COLS];
+
+        //  共有I2Cバスのデバイス番号
+        int8_t lcd_device = -1;
+
+        void clear_frame(void);
+        void put_text(uint8_t col, uint8_t row, const char* text);
+        void put_number(uint8_t col, uint8_t row, int32_t value, uint8_t width, uint8_t decimals = 0);
+        void put_channel(void);
+        void send_data(const uint8_t* data, uint8_t length);
+        void set_cursor(uint8_t col, uint8_t row);
 };
 
-String right_align(String num_in_string, uint16_t digit);
+void format_number(char* buf, int32_t value, uint8_t width, uint8_t decimals = 0);
 
 #endif // _DISPLAY_CLASS_H_
\ No newline at end of file
@@ -8,6 +8,15 @@ namespace{
     constexpr uint16_t POSITION_TIMER_COUNT     = 2;
     constexpr uint16_t POSITION_LEVEL           = 10;
     constexpr uint16_t POSITION_MODE            = 0;
+    constexpr uint16_t POSITION_CHANNEL         = 0;   //  2行目  計測チャネルが複数の時だけ
+
+    //  LCDのI2Cコントロールバイト  以降のバイトをすべて表示データとして送る
+    constexpr uint8_t LCD_CONTROL_DATA = 0x40;
+    //  LCDのI2Cコントロールバイト  次の1バイトをコマンドとして送る
+    constexpr uint8_t LCD_CONTROL_COMMAND = 0x80;
+    //  変更のない桁がこれ以下なら、前後の変更とまとめて1回で送る
+    //  （カーソル移動のコマンドは1回3byte）
+    constexpr uint8_t MERGE_GAP = 2;
 
     //  バーグラフのためのCGデータ
     byte bar_graph[5][8] = {
@@ -70,6 +79,8 @@ namespace{
     @param pModel eh900型のインスタンスのポインタ（表示するパラメタの参照用）
 */
 Eh_display::Eh_display(eh900* pModel) : LevelMeter(pModel) {
+    clear_frame();
+    memcpy(shown, frame, sizeof(shown));
  }
 
 /*! 
@@ -85,6 +96,8 @@ boolean Eh_display::init(uint16_t error){
     }
 
     rgb_lcd::begin(16,2);
+    //  初期化のコマンドはライブラリが送る. 以降の表示データは共有バスで送って数える
+    lcd_device = i2c_bus.addDevice(LCD_ADDRESS, I2C_CLOCK_FAST, "LCD");
 
     for (int i=0; i<5; i++){
         rgb_lcd::createChar(i, bar_graph[i]);
@@ -99,107 +112,133 @@ boolean Eh_display::init(uint16_t error){
 
 
     if(error != 0){
+        char number[3];
+        format_number(number, error, 2);
         rgb_lcd::setCursor(3, 1);
         rgb_lcd::print("INIT ERR:");
-        rgb_lcd::print(right_align(String( error ), 2));
+        rgb_lcd::print(number);
     }
     return true;
 }
 
 /*!
     @brief  メータの基本フォーマットを表示
+            LCDを消去して全体を描き直す（設定メニューなどで直接描いた後に呼ぶこと）
 */
 void Eh_display::showMeter(void){
+    PROFILE_SCOPE(PROF_SHOW_METER);
+        //  ライブラリは Wire で直接送るので、キューの表示データを先に送り終える
+        i2c_bus.flush();
         rgb_lcd::clear();
-        rgb_lcd::setCursor(0, 0);
-        rgb_lcd::print(" :  /   E:    :F");
+        clear_frame();
+        memcpy(shown, frame, sizeof(shown));
 
-        rgb_lcd::setCursor(POSITION_TIMER_SET,0);
-        rgb_lcd::print(right_align(String( LevelMeter->getTimerPeriod() / 60 ), 2));
+        put_text(0, 0, " :  /   E:    :F");
+        put_number(POSITION_TIMER_SET, 0, LevelMeter->getTimerInterval() / 60, 2);
+        put_number(POSITION_SENSOR_LENGTH, 1, LevelMeter->getSensorLength(channel), 2);
+        put_text(POSITION_SENSOR_LENGTH + 2, 1, "inch   ");
+        put_channel();
 
-        rgb_lcd::setCursor(POSITION_SENSOR_LENGTH,1);
-        rgb_lcd::print(right_align(String( LevelMeter->getSensorLength() ), 2));
-        rgb_lcd::print("inch   ");
+        flush();
 }
 
 /*!
     @brief  液面の表示（数値・バーグラフ）、センサエラーの表示
 */
 void Eh_display::showLevel(void){
-    uint16_t value = LevelMeter->getLiquidLevel();
-
-    delay(10);
-    rgb_lcd::setCursor(POSITION_LEVEL, 1);
-    rgb_lcd::print(right_align(String((float)value/10.0,1),5));
-    rgb_lcd::print("%");
+    PROFILE_SCOPE(PROF_SHOW_LEVEL);
+    uint16_t value = LevelMeter->getLiquidLevel(channel);
 
+    put_number(POSITION_LEVEL, 1, value, 5, 1);
+    put_text(POSITION_LEVEL + 5, 1, "%");
 
-    rgb_lcd::setCursor(POSITION_BAR_GRAPH, 0);
-    // clear bar display area
-    rgb_lcd::print("    ");
-
+    // bar graph  25%ごとに全ブロック、残りを5%ごとの部分ブロックで表す
     uint16_t fine = (value % 250)/50;
     uint16_t coarse = value / 250;
-    uint16_t x_pos = 0;
 
-    // block of 25%
-    for (x_pos=0; x_pos<coarse; x_pos++){
-        rgb_lcd::setCursor(POSITION_BAR_GRAPH+x_pos,0);
-        rgb_lcd::write((unsigned char)4);
-    };
-    // block of 5%
-    if (fine>0){
-        rgb_lcd::setCursor(POSITION_BAR_GRAPH+x_pos,0);
-        rgb_lcd::write((unsigned char)(fine-1));
-    };
+    for (uint16_t x_pos=0; x_pos<4; x_pos++){
+        uint8_t cell = ' ';
+        if (x_pos < coarse){
+            cell = 4;
+        } else if (x_pos == coarse && fine > 0){
+            cell = fine - 1;
+        }
+        frame[0][POSITION_BAR_GRAPH + x_pos] = cell;
+    }
 
     //  センサエラー表示
-    if(LevelMeter->isSensorError()){
-        rgb_lcd::setCursor(POSITION_SENSOR_LENGTH,1);
-        rgb_lcd::print("-ERROR-");
+    if(LevelMeter->isSensorError(channel)){
+        put_text(POSITION_SENSOR_LENGTH, 1, "-ERROR-  ");
     } else {
-        rgb_lcd::setCursor(POSITION_SENSOR_LENGTH,1);
-        rgb_lcd::print(right_align(String( LevelMeter->getSensorLength() ), 2));
-        rgb_lcd::print("inch   ");
+        put_number(POSITION_SENSOR_LENGTH, 1, LevelMeter->getSensorLength(channel), 2);
+        put_text(POSITION_SENSOR_LENGTH + 2, 1, "inch   ");
+    }
+    put_channel();
+
+    flush();
+}
+
+/*!
+    @brief  計測チャネルの数を設定する  2以上なら液面の行の先頭にチャネル番号（1から）を表示する
+*/
+void Eh_display::setChannelCount(uint8_t count){
+    channel_count = count;
+}
+
+/*!
+    @brief  液面・センサ長を表示するチャネルを替える. 同じチャネルなら何もしない
+    @param ch 計測チャネルの番号
+*/
+void Eh_display::showChannel(uint8_t ch){
+    if (ch == channel){
+        return;
+    }
+    channel = ch;
+    showLevel();
+}
+
+/*!
+    @brief  計測チャネルの番号を描く (private)
+*/
+void Eh_display::put_channel(void){
+    if (channel_count > 1){
+        frame[1][POSITION_CHANNEL] = '1' + channel;
     }
-    
 }
 /*!
     @brief  モードの表示、セミコロンおよびモード表示のフラッシュ含む
     @details 比較的短い周期（100ms程度）で周期的に呼ぶことでスムースに表示
+            変化がなければI2Cには何も送らない
+    @param f_blink False:ブリンクを止め、モードとセミコロンを表示したままにする（CPUが眠る前）
 */
-void Eh_display::showMode(void){
-
-    // rgb_lcd::setCursor(POSITION_MODE,0);
+void Eh_display::showMode(boolean f_blink){
+    PROFILE_SCOPE(PROF_SHOW_MODE);
 
     // 連続モードの時にフラッシュする   1sec周期でブリンク
-    if ( ( LevelMeter->getMode() == Continuous ) && ( millis()%1000 < 500 )){
-        rgb_lcd::setCursor(POSITION_MODE,0);
-        rgb_lcd::print(" ");
+    if ( f_blink && ( LevelMeter->getMode() == Continuous ) && ( millis()%1000 < 500 )){
+        frame[0][POSITION_MODE] = ' ';
     } else {
-        rgb_lcd::setCursor(POSITION_MODE,0);
-        rgb_lcd::print(ModeNames[LevelMeter->getMode()]);
+        frame[0][POSITION_MODE] = ModeNames[LevelMeter->getMode()];
     }      
 
-    // タイマーモードの時のtick-tock 
-    rgb_lcd::setCursor(POSITION_MODE+1,0);
-    // 2sec周期でブリンク
-    if ( ( LevelMeter->getMode() == Timer ) && ( millis()%2000 < 1000 ) && !(LevelMeter->getTimerPeriod()==0)){
-        rgb_lcd::write(" ");
+    // タイマーモードの時のtick-tock 2sec周期でブリンク
+    if ( f_blink && ( LevelMeter->getMode() == Timer ) && ( millis()%2000 < 1000 ) && !(LevelMeter->getTimerPeriod()==0)){
+        frame[0][POSITION_MODE+1] = ' ';
     } else {
-        rgb_lcd::write(":");
+        frame[0][POSITION_MODE+1] = ':';
     }
-    rgb_lcd::setCursor(POSITION_MODE,0);
 
+    flush();
 }
 
 /*!
-    @brief  タイマーの時間経過を表示
+    @brief  タイマーの時間経過と周期を表示  周期は適応タイマで計測ごとに変わる
 */
 void Eh_display::showTimer(void){
-    rgb_lcd::setCursor(POSITION_TIMER_COUNT,0);
-    rgb_lcd::print(right_align(String(LevelMeter->getTimerElasped() / 60),2));
-    rgb_lcd::setCursor(POSITION_MODE,0);
+    PROFILE_SCOPE(PROF_SHOW_TIMER);
+    put_number(POSITION_TIMER_COUNT, 0, LevelMeter->getTimerElasped() / 60, 2);
+    put_number(POSITION_TIMER_SET, 0, LevelMeter->getTimerInterval() / 60, 2);
+    flush();
 }
 
 /*!
@@ -207,37 +246,130 @@ void Eh_display::showTimer(void){
 */
 void Eh_display::flashDisplay(void){
     constexpr uint16_t interval = 200;
+    i2c_bus.flush();
     rgb_lcd::noDisplay();
     delay(interval + 100);
     rgb_lcd::display();
     delay(interval);
 }
-/*!
- * @brief 文字列を指定された桁数の右詰にする
- * @param num_in_string 文字列
- * @param digit 桁数
- * @returns 右詰にされた文字列
- */
-String right_align(const String num_in_string, const uint16_t digit){
 
-    String right_aligned="";
-    String pad="";
-
-    if (digit>1){
-        //  string pad(digit-1, ' '); と同じ  arduino のstringはこれができない
-        for (uint16_t i=0; i< digit-1; i++){
-            pad += " ";
+/*!
+    @brief  表示したい内容とLCDの内容を比べ、変わった桁だけを送る
+            隣り合う（MERGE_GAP以下の隙間を含む）変更は、カーソル移動1回と1回の転送にまとめる
+*/
+void Eh_display::flush(void){
+    for (uint8_t row = 0; row < LCD_ROWS; row++){
+        uint8_t col = 0;
+        while (col < LCD_COLS){
+            if (frame[row][col] == shown[row][col]){
+                col++;
+                continue;
+            }
+
+            uint8_t end = col + 1;
+            uint8_t gap = 0;
+            while (end + gap < LCD_COLS && gap <= MERGE_GAP){
+                if (frame[row][end + gap] != shown[row][end + gap]){
+                    end += gap + 1;
+                    gap = 0;
+                } else {
+                    gap++;
+                }
+            }
+
+            set_cursor(col, row);
+            send_data(&frame[row][col], end - col);
+            memcpy(&shown[row][col], &frame[row][col], end - col);
+            col = end;
         }
+    }
+}
 
-        pad += num_in_string;
+/*!
+    @brief  表示したい内容を空白にする (private)
+*/
+void Eh_display::clear_frame(void){
+    memset(frame, ' ', sizeof(frame));
+}
 
-        for (uint16_t i=digit ; i> 0 ; i--){
-            right_aligned += pad[pad.length()-i];
-        }
+/*!
+    @brief  表示したい内容に文字列を書く (private)  行からはみ出した分は捨てる
+*/
+void Eh_display::put_text(uint8_t col, uint8_t row, const char* text){
+    while (*text && col < LCD_COLS){
+        frame[row][col++] = *text++;
     }
+}
 
-    return right_aligned;
+/*!
+    @brief  表示したい内容に数値を右詰めで書く (private)
+*/
+void Eh_display::put_number(uint8_t col, uint8_t row, int32_t value, uint8_t width, uint8_t decimals){
+    //  format_number() は width までをすべて書くが、コンパイラには見えないので初期化しておく
+    char buf[12] = {};
+    format_number(buf, value, width < sizeof(buf) ? width : sizeof(buf) - 1, decimals);
+    put_text(col, row, buf);
 }
 
+/*!
+    @brief  表示データを1回のI2C転送で送る (private)  キューに入れて転送の終わりは待たない
+            LCDはアドレスを自動で進めるので、連続した桁をまとめて書ける
+*/
+void Eh_display::send_data(const uint8_t* data, uint8_t length){
+    uint8_t packet[LCD_COLS + 1];
 
+    if (length > LCD_COLS){
+        length = LCD_COLS;
+    }
+    packet[0] = LCD_CONTROL_DATA;
+    memcpy(&packet[1], data, length);
+    i2c_bus.submit(lcd_device, packet, length + 1);
+}
 
+/*!
+    @brief  カーソルを移動する (private)  rgb_lcd::setCursor と同じコマンドを共有バスで送る
+            コントロールバイト 0x80（Co=1）の後にはさらにコントロールバイトを続けられるので、
+            続く表示データと1回の転送にまとめてよい（I2C_MERGE_CONTINUE）
+*/
+void Eh_display::set_cursor(uint8_t col, uint8_t row){
+    const uint8_t packet[2] = {LCD_CONTROL_COMMAND, (uint8_t)(LCD_SETDDRAMADDR | ((row == 0) ? col : (col | 0x40)))};
+    i2c_bus.submit(lcd_device, packet, 2, I2C_MERGE_CONTINUE);
+}
+
+/*!
+ * @brief 数値を指定された桁数の右詰の文字列にする. ヒープを使わない
+ *          桁数に収まらない時は下の桁を残す（旧 right_align と同じ）
+ * @param buf 出力先  width+1 byte 以上
+ * @param value 数値（10^decimals 倍した整数）  例：value=123, decimals=1 -> "12.3"
+ * @param width 桁数（小数点を含む）
+ * @param decimals 小数点以下桁数
+ */
+void format_number(char* buf, int32_t value, uint8_t width, uint8_t decimals){
+    const boolean negative = value < 0;
+    uint32_t magnitude = negative ? (uint32_t)0 - (uint32_t)value : (uint32_t)value;
+    int8_t pos = width;
+
+    buf[pos] = '\0';
+    uint8_t digits = 0;
+    do {
+        if (pos == 0){
+            return;
+        }
+        if (decimals > 0 && digits == decimals){
+            buf[--pos] = '.';
+            if (pos == 0){
+                return;
+            }
+        }
+        buf[--pos] = '0' + (magnitude % 10);
+        magnitude /= 10;
+        digits++;
+    } while (magnitude != 0 || digits <= decimals);
+
+    if (negative && pos > 0){
+        buf[--pos] = '-';
+    }
+    while (pos > 0){
+        buf[--pos] = ' ';
+    }
+}
@@ -2,11 +2,38 @@
 #define _EH900_CLASS_H_
 
 #include <Adafruit_FRAM_I2C.h>
+#include "I2cBus.h"
+#include "NvStorage.h"
+#include "HistoryLog.h"
+#include "ParamStore.h"
+#include "Profiler.h"
+#include "LevelEstimator.h"
+#include "AdaptiveTimer.h"
+#include "AdcEngine.h"
 
 // モードの名前とその表示   GLOVAL
 enum Modes{Manual, Timer, Continuous};
 const char ModeNames[3]={'M','T','C'};
 
+//  計測チャネル（ADコンバータ・電流源の組とセンサ）の最大数
+//      チャネル0は Meter_parameters の旧版からあるフィールドを使い、チャネル1以降は channels[] に置く
+constexpr uint8_t METER_CHANNEL_MAX = 3;
+
+/*!
+    @brief  チャネル1以降のセンサと計測ユニットのパラメタ
+            各フィールドは Meter_parameters の同じ名前のフィールド（チャネル0）と同じ意味
+*/
+struct Channel_parameters{
+    uint16_t sensor_length;
+    uint16_t liqud_level;
+    float_t adc_err_comp_diff_0_1;
+    float_t adc_err_comp_diff_2_3;
+    int16_t adc_OFS_comp_diff_0_1;
+    int16_t adc_OFS_comp_diff_2_3;
+    uint16_t current_set_default;
+    boolean f_sensor_error;
+};
+
 
 struct Meter_parameters{
     
@@ -45,10 +72,49 @@ struct Meter_parameters{
 
     //      アナログモニタ出力DAのオフセット（0.1V出力時の誤差）  [LSB] 
     uint16_t vmon_da_offset;
+
+    //  ここから後ろは旧版（構造体をそのまま保存していた版）にはない
+
+    //  連続計測の液面推定のパラメタ
+    EstimatorConfig estimator;
+    //  連続計測の高速ストリーミングのパラメタ
+    AdcStreamConfig stream;
+    //  チャネル1以降のパラメタ
+    Channel_parameters channels[METER_CHANNEL_MAX - 1];
+    //  タイマモードの適応タイマのパラメタ
+    AdaptiveConfig adaptive;
 };
 
+//  旧版の構造体の大きさ（旧版のFRAMから移行する時に読む長さ）
+constexpr size_t METER_PARAMETERS_LEGACY_SIZE = offsetof(Meter_parameters, estimator);
 
 
+
+/*! @class FramStorage
+    @brief  FRAM を共有I2Cバスで読み書きする NvStorage
+            書き込みはキューに入れて待たずに戻る（計測や表示の転送と並べて行う）.
+            読み出しは先に入れた書き込みが終わってから行うので、書いた内容が読める.
+            書き込みの失敗は、次の読み書きの戻り値で知らせる
+*/
+class FramStorage : public NvStorage
+{
+    public:
+        FramStorage(I2cBus* bus) : bus(bus){};
+
+        void begin(uint8_t i2c_address);
+
+        bool write(uint16_t addr, const uint8_t* data, size_t length) override;
+        bool read(uint16_t addr, uint8_t* data, size_t length) override;
+
+    private:
+        I2cBus* bus;
+        int8_t device = -1;
+        volatile bool f_write_error = false;
+
+        bool take_write_error(void);
+        static void on_write_complete(void* context, bool f_success);
+};
+
 /*! @class eh900
     @brief  液面計のパラメタを保存する構造体 Meter_parameters のインスタンスを操作するためのクラス
 */
@@ -59,17 +125,32 @@ class eh900
         // パラメタ保存の構造体の実体 
         Meter_parameters eh_status = {};
 
-        // 構造体の内容を保存するためのメモリのドライバ 
+        // 構造体の内容を保存するためのメモリのドライバ  識別はライブラリ、読み書きは共有I2Cバスで行う
         Adafruit_FRAM_I2C fram = Adafruit_FRAM_I2C();
+        FramStorage fram_storage = FramStorage(&i2c_bus);
 
-        template <typename T> 
-            void nvram_put(uint16_t idx, const T& t);
-        
-        template <typename T> 
-            void nvram_get(uint16_t, T&);
+        // パラメタの保存（A/B スロット, CRC, 版付き）
+        ParamStore param_store = ParamStore(&fram_storage);
+
+        // 計測結果の履歴（FRAMのパラメタ領域の後ろ）
+        HistoryLog history = HistoryLog(&fram_storage);
+
+        //  適応タイマが決めた次の計測までの周期 [s]  保存しない. 0ならタイマ周期を使う
+        uint16_t timer_interval = 0;
+
+        uint16_t encode_parameters(uint8_t* image) const;
+        void decode_parameters(const uint8_t* image, uint16_t length, uint16_t version);
 
     public:
-        eh900(void){};
+        eh900(void){
+            eh_status.estimator = LevelEstimator::defaultConfig();
+            eh_status.stream = {AdcEngine::RATE_860SPS, 0};
+            eh_status.adaptive = AdaptiveTimer::defaultConfig();
+            //  チャネル1以降は FRAM の旧版にないので、メモリがない時の初期値（20inch, 75mA）から始める
+            for (Channel_parameters& channel : eh_status.channels){
+                channel = {20, 0, 1.0, 1.0, 0, 0, 750, false};
+            }
+        };
 
         ~eh900(){
             Serial.println("~ eh900 ----");
@@ -79,12 +160,20 @@ class eh900
         boolean storeParameter(void);
         boolean recallParameter(void);
 
+        //  計測結果の履歴
+        HistoryLog* getHistory(void){
+            return &history;
+        };
+
+        //  センサ・液面・計測ユニットのパラメタはチャネルごとにある
+        //      引数の ch はチャネル番号（METER_CHANNEL_MAX 未満）, 省略するとチャネル0
+
         //  センサ長を返す[inch]
-        uint16_t getSensorLength(void) const {
-            return eh_status.sensor_length;
+        uint16_t getSensorLength(uint8_t ch = 0) const {
+            return ch ? eh_status.channels[ch-1].sensor_length : eh_status.sensor_length;
         };
 
-        void setSensorLength(uint16_t);
+        void setSensorLength(uint16_t, uint8_t ch = 0);
 
     //タイマ設定
     
@@ -95,6 +184,16 @@ class eh900
 
         void setTimerPeriod(uint16_t);
 
+        //  次の計測までの周期を返す[s]  適応タイマを使わない時はタイマ周期
+        uint16_t getTimerInterval(void) const {
+            return (eh_status.adaptive.enabled && timer_interval != 0) ? timer_interval : eh_status.timer_period;
+        };
+
+        //  適応タイマが決めた周期を設定する[s]  0でタイマ周期に戻す
+        void setTimerInterval(uint16_t value){
+            timer_interval = value;
+        };
+
         //  タイマの経過時間を返す
         uint16_t getTimerElasped(void) const {
             return eh_status.timer_elasped;
@@ -106,11 +205,11 @@ class eh900
     // 液面データ
 
         //  液面レベルを返す[0.1%単位]
-        uint16_t getLiquidLevel(void) const {
-            return eh_status.liqud_level;
+        uint16_t getLiquidLevel(uint8_t ch = 0) const {
+            return ch ? eh_status.channels[ch-1].liqud_level : eh_status.liqud_level;
         };
         
-        void setLiquidLevel(uint16_t);
+        void setLiquidLevel(uint16_t, uint8_t ch = 0);
 
     //  モード
 
@@ -128,18 +227,18 @@ class eh900
 
         //  センサエラーかどうか。ErrorならTrue
         //  次の計測までエラーは保持される
-        boolean isSensorError(void) const {
-            return eh_status.f_sensor_error;
+        boolean isSensorError(uint8_t ch = 0) const {
+            return ch ? eh_status.channels[ch-1].f_sensor_error : eh_status.f_sensor_error;
         };
     
         //  センサエラーフラグを設定する
-        void setSensorError(void){
-            eh_status.f_sensor_error = true;
+        void setSensorError(uint8_t ch = 0){
+            (ch ? eh_status.channels[ch-1].f_sensor_error : eh_status.f_sensor_error) = true;
         };
 
         //  センサエラーフラグをクリアする
-        void clearSensorError(void){
-            eh_status.f_sensor_error = false;
+        void clearSensorError(uint8_t ch = 0){
+            (ch ? eh_status.channels[ch-1].f_sensor_error : eh_status.f_sensor_error) = false;
         };
 
         boolean hasTickTock(void);
@@ -147,62 +246,62 @@ class eh900
     //  計測ユニット用のデータ
 
         //  ADコンバータの補正係数を得る 電圧計測チャネル
-        float_t getAdcErrComp01(void) const {
-            return eh_status.adc_err_comp_diff_0_1;
+        float_t getAdcErrComp01(uint8_t ch = 0) const {
+            return ch ? eh_status.channels[ch-1].adc_err_comp_diff_0_1 : eh_status.adc_err_comp_diff_0_1;
         };
 
         //  ADコンバータの補正係数を設定 電圧計測チャネル
-        void setAdcErrComp01(float_t value){
+        void setAdcErrComp01(float_t value, uint8_t ch = 0){
             if( 0.9 < value && value < 1.1 ){
-                eh_status.adc_err_comp_diff_0_1 = value;
+                (ch ? eh_status.channels[ch-1].adc_err_comp_diff_0_1 : eh_status.adc_err_comp_diff_0_1) = value;
             }
         };
 
         //  ADコンバータの補正係数を得る 電流計測チャネル
-        float_t getAdcErrComp23(void) const {
-            return eh_status.adc_err_comp_diff_2_3;
+        float_t getAdcErrComp23(uint8_t ch = 0) const {
+            return ch ? eh_status.channels[ch-1].adc_err_comp_diff_2_3 : eh_status.adc_err_comp_diff_2_3;
         };
 
         //  ADコンバータの補正係数を設定 電流計測チャネル
-        void setAdcErrComp23(float_t value){
+        void setAdcErrComp23(float_t value, uint8_t ch = 0){
             if( 0.9 < value && value < 1.1 ){
-                eh_status.adc_err_comp_diff_2_3 = value;
+                (ch ? eh_status.channels[ch-1].adc_err_comp_diff_2_3 : eh_status.adc_err_comp_diff_2_3) = value;
             }
         };
 
         //  ADコンバータのオフセット補正値を得る 電圧計測チャネル
-        int16_t getAdcOfsComp01(void) const {
-            return eh_status.adc_OFS_comp_diff_0_1;
+        int16_t getAdcOfsComp01(uint8_t ch = 0) const {
+            return ch ? eh_status.channels[ch-1].adc_OFS_comp_diff_0_1 : eh_status.adc_OFS_comp_diff_0_1;
         };
 
         //  ADコンバータのオフセット補正値を設定 電圧計測チャネル
-        void setAdcOfsComp01(int16_t value){
+        void setAdcOfsComp01(int16_t value, uint8_t ch = 0){
             if( -256 < value && value < 256 ){
-                eh_status.adc_OFS_comp_diff_0_1 = value;
+                (ch ? eh_status.channels[ch-1].adc_OFS_comp_diff_0_1 : eh_status.adc_OFS_comp_diff_0_1) = value;
             }
         };
 
         //  ADコンバータのオフセット補正値を得る 電流計測チャネル
-        int16_t getAdcOfsComp23(void) const {
-            return eh_status.adc_OFS_comp_diff_2_3;
+        int16_t getAdcOfsComp23(uint8_t ch = 0) const {
+            return ch ? eh_status.channels[ch-1].adc_OFS_comp_diff_2_3 : eh_status.adc_OFS_comp_diff_2_3;
         };
 
         //  ADコンバータのオフセット補正値を設定 電流計測チャネル
-        void setAdcOfsComp23(int16_t value){
+        void setAdcOfsComp23(int16_t value, uint8_t ch = 0){
             if( -256 < value && value < 256 ){
-                eh_status.adc_OFS_comp_diff_2_3 = value;
+                (ch ? eh_status.channels[ch-1].adc_OFS_comp_diff_2_3 : eh_status.adc_OFS_comp_diff_2_3) = value;
             }
         };
 
         //  電流源設定値を得る  [0.1mA]
-        uint16_t getCurrentSetting(void) const {
-            return eh_status.current_set_default;
+        uint16_t getCurrentSetting(uint8_t ch = 0) const {
+            return ch ? eh_status.channels[ch-1].current_set_default : eh_status.current_set_default;
         };
 
         //  電流源設定値を設定  [Range: 67--83mA]
-        void setCurrentSetting(uint16_t value){
+        void setCurrentSetting(uint16_t value, uint8_t ch = 0){
             if ( 670 < value && value < 830){
-                eh_status.current_set_default = value;
+                (ch ? eh_status.channels[ch-1].current_set_default : eh_status.current_set_default) = value;
             }
         };
 
@@ -217,6 +316,54 @@ class eh900
                 eh_status.vmon_da_offset = value;
             }
         };
+
+    //  連続計測の液面推定
+
+        //  液面推定のパラメタを得る
+        const EstimatorConfig& getEstimatorConfig(void) const {
+            return eh_status.estimator;
+        };
+
+        //  液面推定のパラメタを設定する  範囲外なら変えずに False
+        boolean setEstimatorConfig(const EstimatorConfig& config){
+            if (!LevelEstimator::isValid(config)){
+                return false;
+            }
+            eh_status.estimator = config;
+            return true;
+        };
+
+    //  連続計測の高速ストリーミング
+
+        //  ストリーミングのパラメタを得る
+        const AdcStreamConfig& getStreamConfig(void) const {
+            return eh_status.stream;
+        };
+
+        //  ストリーミングのパラメタを設定する  範囲外なら変えずに False
+        boolean setStreamConfig(const AdcStreamConfig& config){
+            if (config.data_rate >= AdcEngine::RATE_NUM || config.oversampling > ADC_RING_SIZE){
+                return false;
+            }
+            eh_status.stream = config;
+            return true;
+        };
+
+    //  タイマモードの適応タイマ
+
+        //  適応タイマのパラメタを得る
+        const AdaptiveConfig& getAdaptiveConfig(void) const {
+            return eh_status.adaptive;
+        };
+
+        //  適応タイマのパラメタを設定する  範囲外なら変えずに False
+        boolean setAdaptiveConfig(const AdaptiveConfig& config){
+            if (!AdaptiveTimer::isValid(config)){
+                return false;
+            }
+            eh_status.adaptive = config;
+            return true;
+        };
 };
 
 #endif // _EH900_CLASS_H_
\ No newline at end of file
@@ -20,8 +20,114 @@ namespace{
     constexpr uint16_t I2C_ADDR_FRAM = 0x50;
     // FRAM 領域（予備）フラグ用の領域(256byte)
     constexpr uint16_t FRAM_FLAG_ADDR = 0x0000;
-    // FRAM 領域    パラメタ保存(256byte) Meter_parameters構造体をそのまま保存
+    // FRAM 領域    パラメタ保存(256byte) ParamStore の A/B スロット
+    //      旧版は Meter_parameters構造体をそのまま保存していた（起動時に移行する）
     constexpr uint16_t FRAM_PARM_ADDR = 0x0100;
+    constexpr uint16_t FRAM_PARM_ADDR_B = FRAM_PARM_ADDR + PARAM_STORE_SLOT_SIZE;
+    static_assert(FRAM_PARM_ADDR_B + PARAM_STORE_SLOT_SIZE <= 0x0200, "parameter slots overflow");
+    // FRAM 領域    計測結果の履歴  ここからFRAMの終わりまで
+    constexpr uint16_t FRAM_HIST_ADDR = 0x0200;
+    // FRAM の容量 (MB85RC256V 32kbyte)
+    constexpr uint32_t FRAM_SIZE = 0x8000;
+    // FRAM のメモリアドレスのバイト数と、1回の転送で読み書きする最大バイト数
+    //      書き込みは要求1つに入る分, 読み出しは Wire のバッファ（初期化中は Wire で読むため）
+    constexpr size_t FRAM_ADDRESS_BYTES = 2;
+    constexpr size_t FRAM_WRITE_CHUNK = I2C_BUS_DATA_MAX - FRAM_ADDRESS_BYTES;
+    constexpr size_t FRAM_READ_CHUNK = 32;
+
+    //  保存するパラメタの形式の版
+    //      フィールドは後ろに追加するだけにする. 古い版のデータは足りないフィールドを今の値のまま読む
+    //      1: 最初の版
+    //      2: 連続計測の液面推定のパラメタを追加
+    //      3: 連続計測の高速ストリーミングのパラメタを追加
+    //      4: チャネル1以降のセンサと計測ユニットのパラメタを追加
+    //      5: タイマモードの適応タイマのパラメタを追加
+    constexpr uint16_t PARAM_SCHEMA_VERSION = 5;
+
+    //  パラメタをバイト列に書き出す
+    template <typename T>
+    void put_field(uint8_t*& ptr, const T& value){
+        memcpy(ptr, &value, sizeof(T));
+        ptr += sizeof(T);
+    }
+
+    //  バイト列からパラメタを読む. 残りが足りなければ読まない
+    template <typename T>
+    void get_field(const uint8_t*& ptr, const uint8_t* end, T& value){
+        if (ptr + sizeof(T) <= end){
+            memcpy(&value, ptr, sizeof(T));
+            ptr += sizeof(T);
+        }
+    }
+}
+
+/*!
+ *    @brief  共有I2Cバスに登録する
+ *    @param i2c_address FRAMのI2Cアドレス
+ */
+void FramStorage::begin(uint8_t i2c_address){
+    device = bus->addDevice(i2c_address, I2C_CLOCK_FAST_PLUS, "FRAM");
+}
+
+/*!
+ *    @brief  書き込みをキューに入れる. 転送の終わりは待たない
+ *    @return True:キューに入れた, False:前に入れた書き込みが失敗していた
+ */
+bool FramStorage::write(uint16_t addr, const uint8_t* data, size_t length){
+    PROFILE_SCOPE(PROF_FRAM);
+    uint8_t packet[FRAM_ADDRESS_BYTES + FRAM_WRITE_CHUNK];
+    bool f_success = !take_write_error();
+
+    while (length > 0){
+        const size_t chunk = (length < FRAM_WRITE_CHUNK) ? length : FRAM_WRITE_CHUNK;
+        packet[0] = addr >> 8;
+        packet[1] = addr & 0xFF;
+        memcpy(&packet[FRAM_ADDRESS_BYTES], data, chunk);
+        f_success = bus->submit(device, packet, FRAM_ADDRESS_BYTES + chunk, I2C_MERGE_NONE, on_write_complete, this) && f_success;
+
+        addr += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+    return f_success;
+}
+
+/*!
+ *    @brief  読み出す. キューに入っている書き込みが終わってから読む
+ *    @return True:読めた, False:読めなかった もしくは前に入れた書き込みが失敗していた
+ */
+bool FramStorage::read(uint16_t addr, uint8_t* data, size_t length){
+    PROFILE_SCOPE(PROF_FRAM);
+    bool f_success = true;
+
+    while (length > 0 && f_success){
+        const size_t chunk = (length < FRAM_READ_CHUNK) ? length : FRAM_READ_CHUNK;
+        const uint8_t packet[FRAM_ADDRESS_BYTES] = {(uint8_t)(addr >> 8), (uint8_t)(addr & 0xFF)};
+        f_success = bus->writeRead(device, packet, FRAM_ADDRESS_BYTES, data, chunk);
+
+        addr += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+    return !take_write_error() && f_success;
+}
+
+/*!
+ *    @brief  前回から書き込みの失敗があったかを返してクリアする (private)
+ */
+bool FramStorage::take_write_error(void){
+    const bool f_error = f_write_error;
+    f_write_error = false;
+    return f_error;
+}
+
+/*!
+ *    @brief  書き込みの完了 (private)  失敗を覚えておく
+ */
+void FramStorage::on_write_complete(void* context, bool f_success){
+    if (!f_success){
+        static_cast<FramStorage*>(context)->f_write_error = true;
+    }
 }
 
 
@@ -34,13 +140,30 @@ boolean eh900::init(void){
     // init FRAM
     if (fram.begin(I2C_ADDR_FRAM)) {  // you can stick the new i2c addr in here, e.g. begin(0x51);
         Serial.println("Found I2C FRAM");
+        fram_storage.begin(I2C_ADDR_FRAM);
 
         // 設定値をFRAMから読み込む
-        nvram_get(FRAM_PARM_ADDR, eh_status);
+        if (param_store.begin(FRAM_PARM_ADDR, FRAM_PARM_ADDR_B)){
+            recallParameter();
+            Serial.print(" .. Parameter slot: "); Serial.print(param_store.getActiveSlot());
+            Serial.print(" seq "); Serial.println(param_store.getSequence());
+        } else {
+            //  旧版の構造体をそのまま読み、新しい形式で保存し直す
+            //  旧版にないパラメタは既定値のまま
+            fram_storage.read(FRAM_PARM_ADDR, (uint8_t*)&eh_status, METER_PARAMETERS_LEGACY_SIZE);
+            storeParameter();
+            Serial.println(" .. Parameter migrated from legacy layout");
+        }
         Serial.print(" .. Sensor Length: "); Serial.println(eh_status.sensor_length);
         Serial.print(" .. Timer period: "); Serial.println(eh_status.timer_period);
         //  初回起動フラグをクリアしておく
-        fram.write8(FRAM_FLAG_ADDR, 1);
+        const uint8_t flag = 1;
+        fram_storage.write(FRAM_FLAG_ADDR, &flag, sizeof(flag));
+
+        // 計測結果の履歴を読み込む（書きかけの記録があれば取り込む）
+        history.begin(FRAM_HIST_ADDR, FRAM_SIZE - FRAM_HIST_ADDR);
+        Serial.print(" .. History: "); Serial.print(history.getCount());
+        Serial.print(" records, unsent "); Serial.println(history.getUnsent());
 
         initSucceed = true;
     } else {
@@ -48,29 +171,36 @@ boolean eh900::init(void){
 
     }
 
-    Serial.print("FRAM:"); Serial.print((uint32_t)&fram,HEX); Serial.print("/");Serial.println(sizeof(fram));
-    Serial.print("eh_status:"); Serial.print((uint32_t)&eh_status,HEX); Serial.print("/");Serial.println(sizeof(eh_status));
+    Serial.print("FRAM:"); Serial.print((uintptr_t)&fram,HEX); Serial.print("/");Serial.println(sizeof(fram));
+    Serial.print("eh_status:"); Serial.print((uintptr_t)&eh_status,HEX); Serial.print("/");Serial.println(sizeof(eh_status));
     
     return initSucceed;
 }
 
 /*!
- *    @brief  液面計の設定パラメタをFRAMに保存
- *    @return つねにTrue
+ *    @brief  液面計の設定パラメタをFRAMに保存. 前回と変わった部分だけを書き込み、変わっていなければ何も書かない
+ *    @return True:保存成功
  */
 boolean eh900::storeParameter(void){
+    uint8_t image[PARAM_STORE_IMAGE_MAX];
 
-    nvram_put(FRAM_PARM_ADDR, eh_status);
-    return true;
+    const uint16_t length = encode_parameters(image);
+    return param_store.save(image, length, PARAM_SCHEMA_VERSION);
 }
 
 /*!
  *    @brief  液面計の設定パラメタをFRAMから読み出し
- *    @return つねにTrue
+ *    @return True:読み出し成功, False:有効なパラメタがない（パラメタは変えない）
  */
 boolean eh900::recallParameter(void){
+    uint8_t image[PARAM_STORE_IMAGE_MAX];
+    uint16_t length = 0;
+    uint16_t version = 0;
 
-    nvram_get(FRAM_PARM_ADDR, eh_status);
+    if (!param_store.load(image, length, version)){
+        return false;
+    }
+    decode_parameters(image, length, version);
     return true;
 }
 
@@ -78,8 +208,9 @@ boolean eh900::recallParameter(void){
  *    @brief  センサ長を設定する
  *    @param  value センサ長[inch]：
  *              センサ長はSENSOR_LENGTH_MAX から SENSOR_LENGTH_MIN に制限される
+ *    @param  ch チャネル番号
  */
-void eh900::setSensorLength(uint16_t value){
+void eh900::setSensorLength(uint16_t value, uint8_t ch){
     
     if (value > SENSOR_LENGTH_MAX ){
         value = SENSOR_LENGTH_MAX;
@@ -88,7 +219,7 @@ void eh900::setSensorLength(uint16_t value){
         value = SENSOR_LENGTH_MIN;
     }
 
-    eh_status.sensor_length = value;
+    (ch ? eh_status.channels[ch-1].sensor_length : eh_status.sensor_length) = value;
 }
 
 /*!
@@ -109,11 +240,11 @@ void eh900::setTimerPeriod(uint16_t value){
 /*!
  *    @brief  タイマ経過時間をセットする
  *    @param  value 経過時間[s]：
- *              valueの上限はタイマ周期、それ以上なら0に設定される
+ *              valueの上限は次の計測までの周期、それ以上なら0に設定される
  */
 void eh900::setTimerElasped(uint16_t value){
-    // 引数がタイマの設定値より大きければ0に設定する
-    if (value > eh_status.timer_period){
+    // 引数がタイマの周期より大きければ0に設定する
+    if (value > getTimerInterval()){
         value = 0;
     }
     eh_status.timer_elasped = value;
@@ -122,15 +253,15 @@ void eh900::setTimerElasped(uint16_t value){
 /*!
  *    @brief  タイマの経過時間を１秒進める. 
  *              メンバ変数eh_status.f_tick_tock をtrueにセットする
- *    @return True：タイマ周期に設定された時間になった（タイムアップ）  False:それ以外
+ *    @return True：次の計測までの周期（適応タイマを使わない時はタイマ周期）になった（タイムアップ）  False:それ以外
  */
 boolean eh900::incTimeElasped(void){
     boolean flag=false;
 
     //  timerの経過時間をカウントアップ
     eh_status.timer_elasped++;
-    //  設定時間経過したら経過時間を0に戻してフラグを立てる
-    if (eh_status.timer_elasped >= eh_status.timer_period){
+    //  周期の時間が経過したら経過時間を0に戻してフラグを立てる
+    if (eh_status.timer_elasped >= getTimerInterval()){
         eh_status.timer_elasped = 0;
         flag = true;
     }
@@ -144,14 +275,15 @@ boolean eh900::incTimeElasped(void){
  *    @brief  計測した液面を保存する
  *    @param  value 液面[0.1%]:
  *              LIQUID_LEVEL_UPPER_LIMITで制限される
+ *    @param  ch チャネル番号
  */
-void eh900::setLiquidLevel(uint16_t value){
+void eh900::setLiquidLevel(uint16_t value, uint8_t ch){
     // 上限は100
 
     if (value > LIQUID_LEVEL_UPPER_LIMIT){
         value = LIQUID_LEVEL_UPPER_LIMIT;
     }
-    eh_status.liqud_level = value;
+    (ch ? eh_status.channels[ch-1].liqud_level : eh_status.liqud_level) = value;
 }
 /*!
  *    @brief  １秒クロックのフラグを確認    この関数を呼ぶと当該フラグはクリアされる
@@ -165,27 +297,118 @@ boolean eh900::hasTickTock(void){
 }
 
 /*!
- *    @brief  FRAMに変数の値を書き込む
- *    @param  idx 書き込み開始アドレス
- *    @param  t 書き込むデータ（変数、構造体など）
+ *    @brief  保存するパラメタをバイト列にする（PARAM_SCHEMA_VERSION の形式）
+ *    @param  image 出力先  PARAM_STORE_IMAGE_MAX byte
+ *    @return バイト列の長さ
  */
-template <typename T>
-void eh900::nvram_put(uint16_t idx, const T& t){
-    const uint8_t* ptr = (const uint8_t *) &t;
-    for (int i=0; i < sizeof(t); i++){
-        fram.write8(idx + i, *(ptr + i));
+uint16_t eh900::encode_parameters(uint8_t* image) const {
+    uint8_t* ptr = image;
+
+    put_field(ptr, eh_status.sensor_length);
+    put_field(ptr, eh_status.timer_period);
+    put_field(ptr, eh_status.timer_elasped);
+    put_field(ptr, eh_status.liqud_level);
+    put_field(ptr, eh_status.adc_err_comp_diff_0_1);
+    put_field(ptr, eh_status.adc_err_comp_diff_2_3);
+    put_field(ptr, eh_status.adc_OFS_comp_diff_0_1);
+    put_field(ptr, eh_status.adc_OFS_comp_diff_2_3);
+    put_field(ptr, eh_status.current_set_default);
+    put_field(ptr, (uint8_t)eh_status.f_sensor_error);
+    put_field(ptr, (uint8_t)eh_status.mode);
+    put_field(ptr, eh_status.vmon_da_offset);
+    //  版2
+    put_field(ptr, eh_status.estimator.filter);
+    put_field(ptr, eh_status.estimator.median_window);
+    put_field(ptr, eh_status.estimator.iir_alpha);
+    put_field(ptr, eh_status.estimator.kalman_accel);
+    put_field(ptr, eh_status.estimator.kalman_noise);
+    //  版3
+    put_field(ptr, eh_status.stream.data_rate);
+    put_field(ptr, eh_status.stream.oversampling);
+    //  版4
+    for (const Channel_parameters& channel : eh_status.channels){
+        put_field(ptr, channel.sensor_length);
+        put_field(ptr, channel.liqud_level);
+        put_field(ptr, channel.adc_err_comp_diff_0_1);
+        put_field(ptr, channel.adc_err_comp_diff_2_3);
+        put_field(ptr, channel.adc_OFS_comp_diff_0_1);
+        put_field(ptr, channel.adc_OFS_comp_diff_2_3);
+        put_field(ptr, channel.current_set_default);
+        put_field(ptr, (uint8_t)channel.f_sensor_error);
     }
+    //  版5
+    put_field(ptr, eh_status.adaptive.enabled);
+    put_field(ptr, eh_status.adaptive.period_min);
+    put_field(ptr, eh_status.adaptive.period_max);
+    put_field(ptr, eh_status.adaptive.uncertainty);
+    put_field(ptr, eh_status.adaptive.alarm_level);
+
+    return ptr - image;
 }
 
 /*!
- *    @brief  FRAMから変数に値を読み込む
- *    @param  idx 読み込み開始アドレス
- *    @param  t 読み込む変数（書き込みの時と型が同じであることが必須）
+ *    @brief  保存されていたバイト列からパラメタを読む
+ *    @param  image バイト列
+ *    @param  length バイト列の長さ  古い版で足りないフィールドは今の値のまま
+ *    @param  version バイト列の形式の版
  */
-template <typename T>
-void eh900::nvram_get(uint16_t idx, T& t){
-    uint8_t* ptr = (uint8_t *) &t;
-    for (int i=0; i < sizeof(t); i++){
-        *(ptr + i) = fram.read8(idx + i);
+void eh900::decode_parameters(const uint8_t* image, uint16_t length, uint16_t version){
+    const uint8_t* ptr = image;
+    const uint8_t* end = image + length;
+    uint8_t flag = eh_status.f_sensor_error;
+    uint8_t mode = eh_status.mode;
+
+    if (version > PARAM_SCHEMA_VERSION){
+        Serial.print(" .. Parameter version "); Serial.print(version); Serial.println(" is newer, reading known fields");
     }
+
+    get_field(ptr, end, eh_status.sensor_length);
+    get_field(ptr, end, eh_status.timer_period);
+    get_field(ptr, end, eh_status.timer_elasped);
+    get_field(ptr, end, eh_status.liqud_level);
+    get_field(ptr, end, eh_status.adc_err_comp_diff_0_1);
+    get_field(ptr, end, eh_status.adc_err_comp_diff_2_3);
+    get_field(ptr, end, eh_status.adc_OFS_comp_diff_0_1);
+    get_field(ptr, end, eh_status.adc_OFS_comp_diff_2_3);
+    get_field(ptr, end, eh_status.current_set_default);
+    get_field(ptr, end, flag);
+    get_field(ptr, end, mode);
+    get_field(ptr, end, eh_status.vmon_da_offset);
+    //  版2
+    EstimatorConfig estimator = eh_status.estimator;
+    get_field(ptr, end, estimator.filter);
+    get_field(ptr, end, estimator.median_window);
+    get_field(ptr, end, estimator.iir_alpha);
+    get_field(ptr, end, estimator.kalman_accel);
+    get_field(ptr, end, estimator.kalman_noise);
+    setEstimatorConfig(estimator);
+    //  版3
+    AdcStreamConfig stream = eh_status.stream;
+    get_field(ptr, end, stream.data_rate);
+    get_field(ptr, end, stream.oversampling);
+    setStreamConfig(stream);
+    //  版4
+    for (Channel_parameters& channel : eh_status.channels){
+        uint8_t channel_flag = channel.f_sensor_error;
+        get_field(ptr, end, channel.sensor_length);
+        get_field(ptr, end, channel.liqud_level);
+        get_field(ptr, end, channel.adc_err_comp_diff_0_1);
+        get_field(ptr, end, channel.adc_err_comp_diff_2_3);
+        get_field(ptr, end, channel.adc_OFS_comp_diff_0_1);
+        get_field(ptr, end, channel.adc_OFS_comp_diff_2_3);
+        get_field(ptr, end, channel.current_set_default);
+        get_field(ptr, end, channel_flag);
+        channel.f_sensor_error = (channel_flag != 0);
+    }
+    //  版5
+    AdaptiveConfig adaptive = eh_status.adaptive;
+    get_field(ptr, end, adaptive.enabled);
+    get_field(ptr, end, adaptive.period_min);
+    get_field(ptr, end, adaptive.period_max);
+    get_field(ptr, end, adaptive.uncertainty);
+    get_field(ptr, end, adaptive.alarm_level);
+    setAdaptiveConfig(adaptive);
+
+    eh_status.f_sensor_error = (flag != 0);
+    eh_status.mode = (mode <= Continuous) ? (Modes)mode : Timer;
 }
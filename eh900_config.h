@@ -21,11 +21,11 @@ extern Eh_display lcd_display;
 //! eh900のパラメタを設定／保存するためのクラス
 extern eh900 level_meter;
 
-void menu_main(void);
+void menu_main(uint8_t channels = 1);
 
 void menu_timer_period(void);
 
-void menu_sensor_length(void);
+void menu_sensor_length(uint8_t ch = 0, uint8_t channels = 1);
 
 
 #endif // _EH900_CONFIG_H_
\ No newline at end of file
@@ -24,8 +24,9 @@
     @fn
         コンフィギュレーションメニューの１層目
     @brief  センサ長とタイマー時間のメニューを表示・選択させる
+    @param channels 計測チャネルの数  センサ長はチャネルごとに順に設定する
 */
-void menu_main(void){
+void menu_main(uint8_t channels){
     // メニュー用の列挙型、メニュー名、カーソル位置の指定
     /**
      * @enum Enum
@@ -34,7 +35,7 @@ void menu_main(void){
     enum Menus{LengthConfig, TimerConfig, QuitConfig, Len_menu};
 
     // LCDに表示するメニュー名
-    constexpr char* menu_names[]= {"LEN","TIM","QUIT"};
+    constexpr const char* menu_names[]= {"LEN","TIM","QUIT"};
 
     // メニュー表示の位置
     constexpr uint16_t screen_position[Len_menu]={1,6,12};
@@ -83,7 +84,9 @@ void menu_main(void){
                         // change sensor length
                         meas_sw.clearDuration();
                         Serial.println("Length Config : ---");
-                        menu_sensor_length();
+                        for (uint8_t ch = 0; ch < channels; ch++){
+                            menu_sensor_length(ch, channels);
+                        }
                     break;
 
                     case TimerConfig:
@@ -113,7 +116,7 @@ void menu_main(void){
                 }
 
             } else {
-                menu = ++menu % Len_menu;  
+                menu = (menu + 1) % Len_menu;
                 Serial.print(menu); Serial.print(":");
             }
             meas_sw.clearDuration();
@@ -130,12 +133,18 @@ void menu_main(void){
     @fn
         コンフィギュレーションメニューの２層目
     @brief  センサ長の設定をする
+    @param ch 計測チャネルの番号
+    @param channels 計測チャネルの数  複数ならチャネル番号（1から）を表示する
 */
-void menu_sensor_length(void){
+void menu_sensor_length(uint8_t ch, uint8_t channels){
     lcd_display.clear();
     lcd_display.home();
     lcd_display.blink();
     lcd_display.print("Config: LENGTH");
+    if (channels > 1){
+        lcd_display.print(" ");
+        lcd_display.print(ch + 1);
+    }
     lcd_display.setCursor(10,1);
     lcd_display.print(" inch");
 
@@ -151,9 +160,11 @@ void menu_sensor_length(void){
     //  センサ長の設定のステップ[inch]
     uint16_t length_step = 2;
 
-    uint16_t length = level_meter.getSensorLength();
+    uint16_t length = level_meter.getSensorLength(ch);
+    char number[3];
     lcd_display.setCursor(CURSOR_POSITION, 1);
-    lcd_display.print(right_align(String(length),2));
+    format_number(number, length, 2);
+    lcd_display.print(number);
     lcd_display.setCursor(CURSOR_POSITION-2, 1);
 
     while (! f_exit ){
@@ -175,7 +186,8 @@ void menu_sensor_length(void){
                 }  
                 Serial.print(length); Serial.print(":");
                 lcd_display.setCursor(CURSOR_POSITION, 1);
-                lcd_display.print(right_align(String(length),2));
+                format_number(number, length, 2);
+                lcd_display.print(number);
                 lcd_display.setCursor(CURSOR_POSITION-2, 1);
             }
             meas_sw.clearDuration();
@@ -184,7 +196,7 @@ void menu_sensor_length(void){
         delay(50);
     }
     
-    level_meter.setSensorLength(length);
+    level_meter.setSensorLength(length, ch);
 
     return;
 }
@@ -219,8 +231,10 @@ void menu_timer_period(void){
     boolean f_exit = false;
 
     uint16_t timer_period = level_meter.getTimerPeriod()/60; // [min.]
+    char number[3];
     lcd_display.setCursor(CURSOR_POSITION, 1);
-    lcd_display.print(right_align(String(timer_period),2));
+    format_number(number, timer_period, 2);
+    lcd_display.print(number);
     lcd_display.setCursor(CURSOR_POSITION-2, 1);
     
     while (! f_exit ){
@@ -242,7 +256,8 @@ void menu_timer_period(void){
                 }
                 Serial.print(timer_period); Serial.print(":");
                 lcd_display.setCursor(CURSOR_POSITION, 1);
-                lcd_display.print(right_align(String(timer_period),2));
+                format_number(number, timer_period, 2);
+                lcd_display.print(number);
                 lcd_display.setCursor(CURSOR_POSITION-2, 1);
             }
             meas_sw.clearDuration();
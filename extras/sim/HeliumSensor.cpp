@@ -0,0 +1,109 @@
+/**************************************************************************/
+/*!
+    @file     HeliumSensor.cpp
+    @author   Masa
+
+        Superconducting level sensor model with heat propagation delay
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "HeliumSensor.h"
+#include "SimClock.h"
+
+namespace{
+    //  センサの単位長あたりの常伝導抵抗 [ohm/inch]
+    constexpr double UNIT_RESISTANCE = 11.6;
+    //  常伝導の領域が広がる速さ [inch/s]
+    constexpr double PROPAGATION_VELOCITY = 7.9;
+    //  これより小さい電流ではヒータが働かない [A]
+    constexpr double HEATING_CURRENT = 0.01;
+}
+
+/*!
+    @brief  今の液面を設定する. 以降は減る速さに従って減る
+    @param percent 液面 [%]
+*/
+void HeliumSensor::setLevel(double percent){
+    update();
+    level_start = (percent < 0.0) ? 0.0 : ((percent > 100.0) ? 100.0 : percent);
+    level_time = sim_clock.now();
+}
+
+/*!
+    @brief  液面の減る速さを設定する
+    @param percent_per_hour 減る速さ [%/h]
+*/
+void HeliumSensor::setDrainRate(double percent_per_hour){
+    setLevel(getLevel());
+    drain_rate = percent_per_hour;
+}
+
+/*!
+    @brief  センサに流す電流を変える（電流源の状態が変わった時に呼ぶ）
+    @param amps 電流 [A]
+*/
+void HeliumSensor::setCurrent(double amps){
+    update();
+    current = amps;
+    if (current < HEATING_CURRENT){
+        normal_length = 0.0;
+    }
+}
+
+/*!
+    @brief  今の液面 [%]
+*/
+double HeliumSensor::getLevel(void) const {
+    const double hours = (double)(sim_clock.now() - level_time) / 3.6e9;
+    const double level = level_start - drain_rate * hours;
+    return (level < 0.0) ? 0.0 : level;
+}
+
+/*!
+    @brief  今のセンサの抵抗 [ohm]
+*/
+double HeliumSensor::getResistance(void){
+    update();
+    return UNIT_RESISTANCE * normal_length;
+}
+
+/*!
+    @brief  今のセンサの両端の電圧 [V]
+*/
+double HeliumSensor::getVoltage(void){
+    return current * getResistance();
+}
+
+/*!
+    @brief  前回から今までの常伝導の領域の広がりと発熱を計算する (private)
+*/
+void HeliumSensor::update(void){
+    const uint64_t now = sim_clock.now();
+    const double dt = (double)(now - last_update) / 1e6;
+    last_update = now;
+
+    if (current < HEATING_CURRENT){
+        normal_length = 0.0;
+        return;
+    }
+
+    const double before = normal_length;
+    double after = before + PROPAGATION_VELOCITY * dt;
+    const double limit = gas_length();
+    if (after > limit){
+        after = limit;
+    }
+    normal_length = after;
+
+    heater_time += dt;
+    heat_energy += current * current * UNIT_RESISTANCE * (before + after) / 2.0 * dt;
+}
+
+/*!
+    @brief  液面より上のセンサの長さ [inch] (private)
+*/
+double HeliumSensor::gas_length(void) const {
+    return length * (1.0 - getLevel() / 100.0);
+}
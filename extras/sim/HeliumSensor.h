@@ -0,0 +1,87 @@
+/**************************************************************************/
+/*!
+    @file     HeliumSensor.h
+
+    超伝導液面センサの物理モデル
+    センサの液面より上（ガス中）の部分は、電流を流すとヒータで上端から常伝導に転移し、
+    その領域が熱伝導速度で下へ広がって液面で止まる. 液中の部分は超伝導のまま（抵抗0）.
+    電流を切ると常伝導の領域はすぐに冷えて消える.
+    液面は一定の速さで減り、補充のイベントで戻す.
+*/
+/**************************************************************************/
+
+#ifndef _HELIUMSENSOR_H_
+#define _HELIUMSENSOR_H_
+
+#include <stdint.h>
+
+class HeliumSensor {
+
+  public:
+    HeliumSensor(double length_inch) : length(length_inch){};
+
+    void setLevel(double percent);
+    void setDrainRate(double percent_per_hour);
+    void setCurrent(double amps);
+
+    double getLevel(void) const;
+    double getResistance(void);
+    double getVoltage(void);
+
+    /*!
+    @brief  センサに流れている電流 [A]
+    */
+    double getCurrent(void) const {
+      return current;
+    };
+
+    /*!
+    @brief  センサの長さを変える [inch]  常伝導の領域は電流を流し直した時から広がり直す
+    */
+    void setLength(double length_inch){
+      length = length_inch;
+    };
+
+    /*!
+    @brief  センサの長さ [inch]
+    */
+    double getLength(void) const {
+      return length;
+    };
+
+    /*!
+    @brief  電流を流していた時間の合計 [s]
+    */
+    double getHeaterTime(void){
+      update();
+      return heater_time;
+    };
+
+    /*!
+    @brief  センサで発生した熱量の合計 [J]（ヘリウムの蒸発の目安）
+    */
+    double getHeatEnergy(void){
+      update();
+      return heat_energy;
+    };
+
+  private:
+    double length;
+    //  基準時刻 [us] とその時の液面 [%], 減る速さ [%/h]
+    uint64_t level_time = 0;
+    double level_start = 100.0;
+    double drain_rate = 0.0;
+
+    double current = 0.0;
+    //  常伝導の領域の長さ [inch]
+    double normal_length = 0.0;
+    uint64_t last_update = 0;
+
+    double heater_time = 0.0;
+    double heat_energy = 0.0;
+
+    void update(void);
+    double gas_length(void) const;
+};
+
+#endif // _HELIUMSENSOR_H_
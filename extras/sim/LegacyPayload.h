@@ -0,0 +1,183 @@
+/**************************************************************************/
+/*!
+    @file     LegacyPayload.h
+
+    ベンチマークの比較用  JsonWriter 以前の String を使った IoTゲートウエイのペイロード
+        IotGateway の setPayload / getPayload / addPayload / joinToPayload を String のまま写したもの.
+        ホストには Arduino の String がないので、同じヒープの使い方をする LegacyString で置き換える.
+            コピー・数値からの作成    1回確保する
+            連結（concat）            長さちょうどに確保し直す（Arduino の realloc と同じ回数）
+            a + b + c                 最初の + で a をコピーし、後は同じ文字列に連結する（StringSumHelper）
+        ファームウエアには入れない（eh900_bench だけが使う）.
+*/
+/**************************************************************************/
+
+#ifndef _LEGACYPAYLOAD_H_
+#define _LEGACYPAYLOAD_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <utility>
+
+/*!
+    @brief  Arduino の String と同じ回数ヒープを確保する文字列
+*/
+class LegacyString {
+
+  public:
+    LegacyString(void){};
+
+    LegacyString(const char* str){
+      concat(str, strlen(str));
+    };
+
+    LegacyString(const LegacyString& other){
+      concat(other.c_str(), other.len);
+    };
+
+    LegacyString(LegacyString&& other) noexcept : buf(other.buf), len(other.len){
+      other.buf = nullptr;
+      other.len = 0;
+    };
+
+    explicit LegacyString(int32_t value){
+      char text[12];
+      concat(text, snprintf(text, sizeof(text), "%ld", (long)value));
+    };
+
+    //  小数点以下 decimals 桁（dtostrf と同じく四捨五入）
+    LegacyString(float value, uint8_t decimals){
+      char text[24];
+      concat(text, snprintf(text, sizeof(text), "%.*f", decimals, value));
+    };
+
+    ~LegacyString(){
+      delete[] buf;
+    };
+
+    LegacyString& operator=(const LegacyString& other){
+      if (this != &other){
+        LegacyString copy(other);
+        std::swap(buf, copy.buf);
+        std::swap(len, copy.len);
+      }
+      return *this;
+    };
+
+    LegacyString& operator=(LegacyString&& other) noexcept {
+      std::swap(buf, other.buf);
+      std::swap(len, other.len);
+      return *this;
+    };
+
+    size_t length(void) const {
+      return len;
+    };
+
+    const char* c_str(void) const {
+      return buf ? buf : "";
+    };
+
+    //  後ろに連結する  長さちょうどに確保し直す
+    LegacyString& concat(const char* str, size_t length){
+      if (length == 0){
+        return *this;
+      }
+      char* grown = new char[len + length + 1];
+      if (buf){
+        memcpy(grown, buf, len);
+      }
+      memcpy(grown + len, str, length);
+      grown[len + length] = '\0';
+      delete[] buf;
+      buf = grown;
+      len += length;
+      return *this;
+    };
+
+    //  最初の + だけ左辺をコピーし、続く + は同じ一時オブジェクトに連結する
+    friend LegacyString operator+(const LegacyString& lhs, const LegacyString& rhs){
+      LegacyString sum(lhs);
+      return std::move(sum.concat(rhs.c_str(), rhs.len));
+    };
+    friend LegacyString operator+(const LegacyString& lhs, const char* rhs){
+      LegacyString sum(lhs);
+      return std::move(sum.concat(rhs, strlen(rhs)));
+    };
+    friend LegacyString operator+(const char* lhs, const LegacyString& rhs){
+      LegacyString sum(lhs);
+      return std::move(sum.concat(rhs.c_str(), rhs.len));
+    };
+    friend LegacyString operator+(LegacyString&& lhs, const LegacyString& rhs){
+      return std::move(lhs.concat(rhs.c_str(), rhs.len));
+    };
+    friend LegacyString operator+(LegacyString&& lhs, const char* rhs){
+      return std::move(lhs.concat(rhs, strlen(rhs)));
+    };
+
+  private:
+    char* buf = nullptr;
+    size_t len = 0;
+};
+
+/*!
+    @brief  String を連結してJSONを作っていた頃の IotGateway のペイロード部分
+*/
+class LegacyPayload {
+
+  public:
+    //  payloadに直接JSONデータを書き込む（オーバーライト）  大外の { } なし
+    void setPayload(LegacyString json){
+      payload = json;
+    };
+
+    //  payloadの中身を { } で囲んで返す
+    LegacyString getPayload(void){
+      return("{" + payload + "}");
+    };
+
+    void addPayload(LegacyString key, LegacyString value){
+      LegacyString quote = "\"";
+      LegacyString node = quote + key + quote + ":" + quote + value + quote;
+
+      joinToPayload(node);
+    };
+
+    void addPayload(LegacyString key, int32_t value){
+      LegacyString quote = "\"";
+      LegacyString node = quote + key + quote + ":" + LegacyString(value);
+
+      joinToPayload(node);
+    };
+
+    void addPayload(LegacyString key, float value, uint8_t deciPlac){
+      LegacyString quote = "\"";
+      LegacyString node = quote + key + quote + ":" + LegacyString(value, deciPlac);
+
+      joinToPayload(node);
+    };
+
+    void clearPayload(void){
+      payload = LegacyString();
+    };
+
+    //  大外の { } なしのpayload  （ベンチマークで同じ送信キューに渡すため）
+    const char* body(void) const {
+      return payload.c_str();
+    };
+
+  private:
+    LegacyString payload;
+
+    //  データセパレータ(,)を入れながらpayloadにノードを足す
+    void joinToPayload(LegacyString node){
+      if (payload.length() != 0){
+        payload = payload + "," + node;
+      } else {
+        payload = node;
+      }
+    };
+};
+
+#endif // _LEGACYPAYLOAD_H_
@@ -0,0 +1,208 @@
+/**************************************************************************/
+/*!
+    @file     SimBoard.cpp
+    @author   Masa
+
+        EH900 measurement board model wiring the device models together
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "SimBoard.h"
+#include "SimClock.h"
+
+#include <string.h>
+#include "eh900_class.h"
+
+namespace{
+    //  電流源  DAC 0LSB の時の電流 [A] と、DACの1LSBあたりの電流 [A/LSB]
+    constexpr double CURRENT_OFFSET = 0.0666;
+    constexpr double CURRENT_PER_LSB = 0.0056 / 1241.0;
+
+    //  電圧計測のアッテネータ（実際の抵抗値での比）
+    constexpr double ATTENUATOR = 24.6642;
+    //  電流計測の電流電圧変換 [V/A]
+    constexpr double CURRENT_SENSE = 20.0;
+
+    //  FRAMのパラメタ領域（eh900_class.ino の FRAM_PARM_ADDR）
+    constexpr uint16_t FRAM_PARM_ADDR = 0x0100;
+
+    //  ADS1115 の MUX 設定  差動 0-1, 2-3
+    constexpr uint8_t MUX_DIFF_0_1 = 0;
+    constexpr uint8_t MUX_DIFF_2_3 = 3;
+}
+
+/*!
+    @brief  コンストラクタ  計測チャネルのデバイスのモデルをチャネルのアドレスで Wire につなぐ
+    @param ch チャネル番号（SIM_CHANNEL_MAX 未満）
+    @param sensor_length センサ長 [inch]
+    @param noise_uv ADの入力に加える雑音（標準偏差） [uV]
+    @param seed 雑音の乱数の種
+*/
+SimChannel::SimChannel(uint8_t ch, double sensor_length, double noise_uv, uint32_t seed)
+    : sensor(sensor_length),
+      adc([this](uint8_t mux){ return analog_input(mux); }),
+      channel(ch), noise_volts(noise_uv * 1e-6), rng(seed), noise(0.0, 1.0) {
+
+    pio.setInput([this](void){
+        //  エラーフラグ  断線していて電流を流そうとしている時に LOW
+        const bool f_fault = f_open && isCurrentEnabled();
+        return (uint8_t)(f_fault ? ~(1 << PIO_CURRENT_ERRFLAG) : 0xFF);
+    });
+    pio.setObserver([this](void){ update_current(); });
+    current_dac.setObserver([this](void){ update_current(); });
+
+    Wire.attach(SIM_ADDR_CHANNEL[channel][0], &adc);
+    Wire.attach(SIM_ADDR_CHANNEL[channel][1], &current_dac);
+    Wire.attach(SIM_ADDR_CHANNEL[channel][2], &pio);
+}
+
+/*!
+    @brief  センサの断線を注入する／戻す
+*/
+void SimChannel::setSensorOpen(bool open){
+    f_open = open;
+    update_current();
+}
+
+/*!
+    @brief  電流源のドリフトを設定する  電流を流し始めてから t[s] で電流が (1 + per_second x t) 倍になる
+            電圧と電流のサンプルの時刻がずれていると、比（抵抗）に誤差が出る
+    @param per_second 1秒あたりの電流の変化の割合  0でドリフトなし
+*/
+void SimChannel::setCurrentDrift(double per_second){
+    current_drift = per_second;
+}
+
+/*!
+    @brief  アドレスにつないだこのチャネルのデバイスのモデル
+*/
+SimI2cDevice* SimChannel::findDevice(uint8_t address){
+    if (address == SIM_ADDR_CHANNEL[channel][0]){
+        return &adc;
+    }
+    if (address == SIM_ADDR_CHANNEL[channel][1]){
+        return &current_dac;
+    }
+    if (address == SIM_ADDR_CHANNEL[channel][2]){
+        return &pio;
+    }
+    return nullptr;
+}
+
+/*!
+    @brief  電流源の出す電流 [A] (private)
+*/
+double SimChannel::source_current(void) const {
+    if (!isCurrentEnabled() || f_open){
+        return 0.0;
+    }
+    return CURRENT_OFFSET + CURRENT_PER_LSB * current_dac.getValue();
+}
+
+/*!
+    @brief  電流源の状態が変わったらセンサに伝える (private)
+*/
+void SimChannel::update_current(void){
+    const double amps = source_current();
+    if (amps > 0.0 && !f_current_on){
+        current_on_time = sim_clock.now();
+    }
+    f_current_on = amps > 0.0;
+    sensor.setCurrent(amps);
+}
+
+/*!
+    @brief  ADコンバータの入力電圧 [V] (private)
+*/
+double SimChannel::analog_input(uint8_t mux){
+    double volts = 0.0;
+
+    switch (mux){
+        case MUX_DIFF_0_1:
+            volts = sensor.getVoltage() / ATTENUATOR;
+            break;
+        case MUX_DIFF_2_3:
+            volts = sensor.getCurrent() * CURRENT_SENSE;
+            break;
+        default:
+            break;
+    }
+    if (f_current_on){
+        volts *= 1.0 + current_drift * (double)(sim_clock.now() - current_on_time) * 1e-6;
+    }
+    return volts + noise_volts * noise(rng);
+}
+
+/*!
+    @brief  コンストラクタ  デバイスのモデルを Wire につなぐ
+    @param sensor_length センサ長 [inch]  全チャネル同じ
+    @param noise_uv ADの入力に加える雑音（標準偏差） [uV]
+    @param seed 雑音の乱数の種  チャネルごとに1ずつずらす
+    @param channel_num 計測チャネルの数（1〜SIM_CHANNEL_MAX）
+*/
+SimBoard::SimBoard(double sensor_length, double noise_uv, uint32_t seed, uint8_t channel_num)
+    : channels(make_channels(channel_num, sensor_length, noise_uv, seed)),
+      sensor(channels[0]->sensor), adc(channels[0]->adc), pio(channels[0]->pio), current_dac(channels[0]->current_dac) {
+
+    Wire.attach(SIM_ADDR_V_MON, &vmon_dac);
+    Wire.attach(SIM_ADDR_FRAM, &fram);
+    Wire.attach(SIM_ADDR_LCD, &lcd);
+    Wire.attach(SIM_ADDR_LCD_RGB, &rgb);
+}
+
+/*!
+    @brief  計測チャネルを作る (private)
+*/
+std::vector<std::unique_ptr<SimChannel>> SimBoard::make_channels(uint8_t channel_num, double sensor_length,
+                                                                 double noise_uv, uint32_t seed){
+    std::vector<std::unique_ptr<SimChannel>> made;
+    for (uint8_t ch = 0; ch < channel_num && ch < SIM_CHANNEL_MAX; ch++){
+        made.emplace_back(new SimChannel(ch, sensor_length, noise_uv, seed + ch));
+    }
+    return made;
+}
+
+/*!
+    @brief  チャネル0のセンサの断線を注入する／戻す
+*/
+void SimBoard::setSensorOpen(bool open){
+    channels[0]->setSensorOpen(open);
+}
+
+/*!
+    @brief  旧版の形式で液面計のパラメタをFRAMに入れておく（起動時に新しい形式へ移行される）
+            FRAMが空のままだとセンサ長0で起動してしまう
+    @param sensor_length センサ長 [inch]
+    @param timer_period 計測タイマの周期 [s]
+*/
+void SimBoard::seedParameters(uint16_t sensor_length, uint16_t timer_period){
+    Meter_parameters params = {};
+    params.sensor_length = sensor_length;
+    params.timer_period = timer_period;
+    params.adc_err_comp_diff_0_1 = 1.0;
+    params.adc_err_comp_diff_2_3 = 1.0;
+    params.current_set_default = 750;
+    params.mode = Timer;
+
+    memcpy(&fram.contents()[FRAM_PARM_ADDR], &params, METER_PARAMETERS_LEGACY_SIZE);
+}
+
+/*!
+    @brief  アドレスにつないだデバイスのモデル（無応答の注入に使う）
+*/
+SimI2cDevice* SimBoard::findDevice(uint8_t address){
+    for (const std::unique_ptr<SimChannel>& channel : channels){
+        SimI2cDevice* device = channel->findDevice(address);
+        if (device){
+            return device;
+        }
+    }
+    switch (address){
+        case SIM_ADDR_V_MON:        return &vmon_dac;
+        case SIM_ADDR_FRAM:         return &fram;
+        case SIM_ADDR_LCD:          return &lcd;
+        default:                    return nullptr;
+    }
+}
@@ -0,0 +1,165 @@
+/**************************************************************************/
+/*!
+    @file     SimBoard.h
+
+    EH900 の計測ボードの模擬  デバイスのモデルを実機と同じアドレスで Wire につなぎ、
+    電流源（DAC + PIO）・センサ・ADコンバータの間のアナログの関係を計算する
+    計測チャネル（ADC・電流源DAC・PIOの組とセンサ）は SimChannel. 増設のチャネルも同じ形でつなぐ
+        電流源      I = 66.6mA + DAC設定値 x 5.6mA/V / 1241LSB/V  （PIO 4 が LOW の時だけ流れる）
+        電圧計測    V(0-1) = センサの電圧 / アッテネータ(24.6642)
+        電流計測    V(2-3) = I x 20ohm
+    故障の注入: センサの断線（エラーフラグ PIO 0 が LOW になる）, デバイスの無応答
+    電流源のドリフト: 電流を流し始めてからの時間に比例して電流が変わる（センサの電圧も同じ割合で変わる）
+*/
+/**************************************************************************/
+
+#ifndef _SIMBOARD_H_
+#define _SIMBOARD_H_
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "SimDevices.h"
+#include "HeliumSensor.h"
+
+//  実機のI2Cアドレス  ADC・電流源DAC・PIO はチャネル0
+constexpr uint8_t SIM_ADDR_ADC = 0x48;
+constexpr uint8_t SIM_ADDR_V_MON = 0x49;
+constexpr uint8_t SIM_ADDR_CURRENT_ADJ = 0x60;
+constexpr uint8_t SIM_ADDR_PIO = 0x20;
+constexpr uint8_t SIM_ADDR_FRAM = 0x50;
+constexpr uint8_t SIM_ADDR_LCD = 0x3E;
+constexpr uint8_t SIM_ADDR_LCD_RGB = 0x62;
+
+//  計測チャネルの最大数と、チャネルごとの ADC・電流源DAC・PIO のアドレス（measurement.ino の I2C_ADDR_CHANNEL）
+constexpr uint8_t SIM_CHANNEL_MAX = 3;
+constexpr uint8_t SIM_ADDR_CHANNEL[SIM_CHANNEL_MAX][3] = {
+    {SIM_ADDR_ADC, SIM_ADDR_CURRENT_ADJ, SIM_ADDR_PIO},
+    {0x4A, 0x61, 0x21},
+    {0x4B, 0x63, 0x22},
+};
+
+/*!
+    @brief  計測チャネル1組  電流源（DAC + PIO）・センサ・ADコンバータ
+*/
+class SimChannel {
+
+  public:
+    SimChannel(uint8_t ch, double sensor_length, double noise_uv, uint32_t seed);
+
+    void setSensorOpen(bool open);
+    void setCurrentDrift(double per_second);
+    SimI2cDevice* findDevice(uint8_t address);
+
+    /*!
+    @brief  センサが断線しているか
+    */
+    bool isSensorOpen(void) const {
+      return f_open;
+    };
+
+    /*!
+    @brief  電流源が電流を流す設定になっているか
+    */
+    bool isCurrentEnabled(void) const {
+      return (pio.getOutputs() & (1 << PIO_CURRENT_ENABLE)) == 0;
+    };
+
+    HeliumSensor sensor;
+
+    Ads1115Model adc;
+    Mcp23008Model pio;
+    Mcp4725Model current_dac;
+
+  private:
+    static constexpr uint8_t PIO_CURRENT_ENABLE = 4;
+    static constexpr uint8_t PIO_CURRENT_ERRFLAG = 0;
+
+    uint8_t channel;
+    bool f_open = false;
+    //  電流源のドリフト [1/s] と、電流を流し始めた時刻 [us]
+    double current_drift = 0.0;
+    uint64_t current_on_time = 0;
+    bool f_current_on = false;
+    double noise_volts;
+    std::mt19937 rng;
+    std::normal_distribution<double> noise;
+
+    double source_current(void) const;
+    void update_current(void);
+    double analog_input(uint8_t mux);
+};
+
+class SimBoard {
+
+  private:
+    //  計測チャネル  下の sensor などの参照より先に作る
+    std::vector<std::unique_ptr<SimChannel>> channels;
+
+  public:
+    SimBoard(double sensor_length, double noise_uv, uint32_t seed, uint8_t channel_num = 1);
+
+    void setSensorOpen(bool open);
+    void seedParameters(uint16_t sensor_length, uint16_t timer_period);
+
+    /*!
+    @brief  センサが断線しているか（チャネル0）
+    */
+    bool isSensorOpen(void) const {
+      return channels[0]->isSensorOpen();
+    };
+
+    /*!
+    @brief  電流源が電流を流す設定になっているか（チャネル0）
+    */
+    bool isCurrentEnabled(void) const {
+      return channels[0]->isCurrentEnabled();
+    };
+
+    /*!
+    @brief  計測チャネルの数
+    */
+    uint8_t getChannelCount(void) const {
+      return (uint8_t)channels.size();
+    };
+
+    /*!
+    @brief  計測チャネル
+    */
+    SimChannel& getChannel(uint8_t ch){
+      return *channels[ch];
+    };
+
+    SimI2cDevice* findDevice(uint8_t address);
+
+    //  チャネル0のセンサとデバイス
+    HeliumSensor& sensor;
+    Ads1115Model& adc;
+    Mcp23008Model& pio;
+    Mcp4725Model& current_dac;
+
+    Dac80501Model vmon_dac;
+    FramModel fram;
+    LcdModel lcd;
+
+  private:
+    //  バックライトの制御（書き込みを受け取るだけ）
+    class RgbModel : public SimI2cDevice {
+      public:
+        bool onWrite(const uint8_t* data, size_t length) override {
+          (void)data;
+          (void)length;
+          return true;
+        };
+        size_t onRead(uint8_t* data, size_t length) override {
+          (void)data;
+          return length;
+        };
+    } rgb;
+
+    static std::vector<std::unique_ptr<SimChannel>> make_channels(uint8_t channel_num, double sensor_length,
+                                                                  double noise_uv, uint32_t seed);
+};
+
+#endif // _SIMBOARD_H_
@@ -0,0 +1,105 @@
+/**************************************************************************/
+/*!
+    @file     SimClock.cpp
+    @author   Masa
+
+        Virtual time base for the host simulation
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "SimClock.h"
+
+#include <algorithm>
+
+SimClock sim_clock;
+
+/*!
+    @brief  時計を進める
+    @param us 進める時間 [us]
+*/
+void SimClock::advance(uint64_t us){
+  advanceTo(time_us + us);
+}
+
+/*!
+    @brief  指定の時刻まで時計を進める. 途中で期限の来たタイマとイベントを順に呼ぶ
+            呼ばれた側がさらに時計を進めても（ISRの中の delay() など）壊れない
+    @param target 時刻 [us]  今より前なら何もしない
+*/
+void SimClock::advanceTo(uint64_t target){
+  while (true){
+    uint64_t due = UINT64_MAX;
+    SimTimerSource* source = nullptr;
+
+    for (SimTimerSource* s : sources){
+      const uint64_t t = s->nextDue();
+      if (t < due){
+        due = t;
+        source = s;
+      }
+    }
+
+    const bool f_event = !events.empty() && events.begin()->first <= due;
+    if (f_event){
+      due = events.begin()->first;
+    }
+    if (due > target){
+      break;
+    }
+
+    if (due > time_us){
+      time_us = due;
+    }
+    if (f_event){
+      std::function<void(void)> event = events.begin()->second;
+      events.erase(events.begin());
+      event();
+    } else {
+      source->fire();
+    }
+  }
+
+  if (target > time_us){
+    time_us = target;
+  }
+}
+
+/*!
+    @brief  一度だけ実行するイベントを予定する
+    @param at 時刻 [us]
+    @param event 実行する処理
+*/
+void SimClock::schedule(uint64_t at, std::function<void(void)> event){
+  events.emplace(at, event);
+}
+
+/*!
+    @brief  次にタイマかイベントが発火する時刻
+    @return 時刻 [us]  予定がなければ UINT64_MAX
+*/
+uint64_t SimClock::nextEvent(void) const {
+  uint64_t due = events.empty() ? UINT64_MAX : events.begin()->first;
+
+  for (const SimTimerSource* s : sources){
+    due = std::min(due, s->nextDue());
+  }
+  return due;
+}
+
+/*!
+    @brief  周期的な発生源を登録する
+*/
+void SimClock::attach(SimTimerSource* source){
+  if (std::find(sources.begin(), sources.end(), source) == sources.end()){
+    sources.push_back(source);
+  }
+}
+
+/*!
+    @brief  周期的な発生源の登録を外す
+*/
+void SimClock::detach(SimTimerSource* source){
+  sources.erase(std::remove(sources.begin(), sources.end(), source), sources.end());
+}
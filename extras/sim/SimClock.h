@@ -0,0 +1,64 @@
+/**************************************************************************/
+/*!
+    @file     SimClock.h
+
+    ホストシミュレーションの仮想時計
+    millis() / micros() / delay() はこの時計を読み進めるだけで、実時間は待たない.
+    タイマ割り込みや予定したイベント（スイッチ操作・故障の注入など）は
+    時計を進める途中で、期限の順に呼び出される.
+*/
+/**************************************************************************/
+
+#ifndef _SIMCLOCK_H_
+#define _SIMCLOCK_H_
+
+#include <stdint.h>
+#include <functional>
+#include <map>
+#include <vector>
+
+/*!
+    @brief  時計が進むと呼ばれる周期的な発生源（HardwareTimer など）
+*/
+class SimTimerSource {
+
+  public:
+    virtual ~SimTimerSource(){};
+
+    //  次に発火する時刻 [us]  予定がなければ UINT64_MAX
+    virtual uint64_t nextDue(void) const = 0;
+    //  発火させる  次の期限は自分で更新すること
+    virtual void fire(void) = 0;
+};
+
+class SimClock {
+
+  public:
+    SimClock(void){};
+
+    /*!
+    @brief  今の時刻 [us]
+    */
+    uint64_t now(void) const {
+      return time_us;
+    };
+
+    void advance(uint64_t us);
+    void advanceTo(uint64_t target);
+
+    void schedule(uint64_t at, std::function<void(void)> event);
+    uint64_t nextEvent(void) const;
+
+    void attach(SimTimerSource* source);
+    void detach(SimTimerSource* source);
+
+  private:
+    uint64_t time_us = 0;
+    std::multimap<uint64_t, std::function<void(void)>> events;
+    std::vector<SimTimerSource*> sources;
+};
+
+//  シミュレーション全体で共有する時計（SimClock.cpp で定義）
+extern SimClock sim_clock;
+
+#endif // _SIMCLOCK_H_
@@ -0,0 +1,322 @@
+/**************************************************************************/
+/*!
+    @file     SimDevices.cpp
+    @author   Masa
+
+        Register-level I2C device models for the host simulation
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "SimDevices.h"
+#include "SimClock.h"
+
+#include <math.h>
+#include <string.h>
+
+namespace{
+    //  ADS1115 のレジスタとビット
+    constexpr uint8_t ADS_REG_CONVERSION = 0x00;
+    constexpr uint8_t ADS_REG_CONFIG = 0x01;
+    constexpr uint16_t ADS_OS = 0x8000;
+    constexpr uint16_t ADS_MODE_SINGLE = 0x0100;
+    //  変換時間に足す内部発振器のばらつき分 [us]
+    constexpr uint64_t ADS_CONVERSION_MARGIN = 20;
+
+    //  PGAごとのフルスケール [V]  PGA[2:0]
+    constexpr double ADS_FULL_SCALE[8] = {6.144, 4.096, 2.048, 1.024, 0.512, 0.256, 0.256, 0.256};
+    //  データレート [SPS]  DR[2:0]
+    constexpr uint32_t ADS_DATA_RATE[8] = {8, 16, 32, 64, 128, 250, 475, 860};
+
+    //  LCDのコントロールバイト
+    constexpr uint8_t LCD_CO = 0x80;
+    constexpr uint8_t LCD_RS = 0x40;
+    //  LCDの行の先頭のDDRAMアドレス
+    constexpr uint8_t LCD_ROW_ADDR[2] = {0x00, 0x40};
+    constexpr uint8_t LCD_COLS = 16;
+}
+
+/*------------------------------------------------------------------------*/
+//  Ads1115Model
+
+double Ads1115Model::fullScale(uint16_t config){
+    return ADS_FULL_SCALE[(config >> 9) & 0x7];
+}
+
+uint32_t Ads1115Model::dataRate(uint16_t config){
+    return ADS_DATA_RATE[(config >> 5) & 0x7];
+}
+
+bool Ads1115Model::onWrite(const uint8_t* data, size_t length){
+    update();
+    pointer = data[0] & 0x3;
+    if (length < 3 || pointer != ADS_REG_CONFIG){
+        return true;
+    }
+
+    config = ((uint16_t)data[1] << 8) | data[2];
+    const uint64_t period = 1000000 / dataRate(config) + ADS_CONVERSION_MARGIN;
+
+    if (config & ADS_MODE_SINGLE){
+        if (config & ADS_OS){
+            conv_done = sim_clock.now() + period;
+        }
+    } else {
+        cont_start = sim_clock.now();
+        conv_done = cont_start + period;
+    }
+    config &= ~ADS_OS;
+    return true;
+}
+
+size_t Ads1115Model::onRead(uint8_t* data, size_t length){
+    update();
+
+    uint16_t value = (uint16_t)conversion;
+    if (pointer == ADS_REG_CONFIG){
+        //  OS=1 は変換していない（シングルショット）
+        value = config | ((conv_done == 0) ? ADS_OS : 0);
+    }
+    if (length > 0){
+        data[0] = value >> 8;
+    }
+    if (length > 1){
+        data[1] = value & 0xFF;
+    }
+    return length;
+}
+
+/*!
+    @brief  今の時刻までに終わった変換の結果を変換レジスタに入れる (private)
+*/
+void Ads1115Model::update(void){
+    if (conv_done == 0 || sim_clock.now() < conv_done || f_stalled){
+        return;
+    }
+    conversion = sample();
+    conversions++;
+
+    if (config & ADS_MODE_SINGLE){
+        conv_done = 0;
+    } else {
+        //  連続変換  次の変換の終わる時刻
+        const uint64_t period = 1000000 / dataRate(config) + ADS_CONVERSION_MARGIN;
+        const uint64_t done = (sim_clock.now() - cont_start) / period;
+        conv_done = cont_start + (done + 1) * period;
+    }
+}
+
+/*!
+    @brief  入力をPGAのフルスケールで16bitに量子化する (private)
+*/
+int16_t Ads1115Model::sample(void){
+    const double volts = source ? source((config >> 12) & 0x7) : 0.0;
+    const double code = round(volts / fullScale(config) * 32768.0);
+
+    if (code > 32767.0){
+        return 32767;
+    }
+    if (code < -32768.0){
+        return -32768;
+    }
+    return (int16_t)code;
+}
+
+/*------------------------------------------------------------------------*/
+//  Mcp23008Model
+
+bool Mcp23008Model::onWrite(const uint8_t* data, size_t length){
+    pointer = data[0];
+    for (size_t i = 1; i < length; i++){
+        if (pointer < REG_NUM){
+            //  GPIOへの書き込みは出力ラッチに入る
+            regs[(pointer == GPIO) ? OLAT : pointer] = data[i];
+        }
+        pointer++;
+    }
+    if (length > 1 && observer){
+        observer();
+    }
+    return true;
+}
+
+size_t Mcp23008Model::onRead(uint8_t* data, size_t length){
+    for (size_t i = 0; i < length; i++){
+        data[i] = (pointer == GPIO) ? read_gpio() : ((pointer < REG_NUM) ? regs[pointer] : 0);
+        pointer++;
+    }
+    return length;
+}
+
+/*!
+    @brief  GPIOの読み値  出力ピンはラッチの値, 入力ピンは外からのレベル (private)
+*/
+uint8_t Mcp23008Model::read_gpio(void) const {
+    const uint8_t input = input_source ? input_source() : regs[GPPU];
+    return (regs[OLAT] & ~regs[IODIR]) | (input & regs[IODIR]);
+}
+
+/*------------------------------------------------------------------------*/
+//  Mcp4725Model
+
+bool Mcp4725Model::onWrite(const uint8_t* data, size_t length){
+    if (length >= 3 && (data[0] & 0x40)){
+        //  DACレジスタへの書き込み（EEPROMへの書き込みを含む）
+        value = ((uint16_t)data[1] << 4) | (data[2] >> 4);
+    } else if (length >= 2 && (data[0] & 0xC0) == 0){
+        //  ファストモードの書き込み
+        value = ((uint16_t)(data[0] & 0x0F) << 8) | data[1];
+    }
+    if (observer){
+        observer();
+    }
+    return true;
+}
+
+size_t Mcp4725Model::onRead(uint8_t* data, size_t length){
+    const uint8_t status[5] = {0xC0, (uint8_t)(value >> 4), (uint8_t)(value << 4), 0, 0};
+    for (size_t i = 0; i < length; i++){
+        data[i] = (i < sizeof(status)) ? status[i] : 0;
+    }
+    return length;
+}
+
+/*------------------------------------------------------------------------*/
+//  Dac80501Model
+
+bool Dac80501Model::onWrite(const uint8_t* data, size_t length){
+    pointer = data[0] & 0x0F;
+    if (length < 3 || pointer >= CMD_NUM || pointer == CMD_STATUS){
+        return true;
+    }
+    regs[pointer] = ((uint16_t)data[1] << 8) | data[2];
+    if (pointer == CMD_DAC){
+        updates++;
+    }
+    return true;
+}
+
+size_t Dac80501Model::onRead(uint8_t* data, size_t length){
+    //  STATUS は REF-ALARM=0 のまま
+    const uint16_t value = (pointer < CMD_NUM && pointer != CMD_STATUS) ? regs[pointer] : 0;
+    if (length > 0){
+        data[0] = value >> 8;
+    }
+    if (length > 1){
+        data[1] = value & 0xFF;
+    }
+    return length;
+}
+
+/*------------------------------------------------------------------------*/
+//  FramModel
+
+bool FramModel::onWrite(const uint8_t* data, size_t length){
+    if (length < 2){
+        return true;
+    }
+    address = ((uint16_t)data[0] << 8) | data[1];
+    for (size_t i = 2; i < length; i++){
+        memory[address % memory.size()] = data[i];
+        address++;
+    }
+    return true;
+}
+
+size_t FramModel::onRead(uint8_t* data, size_t length){
+    for (size_t i = 0; i < length; i++){
+        data[i] = memory[address % memory.size()];
+        address++;
+    }
+    return length;
+}
+
+/*------------------------------------------------------------------------*/
+//  LcdModel
+
+LcdModel::LcdModel(void){
+    memset(ddram, ' ', sizeof(ddram));
+}
+
+/*!
+    @brief  コントロールバイトとデータの組を解釈する
+            Co=1 : 次の1byteだけがRSに従うデータ/コマンドで、その後にまたコントロールバイトが来る
+            Co=0 : 残りすべてがRSに従うデータ/コマンド
+*/
+bool LcdModel::onWrite(const uint8_t* data, size_t length){
+    size_t i = 0;
+    bool f_changed = false;
+
+    while (i + 1 < length){
+        const uint8_t control = data[i++];
+        const bool f_data = (control & LCD_RS) != 0;
+        const size_t end = (control & LCD_CO) ? i + 1 : length;
+
+        for (; i < end; i++){
+            if (f_data){
+                data_writes++;
+                write_data(data[i]);
+            } else {
+                commands++;
+                write_command(data[i]);
+            }
+            f_changed = true;
+        }
+    }
+
+    if (f_changed && observer){
+        observer(*this);
+    }
+    return true;
+}
+
+size_t LcdModel::onRead(uint8_t* data, size_t length){
+    memset(data, 0, length);
+    return length;
+}
+
+/*!
+    @brief  1行分の表示内容  表示がOffなら空白. バーグラフ用の文字（0〜7）は '#' にする
+*/
+std::string LcdModel::getLine(uint8_t row) const {
+    std::string line(LCD_COLS, ' ');
+
+    if (!f_display_on || row > 1){
+        return line;
+    }
+    for (uint8_t col = 0; col < LCD_COLS; col++){
+        const uint8_t c = ddram[LCD_ROW_ADDR[row] + col];
+        line[col] = (c < 8) ? '#' : (char)c;
+    }
+    return line;
+}
+
+void LcdModel::write_command(uint8_t value){
+    if (value & 0x80){          //  DDRAMアドレス
+        address = value & 0x7F;
+        f_cgram = false;
+    } else if (value & 0x40){   //  CGRAMアドレス
+        f_cgram = true;
+    } else if (value & 0x20){   //  ファンクションセット
+    } else if (value & 0x10){   //  カーソル・表示シフト
+    } else if (value & 0x08){   //  表示On/Off
+        f_display_on = (value & 0x04) != 0;
+    } else if (value & 0x04){   //  エントリモード
+    } else if (value & 0x02){   //  ホーム
+        address = 0;
+        f_cgram = false;
+    } else if (value & 0x01){   //  クリア
+        memset(ddram, ' ', sizeof(ddram));
+        address = 0;
+        f_cgram = false;
+    }
+}
+
+void LcdModel::write_data(uint8_t value){
+    if (f_cgram){
+        return;
+    }
+    ddram[address & 0x7F] = value;
+    address = (address + 1) & 0x7F;
+}
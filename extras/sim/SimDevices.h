@@ -0,0 +1,217 @@
+/**************************************************************************/
+/*!
+    @file     SimDevices.h
+
+    I2Cデバイスのモデル（レジスタの動作を模擬する）
+        Ads1115Model    ADコンバータ  変換時間・PGA・データレートを模擬. 入力はアナログ源の関数
+        Mcp23008Model   PIO  入力ピンのレベルは外から与える（故障の注入に使う）
+        Mcp4725Model    電流源設定用DAC
+        Dac80501Model   アナログモニタ出力用DAC
+        FramModel       FRAM (MB85RC256V 32kbyte)
+        LcdModel        Grove LCD  表示内容を16x2の文字として取り出せる
+*/
+/**************************************************************************/
+
+#ifndef _SIMDEVICES_H_
+#define _SIMDEVICES_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <Wire.h>
+
+class Ads1115Model : public SimI2cDevice {
+
+  public:
+    //  差動入力の電圧 [V] を返す関数  mux は CONFIGレジスタの MUX[2:0]
+    typedef std::function<double(uint8_t mux)> AnalogSource;
+
+    Ads1115Model(AnalogSource source) : source(source){};
+
+    bool onWrite(const uint8_t* data, size_t length) override;
+    size_t onRead(uint8_t* data, size_t length) override;
+
+    /*!
+    @brief  変換した回数
+    */
+    uint32_t getConversions(void) const {
+      return conversions;
+    };
+
+    /*!
+    @brief  故障の注入  変換が終わらない（OSビットが 0 のまま、変換レジスタも変わらない）
+            I2Cには応答するので、NACK ではなく変換完了のタイムアウトになる
+    */
+    void setStalled(bool stalled){
+      f_stalled = stalled;
+    };
+
+    static double fullScale(uint16_t config);
+    static uint32_t dataRate(uint16_t config);
+
+  private:
+    AnalogSource source;
+
+    uint8_t pointer = 0;
+    uint16_t config = 0x8583;
+    int16_t conversion = 0;
+
+    //  シングルショット変換が終わる時刻 [us]  変換中でなければ0
+    uint64_t conv_done = 0;
+    //  連続変換モードの開始時刻 [us]
+    uint64_t cont_start = 0;
+    uint32_t conversions = 0;
+    bool f_stalled = false;
+
+    void update(void);
+    int16_t sample(void);
+};
+
+class Mcp23008Model : public SimI2cDevice {
+
+  public:
+    Mcp23008Model(void){};
+
+    bool onWrite(const uint8_t* data, size_t length) override;
+    size_t onRead(uint8_t* data, size_t length) override;
+
+    //  入力ピンのレベルを返す関数を設定  nullptrならプルアップの状態
+    void setInput(std::function<uint8_t(void)> input){
+      input_source = input;
+    };
+
+    //  書き込みのたびに呼ばれる関数
+    void setObserver(std::function<void(void)> func){
+      observer = func;
+    };
+
+    //  出力ピンのレベル（入力ピンは1）
+    uint8_t getOutputs(void) const {
+      return regs[OLAT] | regs[IODIR];
+    };
+
+  private:
+    enum Registers { IODIR = 0x00, GPPU = 0x06, GPIO = 0x09, OLAT = 0x0A, REG_NUM = 0x0B };
+
+    uint8_t regs[REG_NUM] = {0xFF};
+    uint8_t pointer = 0;
+    std::function<uint8_t(void)> input_source;
+    std::function<void(void)> observer;
+
+    uint8_t read_gpio(void) const;
+};
+
+class Mcp4725Model : public SimI2cDevice {
+
+  public:
+    Mcp4725Model(void){};
+
+    bool onWrite(const uint8_t* data, size_t length) override;
+    size_t onRead(uint8_t* data, size_t length) override;
+
+    //  書き込みのたびに呼ばれる関数
+    void setObserver(std::function<void(void)> func){
+      observer = func;
+    };
+
+    //  DACの設定値 [LSB] (12bit)
+    uint16_t getValue(void) const {
+      return value;
+    };
+
+  private:
+    uint16_t value = 0;
+    std::function<void(void)> observer;
+};
+
+class Dac80501Model : public SimI2cDevice {
+
+  public:
+    Dac80501Model(void){};
+
+    bool onWrite(const uint8_t* data, size_t length) override;
+    size_t onRead(uint8_t* data, size_t length) override;
+
+    //  DACの設定値 [LSB] (16bit)
+    uint16_t getValue(void) const {
+      return regs[CMD_DAC];
+    };
+
+    //  書き込まれた回数
+    uint32_t getUpdates(void) const {
+      return updates;
+    };
+
+  private:
+    enum Commands { CMD_STATUS = 0x07, CMD_DAC = 0x08, CMD_NUM = 0x09 };
+
+    uint16_t regs[CMD_NUM] = {};
+    uint8_t pointer = 0;
+    uint32_t updates = 0;
+};
+
+class FramModel : public SimI2cDevice {
+
+  public:
+    FramModel(size_t size = 0x8000) : memory(size, 0x00){};
+
+    bool onWrite(const uint8_t* data, size_t length) override;
+    size_t onRead(uint8_t* data, size_t length) override;
+
+    //  メモリの中身を直接読み書きする（起動前の設定など）
+    std::vector<uint8_t>& contents(void){
+      return memory;
+    };
+
+  private:
+    std::vector<uint8_t> memory;
+    uint16_t address = 0;
+};
+
+class LcdModel : public SimI2cDevice {
+
+  public:
+    //  表示が変わるたびに呼ばれる関数
+    typedef std::function<void(const LcdModel& lcd)> Observer;
+
+    LcdModel(void);
+
+    bool onWrite(const uint8_t* data, size_t length) override;
+    size_t onRead(uint8_t* data, size_t length) override;
+
+    std::string getLine(uint8_t row) const;
+
+    bool isDisplayOn(void) const {
+      return f_display_on;
+    };
+
+    void setObserver(Observer func){
+      observer = func;
+    };
+
+    //  受け取った表示データ、コマンドの数
+    uint32_t getDataWrites(void) const {
+      return data_writes;
+    };
+
+    uint32_t getCommands(void) const {
+      return commands;
+    };
+
+  private:
+    uint8_t ddram[0x80];
+    uint8_t address = 0;
+    bool f_cgram = false;
+    bool f_display_on = false;
+    uint32_t data_writes = 0;
+    uint32_t commands = 0;
+    Observer observer;
+
+    void write_command(uint8_t value);
+    void write_data(uint8_t value);
+};
+
+#endif // _SIMDEVICES_H_
@@ -0,0 +1,92 @@
+/**************************************************************************/
+/*!
+    @file     SimI2cPort.cpp
+    @author   Masa
+
+        Interrupt-driven I2C transfers for the host simulation (replaces I2cPortStm32.cpp)
+        A transfer reaches the device model when it starts, and its completion
+        "interrupt" fires from the virtual clock after the bus time has passed.
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "I2cPort.h"
+#include "SimClock.h"
+
+namespace{
+    /*!
+        @brief  転送の完了割り込みの模擬  転送は1つずつなので予定も1つ
+                （SimClock::schedule() はヒープを使うので、ベンチマークの数に入らないよう時計の発生源にする）
+    */
+    class TransferCompletion : public SimTimerSource {
+
+      public:
+        void begin(I2cPort* new_port){
+          if (!port){
+            sim_clock.attach(this);
+          }
+          port = new_port;
+        };
+
+        void expect(uint64_t time_us, bool f_result){
+          due = sim_clock.now() + time_us;
+          f_success = f_result;
+        };
+
+        uint64_t nextDue(void) const override {
+          return due;
+        };
+
+        void fire(void) override {
+          due = UINT64_MAX;
+          port->onComplete(f_success);
+        };
+
+      private:
+        I2cPort* port = nullptr;
+        uint64_t due = UINT64_MAX;
+        bool f_success = false;
+    };
+
+    TransferCompletion completion;
+}
+
+/*!
+    @brief  完了の割り込みを時計につなぐ (private)
+*/
+void I2cPort::hw_start(void){
+    completion.begin(this);
+}
+
+/*!
+    @brief  書き込みを始める (private)  デバイスのモデルにはすぐ届き、転送時間の後に完了する
+*/
+bool I2cPort::hw_write(uint8_t address, const uint8_t* data, size_t length, bool f_stop){
+    (void)f_stop;
+    uint64_t time_us = 0;
+    const bool f_success = wire->transferWrite(address, data, length, time_us);
+
+    completion.expect(time_us, f_success);
+    return true;
+}
+
+/*!
+    @brief  読み出しを始める (private)  転送時間の後に完了する
+*/
+bool I2cPort::hw_read(uint8_t address, uint8_t* data, size_t length, bool f_restart){
+    (void)f_restart;
+    uint64_t time_us = 0;
+    const bool f_success = wire->transferRead(address, data, length, time_us);
+
+    completion.expect(time_us, f_success);
+    return true;
+}
+
+/*!
+    @brief  完了を待つ間は、次の予定（転送の完了やタイマ）まで時計を進める
+*/
+void I2cPort::idle(void){
+    const uint64_t next = sim_clock.nextEvent();
+    sim_clock.advanceTo((next == UINT64_MAX) ? sim_clock.now() + 1 : next);
+}
@@ -0,0 +1,58 @@
+/**************************************************************************/
+/*!
+    @file     SimLowPower.cpp
+    @author   Masa
+
+        CPU sleep for the host simulation (replaces LowPowerStm32.cpp)
+        Sleeping advances the virtual clock to the next timer or scheduled event,
+        so the time spent asleep is what the firmware would spend on the target.
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "LowPower.h"
+#include "SimClock.h"
+
+#include <algorithm>
+
+/*!
+    @brief  RTCは設計値の周波数で動いているものとする (private)
+*/
+uint32_t LowPower::hw_begin(void){
+    return LOW_POWER_RTC_HZ;
+}
+
+/*!
+    @brief  次のタイマ割り込みかイベントまで時計を進める (private)
+            実機と同じく SysTick が 1ms ごとに起こすので、次の 1ms の境目より先には進めない
+*/
+void LowPower::hw_idle(uint32_t ms){
+    (void)ms;
+    const uint64_t tick = (sim_clock.now() / 1000 + 1) * 1000;
+    sim_clock.advanceTo(std::min(tick, sim_clock.nextEvent()));
+}
+
+/*!
+    @brief  ms だけ時計を進める. 途中でISRが wake() を呼べばそこで起きる (private)
+            STOPの間はタイマが止まるので、呼ぶ側はタイマとI2Cの転送を止めておくこと
+    @return 眠った時間 [ms]
+*/
+uint32_t LowPower::hw_stop(uint32_t ms){
+    const uint64_t start = sim_clock.now();
+    const uint64_t limit = start + (uint64_t)ms * 1000;
+
+    while (!f_wake && sim_clock.now() < limit){
+        sim_clock.advanceTo(std::min(limit, sim_clock.nextEvent()));
+    }
+    return (uint32_t)((sim_clock.now() - start) / 1000);
+}
+
+/*!
+    @brief  UARTが1byte受信するたびに起こす (private)  STOPの間に届いたバイトも受信バッファに入る
+*/
+void LowPower::hw_wake_on_receive(HardwareSerial& serial){
+    serial.setReceiveHandler([this](void){
+        f_wake = true;
+    });
+}
@@ -0,0 +1,75 @@
+/**************************************************************************/
+/*!
+    @file     SimTest.h
+
+    ホストシミュレーションの単体テストの道具
+        テストは extras/sim/tests/test_*.cpp に1ファイル1実行ファイルで置き、ctest から実行する.
+        テストケースは引数なしの関数にし、main() から SIM_RUN() で順に呼ぶ.
+        SIM_CHECK() は失敗しても止まらずに、ファイル・行・式を表示して数える.
+        最後に simTestResult() の値を main() から返す（失敗が1つでもあれば1）.
+
+            void block_sequence(void){
+                SIM_CHECK_EQ(engine.getCount(AdcEngine::CH_DIFF_0_1), 10);
+            }
+            int main(void){
+                SIM_RUN(block_sequence);
+                return simTestResult();
+            }
+*/
+/**************************************************************************/
+
+#ifndef _SIMTEST_H_
+#define _SIMTEST_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+//  失敗した確認の数
+inline uint32_t sim_test_failures = 0;
+
+/*!
+    @brief  確認1つ  失敗なら場所と式を表示して数える
+*/
+inline bool simCheck(bool f_ok, const char* expr, const char* file, int line){
+  if (!f_ok){
+    printf("  FAIL %s:%d: %s\n", file, line, expr);
+    sim_test_failures++;
+  }
+  return f_ok;
+}
+
+/*!
+    @brief  値が等しいかの確認  失敗なら両方の値も表示する
+*/
+inline bool simCheckEqual(long long actual, long long expected, const char* expr, const char* file, int line){
+  if (actual != expected){
+    printf("  FAIL %s:%d: %s  (%lld != %lld)\n", file, line, expr, actual, expected);
+    sim_test_failures++;
+    return false;
+  }
+  return true;
+}
+
+/*!
+    @brief  テストケースを1つ実行して結果を1行表示する
+*/
+inline void simRun(void (*test)(void), const char* name){
+  const uint32_t before = sim_test_failures;
+  test();
+  printf("%s %s\n", (sim_test_failures == before) ? "ok  " : "FAIL", name);
+}
+
+/*!
+    @brief  main() の終了コード  0:すべて成功, 1:失敗あり
+*/
+inline int simTestResult(void){
+  printf("%u failure(s)\n", sim_test_failures);
+  return (sim_test_failures == 0) ? 0 : 1;
+}
+
+#define SIM_CHECK(expr)             simCheck((expr), #expr, __FILE__, __LINE__)
+#define SIM_CHECK_EQ(actual, expected) \
+  simCheckEqual((long long)(actual), (long long)(expected), #actual " == " #expected, __FILE__, __LINE__)
+#define SIM_RUN(test)               simRun(test, #test)
+
+#endif // _SIMTEST_H_
@@ -0,0 +1,580 @@
+/**************************************************************************/
+/*!
+    @file     bench_main.cpp
+    @author   Masa
+
+        Micro-benchmarks of the measurement math, display formatting,
+        telemetry payloads, command parsing and parameter serialization on the host
+
+        ファームウエアを起動（setup()）してから、計測・表示・送信・保存の処理を1つずつ繰り返し呼び、
+        1回あたりの時間 [ns]・ヒープ確保の回数・バスの使用量（I2Cの転送回数とバイト数、そのうちFRAMのバイト数、
+        IoTゲートウエイのUARTのバイト数）を出す.
+        準備（AD変換を完了させる、送信キューを空にするなど）は時間にも使用量にも含めない.
+
+        基準値との比較（--baseline）は、マシンによらず決まる値（ヒープ確保の回数とバスの使用量）だけで行い、
+        1つでも増えていれば失敗にする. 時間はホストのCPUとその時の負荷で変わるので、参考として表示するだけ.
+
+        payload/string_reference は JsonWriter 以前の String の連結（LegacyPayload.h）で同じペイロードを作る.
+        ファームウエアにはもうないが、payload/json_writer と比べるための記録した基準として残す.
+
+        使い方
+            eh900_bench [--runs N] [--json FILE] [--baseline FILE]
+            --runs N            繰り返しの回数  時間は一番速かった回の値を使う (5)
+            --json FILE         結果を1行1項目のJSONで書く
+            --baseline FILE     基準値（--json の出力）と比べ、増えていれば終了コード1
+
+        基準値の更新（スケッチのフォルダで）:
+            build-sim/eh900_bench --json extras/sim/bench_baseline.json
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+#include "SimClock.h"
+#include "SimBoard.h"
+#include "LegacyPayload.h"
+#include "../../LevelEstimator.h"
+#include "../../CommandParser.h"
+
+#include "eh900_class.h"
+#include "measurement.h"
+#include "MeasurementEngine.h"
+#include "display_class.h"
+#include "IotGateway.h"
+
+//  ファームウエア（sketch.cpp）の中のもの
+extern eh900 level_meter;
+extern MeasurementEngine meas_unit;
+extern Eh_display lcd_display;
+extern IotGateway uart1;
+void setup(void);
+boolean submit_status(void);
+
+/*------------------------------------------------------------------------*/
+//  ヒープ確保の計測  計測中の new だけを数える
+
+namespace{
+    bool f_count_alloc = false;
+    uint64_t alloc_count = 0;
+    uint64_t alloc_bytes = 0;
+}
+
+void* operator new(size_t size){
+    if (f_count_alloc){
+        alloc_count++;
+        alloc_bytes += size;
+    }
+    void* ptr = malloc(size ? size : 1);
+    if (!ptr){
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t size) noexcept {
+    (void)size;
+    free(ptr);
+}
+
+/*------------------------------------------------------------------------*/
+
+namespace{
+    typedef std::chrono::steady_clock BenchClock;
+
+    //  1回の繰り返しでの呼び出し回数
+    constexpr uint32_t OPS_FAST = 20000;    //  バスを使わない処理
+    constexpr uint32_t OPS_BUS = 500;       //  I2C・UARTを使う処理
+    //  AD変換が終わるまで待つ時間 [us]（交互サンプリング6組・ブロック10回ずつの両方に足りる）
+    constexpr uint64_t ACQUISITION_WAIT = 400000;
+
+    /*!
+        @brief  ベンチマーク1項目
+                prepare は毎回 op の前に呼ぶ（時間に含めない）. nullptr なら op をまとめて計る
+                op は処理が成功したかを返す（失敗があれば計測が正しくないので中止する）
+    */
+    struct Benchmark {
+        const char* name;
+        uint32_t ops;
+        std::function<void(uint32_t i)> prepare;
+        std::function<bool(uint32_t i)> op;
+    };
+
+    /*!
+        @brief  バスの使用量  I2Cは全アドレスの合計、FRAMはそのうちの FRAM のアドレスの分
+    */
+    struct BusUsage {
+        uint64_t i2c_transfers;
+        uint64_t i2c_bytes;
+        uint64_t fram_bytes;
+        uint64_t uart_bytes;
+
+        BusUsage& operator+=(const BusUsage& other){
+            i2c_transfers += other.i2c_transfers;
+            i2c_bytes += other.i2c_bytes;
+            fram_bytes += other.fram_bytes;
+            uart_bytes += other.uart_bytes;
+            return *this;
+        }
+
+        BusUsage operator-(const BusUsage& other) const {
+            return {i2c_transfers - other.i2c_transfers, i2c_bytes - other.i2c_bytes,
+                    fram_bytes - other.fram_bytes, uart_bytes - other.uart_bytes};
+        }
+    };
+
+    /*!
+        @brief  1項目の結果  ns_per_op 以外はマシンによらず決まる
+    */
+    struct Result {
+        std::string name;
+        double ns_per_op;
+        double allocs_per_op;
+        double i2c_transfers_per_op;
+        double i2c_bytes_per_op;
+        double fram_bytes_per_op;
+        double uart_bytes_per_op;
+        uint32_t failures;
+    };
+
+    //  今までのI2Cの転送回数とバイト数の合計と、IoTゲートウエイの送信キューのバイト数
+    //  キューに入ったI2Cの転送は先に終わらせる（計測時間の外で呼ぶこと）
+    BusUsage bus_usage(void){
+        i2c_bus.flush();
+        BusUsage usage = {0, 0, Wire.getStats(SIM_ADDR_FRAM).bytes, uart1.getTxPending()};
+        for (uint16_t address = 0; address < 128; address++){
+            usage.i2c_transfers += Wire.getStats(address).transactions;
+            usage.i2c_bytes += Wire.getStats(address).bytes;
+        }
+        return usage;
+    }
+
+    //  IoTゲートウエイの送信キューを空にする
+    void drain_uart(void){
+        while (uart1.getTxPending() != 0){
+            uart1.service();
+            sim_clock.advance(1000);
+        }
+    }
+
+    //  submit_channel_status() と同じ内容のペイロードを JsonWriter で作って送信キューに入れる
+    bool send_json_payload(void){
+        const char mode[2] = {ModeNames[level_meter.getMode()], '\0'};
+        uart1.clearPayload();
+        uart1.addPayload("status", "NORMAL");
+        uart1.addPayload("mode", mode);
+        uart1.addPayload("length", (int32_t)level_meter.getSensorLength());
+        uart1.addPayload("period", (int32_t)level_meter.getTimerPeriod());
+        uart1.addPayload("level", (int32_t)level_meter.getLiquidLevel(), (uint8_t)1);
+        return !uart1.hasOverflow() && uart1.sendPayload();
+    }
+
+    //  比較の基準  JsonWriter 以前の String の連結で同じ内容を作る（送信は同じキューに入れる）
+    LegacyPayload legacy_payload;
+
+    bool send_legacy_payload(void){
+        const char mode[2] = {ModeNames[level_meter.getMode()], '\0'};
+        legacy_payload.clearPayload();
+        legacy_payload.addPayload("status", "NORMAL");
+        legacy_payload.addPayload("mode", mode);
+        legacy_payload.addPayload("length", (int32_t)level_meter.getSensorLength());
+        legacy_payload.addPayload("period", (int32_t)level_meter.getTimerPeriod());
+        legacy_payload.addPayload("level", (float)level_meter.getLiquidLevel() / (float)10.0, (uint8_t)1);
+        //  以前の sendPayload() は getPayload() の文字列をそのまま送っていた
+        const LegacyString frame = legacy_payload.getPayload();
+        if (frame.length() == 0){
+            return false;
+        }
+        uart1.setPayload(legacy_payload.body());
+        return uart1.sendPayload();
+    }
+
+    //  2つの作り方のペイロードが同じ文字列か
+    bool payloads_match(void){
+        send_legacy_payload();
+        const LegacyString legacy = legacy_payload.getPayload();
+        send_json_payload();
+        const bool f_match = strcmp(legacy.c_str(), uart1.getPayload()) == 0;
+        if (!f_match){
+            fprintf(stderr, "payload mismatch:\n  String     %s\n  JsonWriter %s\n", legacy.c_str(), uart1.getPayload());
+        }
+        uart1.clearPayload();
+        drain_uart();
+        return f_match;
+    }
+
+    //  AD変換を開始して終わるまで仮想時計を進める
+    void complete_acquisition(void){
+        meas_unit.startAcquisition();
+        for (uint64_t t = 0; t < ACQUISITION_WAIT; t += 1000){
+            sim_clock.advance(1000);
+            meas_unit.poll();
+        }
+    }
+
+    volatile uint32_t sink;
+
+    //  推定の単体  パラメタは既定値でフィルタだけ選ぶ
+    LevelEstimator estimator;
+
+    void configure_estimator(uint8_t filter){
+        EstimatorConfig config = LevelEstimator::defaultConfig();
+        config.filter = filter;
+        estimator.configure(config);
+    }
+
+    //  適応タイマの単体  既定値のパラメタで適応だけ使う
+    AdaptiveTimer adaptive;
+
+    void configure_adaptive(void){
+        AdaptiveConfig config = AdaptiveTimer::defaultConfig();
+        config.enabled = 1;
+        adaptive.configure(config);
+        adaptive.reset();
+    }
+
+    //  コマンドのパーサの単体  正しい行・CRLF・不正な文字・長すぎる行・空行の混ざった受信データ
+    CommandParser parser;
+    const char COMMAND_STREAM[] =
+        "set length 20 1\r\n"
+        "get level\n"
+        "\x01\xFFget\n"
+        "hist 4 aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\n"
+        "\r\n"
+        "mode   c\n";
+
+    //  受信データを1byteずつ渡し、そろった行と捨てた行が期待どおりかを返す
+    bool parse_commands(void){
+        uint32_t ready = 0;
+        uint32_t rejected = 0;
+        for (size_t i = 0; i < sizeof(COMMAND_STREAM) - 1; i++){
+            const CommandParser::Status status = parser.feed((uint8_t)COMMAND_STREAM[i]);
+            if (status == CommandParser::COMMAND_READY){
+                ready++;
+                sink = parser.getArgCount();
+            } else if (status != CommandParser::COMMAND_PENDING){
+                rejected++;
+            }
+        }
+        return ready == 3 && rejected == 2;
+    }
+
+    Result run_once(const Benchmark& bench){
+        BenchClock::duration elapsed(0);
+        BusUsage usage = {};
+        uint32_t failures = 0;
+
+        alloc_count = 0;
+        alloc_bytes = 0;
+
+        if (!bench.prepare){
+            const BusUsage usage_start = bus_usage();
+            const BenchClock::time_point start = BenchClock::now();
+            f_count_alloc = true;
+            for (uint32_t i = 0; i < bench.ops; i++){
+                failures += bench.op(i) ? 0 : 1;
+            }
+            f_count_alloc = false;
+            elapsed = BenchClock::now() - start;
+            usage = bus_usage() - usage_start;
+        } else {
+            for (uint32_t i = 0; i < bench.ops; i++){
+                bench.prepare(i);
+                const BusUsage usage_start = bus_usage();
+                const BenchClock::time_point start = BenchClock::now();
+                f_count_alloc = true;
+                const bool f_ok = bench.op(i);
+                f_count_alloc = false;
+                failures += f_ok ? 0 : 1;
+                elapsed += BenchClock::now() - start;
+                usage += bus_usage() - usage_start;
+            }
+        }
+
+        Result result;
+        result.name = bench.name;
+        result.ns_per_op = std::chrono::duration<double, std::nano>(elapsed).count() / bench.ops;
+        result.allocs_per_op = (double)alloc_count / bench.ops;
+        result.i2c_transfers_per_op = (double)usage.i2c_transfers / bench.ops;
+        result.i2c_bytes_per_op = (double)usage.i2c_bytes / bench.ops;
+        result.fram_bytes_per_op = (double)usage.fram_bytes / bench.ops;
+        result.uart_bytes_per_op = (double)usage.uart_bytes / bench.ops;
+        result.failures = failures;
+        return result;
+    }
+
+    //  1行から "key":数値 を読む
+    bool read_number(const std::string& line, const char* key, double& value){
+        const std::string pattern = std::string("\"") + key + "\":";
+        const size_t pos = line.find(pattern);
+        if (pos == std::string::npos){
+            return false;
+        }
+        value = strtod(line.c_str() + pos + pattern.size(), nullptr);
+        return true;
+    }
+
+    bool read_name(const std::string& line, std::string& name){
+        const std::string pattern = "\"name\":\"";
+        const size_t pos = line.find(pattern);
+        if (pos == std::string::npos){
+            return false;
+        }
+        const size_t end = line.find('"', pos + pattern.size());
+        if (end == std::string::npos){
+            return false;
+        }
+        name = line.substr(pos + pattern.size(), end - pos - pattern.size());
+        return true;
+    }
+
+    bool load_baseline(const char* path, std::vector<Result>& baseline){
+        FILE* in = fopen(path, "r");
+        if (!in){
+            return false;
+        }
+        char buf[256];
+        while (fgets(buf, sizeof(buf), in)){
+            const std::string line = buf;
+            Result r;
+            if (read_name(line, r.name) && read_number(line, "ns_per_op", r.ns_per_op)
+                    && read_number(line, "allocs_per_op", r.allocs_per_op)
+                    && read_number(line, "i2c_transfers_per_op", r.i2c_transfers_per_op)
+                    && read_number(line, "i2c_bytes_per_op", r.i2c_bytes_per_op)
+                    && read_number(line, "fram_bytes_per_op", r.fram_bytes_per_op)
+                    && read_number(line, "uart_bytes_per_op", r.uart_bytes_per_op)){
+                baseline.push_back(r);
+            }
+        }
+        fclose(in);
+        return true;
+    }
+
+    bool write_results(const char* path, const std::vector<Result>& results){
+        FILE* out = fopen(path, "w");
+        if (!out){
+            return false;
+        }
+        for (const Result& r : results){
+            fprintf(out, "{\"name\":\"%s\",\"ns_per_op\":%.1f,\"allocs_per_op\":%.3f,\"i2c_transfers_per_op\":%.3f,"
+                         "\"i2c_bytes_per_op\":%.3f,\"fram_bytes_per_op\":%.3f,\"uart_bytes_per_op\":%.3f}\n",
+                    r.name.c_str(), r.ns_per_op, r.allocs_per_op, r.i2c_transfers_per_op,
+                    r.i2c_bytes_per_op, r.fram_bytes_per_op, r.uart_bytes_per_op);
+        }
+        fclose(out);
+        return true;
+    }
+
+    //  基準値より増えたか  JSONに書いた桁（小数3桁）より小さい差は無視する
+    bool increased(double value, double base){
+        return value > base + 0.0005;
+    }
+
+    //  名前で結果を探す  なければ nullptr
+    const Result* find_result(const std::vector<Result>& results, const std::string& name){
+        for (const Result& r : results){
+            if (r.name == name){
+                return &r;
+            }
+        }
+        return nullptr;
+    }
+
+    //  基準値と比べる  ヒープ確保とバスの使用量が増えた項目の数を返す
+    //  時間は参考（基準値との比）として表示するだけ
+    uint32_t compare(const std::vector<Result>& results, const std::vector<Result>& baseline){
+        uint32_t regressions = 0;
+
+        for (const Result& r : results){
+            const Result* base = find_result(baseline, r.name);
+            if (!base){
+                printf("  %-28s no baseline\n", r.name.c_str());
+                continue;
+            }
+
+            const double ratio = r.ns_per_op / base->ns_per_op;
+            const bool f_alloc = increased(r.allocs_per_op, base->allocs_per_op);
+            const bool f_i2c = increased(r.i2c_transfers_per_op, base->i2c_transfers_per_op)
+                               || increased(r.i2c_bytes_per_op, base->i2c_bytes_per_op);
+            const bool f_fram = increased(r.fram_bytes_per_op, base->fram_bytes_per_op);
+            const bool f_uart = increased(r.uart_bytes_per_op, base->uart_bytes_per_op);
+
+            printf("  %-28s time x%.2f (info)%s%s%s%s\n", r.name.c_str(), ratio,
+                   f_alloc ? "  MORE ALLOCS" : "", f_i2c ? "  MORE I2C" : "",
+                   f_fram ? "  MORE FRAM" : "", f_uart ? "  MORE UART" : "");
+            if (f_alloc || f_i2c || f_fram || f_uart){
+                regressions++;
+            }
+        }
+        return regressions;
+    }
+}
+
+int main(int argc, char** argv){
+    uint32_t runs = 5;
+    const char* json_file = nullptr;
+    const char* baseline_file = nullptr;
+
+    for (int i = 1; i < argc; i++){
+        const std::string arg = argv[i];
+        if (i + 1 >= argc){
+            fprintf(stderr, "usage: %s [--runs N] [--json FILE] [--baseline FILE]\n", argv[0]);
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (arg == "--runs"){
+            runs = (uint32_t)strtoul(value, nullptr, 0);
+        } else if (arg == "--json"){
+            json_file = value;
+        } else if (arg == "--baseline"){
+            baseline_file = value;
+        } else {
+            fprintf(stderr, "unknown option %s\n", arg.c_str());
+            return 2;
+        }
+    }
+
+    //  ボードを用意してファームウエアを起動する  液面50%, 雑音なし
+    static SimBoard board(20, 0.0, 1);
+    board.sensor.setLevel(50.0);
+    board.seedParameters(20, 1800);
+    setup();
+    meas_unit.startCurrent();
+    while (meas_unit.updateCurrent() < CurrentReady){
+        sim_clock.advance(1000);
+    }
+
+    if (!payloads_match()){
+        return 2;
+    }
+
+    const std::vector<Benchmark> benchmarks = {
+        {"readLevel/interleaved", OPS_BUS,
+            [](uint32_t){ meas_unit.getMeasurement(0).setSamplingMode(Interleaved); complete_acquisition(); },
+            [](uint32_t){ return meas_unit.getMeasurement(0).readLevel(); }},
+        //  ブロックサンプリングは read_voltage / read_current を通る
+        {"readLevel/block", OPS_BUS,
+            [](uint32_t){ meas_unit.getMeasurement(0).setSamplingMode(Block); complete_acquisition(); },
+            [](uint32_t){ return meas_unit.getMeasurement(0).readLevel(); }},
+        {"format_number", OPS_FAST, nullptr,
+            [](uint32_t i){
+                char buf[8];
+                format_number(buf, (int32_t)(i % 2001) - 1000, 6, 1);
+                sink = buf[5];
+                return true;
+            }},
+        //  液面を変えて棒グラフと数値を描き直させる
+        {"showLevel", OPS_BUS,
+            [](uint32_t i){ level_meter.setLiquidLevel((i * 37) % 1001); },
+            [](uint32_t){ lcd_display.showLevel(); return true; }},
+        {"submit_status/json", OPS_BUS,
+            [](uint32_t){ uart1.setFormat(IotGateway::FORMAT_JSON); drain_uart(); },
+            [](uint32_t){ return submit_status(); }},
+        //  ペイロードの作り方だけを比べる  String（JsonWriter 以前）は記録した基準
+        {"payload/json_writer", OPS_BUS,
+            [](uint32_t){ drain_uart(); },
+            [](uint32_t){ return send_json_payload(); }},
+        {"payload/string_reference", OPS_BUS,
+            [](uint32_t){ drain_uart(); },
+            [](uint32_t){ return send_legacy_payload(); }},
+        {"submit_status/binary", OPS_BUS,
+            [](uint32_t){ uart1.setFormat(IotGateway::FORMAT_BINARY); drain_uart(); },
+            [](uint32_t){ return submit_status(); }},
+        //  変わったパラメタだけをFRAMに書く
+        {"storeParameter/changed", OPS_BUS,
+            [](uint32_t i){ level_meter.setTimerPeriod((i % 2) ? 1200 : 1800); },
+            [](uint32_t){ return level_meter.storeParameter(); }},
+        {"storeParameter/unchanged", OPS_BUS, nullptr,
+            [](uint32_t){ return level_meter.storeParameter(); }},
+        {"recallParameter", OPS_BUS, nullptr,
+            [](uint32_t){ return level_meter.recallParameter(); }},
+        //  連続計測の推定  液面を少しずつ下げながら 1/3秒ごとに計測値を入れる
+        {"estimator/median", OPS_FAST,
+            [](uint32_t){ configure_estimator(LevelEstimator::FILTER_MEDIAN); },
+            [](uint32_t i){ sink = estimator.update(500 - (i / 64) % 100 + (i % 7), i * 333); return true; }},
+        {"estimator/kalman", OPS_FAST,
+            [](uint32_t){ configure_estimator(LevelEstimator::FILTER_KALMAN); },
+            [](uint32_t i){ sink = estimator.update(500 - (i / 64) % 100 + (i % 7), i * 333); return true; }},
+        //  適応タイマ  1回計測の結果を記録して次の周期を決める（液面を少しずつ下げる）
+        {"adaptive/sample", OPS_FAST,
+            [](uint32_t){ configure_adaptive(); },
+            [](uint32_t i){ adaptive.addSample(500 - (i / 16) % 100 + (i % 3), i * 600); sink = adaptive.nextPeriod(1800); return true; }},
+        //  IoTゲートウエイから届くコマンド行  1回は6行分（約110byte）
+        {"command/parse", OPS_FAST, nullptr,
+            [](uint32_t){ return parse_commands(); }},
+    };
+
+    //  1周目  全項目を2回ずつ計り、1回目は捨てる（キャッシュや、前の項目が残した状態の影響をなくす）
+    //  回数とバイト数はこの周の値を使う. フレームの通し番号など、前に何回送ったかで少し変わる項目があるので、
+    //  --runs によらず同じ状態から計る
+    std::vector<Result> results;
+    for (const Benchmark& bench : benchmarks){
+        run_once(bench);
+        results.push_back(run_once(bench));
+    }
+    //  2周目から  時間は一番速かった回の値を使う
+    for (uint32_t run = 1; run < runs; run++){
+        for (size_t k = 0; k < benchmarks.size(); k++){
+            const Result r = run_once(benchmarks[k]);
+            if (r.ns_per_op < results[k].ns_per_op){
+                results[k].ns_per_op = r.ns_per_op;
+            }
+            results[k].failures += r.failures;
+        }
+    }
+
+    printf("%-28s %10s %10s %10s %10s %10s %10s\n", "benchmark", "ns/op", "allocs/op",
+           "i2c xfr/op", "i2c B/op", "fram B/op", "uart B/op");
+    for (const Result& r : results){
+        printf("%-28s %10.1f %10.3f %10.3f %10.3f %10.3f %10.3f\n", r.name.c_str(), r.ns_per_op,
+               r.allocs_per_op, r.i2c_transfers_per_op, r.i2c_bytes_per_op,
+               r.fram_bytes_per_op, r.uart_bytes_per_op);
+        if (r.failures != 0){
+            fprintf(stderr, "%s: %u operations failed\n", r.name.c_str(), r.failures);
+            return 2;
+        }
+    }
+
+    //  ペイロードの作り方  JsonWriter と String（基準）
+    const Result* writer = find_result(results, "payload/json_writer");
+    const Result* reference = find_result(results, "payload/string_reference");
+    if (writer && reference){
+        printf("payload: JsonWriter %.1f ns %.0f allocs, String %.1f ns %.0f allocs (time x%.2f), %.0f bytes each\n",
+               writer->ns_per_op, writer->allocs_per_op, reference->ns_per_op, reference->allocs_per_op,
+               writer->ns_per_op / reference->ns_per_op, writer->uart_bytes_per_op);
+    }
+
+    if (json_file && !write_results(json_file, results)){
+        perror(json_file);
+        return 2;
+    }
+
+    if (baseline_file){
+        std::vector<Result> baseline;
+        if (!load_baseline(baseline_file, baseline)){
+            perror(baseline_file);
+            return 2;
+        }
+        printf("vs baseline (allocations and bus usage; time is informational):\n");
+        const uint32_t regressions = compare(results, baseline);
+        if (regressions != 0){
+            printf("%u regression(s)\n", regressions);
+            return 1;
+        }
+        printf("no regressions\n");
+    }
+    return 0;
+}
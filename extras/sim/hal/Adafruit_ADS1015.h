@@ -0,0 +1,23 @@
+/**************************************************************************/
+/*!
+    @file     Adafruit_ADS1015.h  (host simulation)
+
+    ADS1115 のPGAの設定値だけ（変換は AdcEngine が行う）
+*/
+/**************************************************************************/
+
+#ifndef _SIM_ADAFRUIT_ADS1015_H_
+#define _SIM_ADAFRUIT_ADS1015_H_
+
+#include <Arduino.h>
+
+typedef enum {
+    GAIN_TWOTHIRDS = 0x0000,
+    GAIN_ONE = 0x0200,
+    GAIN_TWO = 0x0400,
+    GAIN_FOUR = 0x0600,
+    GAIN_EIGHT = 0x0800,
+    GAIN_SIXTEEN = 0x0A00
+} adsGain_t;
+
+#endif // _SIM_ADAFRUIT_ADS1015_H_
@@ -0,0 +1,12 @@
+/**************************************************************************/
+/*!
+    @file     Adafruit_BusIO_Register.h  (host simulation)
+*/
+/**************************************************************************/
+
+#ifndef _SIM_ADAFRUIT_BUSIO_REGISTER_H_
+#define _SIM_ADAFRUIT_BUSIO_REGISTER_H_
+
+#include "Adafruit_I2CDevice.h"
+
+#endif // _SIM_ADAFRUIT_BUSIO_REGISTER_H_
@@ -0,0 +1,40 @@
+/**************************************************************************/
+/*!
+    @file     Adafruit_FRAM_I2C.h  (host simulation)
+
+    I2C FRAM のドライバ  2byteのメモリアドレスに続けてデータを読み書きする
+    1回の転送は Wire のバッファに収まる長さに分ける
+*/
+/**************************************************************************/
+
+#ifndef _SIM_ADAFRUIT_FRAM_I2C_H_
+#define _SIM_ADAFRUIT_FRAM_I2C_H_
+
+#include "Adafruit_I2CDevice.h"
+
+class Adafruit_FRAM_I2C {
+
+  public:
+    Adafruit_FRAM_I2C(void){};
+    ~Adafruit_FRAM_I2C(){
+      delete i2c_dev;
+    };
+
+    bool begin(uint8_t addr = 0x50, TwoWire* theWire = &Wire);
+
+    bool write(uint16_t addr, uint8_t value){
+      return write(addr, &value, 1);
+    };
+    bool write(uint16_t addr, uint8_t* buffer, uint16_t num);
+    bool write8(uint16_t addr, uint8_t value){
+      return write(addr, &value, 1);
+    };
+
+    uint8_t read8(uint16_t addr);
+    bool read(uint16_t addr, uint8_t* buffer, uint16_t num);
+
+  private:
+    Adafruit_I2CDevice* i2c_dev = nullptr;
+};
+
+#endif // _SIM_ADAFRUIT_FRAM_I2C_H_
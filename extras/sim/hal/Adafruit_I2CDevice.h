@@ -0,0 +1,44 @@
+/**************************************************************************/
+/*!
+    @file     Adafruit_I2CDevice.h  (host simulation)
+
+    Adafruit BusIO の I2Cデバイスのうち、ファームウエアが使う機能
+    転送は模擬の Wire に渡す
+*/
+/**************************************************************************/
+
+#ifndef _SIM_ADAFRUIT_I2CDEVICE_H_
+#define _SIM_ADAFRUIT_I2CDEVICE_H_
+
+#include <Arduino.h>
+#include <Wire.h>
+
+class Adafruit_I2CDevice {
+
+  public:
+    Adafruit_I2CDevice(uint8_t addr, TwoWire* theWire = &Wire) : addr(addr), wire(theWire){};
+
+    uint8_t address(void) const {
+      return addr;
+    };
+
+    bool begin(bool addr_detect = true);
+    bool detected(void);
+
+    bool read(uint8_t* buffer, size_t len, bool stop = true);
+    bool write(const uint8_t* buffer, size_t len, bool stop = true,
+               const uint8_t* prefix_buffer = nullptr, size_t prefix_len = 0);
+    bool write_then_read(const uint8_t* write_buffer, size_t write_len,
+                         uint8_t* read_buffer, size_t read_len, bool stop = false);
+    bool setSpeed(uint32_t desiredclk);
+
+    size_t maxBufferSize(void) const {
+      return SIM_WIRE_BUFFER_SIZE;
+    };
+
+  private:
+    uint8_t addr;
+    TwoWire* wire;
+};
+
+#endif // _SIM_ADAFRUIT_I2CDEVICE_H_
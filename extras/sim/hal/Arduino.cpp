@@ -0,0 +1,233 @@
+/**************************************************************************/
+/*!
+    @file     Arduino.cpp  (host simulation)
+    @author   Masa
+
+        Arduino core functions on the virtual clock
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "Arduino.h"
+#include "../SimClock.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+namespace{
+    uint8_t pin_mode[SIM_PIN_NUM] = {};
+    uint8_t pin_level[SIM_PIN_NUM] = {};
+    //  シミュレータ側（外部の回路）がレベルを決めているピン  プルアップより強い
+    bool pin_driven[SIM_PIN_NUM] = {};
+
+    voidFuncPtr pin_isr[SIM_PIN_NUM] = {};
+    uint8_t pin_isr_mode[SIM_PIN_NUM] = {};
+
+    uint32_t primask = 0;
+
+    SimDWT dwt;
+    SimCoreDebug core_debug;
+}
+
+uint32_t SystemCoreClock = 64000000;
+
+SimDWT* const DWT = &dwt;
+SimCoreDebug* const CoreDebug = &core_debug;
+
+uint32_t millis(void){
+    return (uint32_t)(sim_clock.now() / 1000);
+}
+
+uint32_t micros(void){
+    return (uint32_t)sim_clock.now();
+}
+
+void delay(uint32_t ms){
+    sim_clock.advance((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us){
+    sim_clock.advance(us);
+}
+
+void pinMode(uint32_t pin, uint32_t mode){
+    if (pin >= SIM_PIN_NUM){
+        return;
+    }
+    pin_mode[pin] = mode;
+    if (mode == INPUT_PULLUP && !pin_driven[pin]){
+        pin_level[pin] = HIGH;
+    }
+}
+
+void digitalWrite(uint32_t pin, uint32_t value){
+    if (pin < SIM_PIN_NUM){
+        pin_level[pin] = value ? HIGH : LOW;
+    }
+}
+
+int digitalRead(uint32_t pin){
+    return (pin < SIM_PIN_NUM) ? pin_level[pin] : LOW;
+}
+
+void attachInterrupt(uint32_t pin, voidFuncPtr callback, uint32_t mode){
+    if (pin < SIM_PIN_NUM){
+        pin_isr[pin] = callback;
+        pin_isr_mode[pin] = mode;
+    }
+}
+
+void detachInterrupt(uint32_t pin){
+    if (pin < SIM_PIN_NUM){
+        pin_isr[pin] = nullptr;
+    }
+}
+
+/*!
+    @brief  入力ピンのレベルを変える. 割り込みが登録されていて条件に合えばISRを呼ぶ
+*/
+void sim_gpio_set(uint32_t pin, int value){
+    if (pin >= SIM_PIN_NUM){
+        return;
+    }
+    const uint8_t before = pin_level[pin];
+    const uint8_t after = value ? HIGH : LOW;
+    pin_level[pin] = after;
+    pin_driven[pin] = true;
+
+    if (before == after || !pin_isr[pin]){
+        return;
+    }
+    const uint8_t mode = pin_isr_mode[pin];
+    if (mode == CHANGE || (mode == RISING && after == HIGH) || (mode == FALLING && after == LOW)){
+        pin_isr[pin]();
+    }
+}
+
+int sim_gpio_get(uint32_t pin){
+    return digitalRead(pin);
+}
+
+uint32_t __get_PRIMASK(void){
+    return primask;
+}
+
+void __set_PRIMASK(uint32_t value){
+    primask = value;
+}
+
+void __disable_irq(void){
+    primask = 1;
+}
+
+void __enable_irq(void){
+    primask = 0;
+}
+
+uint32_t __get_MSP(void){
+    volatile uint8_t marker = 0;
+    return (uint32_t)(uintptr_t)&marker;
+}
+
+SimCycleCounter::operator uint32_t() const {
+    return (uint32_t)(sim_clock.now() * (SystemCoreClock / 1000000)) - offset;
+}
+
+SimCycleCounter& SimCycleCounter::operator=(uint32_t value){
+    offset = 0;
+    offset = (uint32_t)*this - value;
+    return *this;
+}
+
+extern "C" void* _sbrk(ptrdiff_t increment){
+    return sbrk(increment);
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size){
+    size_t n = 0;
+    while (size--){
+        n += write(*buffer++);
+    }
+    return n;
+}
+
+size_t Print::write(const char* str){
+    return str ? write((const uint8_t*)str, strlen(str)) : 0;
+}
+
+size_t Print::print(const char* str){
+    return write(str);
+}
+
+size_t Print::print(char c){
+    return write((uint8_t)c);
+}
+
+size_t Print::print(unsigned char value, int base){
+    return print_number(value, base);
+}
+
+size_t Print::print(int value, int base){
+    return print((long long)value, base);
+}
+
+size_t Print::print(unsigned int value, int base){
+    return print_number(value, base);
+}
+
+size_t Print::print(long value, int base){
+    return print((long long)value, base);
+}
+
+size_t Print::print(unsigned long value, int base){
+    return print_number(value, base);
+}
+
+size_t Print::print(long long value, int base){
+    if (base == DEC && value < 0){
+        return print('-') + print_number(0ULL - (unsigned long long)value, base);
+    }
+    if (base != DEC){
+        //  実機と同じく、10進以外は32bitの2の補数で表す
+        return print_number((uint32_t)value, base);
+    }
+    return print_number(value, base);
+}
+
+size_t Print::print(unsigned long long value, int base){
+    return print_number(value, base);
+}
+
+size_t Print::print(double value, int digits){
+    char buf[48];
+    if (isnan(value)){
+        return write("nan");
+    }
+    if (isinf(value)){
+        return write("inf");
+    }
+    snprintf(buf, sizeof(buf), "%.*f", digits, value);
+    return write(buf);
+}
+
+size_t Print::println(void){
+    return write("\r\n");
+}
+
+size_t Print::print_number(unsigned long long value, int base){
+    char buf[65];
+    char* p = &buf[sizeof(buf) - 1];
+
+    if (base < 2){
+        base = 10;
+    }
+    *p = '\0';
+    do {
+        const int digit = value % base;
+        *--p = (digit < 10) ? '0' + digit : 'A' + digit - 10;
+        value /= base;
+    } while (value != 0);
+
+    return write(p);
+}
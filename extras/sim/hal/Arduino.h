@@ -0,0 +1,97 @@
+/**************************************************************************/
+/*!
+    @file     Arduino.h  (host simulation)
+
+    ファームウエアが使っている Arduino / STM32コア / CMSIS の機能だけをホストで置き換える
+    時間はすべて仮想時計（SimClock）で進み、GPIOと割り込みはシミュレータから操作する
+*/
+/**************************************************************************/
+
+#ifndef _SIM_ARDUINO_H_
+#define _SIM_ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "Print.h"
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH    0x1
+#define LOW     0x0
+
+#define INPUT           0x0
+#define OUTPUT          0x1
+#define INPUT_PULLUP    0x2
+
+#define CHANGE  2
+#define FALLING 3
+#define RISING  4
+
+//  ピン番号  D0〜D15 はそのまま, PAx / PBx は 0x80 から
+enum SimPins : uint32_t {
+    D0, D1, D2, D3, D4, D5, D6, D7, D8, D9, D10, D11, D12, D13, D14, D15,
+    PA0 = 0x80, PA1, PA2, PA3, PA4, PA5, PA6, PA7, PA8, PA9, PA10, PA11, PA12, PA13, PA14, PA15,
+    PB0, PB1, PB2, PB3, PB4, PB5, PB6, PB7, PB8, PB9, PB10, PB11, PB12, PB13, PB14, PB15,
+    SIM_PIN_NUM
+};
+
+uint32_t millis(void);
+uint32_t micros(void);
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+void pinMode(uint32_t pin, uint32_t mode);
+void digitalWrite(uint32_t pin, uint32_t value);
+int digitalRead(uint32_t pin);
+
+typedef void (*voidFuncPtr)(void);
+#define digitalPinToInterrupt(pin)  (pin)
+void attachInterrupt(uint32_t pin, voidFuncPtr callback, uint32_t mode);
+void detachInterrupt(uint32_t pin);
+
+//  CMSIS  割り込み禁止はホストでは意味がないので状態だけ持つ
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t primask);
+void __disable_irq(void);
+void __enable_irq(void);
+uint32_t __get_MSP(void);
+
+//  DWTのサイクルカウンタ  仮想時計から SystemCoreClock で換算した値を返す
+extern uint32_t SystemCoreClock;
+
+struct SimCycleCounter {
+    operator uint32_t() const;
+    SimCycleCounter& operator=(uint32_t value);
+    uint32_t offset = 0;
+};
+
+struct SimDWT {
+    uint32_t CTRL = 0;
+    SimCycleCounter CYCCNT;
+};
+
+struct SimCoreDebug {
+    uint32_t DEMCR = 0;
+};
+
+extern SimDWT* const DWT;
+extern SimCoreDebug* const CoreDebug;
+
+constexpr uint32_t DWT_CTRL_CYCCNTENA_Msk = 0x00000001;
+constexpr uint32_t CoreDebug_DEMCR_TRCENA_Msk = 0x01000000;
+
+extern "C" void* _sbrk(ptrdiff_t increment);
+
+//  シミュレータ側からGPIOを操作する  入力ピンのレベルを変え、割り込みを発生させる
+void sim_gpio_set(uint32_t pin, int value);
+//  出力ピンのレベル
+int sim_gpio_get(uint32_t pin);
+
+#include "HardwareSerial.h"
+
+#endif // _SIM_ARDUINO_H_
@@ -0,0 +1,143 @@
+/**************************************************************************/
+/*!
+    @file     HardwareSerial.cpp  (host simulation)
+    @author   Masa
+
+        UART model paced by the baud rate on the virtual clock
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "HardwareSerial.h"
+#include "../SimClock.h"
+
+HardwareSerial Serial(0, 0);
+
+HardwareSerial::HardwareSerial(uint32_t pin_rx, uint32_t pin_tx){
+    (void)pin_rx;
+    (void)pin_tx;
+}
+
+void HardwareSerial::begin(uint32_t baud_rate){
+    baud = baud_rate ? baud_rate : 9600;
+}
+
+/*!
+    @brief  1byte（スタート・ストップビットを含め10bit）の時間 [ns]
+*/
+uint64_t HardwareSerial::byte_time_ns(void) const {
+    return 10000000000ULL / baud;
+}
+
+/*!
+    @brief  今の時刻までに送り終わったバイトを出力先に渡し、届いたバイトを受信バッファに入れる
+*/
+void HardwareSerial::update(void){
+    const uint64_t now_ns = sim_clock.now() * 1000;
+
+    while (!tx_fifo.empty() && tx_done_ns <= now_ns){
+        const uint8_t c = tx_fifo.front();
+        tx_fifo.pop_front();
+        tx_bytes++;
+        if (tx_sink){
+            tx_sink(&c, 1);
+        }
+        tx_done_ns += byte_time_ns();
+    }
+
+    while (!rx_line.empty() && rx_next_ns <= now_ns){
+        if (rx_fifo.size() < SIM_SERIAL_BUFFER_SIZE){
+            rx_fifo.push_back(rx_line.front());
+        } else {
+            rx_overrun++;
+        }
+        rx_line.pop_front();
+        rx_next_ns += byte_time_ns();
+    }
+}
+
+int HardwareSerial::available(void){
+    update();
+    return (int)rx_fifo.size();
+}
+
+int HardwareSerial::peek(void){
+    update();
+    return rx_fifo.empty() ? -1 : rx_fifo.front();
+}
+
+int HardwareSerial::read(void){
+    update();
+    if (rx_fifo.empty()){
+        return -1;
+    }
+    const uint8_t c = rx_fifo.front();
+    rx_fifo.pop_front();
+    return c;
+}
+
+int HardwareSerial::availableForWrite(void){
+    update();
+    return (int)(SIM_SERIAL_BUFFER_SIZE - tx_fifo.size());
+}
+
+/*!
+    @brief  送信バッファが空になるまで待つ
+*/
+void HardwareSerial::flush(void){
+    update();
+    if (!tx_fifo.empty()){
+        const uint64_t wait_ns = tx_done_ns + byte_time_ns() * (tx_fifo.size() - 1) - sim_clock.now() * 1000;
+        sim_clock.advance(wait_ns / 1000 + 1);
+        update();
+    }
+}
+
+/*!
+    @brief  送信バッファに1byte入れる. 一杯なら1byte送り終わるまで待つ
+*/
+size_t HardwareSerial::write(uint8_t c){
+    update();
+    if (tx_fifo.size() >= SIM_SERIAL_BUFFER_SIZE){
+        const uint64_t now_us = sim_clock.now();
+        const uint64_t wait_us = (tx_done_ns + 999) / 1000 - now_us;
+        sim_clock.advance(wait_us);
+        tx_blocked_us += wait_us;
+        update();
+    }
+    if (tx_fifo.empty()){
+        tx_done_ns = sim_clock.now() * 1000 + byte_time_ns();
+    }
+    tx_fifo.push_back(c);
+    return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size){
+    for (size_t i = 0; i < size; i++){
+        write(buffer[i]);
+    }
+    return size;
+}
+
+/*!
+    @brief  受信するバイト列を与える. 今の時刻からボーレートの速さで1byteずつ届く
+*/
+void HardwareSerial::inject(const uint8_t* data, size_t length){
+    update();
+    const uint64_t now_ns = sim_clock.now() * 1000;
+    if (rx_line.empty() && rx_next_ns < now_ns + byte_time_ns()){
+        rx_next_ns = now_ns + byte_time_ns();
+    }
+    for (size_t i = 0; i < length; i++){
+        //  届く時刻に受信の割り込みを起こす
+        const uint64_t arrival_ns = rx_next_ns + byte_time_ns() * rx_line.size();
+        sim_clock.schedule((arrival_ns + 999) / 1000, [this](void){
+            update();
+            if (rx_handler){
+                rx_handler();
+            }
+        });
+        rx_line.push_back(data[i]);
+    }
+}
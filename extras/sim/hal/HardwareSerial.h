@@ -0,0 +1,143 @@
+/**************************************************************************/
+/*!
+    @file     HardwareSerial.h  (host simulation)
+
+    UARTの模擬  送受信バッファは実機（STM32コア）と同じ64byte
+    送信バッファのデータは仮想時計の上でボーレートの速さで送り出され、出力先（sink）に渡る.
+    送信バッファが一杯の時の write() は実機と同じく空くまで待つ（仮想時計が進む）.
+    受信は inject() で与えたバイト列が、ボーレートの速さで受信バッファに届く.
+    1byte届くたびに受信の割り込みとして setReceiveHandler() の関数を呼ぶ（STOPモードから起こすため）.
+*/
+/**************************************************************************/
+
+#ifndef _SIM_HARDWARESERIAL_H_
+#define _SIM_HARDWARESERIAL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <functional>
+
+#include "Print.h"
+
+//  送受信バッファの大きさ[byte]
+constexpr size_t SIM_SERIAL_BUFFER_SIZE = 64;
+
+/*!
+    @brief  送受信バッファ（固定長のリングバッファ）  実機と同じくヒープを使わない
+*/
+class SimFifo {
+
+  public:
+    bool empty(void) const {
+      return count == 0;
+    };
+
+    size_t size(void) const {
+      return count;
+    };
+
+    uint8_t front(void) const {
+      return data[head];
+    };
+
+    void push_back(uint8_t c){
+      data[(head + count) % SIM_SERIAL_BUFFER_SIZE] = c;
+      count++;
+    };
+
+    void pop_front(void){
+      head = (head + 1) % SIM_SERIAL_BUFFER_SIZE;
+      count--;
+    };
+
+  private:
+    uint8_t data[SIM_SERIAL_BUFFER_SIZE];
+    size_t head = 0;
+    size_t count = 0;
+};
+
+class HardwareSerial : public Print {
+
+  public:
+    //  送り出したバイト列を受け取る関数
+    typedef std::function<void(const uint8_t* data, size_t length)> Sink;
+    //  1byte受信した時に呼ぶ関数
+    typedef std::function<void(void)> ReceiveHandler;
+
+    HardwareSerial(uint32_t pin_rx, uint32_t pin_tx);
+
+    void begin(uint32_t baud);
+    void end(void){};
+
+    int available(void);
+    int peek(void);
+    int read(void);
+    int availableForWrite(void);
+    void flush(void);
+
+    using Print::write;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+
+    explicit operator bool(void) const {
+      return true;
+    };
+
+    //  シミュレータ側の操作
+
+    void setSink(Sink sink){
+      tx_sink = sink;
+    };
+
+    void setReceiveHandler(ReceiveHandler handler){
+      rx_handler = handler;
+    };
+
+    void inject(const uint8_t* data, size_t length);
+
+    /*!
+    @brief  送り出したバイト数
+    */
+    uint64_t getTxBytes(void) const {
+      return tx_bytes;
+    };
+
+    /*!
+    @brief  受信バッファが一杯で捨てたバイト数
+    */
+    uint64_t getRxOverrun(void) const {
+      return rx_overrun;
+    };
+
+    /*!
+    @brief  送信バッファが一杯で write() が待った時間の合計 [us]
+    */
+    uint64_t getTxBlocked(void) const {
+      return tx_blocked_us;
+    };
+
+  private:
+    uint32_t baud = 9600;
+    Sink tx_sink;
+
+    SimFifo tx_fifo;
+    //  送信中のバイトが送り終わる時刻 [ns]
+    uint64_t tx_done_ns = 0;
+    uint64_t tx_bytes = 0;
+    uint64_t tx_blocked_us = 0;
+
+    SimFifo rx_fifo;
+    //  まだ届いていないバイトと、最後のバイトが届く時刻 [ns]
+    std::deque<uint8_t> rx_line;
+    uint64_t rx_next_ns = 0;
+    uint64_t rx_overrun = 0;
+    ReceiveHandler rx_handler;
+
+    uint64_t byte_time_ns(void) const;
+    void update(void);
+};
+
+extern HardwareSerial Serial;
+
+#endif // _SIM_HARDWARESERIAL_H_
@@ -0,0 +1,90 @@
+/**************************************************************************/
+/*!
+    @file     HardwareTimer.cpp  (host simulation)
+    @author   Masa
+
+        Periodic timer interrupt on the virtual clock
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "HardwareTimer.h"
+
+HardwareTimer::HardwareTimer(TIM_TypeDef instance) : instance(instance){
+    sim_clock.attach(this);
+}
+
+HardwareTimer::~HardwareTimer(){
+    sim_clock.detach(this);
+}
+
+/*!
+    @brief  カウンタを止める. 再開するとカウンタの値から続ける
+*/
+void HardwareTimer::pause(void){
+    if (f_running){
+        count_us = sim_clock.now() - (due_us - period_us);
+    }
+    f_running = false;
+}
+
+/*!
+    @brief  カウンタを動かす
+*/
+void HardwareTimer::resume(void){
+    if (f_running || period_us == 0){
+        return;
+    }
+    due_us = sim_clock.now() + period_us - (count_us % period_us);
+    f_running = true;
+}
+
+/*!
+    @brief  カウンタを0に戻す
+*/
+void HardwareTimer::refresh(void){
+    count_us = 0;
+    if (f_running){
+        due_us = sim_clock.now() + period_us;
+    }
+}
+
+/*!
+    @brief  周期を設定する
+*/
+void HardwareTimer::setOverflow(uint32_t value, TimerFormat_t format){
+    switch (format){
+        case HERTZ_FORMAT:
+            period_us = value ? 1000000 / value : 0;
+            break;
+        default:
+            period_us = value;
+            break;
+    }
+    if (f_running){
+        due_us = sim_clock.now() + period_us;
+    }
+}
+
+void HardwareTimer::attachInterrupt(callback_function_t func){
+    callback = func;
+}
+
+void HardwareTimer::detachInterrupt(void){
+    callback = nullptr;
+}
+
+uint64_t HardwareTimer::nextDue(void) const {
+    return f_running ? due_us : UINT64_MAX;
+}
+
+/*!
+    @brief  周期の割り込み  次の期限を決めてからISRを呼ぶ
+*/
+void HardwareTimer::fire(void){
+    due_us += period_us;
+    if (callback){
+        callback();
+    }
+}
@@ -0,0 +1,65 @@
+/**************************************************************************/
+/*!
+    @file     HardwareTimer.h  (host simulation)
+
+    STM32コアの HardwareTimer のうち、周期割り込みに使う機能
+    割り込みは仮想時計（SimClock）が期限の時刻に呼ぶ
+*/
+/**************************************************************************/
+
+#ifndef _SIM_HARDWARETIMER_H_
+#define _SIM_HARDWARETIMER_H_
+
+#include <stdint.h>
+#include <functional>
+
+#include "../SimClock.h"
+
+typedef void* TIM_TypeDef;
+#define TIM1    ((TIM_TypeDef)1)
+#define TIM2    ((TIM_TypeDef)2)
+#define TIM3    ((TIM_TypeDef)3)
+#define TIM4    ((TIM_TypeDef)4)
+
+enum TimerFormat_t {
+    TICK_FORMAT,
+    MICROSEC_FORMAT,
+    HERTZ_FORMAT
+};
+
+typedef std::function<void(void)> callback_function_t;
+
+class HardwareTimer : public SimTimerSource {
+
+  public:
+    HardwareTimer(TIM_TypeDef instance);
+    ~HardwareTimer();
+
+    void pause(void);
+    void resume(void);
+    void refresh(void);
+
+    void setOverflow(uint32_t value, TimerFormat_t format = TICK_FORMAT);
+    void attachInterrupt(callback_function_t callback);
+    void detachInterrupt(void);
+
+    bool isRunning(void) const {
+      return f_running;
+    };
+
+    uint64_t nextDue(void) const override;
+    void fire(void) override;
+
+  private:
+    TIM_TypeDef instance;
+    callback_function_t callback;
+    //  周期 [us]  TICK_FORMAT は1tick=1usとして扱う
+    uint64_t period_us = 0;
+    //  止めている間のカウンタの値 [us]
+    uint64_t count_us = 0;
+    //  次の割り込みの時刻 [us]
+    uint64_t due_us = 0;
+    bool f_running = false;
+};
+
+#endif // _SIM_HARDWARETIMER_H_
@@ -0,0 +1,57 @@
+/**************************************************************************/
+/*!
+    @file     Print.h  (host simulation)
+
+    Arduino の Print クラスのうち、ファームウエアが使う print / println
+*/
+/**************************************************************************/
+
+#ifndef _SIM_PRINT_H_
+#define _SIM_PRINT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+class Print {
+
+  public:
+    virtual ~Print(){};
+
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+
+    size_t write(const char* str);
+
+    size_t print(const char* str);
+    size_t print(char c);
+    size_t print(unsigned char value, int base = DEC);
+    size_t print(int value, int base = DEC);
+    size_t print(unsigned int value, int base = DEC);
+    size_t print(long value, int base = DEC);
+    size_t print(unsigned long value, int base = DEC);
+    size_t print(long long value, int base = DEC);
+    size_t print(unsigned long long value, int base = DEC);
+    size_t print(double value, int digits = 2);
+
+    size_t println(void);
+    template <typename T>
+    size_t println(const T& value){
+      const size_t n = print(value);
+      return n + println();
+    };
+    template <typename T>
+    size_t println(const T& value, int format){
+      const size_t n = print(value, format);
+      return n + println();
+    };
+
+  private:
+    size_t print_number(unsigned long long value, int base);
+};
+
+#endif // _SIM_PRINT_H_
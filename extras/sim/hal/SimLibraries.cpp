@@ -0,0 +1,212 @@
+/**************************************************************************/
+/*!
+    @file     SimLibraries.cpp  (host simulation)
+    @author   Masa
+
+        Device drivers (BusIO, FRAM, Grove LCD) on the I2C bus model
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "Adafruit_I2CDevice.h"
+#include "Adafruit_FRAM_I2C.h"
+#include "rgb_lcd.h"
+
+/*------------------------------------------------------------------------*/
+//  Adafruit_I2CDevice
+
+bool Adafruit_I2CDevice::begin(bool addr_detect){
+    wire->begin();
+    return addr_detect ? detected() : true;
+}
+
+bool Adafruit_I2CDevice::detected(void){
+    wire->beginTransmission(addr);
+    return wire->endTransmission() == 0;
+}
+
+bool Adafruit_I2CDevice::read(uint8_t* buffer, size_t len, bool stop){
+    if (wire->requestFrom(addr, (uint8_t)len, stop) != len){
+        return false;
+    }
+    for (size_t i = 0; i < len; i++){
+        buffer[i] = (uint8_t)wire->read();
+    }
+    return true;
+}
+
+bool Adafruit_I2CDevice::write(const uint8_t* buffer, size_t len, bool stop,
+                               const uint8_t* prefix_buffer, size_t prefix_len){
+    if (len + prefix_len > maxBufferSize()){
+        return false;
+    }
+    wire->beginTransmission(addr);
+    if (prefix_len != 0 && wire->write(prefix_buffer, prefix_len) != prefix_len){
+        return false;
+    }
+    if (wire->write(buffer, len) != len){
+        return false;
+    }
+    return wire->endTransmission(stop) == 0;
+}
+
+bool Adafruit_I2CDevice::write_then_read(const uint8_t* write_buffer, size_t write_len,
+                                         uint8_t* read_buffer, size_t read_len, bool stop){
+    if (!write(write_buffer, write_len, stop)){
+        return false;
+    }
+    return read(read_buffer, read_len);
+}
+
+bool Adafruit_I2CDevice::setSpeed(uint32_t desiredclk){
+    wire->setClock(desiredclk);
+    return true;
+}
+
+/*------------------------------------------------------------------------*/
+//  Adafruit_FRAM_I2C
+
+bool Adafruit_FRAM_I2C::begin(uint8_t addr, TwoWire* theWire){
+    delete i2c_dev;
+    i2c_dev = new Adafruit_I2CDevice(addr, theWire);
+    return i2c_dev->begin();
+}
+
+bool Adafruit_FRAM_I2C::write(uint16_t addr, uint8_t* buffer, uint16_t num){
+    const size_t chunk_max = i2c_dev->maxBufferSize() - 2;
+
+    while (num > 0){
+        const uint16_t chunk = (num < chunk_max) ? num : chunk_max;
+        const uint8_t prefix[2] = {(uint8_t)(addr >> 8), (uint8_t)(addr & 0xFF)};
+        if (!i2c_dev->write(buffer, chunk, true, prefix, 2)){
+            return false;
+        }
+        addr += chunk;
+        buffer += chunk;
+        num -= chunk;
+    }
+    return true;
+}
+
+uint8_t Adafruit_FRAM_I2C::read8(uint16_t addr){
+    uint8_t value = 0;
+    read(addr, &value, 1);
+    return value;
+}
+
+bool Adafruit_FRAM_I2C::read(uint16_t addr, uint8_t* buffer, uint16_t num){
+    const size_t chunk_max = i2c_dev->maxBufferSize();
+
+    while (num > 0){
+        const uint16_t chunk = (num < chunk_max) ? num : chunk_max;
+        const uint8_t prefix[2] = {(uint8_t)(addr >> 8), (uint8_t)(addr & 0xFF)};
+        if (!i2c_dev->write_then_read(prefix, 2, buffer, chunk)){
+            return false;
+        }
+        addr += chunk;
+        buffer += chunk;
+        num -= chunk;
+    }
+    return true;
+}
+
+/*------------------------------------------------------------------------*/
+//  rgb_lcd
+
+void rgb_lcd::begin(uint8_t cols, uint8_t rows, uint8_t charsize){
+    (void)cols;
+    (void)charsize;
+    Wire.begin();
+    delay(50);
+
+    command(LCD_FUNCTIONSET | ((rows > 1) ? LCD_2LINE : 0));
+    delayMicroseconds(4500);
+    display_control = LCD_DISPLAYON;
+    command(LCD_DISPLAYCONTROL | display_control);
+    clear();
+    command(LCD_ENTRYMODESET | LCD_ENTRYLEFT);
+
+    setRGB(255, 255, 255);
+}
+
+void rgb_lcd::clear(void){
+    command(LCD_CLEARDISPLAY);
+    delayMicroseconds(2000);
+}
+
+void rgb_lcd::home(void){
+    command(LCD_RETURNHOME);
+    delayMicroseconds(2000);
+}
+
+void rgb_lcd::noDisplay(void){
+    display_control &= ~LCD_DISPLAYON;
+    command(LCD_DISPLAYCONTROL | display_control);
+}
+
+void rgb_lcd::display(void){
+    display_control |= LCD_DISPLAYON;
+    command(LCD_DISPLAYCONTROL | display_control);
+}
+
+void rgb_lcd::noBlink(void){
+    display_control &= ~LCD_BLINKON;
+    command(LCD_DISPLAYCONTROL | display_control);
+}
+
+void rgb_lcd::blink(void){
+    display_control |= LCD_BLINKON;
+    command(LCD_DISPLAYCONTROL | display_control);
+}
+
+void rgb_lcd::noCursor(void){
+    display_control &= ~LCD_CURSORON;
+    command(LCD_DISPLAYCONTROL | display_control);
+}
+
+void rgb_lcd::cursor(void){
+    display_control |= LCD_CURSORON;
+    command(LCD_DISPLAYCONTROL | display_control);
+}
+
+void rgb_lcd::setCursor(uint8_t col, uint8_t row){
+    command(LCD_SETDDRAMADDR | ((row == 0) ? col : (col | 0x40)));
+}
+
+void rgb_lcd::createChar(uint8_t location, uint8_t charmap[]){
+    uint8_t packet[9];
+
+    command(LCD_SETCGRAMADDR | ((location & 0x7) << 3));
+    packet[0] = 0x40;
+    memcpy(&packet[1], charmap, 8);
+    Wire.beginTransmission(LCD_ADDRESS);
+    Wire.write(packet, 9);
+    Wire.endTransmission();
+}
+
+void rgb_lcd::setRGB(uint8_t r, uint8_t g, uint8_t b){
+    const uint8_t regs[3][2] = {{0x04, r}, {0x03, g}, {0x02, b}};
+
+    for (uint8_t i = 0; i < 3; i++){
+        Wire.beginTransmission(RGB_ADDRESS);
+        Wire.write(regs[i], 2);
+        Wire.endTransmission();
+    }
+}
+
+void rgb_lcd::command(uint8_t value){
+    send_pair(0x80, value);
+}
+
+size_t rgb_lcd::write(uint8_t value){
+    send_pair(0x40, value);
+    return 1;
+}
+
+void rgb_lcd::send_pair(uint8_t control, uint8_t value){
+    const uint8_t packet[2] = {control, value};
+    Wire.beginTransmission(LCD_ADDRESS);
+    Wire.write(packet, 2);
+    Wire.endTransmission();
+}
@@ -0,0 +1,164 @@
+/**************************************************************************/
+/*!
+    @file     Wire.cpp  (host simulation)
+    @author   Masa
+
+        I2C bus model with per-address traffic accounting
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include "Wire.h"
+#include "../SimClock.h"
+
+#include <string.h>
+
+TwoWire Wire;
+
+namespace{
+    //  開始・停止条件の時間 [bit]
+    constexpr uint32_t START_STOP_BITS = 2;
+    //  1byte（ACKを含む）の時間 [bit]
+    constexpr uint32_t BITS_PER_BYTE = 9;
+}
+
+void TwoWire::setClock(uint32_t frequency){
+    if (frequency != 0 && frequency != clock_hz){
+        clock_hz = frequency;
+        clock_changes++;
+    }
+}
+
+void TwoWire::beginTransmission(uint8_t address){
+    tx_address = address & 0x7F;
+    tx_length = 0;
+}
+
+size_t TwoWire::write(uint8_t data){
+    if (tx_length >= sizeof(tx_buffer)){
+        return 0;
+    }
+    tx_buffer[tx_length++] = data;
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t* data, size_t length){
+    size_t n = 0;
+    while (n < length && write(data[n])){
+        n++;
+    }
+    return n;
+}
+
+/*!
+    @brief  書き込みを送る
+    @return 0:成功, 2:アドレスにNACK, 3:データにNACK
+*/
+uint8_t TwoWire::endTransmission(bool stop){
+    (void)stop;
+    SimI2cDevice* device = find(tx_address);
+
+    if (!device){
+        sim_clock.advance(account(tx_address, 'W', nullptr, 0, false));
+        return 2;
+    }
+    const bool ack = (tx_length == 0) || device->onWrite(tx_buffer, tx_length);
+    sim_clock.advance(account(tx_address, 'W', tx_buffer, tx_length, ack));
+    return ack ? 0 : 3;
+}
+
+/*!
+    @brief  読み出す
+    @return 読めたバイト数
+*/
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, bool stop){
+    (void)stop;
+    SimI2cDevice* device = find(address & 0x7F);
+
+    rx_index = 0;
+    rx_length = 0;
+    if (quantity > sizeof(rx_buffer)){
+        quantity = sizeof(rx_buffer);
+    }
+    if (!device){
+        sim_clock.advance(account(address & 0x7F, 'R', nullptr, 0, false));
+        return 0;
+    }
+    memset(rx_buffer, 0xFF, quantity);
+    rx_length = device->onRead(rx_buffer, quantity);
+    sim_clock.advance(account(address & 0x7F, 'R', rx_buffer, quantity, true));
+    return (uint8_t)rx_length;
+}
+
+int TwoWire::available(void){
+    return (int)(rx_length - rx_index);
+}
+
+int TwoWire::read(void){
+    return (rx_index < rx_length) ? rx_buffer[rx_index++] : -1;
+}
+
+/*!
+    @brief  アドレスにデバイスのモデルをつなぐ
+*/
+void TwoWire::attach(uint8_t address, SimI2cDevice* device){
+    devices[address & 0x7F] = device;
+}
+
+SimI2cDevice* TwoWire::find(uint8_t address) const {
+    SimI2cDevice* device = devices[address];
+    return (device && !device->isOffline()) ? device : nullptr;
+}
+
+/*!
+    @brief  割り込み転送の模擬  時計を進めずに書き込み、転送時間を返す（完了は呼んだ側が予定する）
+    @param time_us 転送時間 [us]
+    @return True:ACKされた
+*/
+bool TwoWire::transferWrite(uint8_t address, const uint8_t* data, size_t length, uint64_t& time_us){
+    SimI2cDevice* device = find(address & 0x7F);
+    const bool ack = device && device->onWrite(data, length);
+
+    time_us = account(address & 0x7F, 'W', data, device ? length : 0, ack);
+    return ack;
+}
+
+/*!
+    @brief  割り込み転送の模擬  時計を進めずに読み出し、転送時間を返す
+    @param time_us 転送時間 [us]
+    @return True:length バイト読めた
+*/
+bool TwoWire::transferRead(uint8_t address, uint8_t* data, size_t length, uint64_t& time_us){
+    SimI2cDevice* device = find(address & 0x7F);
+
+    memset(data, 0xFF, length);
+    const bool ack = device && (device->onRead(data, length) == length);
+    time_us = account(address & 0x7F, 'R', data, ack ? length : 0, ack);
+    return ack;
+}
+
+/*!
+    @brief  転送1回分の使用量を数える (private)
+    @return 転送時間 [us]
+*/
+uint64_t TwoWire::account(uint8_t address, char direction, const uint8_t* data, size_t bytes, bool ack){
+    SimI2cStats& s = stats[address];
+    const uint64_t bits = START_STOP_BITS + BITS_PER_BYTE * (1 + bytes);
+    const uint64_t time_ns = bits * 1000000000ULL / clock_hz;
+
+    s.transactions++;
+    s.bytes += bytes;
+    s.time_ns += time_ns;
+    if (!ack){
+        s.nacks++;
+    }
+    if (trace){
+        fprintf(trace, "%llu %02X %c%s", (unsigned long long)sim_clock.now(), address, direction, ack ? "" : " NACK");
+        for (size_t i = 0; i < bytes; i++){
+            fprintf(trace, " %02X", data[i]);
+        }
+        fputc('\n', trace);
+    }
+    return (time_ns + 500) / 1000;
+}
@@ -0,0 +1,134 @@
+/**************************************************************************/
+/*!
+    @file     Wire.h  (host simulation)
+
+    I2Cバスの模擬  アドレスごとに SimI2cDevice（デバイスのモデル）をつなぐ
+    1回の転送ごとに、バスのクロックから求めた転送時間だけ仮想時計を進める（実機の Wire はブロックする）
+    アドレスごとの転送回数・バイト数・時間を数える
+*/
+/**************************************************************************/
+
+#ifndef _SIM_WIRE_H_
+#define _SIM_WIRE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+//  転送バッファの大きさ[byte]（STM32コアと同じ）
+constexpr size_t SIM_WIRE_BUFFER_SIZE = 32;
+
+/*!
+    @brief  I2Cデバイスのモデル
+*/
+class SimI2cDevice {
+
+  public:
+    virtual ~SimI2cDevice(){};
+
+    //  マスタからの書き込み1回分  False ならNACK
+    virtual bool onWrite(const uint8_t* data, size_t length) = 0;
+    //  マスタへの読み出し1回分  返したバイト数だけ応答する
+    virtual size_t onRead(uint8_t* data, size_t length) = 0;
+
+    //  故障の注入  オフラインの間はアドレスにも応答しない
+    void setOffline(bool offline){
+      f_offline = offline;
+    };
+
+    bool isOffline(void) const {
+      return f_offline;
+    };
+
+  private:
+    bool f_offline = false;
+};
+
+/*!
+    @brief  アドレスごとのバスの使用量
+*/
+struct SimI2cStats {
+    uint32_t transactions;
+    uint32_t bytes;
+    uint32_t nacks;
+    uint64_t time_ns;
+};
+
+class TwoWire {
+
+  public:
+    TwoWire(void){};
+
+    //  STM32 のコアと同じく、begin() でクロックは 100kHz に戻る
+    void begin(void){
+      setClock(100000);
+    };
+    void setClock(uint32_t frequency);
+
+    void beginTransmission(uint8_t address);
+    size_t write(uint8_t data);
+    size_t write(const uint8_t* data, size_t length);
+    uint8_t endTransmission(bool stop = true);
+
+    uint8_t requestFrom(uint8_t address, uint8_t quantity, bool stop = true);
+    int available(void);
+    int read(void);
+
+    //  シミュレータ側の操作
+
+    void attach(uint8_t address, SimI2cDevice* device);
+
+    bool transferWrite(uint8_t address, const uint8_t* data, size_t length, uint64_t& time_us);
+    bool transferRead(uint8_t address, uint8_t* data, size_t length, uint64_t& time_us);
+
+    /*!
+    @brief  転送ごとに1行（時刻・アドレス・向き・データ）を書き出す先  nullptr なら書かない
+    */
+    void setTrace(FILE* out){
+      trace = out;
+    };
+
+    /*!
+    @brief  今のバスのクロック [Hz]
+    */
+    uint32_t getClock(void) const {
+      return clock_hz;
+    };
+
+    /*!
+    @brief  アドレスごとのバスの使用量
+    */
+    const SimI2cStats& getStats(uint8_t address) const {
+      return stats[address & 0x7F];
+    };
+
+    /*!
+    @brief  setClock() でクロックが変わった回数
+    */
+    uint32_t getClockChanges(void) const {
+      return clock_changes;
+    };
+
+  private:
+    SimI2cDevice* devices[128] = {};
+    SimI2cStats stats[128] = {};
+    uint32_t clock_hz = 100000;
+    uint32_t clock_changes = 0;
+
+    uint8_t tx_address = 0;
+    uint8_t tx_buffer[SIM_WIRE_BUFFER_SIZE];
+    size_t tx_length = 0;
+
+    uint8_t rx_buffer[SIM_WIRE_BUFFER_SIZE];
+    size_t rx_length = 0;
+    size_t rx_index = 0;
+
+    FILE* trace = nullptr;
+
+    SimI2cDevice* find(uint8_t address) const;
+    uint64_t account(uint8_t address, char direction, const uint8_t* data, size_t bytes, bool ack);
+};
+
+extern TwoWire Wire;
+
+#endif // _SIM_WIRE_H_
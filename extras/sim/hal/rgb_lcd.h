@@ -0,0 +1,66 @@
+/**************************************************************************/
+/*!
+    @file     rgb_lcd.h  (host simulation)
+
+    Grove LCD RGB Backlight のドライバ  実物と同じく1文字・1コマンドごとにI2Cで送る
+*/
+/**************************************************************************/
+
+#ifndef _SIM_RGB_LCD_H_
+#define _SIM_RGB_LCD_H_
+
+#include <Arduino.h>
+#include <Wire.h>
+
+//  LCDコントローラのアドレス
+#define LCD_ADDRESS     (0x7c>>1)
+//  バックライトのアドレス
+#define RGB_ADDRESS     (0xc4>>1)
+
+//  HD44780 互換LCDのコマンド（実物のライブラリと同じく公開する）
+#define LCD_CLEARDISPLAY    0x01
+#define LCD_RETURNHOME      0x02
+#define LCD_ENTRYMODESET    0x04
+#define LCD_DISPLAYCONTROL  0x08
+#define LCD_FUNCTIONSET     0x20
+#define LCD_SETCGRAMADDR    0x40
+#define LCD_SETDDRAMADDR    0x80
+#define LCD_DISPLAYON       0x04
+#define LCD_CURSORON        0x02
+#define LCD_BLINKON         0x01
+#define LCD_ENTRYLEFT       0x02
+#define LCD_2LINE           0x08
+
+class rgb_lcd : public Print {
+
+  public:
+    rgb_lcd(void){};
+
+    void begin(uint8_t cols, uint8_t rows, uint8_t charsize = 0);
+
+    void clear(void);
+    void home(void);
+
+    void noDisplay(void);
+    void display(void);
+    void noBlink(void);
+    void blink(void);
+    void noCursor(void);
+    void cursor(void);
+
+    void setCursor(uint8_t col, uint8_t row);
+    void createChar(uint8_t location, uint8_t charmap[]);
+    void setRGB(uint8_t r, uint8_t g, uint8_t b);
+
+    void command(uint8_t value);
+
+    using Print::write;
+    size_t write(uint8_t value) override;
+
+  private:
+    uint8_t display_control = 0;
+
+    void send_pair(uint8_t control, uint8_t value);
+};
+
+#endif // _SIM_RGB_LCD_H_
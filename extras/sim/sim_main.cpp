@@ -0,0 +1,704 @@
+/**************************************************************************/
+/*!
+    @file     sim_main.cpp
+    @author   Masa
+
+        Host simulation driver: runs the unmodified firmware against the board
+        and helium sensor models on the virtual clock
+
+        使い方の例
+            eh900_sim --hours 24 --level 80 --drain 1.5 --csv result.csv
+            eh900_sim --hours 2 --press 600 --press 1200:3000 --open 4000:60 --lcd
+            eh900_sim --hours 1 --command '60:set per' --command '60.5:iod 600\n' --command '120:hist 2\n' --uart out.txt
+            eh900_sim --hours 168 --replay week.csv --adaptive 300:5400:1 --csv adaptive.csv
+        オプション
+            --hours H           シミュレーションする時間 [h] (24)
+            --length L          センサ長 [inch] (20)
+            --channels N        計測チャネルの数 (1)  チャネル k の最初の液面は P - 10k [%]
+            --period S          計測タイマの周期 [s] (1800)
+            --level P           最初の液面 [%] (80)
+            --drain R           液面の減る速さ [%/h] (1.0)
+            --noise UV          ADの入力の雑音 [uV rms] (20)
+            --seed N            雑音の乱数の種 (1)
+            --filter F          連続計測の液面推定  none / iir / median / kalman (none)
+            --stream SPS:N      連続計測をデータレート SPS[SPS] x N サンプルのストリーミングにする
+            --press T[:MS]      T[s] にスイッチを MS[ms] 押す (100)  2000ms以上で長押し
+            --open T[:S]        T[s] から S[s] の間センサを断線させる (60)
+            --offline A:T[:S]   T[s] から S[s] の間 I2Cアドレス A のデバイスを無応答にする (10)
+            --refill T[:P]      T[s] に液面を P[%] に戻す (90)
+            --replay FILE       チャネル0の液面を記録した液面の変化でたどる（--level と --drain の代わり）
+                                1行に 時刻[s],液面[%]（後ろの列は読まない. --csv の出力もそのまま使える）
+                                点の間は直線でつなぎ、最後の点の後は一定. 数値で始まらない行は読み飛ばす
+            --adaptive MIN:MAX:U[:A]  タイマモードの適応タイマを使う  周期 MIN〜MAX[s], 許容する変化 U[%],
+                                警報液面 A[%] (0:なし)
+            --alarm A           警報液面 A[%]  適応タイマを使わない時も、警報液面を下回ってから分かるまでの遅れを出す
+            --command T:TEXT    T[s] に IoTゲートウエイのUARTへ TEXT を送る（ボーレートの速さで続けて届く）
+                                \r \n \t \\ \xHH が使える. 何回でも指定でき、行を分けて送ってもよい
+            --uart FILE         IoTゲートウエイのUART出力をファイルに書く
+            --serial            デバグ用シリアルの出力を標準エラーに出す
+            --lcd               LCDの表示が変わるたびに標準出力に出す
+            --profile           終了時にプロファイラの結果とI2Cバスの使用量・CPUの負荷を出す
+            --csv FILE          計測結果ごとに 時刻,真の液面,計測値,エラー,モード を書く（チャネル0）
+        結果の tracking は最初の計測の後の、最後の計測結果と真の液面の差（チャネル0, 眠りから覚めるたびに見る）.
+        警報液面を指定すると、真の液面が警報液面を下回ってから計測結果が下回るまでの遅れも出す
+        （計測の誤差で先に下回れば負）
+            --i2c-trace FILE    I2Cの転送ごとに 時刻[us] アドレス 向き データ を書く（転送の順序とまとめ方の確認）
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <Arduino.h>
+#include "SimClock.h"
+#include "SimBoard.h"
+
+#include "eh900_class.h"
+#include "measurement.h"
+#include "MeasurementEngine.h"
+#include "IotGateway.h"
+#include "scheduler_class.h"
+#include "LowPower.h"
+
+//  ファームウエア（sketch.cpp）の中のもの
+extern eh900 level_meter;
+extern Scheduler scheduler;
+extern IotGateway uart1;
+extern MeasurementEngine meas_unit;
+extern LowPower low_power;
+void setup(void);
+void loop(void);
+void dump_profile(void);
+void dump_i2c(void);
+void dump_power(void);
+void configure_adaptive_timer(void);
+
+namespace{
+    //  スイッチのポート（EH900_main.ino の MEAS_SWITCH）
+    constexpr uint32_t SIM_MEAS_SWITCH = D3;
+
+    //  MCUの消費電流 [mA]  STM32F303x8 のデータシートのおよその代表値（64MHz, 周辺のクロックあり, 3.3V）
+    constexpr double MCU_RUN_CURRENT = 28.0;
+    constexpr double MCU_SLEEP_CURRENT = 18.0;
+    constexpr double MCU_STOP_CURRENT = 0.01;   //  低電力レギュレータ, LSIとRTCを含む
+
+    //  増設の計測チャネルの最初の液面をチャネルごとに下げる幅 [%]
+    constexpr double CHANNEL_LEVEL_STEP = 10.0;
+
+    struct Options {
+        double hours = 24.0;
+        uint16_t length = 20;
+        uint8_t channels = 1;
+        uint16_t period = 1800;
+        double level = 80.0;
+        double drain = 1.0;
+        double noise_uv = 20.0;
+        uint32_t seed = 1;
+        uint8_t filter = LevelEstimator::FILTER_NONE;
+        AdcStreamConfig stream = {AdcEngine::RATE_860SPS, 0};
+        bool f_serial = false;
+        bool f_lcd = false;
+        bool f_profile = false;
+        const char* uart_file = nullptr;
+        const char* csv_file = nullptr;
+        const char* i2c_trace_file = nullptr;
+        const char* replay_file = nullptr;
+        bool f_adaptive = false;
+        AdaptiveConfig adaptive = AdaptiveTimer::defaultConfig();
+    };
+
+    //  表示している液面（最後の計測結果）が真の液面をどれだけ追えているか（チャネル0）
+    struct TrackingStats {
+        bool f_started = false;
+        //  最後の計測結果 [%]  計測の途中の表示は使わない
+        double reported = 0.0;
+        double last = 0.0;
+        double time = 0.0;
+        double sum_abs = 0.0;
+        double max_abs = 0.0;
+        //  真の液面が警報液面を下回った時刻と、計測結果が初めて下回った時刻 [s]  負なら未だ
+        double alarm_true = -1.0;
+        double alarm_found = -1.0;
+    };
+
+    //  計測結果と真の液面の差の統計
+    struct ErrorStats {
+        uint32_t count = 0;
+        uint32_t sensor_errors = 0;
+        double sum = 0.0;
+        double sum_sq = 0.0;
+        double max_abs = 0.0;
+    };
+
+    //  1回計測にかかった時間
+    struct SingleStats {
+        uint32_t count = 0;
+        double start = 0.0;
+        double sum = 0.0;
+        double max = 0.0;
+    };
+
+    //  連続計測の更新の速さと、ファームウエアが見積もった雑音
+    struct ContinuousStats {
+        uint32_t count = 0;
+        double first = 0.0;
+        double last = 0.0;
+        double noise_sum = 0.0;
+    };
+
+    uint64_t seconds_to_us(double seconds){
+        return (uint64_t)llround(seconds * 1e6);
+    }
+
+    //  --command の TEXT のエスケープを戻す
+    std::string unescape(const char* text){
+        std::string out;
+        while (*text != '\0'){
+            if (*text != '\\' || text[1] == '\0'){
+                out += *text++;
+                continue;
+            }
+            text++;
+            switch (*text){
+                case 'r': out += '\r'; text++; break;
+                case 'n': out += '\n'; text++; break;
+                case 't': out += '\t'; text++; break;
+                case 'x': {
+                    char* end = nullptr;
+                    const char hex[3] = {text[1], text[1] ? text[2] : '\0', '\0'};
+                    out += (char)strtoul(hex, &end, 16);
+                    text += 1 + (end - hex);
+                    break;
+                }
+                default: out += *text++; break;
+            }
+        }
+        return out;
+    }
+
+    //  "T[:X]" を読む  X がなければ既定値
+    void parse_pair(const char* arg, double& first, double& second){
+        char* end = nullptr;
+        first = strtod(arg, &end);
+        if (end && *end == ':'){
+            second = strtod(end + 1, nullptr);
+        }
+    }
+
+    //  --replay の液面の変化を読み、チャネル0のセンサの液面と減る速さの変化を予定に入れる
+    bool schedule_replay(const char* path, HeliumSensor& sensor){
+        FILE* in = fopen(path, "r");
+        if (!in){
+            perror(path);
+            return false;
+        }
+        std::vector<std::pair<double, double>> points;
+        char line[256];
+        while (fgets(line, sizeof(line), in)){
+            double t = 0.0;
+            double level = 0.0;
+            if (sscanf(line, "%lf,%lf", &t, &level) == 2 && (points.empty() || t > points.back().first)){
+                points.push_back(std::make_pair(t, level));
+            }
+        }
+        fclose(in);
+        if (points.empty()){
+            fprintf(stderr, "%s: no level points\n", path);
+            return false;
+        }
+
+        sensor.setLevel(points[0].second);
+        sensor.setDrainRate(0.0);
+        for (size_t i = 0; i < points.size(); i++){
+            const double level = points[i].second;
+            const double drain = (i + 1 < points.size())
+                ? (level - points[i + 1].second) / (points[i + 1].first - points[i].first) * 3600.0 : 0.0;
+            sim_clock.schedule(seconds_to_us(points[i].first), [&sensor, level, drain](void){
+                sensor.setLevel(level);
+                sensor.setDrainRate(drain);
+            });
+        }
+        return true;
+    }
+
+    void usage(const char* name){
+        fprintf(stderr, "usage: %s [--hours H] [--length L] [--channels N] [--period S] [--level P] [--drain R]\n"
+                        "          [--noise UV] [--seed N] [--filter F] [--stream SPS:N]\n"
+                        "          [--press T[:MS]] [--open T[:S]]\n"
+                        "          [--offline ADDR:T[:S]] [--refill T[:P]] [--replay FILE]\n"
+                        "          [--adaptive MIN:MAX:U[:A]] [--alarm A]\n"
+                        "          [--command T:TEXT] [--uart FILE]\n"
+                        "          [--serial] [--lcd] [--profile] [--csv FILE] [--i2c-trace FILE]\n", name);
+    }
+
+    void schedule_press(double at, double ms){
+        const uint64_t start = seconds_to_us(at);
+        sim_clock.schedule(start, [](void){ sim_gpio_set(SIM_MEAS_SWITCH, HIGH); });
+        sim_clock.schedule(start + seconds_to_us(ms * 1e-3), [](void){ sim_gpio_set(SIM_MEAS_SWITCH, LOW); });
+    }
+}
+
+int main(int argc, char** argv){
+    Options opt;
+    //  ボードができる前の指定は、あとで予定に入れる
+    enum FaultKind { FAULT_PRESS, FAULT_OPEN, FAULT_OFFLINE, FAULT_REFILL };
+    struct Fault { FaultKind kind; double at; double arg; uint8_t address; };
+    std::vector<Fault> faults;
+    struct Command { double at; std::string text; };
+    std::vector<Command> commands;
+
+    for (int i = 1; i < argc; i++){
+        const std::string arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        const bool f_value = (value != nullptr);
+
+        if (arg == "--serial"){
+            opt.f_serial = true;
+        } else if (arg == "--lcd"){
+            opt.f_lcd = true;
+        } else if (arg == "--profile"){
+            opt.f_profile = true;
+        } else if (!f_value){
+            usage(argv[0]);
+            return 2;
+        } else {
+            i++;
+            if (arg == "--hours"){
+                opt.hours = strtod(value, nullptr);
+            } else if (arg == "--length"){
+                opt.length = (uint16_t)strtoul(value, nullptr, 0);
+            } else if (arg == "--channels"){
+                opt.channels = (uint8_t)strtoul(value, nullptr, 0);
+                if (opt.channels < 1 || opt.channels > SIM_CHANNEL_MAX){
+                    usage(argv[0]);
+                    return 2;
+                }
+            } else if (arg == "--period"){
+                opt.period = (uint16_t)strtoul(value, nullptr, 0);
+            } else if (arg == "--level"){
+                opt.level = strtod(value, nullptr);
+            } else if (arg == "--drain"){
+                opt.drain = strtod(value, nullptr);
+            } else if (arg == "--noise"){
+                opt.noise_uv = strtod(value, nullptr);
+            } else if (arg == "--seed"){
+                opt.seed = (uint32_t)strtoul(value, nullptr, 0);
+            } else if (arg == "--filter"){
+                const char* const names[] = {"none", "iir", "median", "kalman"};
+                opt.filter = LevelEstimator::FILTER_NUM;
+                for (uint8_t f = 0; f < LevelEstimator::FILTER_NUM; f++){
+                    if (strcmp(value, names[f]) == 0){
+                        opt.filter = f;
+                    }
+                }
+                if (opt.filter == LevelEstimator::FILTER_NUM){
+                    usage(argv[0]);
+                    return 2;
+                }
+            } else if (arg == "--stream"){
+                double sps = 0.0;
+                double samples = 0.0;
+                parse_pair(value, sps, samples);
+                opt.stream.data_rate = AdcEngine::RATE_NUM;
+                for (uint8_t r = 0; r < AdcEngine::RATE_NUM; r++){
+                    if (AdcEngine::getSamplesPerSecond((AdcEngine::DataRate)r) == (uint16_t)sps){
+                        opt.stream.data_rate = r;
+                    }
+                }
+                opt.stream.oversampling = (uint8_t)samples;
+                if (opt.stream.data_rate == AdcEngine::RATE_NUM || samples < 1 || samples > ADC_RING_SIZE){
+                    usage(argv[0]);
+                    return 2;
+                }
+            } else if (arg == "--press"){
+                Fault f = {FAULT_PRESS, 0.0, 100.0, 0};
+                parse_pair(value, f.at, f.arg);
+                faults.push_back(f);
+            } else if (arg == "--open"){
+                Fault f = {FAULT_OPEN, 0.0, 60.0, 0};
+                parse_pair(value, f.at, f.arg);
+                faults.push_back(f);
+            } else if (arg == "--offline"){
+                char* end = nullptr;
+                Fault f = {FAULT_OFFLINE, 0.0, 10.0, (uint8_t)strtoul(value, &end, 0)};
+                if (!end || *end != ':'){
+                    usage(argv[0]);
+                    return 2;
+                }
+                parse_pair(end + 1, f.at, f.arg);
+                faults.push_back(f);
+            } else if (arg == "--refill"){
+                Fault f = {FAULT_REFILL, 0.0, 90.0, 0};
+                parse_pair(value, f.at, f.arg);
+                faults.push_back(f);
+            } else if (arg == "--replay"){
+                opt.replay_file = value;
+            } else if (arg == "--alarm"){
+                opt.adaptive.alarm_level = (uint16_t)lround(strtod(value, nullptr) * 10.0);
+                if (!AdaptiveTimer::isValid(opt.adaptive)){
+                    usage(argv[0]);
+                    return 2;
+                }
+            } else if (arg == "--adaptive"){
+                double range[4] = {0.0, 0.0, 0.0, opt.adaptive.alarm_level * 0.1};
+                const char* p = value;
+                for (uint8_t k = 0; k < 4 && *p != '\0'; k++){
+                    char* end = nullptr;
+                    range[k] = strtod(p, &end);
+                    p = (*end == ':') ? end + 1 : end;
+                }
+                opt.f_adaptive = true;
+                opt.adaptive.enabled = 1;
+                opt.adaptive.period_min = (uint16_t)range[0];
+                opt.adaptive.period_max = (uint16_t)range[1];
+                opt.adaptive.uncertainty = (uint16_t)lround(range[2] * 10.0);
+                opt.adaptive.alarm_level = (uint16_t)lround(range[3] * 10.0);
+                if (!AdaptiveTimer::isValid(opt.adaptive)){
+                    usage(argv[0]);
+                    return 2;
+                }
+            } else if (arg == "--command"){
+                char* end = nullptr;
+                Command c = {strtod(value, &end), ""};
+                if (!end || *end != ':'){
+                    usage(argv[0]);
+                    return 2;
+                }
+                c.text = unescape(end + 1);
+                commands.push_back(c);
+            } else if (arg == "--uart"){
+                opt.uart_file = value;
+            } else if (arg == "--csv"){
+                opt.csv_file = value;
+            } else if (arg == "--i2c-trace"){
+                opt.i2c_trace_file = value;
+            } else {
+                usage(argv[0]);
+                return 2;
+            }
+        }
+    }
+
+    static SimBoard board(opt.length, opt.noise_uv, opt.seed, opt.channels);
+    for (uint8_t ch = 0; ch < opt.channels; ch++){
+        board.getChannel(ch).sensor.setLevel(fmax(opt.level - CHANNEL_LEVEL_STEP * ch, 0.0));
+        board.getChannel(ch).sensor.setDrainRate(opt.drain);
+    }
+    board.seedParameters(opt.length, opt.period);
+    if (opt.replay_file && !schedule_replay(opt.replay_file, board.sensor)){
+        return 2;
+    }
+
+    for (const Fault& f : faults){
+        const uint64_t at = seconds_to_us(f.at);
+        const uint64_t until = at + seconds_to_us(f.arg);
+        switch (f.kind){
+            case FAULT_PRESS:
+                schedule_press(f.at, f.arg);
+                break;
+            case FAULT_OPEN:
+                sim_clock.schedule(at, [](void){ board.setSensorOpen(true); });
+                sim_clock.schedule(until, [](void){ board.setSensorOpen(false); });
+                break;
+            case FAULT_OFFLINE: {
+                SimI2cDevice* device = board.findDevice(f.address);
+                if (!device){
+                    fprintf(stderr, "no device at 0x%02X\n", f.address);
+                    return 2;
+                }
+                sim_clock.schedule(at, [device](void){ device->setOffline(true); });
+                sim_clock.schedule(until, [device](void){ device->setOffline(false); });
+                break;
+            }
+            case FAULT_REFILL: {
+                const double level = f.arg;
+                sim_clock.schedule(at, [level](void){ board.sensor.setLevel(level); });
+                break;
+            }
+        }
+    }
+
+    for (const Command& c : commands){
+        const std::string text = c.text;
+        sim_clock.schedule(seconds_to_us(c.at), [text](void){
+            uart1.inject((const uint8_t*)text.data(), text.size());
+        });
+    }
+
+    //  出力先
+    FILE* uart_out = opt.uart_file ? fopen(opt.uart_file, "wb") : nullptr;
+    FILE* csv_out = opt.csv_file ? fopen(opt.csv_file, "w") : nullptr;
+    FILE* i2c_trace_out = opt.i2c_trace_file ? fopen(opt.i2c_trace_file, "w") : nullptr;
+    if ((opt.uart_file && !uart_out) || (opt.csv_file && !csv_out) || (opt.i2c_trace_file && !i2c_trace_out)){
+        perror("open");
+        return 2;
+    }
+    if (csv_out){
+        fprintf(csv_out, "time_s,true_level,measured_level,sensor_error,mode\n");
+    }
+    Wire.setTrace(i2c_trace_out);
+
+    Serial.setSink([&opt](const uint8_t* data, size_t length){
+        if (opt.f_serial){
+            fwrite(data, 1, length, stderr);
+        }
+    });
+    uart1.setSink([uart_out](const uint8_t* data, size_t length){
+        if (uart_out){
+            fwrite(data, 1, length, uart_out);
+        }
+    });
+    if (opt.f_lcd){
+        board.lcd.setObserver([](const LcdModel& lcd){
+            static std::string shown;
+            const std::string text = lcd.getLine(0) + "|" + lcd.getLine(1);
+            if (text != shown){
+                shown = text;
+                printf("%10.3f |%s|\n", sim_clock.now() * 1e-6, text.c_str());
+            }
+        });
+    }
+
+    //  起動できない時（FRAMなどの故障）はファームウエアが delay() で止まり続けるので、終了時刻で打ち切る
+    const uint64_t end_us = seconds_to_us(opt.hours * 3600.0);
+    static bool f_setup_done = false;
+    sim_clock.schedule(end_us, [](void){
+        if (!f_setup_done){
+            fprintf(stderr, "\nsetup() did not finish (system error)\n");
+            exit(1);
+        }
+    });
+
+    const auto wall_start = std::chrono::steady_clock::now();
+
+    //  時刻0の予定（起動時からの故障など）を先に反映する
+    sim_clock.advance(0);
+    //  計測スイッチは押すと HIGH  離している間は外で LOW に引かれている
+    sim_gpio_set(SIM_MEAS_SWITCH, LOW);
+    setup();
+    f_setup_done = true;
+
+    //  旧版の形式のパラメタにはチャネル0しかないので、増設のチャネルのセンサ長はここで合わせる
+    for (uint8_t ch = 1; ch < meas_unit.getChannelCount(); ch++){
+        level_meter.setSensorLength(opt.length, ch);
+    }
+    meas_unit.renew_sensor_parameter();
+
+    //  液面推定の選択  連続計測を始める時に読まれる
+    EstimatorConfig estimator = level_meter.getEstimatorConfig();
+    estimator.filter = opt.filter;
+    level_meter.setEstimatorConfig(estimator);
+    level_meter.setStreamConfig(opt.stream);
+
+    //  適応タイマ  パラメタは保存しない（FRAMの内容は起動時のまま）
+    if (opt.f_adaptive){
+        level_meter.setAdaptiveConfig(opt.adaptive);
+        configure_adaptive_timer();
+    }
+
+    ErrorStats channel_stats[SIM_CHANNEL_MAX];
+    SingleStats single;
+    bool f_single_running = false;
+    ContinuousStats cont;
+    TrackingStats tracking;
+    uint32_t results = board.vmon_dac.getUpdates();
+
+    while (sim_clock.now() < end_us){
+        loop();
+
+        //  表示している液面と真の液面の差  前に見た時から今までその差だったとする
+        if (tracking.f_started){
+            const double now = sim_clock.now() * 1e-6;
+            const double diff = fabs(tracking.reported - board.sensor.getLevel());
+            tracking.sum_abs += diff * (now - tracking.last);
+            tracking.time += now - tracking.last;
+            tracking.max_abs = fmax(tracking.max_abs, diff);
+            tracking.last = now;
+        }
+        if (opt.adaptive.alarm_level != 0 && tracking.alarm_true < 0.0
+            && board.sensor.getLevel() * 10.0 < opt.adaptive.alarm_level){
+            tracking.alarm_true = sim_clock.now() * 1e-6;
+        }
+
+        //  1回計測の時間  全チャネルが終わるまで
+        if (meas_unit.isSingleRunning() != f_single_running){
+            f_single_running = meas_unit.isSingleRunning();
+            if (f_single_running){
+                single.start = sim_clock.now() * 1e-6;
+            } else {
+                const double duration = sim_clock.now() * 1e-6 - single.start;
+                single.count++;
+                single.sum += duration;
+                single.max = fmax(single.max, duration);
+            }
+        }
+
+        //  計測結果が出るとアナログモニタ出力が更新される（その時には全チャネルの結果が出ている）
+        if (board.vmon_dac.getUpdates() != results){
+            results = board.vmon_dac.getUpdates();
+
+            for (uint8_t ch = 0; ch < board.getChannelCount(); ch++){
+                ErrorStats& s = channel_stats[ch];
+                if (level_meter.isSensorError(ch)){
+                    s.sensor_errors++;
+                } else {
+                    const double diff = level_meter.getLiquidLevel(ch) * 0.1 - board.getChannel(ch).sensor.getLevel();
+                    s.count++;
+                    s.sum += diff;
+                    s.sum_sq += diff * diff;
+                    s.max_abs = fmax(s.max_abs, fabs(diff));
+                }
+            }
+
+            const double truth = board.sensor.getLevel();
+            const double measured = level_meter.getLiquidLevel() * 0.1;
+            const bool f_error = level_meter.isSensorError();
+            if (!f_error){
+                if (!tracking.f_started){
+                    tracking.f_started = true;
+                    tracking.last = sim_clock.now() * 1e-6;
+                }
+                tracking.reported = measured;
+            }
+            if (!f_error && opt.adaptive.alarm_level != 0 && tracking.alarm_found < 0.0
+                && level_meter.getLiquidLevel() < opt.adaptive.alarm_level){
+                tracking.alarm_found = sim_clock.now() * 1e-6;
+            }
+            if (level_meter.getMode() == Continuous){
+                cont.last = sim_clock.now() * 1e-6;
+                if (cont.count == 0){
+                    cont.first = cont.last;
+                }
+                cont.count++;
+                cont.noise_sum += meas_unit.getLevelNoise() * 0.01;
+            }
+            if (csv_out){
+                fprintf(csv_out, "%.3f,%.2f,%.1f,%d,%c\n", sim_clock.now() * 1e-6, truth, measured,
+                        f_error ? 1 : 0, ModeNames[level_meter.getMode()]);
+            }
+        }
+
+        //  実行できるタスクがなければ、ファームウエアが low_power で眠っている間に時計が進む
+        //  （その間のタイマ割り込みとスイッチ操作は時計が呼ぶ）
+    }
+
+    const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+    if (opt.f_profile){
+        opt.f_serial = true;
+        dump_profile();
+        dump_i2c();
+        dump_power();
+    }
+    //  送信バッファに残っている分を出し切る
+    Serial.flush();
+    uart1.flush();
+
+    printf("simulated %.2f h in %.2f s wall (x%.0f)\n", sim_clock.now() / 3.6e9, wall, sim_clock.now() * 1e-6 / wall);
+    for (uint8_t ch = 0; ch < board.getChannelCount(); ch++){
+        const ErrorStats& s = channel_stats[ch];
+        if (ch == 0){
+            printf("results: %u ok, %u sensor error\n", s.count, s.sensor_errors);
+        } else {
+            printf("channel %u results: %u ok, %u sensor error\n", ch, s.count, s.sensor_errors);
+        }
+        if (s.count > 0){
+            const double mean = s.sum / s.count;
+            printf("  error vs true level [%%]: mean %+.3f  rms %.3f  max %.3f\n",
+                   mean, sqrt(s.sum_sq / s.count), s.max_abs);
+        }
+    }
+    if (tracking.time > 0.0){
+        printf("tracking: mean abs %.3f %%  max %.3f %%  (%.1f shots/day)\n", tracking.sum_abs / tracking.time,
+               tracking.max_abs, single.count * 86400.0 / (sim_clock.now() * 1e-6));
+    }
+    if (tracking.alarm_true >= 0.0){
+        if (tracking.alarm_found >= 0.0){
+            printf("alarm: level below %.1f %% at %.0f s, measured at %.0f s (delay %+.0f s)\n",
+                   opt.adaptive.alarm_level * 0.1, tracking.alarm_true, tracking.alarm_found,
+                   tracking.alarm_found - tracking.alarm_true);
+        } else {
+            printf("alarm: level below %.1f %% at %.0f s, not measured\n", opt.adaptive.alarm_level * 0.1, tracking.alarm_true);
+        }
+    }
+    if (single.count > 0){
+        printf("single shot: %u, average %.3f s  max %.3f s\n", single.count, single.sum / single.count, single.max);
+    }
+    if (cont.count > 1){
+        printf("continuous: %u updates, %.1f /s, estimated noise %.3f %%\n", cont.count,
+               (cont.count - 1) / (cont.last - cont.first), cont.noise_sum / cont.count);
+    }
+    for (uint8_t ch = 0; ch < board.getChannelCount(); ch++){
+        SimChannel& channel = board.getChannel(ch);
+        if (ch != 0){
+            printf("sensor %u", ch);
+        } else {
+            printf("sensor");
+        }
+        printf(": level %.2f %%  heater on %.1f s  heat %.2f J\n",
+               channel.sensor.getLevel(), channel.sensor.getHeaterTime(), channel.sensor.getHeatEnergy());
+    }
+    printf("ADC conversions: %u\n", board.adc.getConversions());
+    for (uint8_t ch = 0; ch < board.getChannelCount(); ch++){
+        //  PGAのゲイン  adsGain_t の PGA[2:0]
+        static const char* const GAIN_NAMES[8] = {"2/3", "1", "2", "4", "8", "16", "16", "16"};
+        const Measurement& measurement = meas_unit.getMeasurement(ch);
+        printf("PGA ch%u: voltage x%s  current x%s  (%u changes)\n", ch,
+               GAIN_NAMES[(measurement.getGain(AdcEngine::CH_DIFF_0_1) >> 9) & 0x7],
+               GAIN_NAMES[(measurement.getGain(AdcEngine::CH_DIFF_2_3) >> 9) & 0x7], measurement.getGainChanges());
+    }
+
+    //  眠っていなかった時間はCPUが動いていたものとする（setup() を含む）
+    const double total_s = sim_clock.now() * 1e-6;
+    const double idle_s = low_power.getIdleTime() * 1e-6;
+    const double stop_s = low_power.getStopTime() * 1e-6;
+    const double run_s = fmax(total_s - idle_s - stop_s, 0.0);
+    printf("CPU: run %.1f s (%.3f %%)  sleep %.1f s  stop %.1f s  (%u stops, %u woken by switch/UART)\n",
+           run_s, run_s * 100.0 / total_s, idle_s, stop_s, low_power.getStops(), low_power.getWakeups());
+    printf("  MCU current (model): average %.3f mA\n",
+           (run_s * MCU_RUN_CURRENT + idle_s * MCU_SLEEP_CURRENT + stop_s * MCU_STOP_CURRENT) / total_s);
+
+    printf("I2C (clock changes %u):\n", Wire.getClockChanges());
+    const uint8_t addresses[] = {SIM_ADDR_ADC, SIM_ADDR_V_MON, SIM_ADDR_CURRENT_ADJ, SIM_ADDR_PIO,
+                                 SIM_ADDR_FRAM, SIM_ADDR_LCD, SIM_ADDR_LCD_RGB};
+    std::vector<uint8_t> devices(std::begin(addresses), std::end(addresses));
+    for (uint8_t ch = 1; ch < board.getChannelCount(); ch++){
+        devices.insert(devices.end(), std::begin(SIM_ADDR_CHANNEL[ch]), std::end(SIM_ADDR_CHANNEL[ch]));
+    }
+    for (uint8_t address : devices){
+        const SimI2cStats& s = Wire.getStats(address);
+        printf("  0x%02X: %8u transactions %9u bytes %6u nacks %10.3f ms\n",
+               address, s.transactions, s.bytes, s.nacks, s.time_ns * 1e-6);
+    }
+    printf("LCD: %u data, %u commands\n", board.lcd.getDataWrites(), board.lcd.getCommands());
+    printf("UART: gateway %llu bytes (blocked %llu us), debug %llu bytes (blocked %llu us)\n",
+           (unsigned long long)uart1.getTxBytes(), (unsigned long long)uart1.getTxBlocked(),
+           (unsigned long long)Serial.getTxBytes(), (unsigned long long)Serial.getTxBlocked());
+    if (!commands.empty()){
+        printf("commands: %u lines, %u rejected, rx overrun %llu bytes\n", uart1.getCommand().getLines(),
+               uart1.getCommand().getErrors(), (unsigned long long)uart1.getRxOverrun());
+    }
+
+    //  終了時のデストラクタの出力は捨てる
+    Serial.setSink(nullptr);
+    uart1.setSink(nullptr);
+    if (uart_out){
+        fclose(uart_out);
+    }
+    if (csv_out){
+        fclose(csv_out);
+    }
+    if (i2c_trace_out){
+        Wire.setTrace(nullptr);
+        fclose(i2c_trace_out);
+    }
+    return 0;
+}
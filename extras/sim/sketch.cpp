@@ -0,0 +1,92 @@
+/**************************************************************************/
+/*!
+    @file     sketch.cpp
+    @author   Masa
+
+        Builds the firmware sketch (*.ino) as one translation unit for the host,
+        the same way the Arduino builder does
+
+        Arduino の IDE は EH900_main.ino を先頭に、残りの .ino をファイル名の順に
+        つなげて1つのファイルとしてコンパイルし、関数のプロトタイプを自動で補う.
+        ここでは同じ順にインクルードし、プロトタイプは手で書いておく.
+        EH900_main.ino に関数を足した時は、ここにもプロトタイプを足すこと.
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include <Arduino.h>
+#include "../../CommandParser.h"
+#include "../../AdaptiveTimer.h"
+#include "../../AdcEngine.h"
+#include "../../LevelEstimator.h"
+
+void setup(void);
+void loop(void);
+void sleep_until_next(void);
+boolean can_stop(void);
+uint32_t time_to_timer_event(void);
+void update_timer_elapsed(void);
+void task_display(void);
+void task_timer_tick(void);
+void task_measure(void);
+void task_continuous(void);
+void task_uplink(void);
+void task_uart_tx(void);
+void task_command(void);
+void execute_command(const CommandParser& command);
+const char* command_get(const CommandParser& command);
+const char* command_set(const CommandParser& command);
+const char* command_meas(const CommandParser& command);
+const char* command_mode(const CommandParser& command);
+const char* command_hist(const CommandParser& command);
+int8_t find_adaptive_param(const char* name);
+int32_t get_adaptive_param(const AdaptiveConfig& config, int8_t index);
+void set_adaptive_param(AdaptiveConfig& config, int8_t index, uint16_t value);
+int8_t find_estimator_param(const char* name);
+int32_t get_estimator_param(const EstimatorConfig& config, int8_t index);
+void set_estimator_param(EstimatorConfig& config, int8_t index, uint16_t value);
+int8_t find_stream_param(const char* name);
+int32_t get_stream_param(const AdcStreamConfig& config, int8_t index);
+void set_stream_param(AdcStreamConfig& config, int8_t index, uint16_t value);
+int8_t find_param_name(const char* name, const char* const names[], uint8_t count);
+boolean command_channel(const CommandParser& command, uint8_t index, uint8_t& ch);
+boolean command_busy(void);
+void begin_command_reply(const char* verb, uint8_t ch);
+void send_command_reply(void);
+void reply_command_error(const char* verb, const char* reason);
+void task_switch(void);
+void start_continuous(void);
+void update_continuous_start(void);
+void configure_continuous(void);
+void stop_continuous(void);
+void begin_manual_meas(void);
+void start_meas_single(void);
+void finish_meas_single(void);
+void configure_adaptive_timer(void);
+void update_adaptive_timer(void);
+uint16_t adaptive_interval(void);
+boolean submit_status(void);
+boolean submit_channel_status(uint8_t ch);
+uint8_t telemetry_flags(uint8_t ch);
+void record_history(boolean f_delivered);
+void drain_history(uint16_t max_records);
+void drain_trace(void);
+void dispatch_events(void);
+void isr_warpper_meas_sw(void);
+void isr_disp_update(void);
+uint32_t dwt_cycles(void);
+void probe_memory(uint32_t& stack, uint32_t& heap);
+void check_debug_command(void);
+void dump_profile(void);
+void dump_i2c(void);
+void dump_power(void);
+void iinfo(uint8_t mode);
+
+#include "../../EH900_main.ino"
+#include "../../display_class.ino"
+#include "../../eh900_class.ino"
+#include "../../eh900_config.ino"
+#include "../../measurement.ino"
+#include "../../scheduler_class.ino"
+#include "../../switch_class.ino"
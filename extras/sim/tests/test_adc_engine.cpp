@@ -0,0 +1,260 @@
+/**************************************************************************/
+/*!
+    @file     test_adc_engine.cpp
+    @author   Masa
+
+        AdcEngine on the ADS1115 model: conversion sequences, streaming,
+        conversion timeouts and bus errors
+
+        ADS1115 のモデル（Ads1115Model）を共有I2Cバスにつなぎ、仮想時計を進めながら poll() を呼ぶ.
+        入力の電圧はテストで決め、変換したチャネルの順番を記録して確かめる.
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include <vector>
+
+#include <Arduino.h>
+#include "SimClock.h"
+#include "SimDevices.h"
+#include "SimTest.h"
+#include "AdcEngine.h"
+
+namespace{
+    //  poll() を呼ぶ周期 [us]（task_measure と同じ）
+    constexpr uint32_t POLL_PERIOD = 1000;
+    //  シーケンスを待つ上限 [us]
+    constexpr uint64_t SEQUENCE_LIMIT = 2000000;
+
+    //  入力の電圧 [V]  差動 0-1（センサ電圧）と 2-3（センサ電流）
+    double voltage_input = 0.5;
+    double current_input = 1.0;
+    //  変換したチャネル（MUX[2:0]）の順番
+    std::vector<uint8_t> mux_log;
+
+    Ads1115Model adc([](uint8_t mux){
+        mux_log.push_back(mux);
+        return (mux == 0) ? voltage_input : current_input;
+    });
+    AdcEngine engine;
+
+    constexpr uint8_t MUX_DIFF_0_1 = 0;
+    constexpr uint8_t MUX_DIFF_2_3 = 3;
+
+    //  前のテストの状態を消す
+    void reset(void){
+        engine.stop();
+        engine.release();
+        engine.setStreaming(false);
+        engine.setGain(GAIN_TWO);
+        engine.setDataRate(AdcEngine::RATE_128SPS);
+        adc.setStalled(false);
+        adc.setOffline(false);
+        voltage_input = 0.5;
+        current_input = 1.0;
+        mux_log.clear();
+    }
+
+    //  シーケンスが終わる（完了かエラー）まで poll() を呼ぶ  かかった時間 [us] を返す
+    uint64_t run_sequence(void){
+        const uint64_t start = sim_clock.now();
+        while (engine.isBusy() && sim_clock.now() - start < SEQUENCE_LIMIT){
+            sim_clock.advance(POLL_PERIOD);
+            engine.poll();
+        }
+        return sim_clock.now() - start;
+    }
+
+    //  ADS1115 へのI2Cの転送回数
+    uint32_t adc_transactions(void){
+        return Wire.getStats(ADS1115_I2CADDR_DEFAULT).transactions;
+    }
+
+    /*------------------------------------------------------------------------*/
+
+    //  ブロック: 電流を10回 -> 電圧を10回  0.5V / 1.0V は GAIN_TWO（±2.048V）で 8000 / 16000 LSB
+    void block_sequence(void){
+        reset();
+        const uint32_t conversions = adc.getConversions();
+        SIM_CHECK(engine.start(10, AdcEngine::SEQ_BLOCK));
+        const uint64_t elapsed = run_sequence();
+
+        SIM_CHECK_EQ(engine.getState(), AdcEngine::STATE_COMPLETE);
+        SIM_CHECK_EQ(engine.getCount(AdcEngine::CH_DIFF_2_3), 10);
+        SIM_CHECK_EQ(engine.getCount(AdcEngine::CH_DIFF_0_1), 10);
+        SIM_CHECK_EQ(engine.getSum(AdcEngine::CH_DIFF_2_3), 160000);
+        SIM_CHECK_EQ(engine.getSum(AdcEngine::CH_DIFF_0_1), 80000);
+        SIM_CHECK_EQ(adc.getConversions() - conversions, 20);
+
+        SIM_CHECK_EQ(mux_log.size(), 20);
+        for (size_t i = 0; i < mux_log.size(); i++){
+            SIM_CHECK_EQ(mux_log[i], (i < 10) ? MUX_DIFF_2_3 : MUX_DIFF_0_1);
+        }
+        //  20回の変換時間より長く、見積りより短い
+        SIM_CHECK(elapsed >= 20 * 1000000ULL / 128);
+        SIM_CHECK(elapsed <= AdcEngine::getSequenceTime(AdcEngine::RATE_128SPS, false, 10, POLL_PERIOD));
+    }
+
+    //  交互: 電流 -> 電圧 を6組
+    void interleaved_sequence(void){
+        reset();
+        SIM_CHECK(engine.start(6, AdcEngine::SEQ_INTERLEAVED));
+        run_sequence();
+
+        SIM_CHECK_EQ(engine.getState(), AdcEngine::STATE_COMPLETE);
+        SIM_CHECK_EQ(engine.getCount(AdcEngine::CH_DIFF_2_3), 6);
+        SIM_CHECK_EQ(engine.getCount(AdcEngine::CH_DIFF_0_1), 6);
+        SIM_CHECK_EQ(mux_log.size(), 12);
+        for (size_t i = 0; i < mux_log.size(); i++){
+            SIM_CHECK_EQ(mux_log[i], (i % 2 == 0) ? MUX_DIFF_2_3 : MUX_DIFF_0_1);
+        }
+    }
+
+    //  リングバッファより多いサンプル  合計は全部, 読めるのは新しい方から ADC_RING_SIZE 個
+    void ring_keeps_latest(void){
+        reset();
+        SIM_CHECK(engine.start(ADC_RING_SIZE + 4, AdcEngine::SEQ_INTERLEAVED));
+        //  電圧を1組ごとに 1mV（16LSB）ずつ上げる
+        uint32_t pairs = 0;
+        while (engine.isBusy()){
+            voltage_input = 0.5 + 0.001 * (mux_log.size() / 2);
+            sim_clock.advance(POLL_PERIOD);
+            engine.poll();
+            pairs = mux_log.size() / 2;
+        }
+        SIM_CHECK_EQ(pairs, ADC_RING_SIZE + 4);
+        SIM_CHECK_EQ(engine.getCount(AdcEngine::CH_DIFF_0_1), ADC_RING_SIZE + 4);
+        SIM_CHECK_EQ(engine.getSample(AdcEngine::CH_DIFF_0_1, 0), 8000 + 16 * 4);
+        SIM_CHECK_EQ(engine.getSample(AdcEngine::CH_DIFF_0_1, ADC_RING_SIZE - 1), 8000 + 16 * (ADC_RING_SIZE + 3));
+        SIM_CHECK_EQ(engine.getSample(AdcEngine::CH_DIFF_0_1, ADC_RING_SIZE), 0);
+    }
+
+    //  入力ごとのゲインと振り切れ  3V は GAIN_TWO で振り切れ、GAIN_ONE（±4.096V）なら 24000 LSB
+    void gain_and_peak(void){
+        reset();
+        voltage_input = 3.0;
+        current_input = -1.0;
+        SIM_CHECK(engine.start(2, AdcEngine::SEQ_INTERLEAVED));
+        run_sequence();
+        SIM_CHECK_EQ(engine.getPeak(AdcEngine::CH_DIFF_0_1), 32767);
+        SIM_CHECK_EQ(engine.getPeak(AdcEngine::CH_DIFF_2_3), 16000);
+        engine.release();
+
+        engine.setGain(AdcEngine::CH_DIFF_0_1, GAIN_ONE);
+        SIM_CHECK(engine.start(2, AdcEngine::SEQ_INTERLEAVED));
+        run_sequence();
+        SIM_CHECK_EQ(engine.getPeak(AdcEngine::CH_DIFF_0_1), 24000);
+        SIM_CHECK_EQ(engine.getSum(AdcEngine::CH_DIFF_2_3), -32000);
+        SIM_CHECK_EQ(engine.getGain(AdcEngine::CH_DIFF_2_3), GAIN_TWO);
+    }
+
+    //  ストリーミング: チャネルが変わる時だけ CONFIG を書き、完了の確認もしない
+    //  stop() で ADS1115 はパワーダウンして変換をやめる
+    void streaming(void){
+        reset();
+        uint32_t transactions = adc_transactions();
+        SIM_CHECK(engine.start(10, AdcEngine::SEQ_BLOCK));
+        run_sequence();
+        const uint32_t single_shot = adc_transactions() - transactions;
+
+        engine.release();
+        engine.setStreaming(true);
+        transactions = adc_transactions();
+        SIM_CHECK(engine.start(10, AdcEngine::SEQ_BLOCK));
+        run_sequence();
+        const uint32_t streamed = adc_transactions() - transactions;
+
+        SIM_CHECK_EQ(engine.getState(), AdcEngine::STATE_COMPLETE);
+        SIM_CHECK_EQ(engine.getSum(AdcEngine::CH_DIFF_2_3), 160000);
+        SIM_CHECK_EQ(engine.getSum(AdcEngine::CH_DIFF_0_1), 80000);
+        SIM_CHECK(streamed < single_shot);
+
+        engine.stop();
+        const uint32_t conversions = adc.getConversions();
+        sim_clock.advance(100000);
+        engine.poll();
+        SIM_CHECK_EQ(adc.getConversions(), conversions);
+        SIM_CHECK_EQ(engine.getState(), AdcEngine::STATE_IDLE);
+    }
+
+    //  変換が終わらない  タイムアウト（50ms）でエラーになり、直れば次のシーケンスは完了する
+    void conversion_timeout(void){
+        reset();
+        adc.setStalled(true);
+        SIM_CHECK(engine.start(4, AdcEngine::SEQ_BLOCK));
+        const uint64_t elapsed = run_sequence();
+
+        SIM_CHECK_EQ(engine.getState(), AdcEngine::STATE_ERROR);
+        SIM_CHECK(engine.hasError());
+        SIM_CHECK_EQ(engine.getCount(AdcEngine::CH_DIFF_2_3), 0);
+        SIM_CHECK(elapsed >= 50000);
+        SIM_CHECK(elapsed <= 50000 + 2 * POLL_PERIOD);
+
+        adc.setStalled(false);
+        engine.release();
+        SIM_CHECK(engine.start(4, AdcEngine::SEQ_BLOCK));
+        run_sequence();
+        SIM_CHECK_EQ(engine.getState(), AdcEngine::STATE_COMPLETE);
+    }
+
+    //  ADS1115 が応答しない（NACK）  最初の poll() で、もしくはシーケンスの途中でエラーになる
+    void bus_error(void){
+        reset();
+        adc.setOffline(true);
+        SIM_CHECK(engine.start(4, AdcEngine::SEQ_BLOCK));
+        sim_clock.advance(POLL_PERIOD);
+        SIM_CHECK_EQ(engine.poll(), AdcEngine::STATE_ERROR);
+        SIM_CHECK(!engine.isBusy());
+
+        adc.setOffline(false);
+        engine.release();
+        SIM_CHECK(engine.start(4, AdcEngine::SEQ_BLOCK));
+        while (engine.isBusy() && engine.getCount(AdcEngine::CH_DIFF_2_3) < 2){
+            sim_clock.advance(POLL_PERIOD);
+            engine.poll();
+        }
+        adc.setOffline(true);
+        run_sequence();
+        SIM_CHECK_EQ(engine.getState(), AdcEngine::STATE_ERROR);
+        SIM_CHECK_EQ(engine.getCount(AdcEngine::CH_DIFF_2_3), 2);
+
+        adc.setOffline(false);
+        engine.release();
+        SIM_CHECK(engine.start(4, AdcEngine::SEQ_BLOCK));
+        run_sequence();
+        SIM_CHECK_EQ(engine.getState(), AdcEngine::STATE_COMPLETE);
+    }
+
+    //  変換中とサンプル数0は開始しない
+    void start_rejected(void){
+        reset();
+        SIM_CHECK(!engine.start(0, AdcEngine::SEQ_BLOCK));
+        SIM_CHECK(engine.start(4, AdcEngine::SEQ_BLOCK));
+        SIM_CHECK(!engine.start(4, AdcEngine::SEQ_INTERLEAVED));
+        SIM_CHECK_EQ(engine.getSequence(), AdcEngine::SEQ_BLOCK);
+        run_sequence();
+        //  完了したまま（release() 前）でも次を開始できる
+        SIM_CHECK(engine.start(4, AdcEngine::SEQ_INTERLEAVED));
+        run_sequence();
+        SIM_CHECK_EQ(engine.getState(), AdcEngine::STATE_COMPLETE);
+    }
+}
+
+int main(void){
+    Wire.attach(ADS1115_I2CADDR_DEFAULT, &adc);
+    if (!SIM_CHECK(engine.begin(ADS1115_I2CADDR_DEFAULT, &i2c_bus))){
+        return simTestResult();
+    }
+    i2c_bus.start();
+
+    SIM_RUN(block_sequence);
+    SIM_RUN(interleaved_sequence);
+    SIM_RUN(ring_keeps_latest);
+    SIM_RUN(gain_and_peak);
+    SIM_RUN(streaming);
+    SIM_RUN(conversion_timeout);
+    SIM_RUN(bus_error);
+    SIM_RUN(start_rejected);
+    return simTestResult();
+}
@@ -0,0 +1,180 @@
+/**************************************************************************/
+/*!
+    @file     test_command_parser.cpp
+    @author   Masa
+
+        CommandParser: line assembly, tokens and recovery from bad lines
+
+        IoTゲートウエイから届くバイトを1つずつ feed() に渡し、結果と取り出したトークンを確かめる.
+            行が feed() の途中で切れて届いても1行になる  CR / LF / CRLF のどれでも1行
+            コマンド・引数・整数（getVerb / getArg / getNumber）  英字は小文字にそろえる
+            COMMAND_LINE_MAX を超える行は COMMAND_OVERFLOW  ちょうどの長さは読める
+            制御文字・8bitの文字・COMMAND_ARG_MAX を超える引数は COMMAND_MALFORMED
+        捨てた行の後も次の改行で同期し直し、続く行が読めることも確かめる.
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+#include "SimTest.h"
+
+#include "CommandParser.h"
+
+namespace{
+    CommandParser parser;
+
+    //  text を1バイトずつ渡し、COMMAND_PENDING 以外の結果を順に返す
+    std::vector<CommandParser::Status> feed(const std::string& text){
+        std::vector<CommandParser::Status> results;
+        for (const char c : text){
+            const CommandParser::Status status = parser.feed((uint8_t)c);
+            if (status != CommandParser::COMMAND_PENDING){
+                results.push_back(status);
+            }
+        }
+        return results;
+    }
+
+    //  text がちょうど1行になるか
+    bool ready(const std::string& text){
+        const std::vector<CommandParser::Status> results = feed(text);
+        return results.size() == 1 && results[0] == CommandParser::COMMAND_READY;
+    }
+
+    //  text がちょうど1つの status で捨てられるか
+    bool rejected(const std::string& text, CommandParser::Status status){
+        const std::vector<CommandParser::Status> results = feed(text);
+        return results.size() == 1 && results[0] == status;
+    }
+
+    //  行が feed() の途中で切れて届いても、改行までが1行になる
+    void split_across_feeds(void){
+        parser.reset();
+        SIM_CHECK(feed("se").empty());
+        SIM_CHECK(parser.isReceiving());
+        SIM_CHECK(feed("t per").empty());
+        SIM_CHECK(feed("iod 6").empty());
+        SIM_CHECK(ready("00\n"));
+        SIM_CHECK(!parser.isReceiving());
+        SIM_CHECK(strcmp(parser.getVerb(), "set") == 0);
+        SIM_CHECK(strcmp(parser.getArg(0), "period") == 0);
+        SIM_CHECK(strcmp(parser.getArg(1), "600") == 0);
+    }
+
+    //  コマンド・引数・整数  空白・タブが続いても1つの区切り
+    void tokens_and_numbers(void){
+        parser.reset();
+        SIM_CHECK(ready("  set\tlength   -25  x1\n"));
+        SIM_CHECK(strcmp(parser.getVerb(), "set") == 0);
+        SIM_CHECK_EQ(parser.getArgCount(), 3);
+        SIM_CHECK(strcmp(parser.getArg(0), "length") == 0);
+        SIM_CHECK(parser.getArg(3) == nullptr);
+
+        int32_t value = 0;
+        SIM_CHECK(parser.getNumber(1, value));
+        SIM_CHECK_EQ(value, -25);
+        //  整数でない引数・ない引数は読めず、値は変えない
+        SIM_CHECK(!parser.getNumber(0, value));
+        SIM_CHECK(!parser.getNumber(2, value));
+        SIM_CHECK(!parser.getNumber(3, value));
+        SIM_CHECK_EQ(value, -25);
+
+        //  引数のないコマンド
+        SIM_CHECK(ready("meas\n"));
+        SIM_CHECK(strcmp(parser.getVerb(), "meas") == 0);
+        SIM_CHECK_EQ(parser.getArgCount(), 0);
+        SIM_CHECK(parser.getArg(0) == nullptr);
+    }
+
+    //  CR / LF / CRLF のどれでも1行  CRLF の LF と空行は何も返さない  英字は小文字にそろえる
+    void line_endings_and_case(void){
+        parser.reset();
+        const uint32_t lines = parser.getLines();
+        SIM_CHECK(ready("GET Level 1\r\n"));
+        SIM_CHECK(strcmp(parser.getVerb(), "get") == 0);
+        SIM_CHECK(strcmp(parser.getArg(0), "level") == 0);
+        SIM_CHECK(ready("Mode C\r"));
+        SIM_CHECK(strcmp(parser.getArg(0), "c") == 0);
+        SIM_CHECK(ready("hist\n"));
+        SIM_CHECK(feed("\r\n\n  \r\n").empty());
+        SIM_CHECK_EQ(parser.getLines() - lines, 3);
+        SIM_CHECK(!parser.isReceiving());
+    }
+
+    //  COMMAND_LINE_MAX ちょうどの行は読める  1文字でも長ければ改行まで捨てる
+    void overflow_at_line_max(void){
+        parser.reset();
+        const std::string longest = "set format " + std::string(COMMAND_LINE_MAX - 11, '1');
+        SIM_CHECK_EQ(longest.size(), COMMAND_LINE_MAX);
+        SIM_CHECK(ready(longest + "\n"));
+        SIM_CHECK_EQ(strlen(parser.getArg(1)), COMMAND_LINE_MAX - 11);
+
+        const uint32_t errors = parser.getErrors();
+        SIM_CHECK(rejected(longest + "2\n", CommandParser::COMMAND_OVERFLOW));
+        SIM_CHECK(rejected(std::string(COMMAND_LINE_MAX * 3, 'a') + "\r\n", CommandParser::COMMAND_OVERFLOW));
+        SIM_CHECK_EQ(parser.getErrors() - errors, 2);
+    }
+
+    //  制御文字（タブを除く）・0x7F 以上を含む行は捨てる
+    void control_and_8bit_bytes(void){
+        parser.reset();
+        const uint32_t errors = parser.getErrors();
+        SIM_CHECK(rejected(std::string("get le\x01vel\n"), CommandParser::COMMAND_MALFORMED));
+        SIM_CHECK(rejected(std::string("get level\x7F\n"), CommandParser::COMMAND_MALFORMED));
+        SIM_CHECK(rejected(std::string("get \xE6\xB6\xB2\xE9\x9D\xA2\n"), CommandParser::COMMAND_MALFORMED));
+        SIM_CHECK(rejected(std::string("\x00\n", 2), CommandParser::COMMAND_MALFORMED));
+        SIM_CHECK_EQ(parser.getErrors() - errors, 4);
+    }
+
+    //  COMMAND_ARG_MAX までの引数は読める  超えた行は捨てる
+    void too_many_arguments(void){
+        parser.reset();
+        std::string line = "set";
+        for (uint8_t i = 0; i < COMMAND_ARG_MAX; i++){
+            line += " " + std::to_string(i);
+        }
+        SIM_CHECK(ready(line + "\n"));
+        SIM_CHECK_EQ(parser.getArgCount(), COMMAND_ARG_MAX);
+        SIM_CHECK(rejected(line + " 9\n", CommandParser::COMMAND_MALFORMED));
+        SIM_CHECK_EQ(parser.getArgCount(), 0);
+        SIM_CHECK(strcmp(parser.getVerb(), "") == 0);
+    }
+
+    //  捨てた行の後は次の改行で同期し直し、続く行を読む
+    void resync_after_bad_line(void){
+        parser.reset();
+        const std::vector<CommandParser::Status> results =
+            feed(std::string("ge\x02t level\r\n") + std::string(COMMAND_LINE_MAX + 5, 'x') + "\nmeas\n");
+        SIM_CHECK_EQ(results.size(), 3);
+        if (results.size() == 3){
+            SIM_CHECK_EQ(results[0], CommandParser::COMMAND_MALFORMED);
+            SIM_CHECK_EQ(results[1], CommandParser::COMMAND_OVERFLOW);
+            SIM_CHECK_EQ(results[2], CommandParser::COMMAND_READY);
+        }
+        SIM_CHECK(strcmp(parser.getVerb(), "meas") == 0);
+
+        //  reset() は受け取りかけの行を捨てる（その行の不正な文字も忘れる）
+        SIM_CHECK(feed("get \x03").empty());
+        SIM_CHECK(parser.isReceiving());
+        parser.reset();
+        SIM_CHECK(!parser.isReceiving());
+        SIM_CHECK(ready("get period\n"));
+        SIM_CHECK(strcmp(parser.getArg(0), "period") == 0);
+    }
+}
+
+int main(void){
+    SIM_RUN(split_across_feeds);
+    SIM_RUN(tokens_and_numbers);
+    SIM_RUN(line_endings_and_case);
+    SIM_RUN(overflow_at_line_max);
+    SIM_RUN(control_and_8bit_bytes);
+    SIM_RUN(too_many_arguments);
+    SIM_RUN(resync_after_bad_line);
+    return simTestResult();
+}
@@ -0,0 +1,280 @@
+/**************************************************************************/
+/*!
+    @file     test_history_log.cpp
+    @author   Masa
+
+        HistoryLog on the simulated FRAM: append, wrap-around and power-loss recovery
+
+        ファームウエアと同じ FramStorage（共有I2Cバス）で FramModel に循環ログを置き、
+        追記・一杯の時の上書き・未送信の数を確かめる.
+        電源断は FramModel の中身を書き換えて作る.
+            書きかけのスロット  スロットの途中までしか書けずに切れた  取り込まない
+            書きかけのヘッダ    ヘッダが壊れた  空のログにする
+            ヘッダの更新前      スロットは書けたがヘッダが古い  seq の続くスロットを取り込む
+        どの場合も begin() の後の head / count / unsent と、続けて追記した記録が正しいことを確かめる.
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include <string.h>
+#include <vector>
+
+#include <Arduino.h>
+#include "SimClock.h"
+#include "SimDevices.h"
+#include "SimTest.h"
+
+#include "eh900_class.h"
+#include "HistoryLog.h"
+
+namespace{
+    //  FRAMのアドレスとログの領域（容量8件）
+    constexpr uint8_t FRAM_ADDRESS = 0x50;
+    constexpr uint16_t LOG_BASE = 0x0200;
+    constexpr uint16_t LOG_CAPACITY = 8;
+    constexpr uint16_t LOG_AREA = HISTORY_HEADER_SIZE + HISTORY_SLOT_SIZE * LOG_CAPACITY;
+
+    FramModel fram;
+    FramStorage storage(&i2c_bus);
+
+    //  FRAMの中身を直接読み書きする前に、キューに入っている書き込みを終える
+    std::vector<uint8_t>& memory(void){
+        i2c_bus.flush();
+        return fram.contents();
+    }
+
+    //  ログの領域を 0xFF で埋めて（消去済みのFRAMに似せる）、新しいログを始める
+    void erase(void){
+        std::vector<uint8_t>& mem = memory();
+        memset(&mem[LOG_BASE], 0xFF, LOG_AREA);
+    }
+
+    //  起動し直す  新しい HistoryLog で begin()
+    uint16_t reboot(HistoryLog& log){
+        return log.begin(LOG_BASE, LOG_AREA);
+    }
+
+    HistoryRecord make_record(uint16_t level){
+        HistoryRecord record = {};
+        record.timestamp = 1000u + level;
+        record.liquid_level = level;
+        record.raw_voltage = (int16_t)(level * 3);
+        record.raw_current = -(int16_t)level;
+        record.flags = level & 0x07;
+        return record;
+    }
+
+    //  ヘッダ・スロットのアドレス
+    uint16_t slot_addr(uint16_t slot){
+        return LOG_BASE + HISTORY_HEADER_SIZE + slot * HISTORY_SLOT_SIZE;
+    }
+
+    std::vector<uint8_t> save_header(void){
+        std::vector<uint8_t>& mem = memory();
+        return std::vector<uint8_t>(mem.begin() + LOG_BASE, mem.begin() + LOG_BASE + HISTORY_HEADER_SIZE);
+    }
+
+    void restore_header(const std::vector<uint8_t>& header){
+        std::vector<uint8_t>& mem = memory();
+        memcpy(&mem[LOG_BASE], header.data(), header.size());
+    }
+
+    //  古い方から新しい方へ、最近の記録の seq が first から続いているか
+    bool seq_continues(HistoryLog& log, uint16_t first){
+        for (uint16_t i = 0; i < log.getCount(); i++){
+            HistoryRecord record;
+            if (!log.readRecent(log.getCount() - 1 - i, record) || record.seq != (uint16_t)(first + i)){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //  空のFRAMから始めて追記する  内容・seq・未送信の数
+    void append_and_read(void){
+        erase();
+        HistoryLog log(&storage);
+        SIM_CHECK_EQ(reboot(log), 0);
+        SIM_CHECK_EQ(log.getCapacity(), LOG_CAPACITY);
+
+        for (uint16_t i = 0; i < 5; i++){
+            HistoryRecord record = make_record(100 + i);
+            SIM_CHECK(log.append(record, i < 2));
+            SIM_CHECK_EQ(record.seq, i);
+        }
+        SIM_CHECK_EQ(log.getCount(), 5);
+        //  送れた2件の後の3件が未送信
+        SIM_CHECK_EQ(log.getUnsent(), 3);
+
+        HistoryRecord record;
+        SIM_CHECK(log.readRecent(0, record));
+        SIM_CHECK_EQ(record.seq, 4);
+        SIM_CHECK_EQ(record.liquid_level, 104);
+        SIM_CHECK_EQ(record.raw_current, -104);
+        SIM_CHECK(log.readUnsent(0, record));
+        SIM_CHECK_EQ(record.seq, 2);
+        SIM_CHECK(!log.readUnsent(3, record));
+
+        //  未送信が残っている間は、送れた記録も未送信として数える（順番に送り直す）
+        HistoryRecord delivered = make_record(200);
+        SIM_CHECK(log.append(delivered, true));
+        SIM_CHECK_EQ(log.getUnsent(), 4);
+
+        //  送信済みにした分は起動し直しても戻らない
+        log.acknowledge(3);
+        SIM_CHECK_EQ(log.getUnsent(), 1);
+        HistoryLog rebooted(&storage);
+        SIM_CHECK_EQ(reboot(rebooted), 6);
+        SIM_CHECK_EQ(rebooted.getUnsent(), 1);
+        SIM_CHECK(rebooted.readUnsent(0, record));
+        SIM_CHECK_EQ(record.seq, 5);
+        SIM_CHECK(seq_continues(rebooted, 0));
+    }
+
+    //  一杯になったら一番古い記録を上書きする  未送信は残っている記録の数まで
+    void wrap_around(void){
+        erase();
+        HistoryLog log(&storage);
+        reboot(log);
+        for (uint16_t i = 0; i < 20; i++){
+            HistoryRecord record = make_record(i);
+            SIM_CHECK(log.append(record, false));
+        }
+        SIM_CHECK_EQ(log.getCount(), LOG_CAPACITY);
+        SIM_CHECK_EQ(log.getUnsent(), LOG_CAPACITY);
+        SIM_CHECK(seq_continues(log, 20 - LOG_CAPACITY));
+        HistoryRecord record;
+        SIM_CHECK(log.readUnsent(0, record));
+        SIM_CHECK_EQ(record.seq, 20 - LOG_CAPACITY);
+
+        //  次に書くスロットには1周前の記録が残っているが、seq が続かないので取り込まない
+        HistoryLog rebooted(&storage);
+        SIM_CHECK_EQ(reboot(rebooted), LOG_CAPACITY);
+        SIM_CHECK(seq_continues(rebooted, 20 - LOG_CAPACITY));
+        HistoryRecord next = make_record(99);
+        SIM_CHECK(rebooted.append(next, false));
+        SIM_CHECK_EQ(next.seq, 20);
+    }
+
+    //  スロットを書いた後、ヘッダを書く前に切れた  seq の続くスロットを取り込んで未送信にする
+    void recover_by_seq(void){
+        erase();
+        HistoryLog log(&storage);
+        reboot(log);
+        for (uint16_t i = 0; i < 3; i++){
+            HistoryRecord record = make_record(i);
+            log.append(record, true);
+        }
+        const std::vector<uint8_t> header = save_header();
+        for (uint16_t i = 3; i < 6; i++){
+            HistoryRecord record = make_record(i);
+            log.append(record, true);
+        }
+        restore_header(header);
+
+        HistoryLog rebooted(&storage);
+        SIM_CHECK_EQ(reboot(rebooted), 6);
+        SIM_CHECK(seq_continues(rebooted, 0));
+        //  取り込んだ3件は送れたかわからないので未送信
+        SIM_CHECK_EQ(rebooted.getUnsent(), 3);
+        HistoryRecord record;
+        SIM_CHECK(rebooted.readUnsent(0, record));
+        SIM_CHECK_EQ(record.seq, 3);
+        SIM_CHECK_EQ(record.liquid_level, 3);
+
+        //  取り込んだ結果はヘッダに書いてある  もう一度起動しても同じ
+        HistoryLog again(&storage);
+        SIM_CHECK_EQ(reboot(again), 6);
+        SIM_CHECK_EQ(again.getUnsent(), 3);
+        HistoryRecord next = make_record(50);
+        SIM_CHECK(again.append(next, false));
+        SIM_CHECK_EQ(next.seq, 6);
+    }
+
+    //  スロットの途中で切れた（CRCが合わない）  取り込まず、そのスロットから書き直す
+    void torn_slot(void){
+        erase();
+        HistoryLog log(&storage);
+        reboot(log);
+        for (uint16_t i = 0; i < 4; i++){
+            HistoryRecord record = make_record(i);
+            log.append(record, true);
+        }
+        const std::vector<uint8_t> header = save_header();
+        std::vector<uint8_t>& mem = memory();
+        const std::vector<uint8_t> before(mem.begin() + slot_addr(4), mem.begin() + slot_addr(5));
+        HistoryRecord record = make_record(4);
+        log.append(record, true);
+        //  新しいスロットの前半だけが書けた
+        std::vector<uint8_t>& torn = memory();
+        memcpy(&torn[slot_addr(4) + HISTORY_SLOT_SIZE / 2], &before[HISTORY_SLOT_SIZE / 2], HISTORY_SLOT_SIZE / 2);
+        restore_header(header);
+
+        HistoryLog rebooted(&storage);
+        SIM_CHECK_EQ(reboot(rebooted), 4);
+        SIM_CHECK_EQ(rebooted.getUnsent(), 0);
+        SIM_CHECK(seq_continues(rebooted, 0));
+
+        HistoryRecord next = make_record(40);
+        SIM_CHECK(rebooted.append(next, false));
+        SIM_CHECK_EQ(next.seq, 4);
+        SIM_CHECK(rebooted.readRecent(0, record));
+        SIM_CHECK_EQ(record.liquid_level, 40);
+        SIM_CHECK_EQ(rebooted.getUnsent(), 1);
+    }
+
+    //  ヘッダの途中で切れた（CRCが合わない）  記録は信用できないので空のログにする
+    void torn_header(void){
+        erase();
+        HistoryLog log(&storage);
+        reboot(log);
+        for (uint16_t i = 0; i < 5; i++){
+            HistoryRecord record = make_record(i);
+            log.append(record, false);
+        }
+        std::vector<uint8_t>& mem = memory();
+        mem[LOG_BASE + 4] ^= 0x01;      //  count の1ビットが化けた
+
+        HistoryLog rebooted(&storage);
+        SIM_CHECK_EQ(reboot(rebooted), 0);
+        SIM_CHECK_EQ(rebooted.getUnsent(), 0);
+        HistoryRecord record;
+        SIM_CHECK(!rebooted.readRecent(0, record));
+
+        //  書き直したヘッダは正しい  最初から追記でき、前のログの seq 1-4 の記録は取り込まない
+        HistoryRecord next = make_record(7);
+        SIM_CHECK(rebooted.append(next, false));
+        SIM_CHECK_EQ(next.seq, 0);
+        HistoryLog again(&storage);
+        SIM_CHECK_EQ(reboot(again), 1);
+        SIM_CHECK_EQ(again.getUnsent(), 1);
+    }
+
+    //  領域の大きさが変わった（ファームウエアの更新）  空のログにする
+    void area_changed(void){
+        erase();
+        HistoryLog log(&storage);
+        reboot(log);
+        HistoryRecord record = make_record(1);
+        log.append(record, false);
+
+        HistoryLog resized(&storage);
+        SIM_CHECK_EQ(resized.begin(LOG_BASE, LOG_AREA - HISTORY_SLOT_SIZE), 0);
+        SIM_CHECK_EQ(resized.getCapacity(), LOG_CAPACITY - 1);
+    }
+}
+
+int main(void){
+    Wire.attach(FRAM_ADDRESS, &fram);
+    storage.begin(FRAM_ADDRESS);
+    i2c_bus.start();
+
+    SIM_RUN(append_and_read);
+    SIM_RUN(wrap_around);
+    SIM_RUN(recover_by_seq);
+    SIM_RUN(torn_slot);
+    SIM_RUN(torn_header);
+    SIM_RUN(area_changed);
+    return simTestResult();
+}
@@ -0,0 +1,262 @@
+/**************************************************************************/
+/*!
+    @file     test_i2c_bus.cpp
+    @author   Masa
+
+        I2cBus request queue on SimI2cPort: ordering, coalescing and waiting
+
+        I2cBus を SimI2cPort（仮想時計で転送時間の後に完了する割り込み転送）の上で動かし、
+        デバイスのモデルに届いた転送の順番と内容を記録して確かめる.
+            キューの順（FIFO）で、デバイスをまたいでも順番どおりに転送・完了する
+            I2C_MERGE_REPLACE  まだ始まっていない同じコマンドのDACの書き込みは最後の値1回になる
+            I2C_MERGE_CONTINUE LCDのカーソル移動に表示データをつなげ、続きが来るか service() まで始めない
+            write() / read()   先に入っている要求が終わってから転送し、終わるまで待つ
+        Wire のライブラリの転送でポートの完了が呼ばれても（実機では同じHALのコールバック）キューが進まないことも確かめる.
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+#include <Wire.h>
+#include "SimClock.h"
+#include "SimTest.h"
+
+#include "I2cBus.h"
+#include "I2cPort.h"
+
+namespace{
+    //  デバイスのアドレス
+    constexpr uint8_t DAC_ADDRESS = 0x60;
+    constexpr uint8_t ADC_ADDRESS = 0x48;
+    constexpr uint8_t LCD_ADDRESS_7BIT = 0x3E;
+
+    //  デバイスに届いた転送  （デバイス名, 向き, データ）
+    struct Transfer {
+        char device;
+        char direction;
+        std::vector<uint8_t> data;
+    };
+    std::vector<Transfer> transfers;
+
+    //  届いた転送を記録するデバイス  読み出しには read_value を返す
+    class RecordingDevice : public SimI2cDevice {
+
+      public:
+        RecordingDevice(char name) : name(name){};
+
+        bool onWrite(const uint8_t* data, size_t length) override {
+          transfers.push_back({name, 'W', std::vector<uint8_t>(data, data + length)});
+          return true;
+        };
+
+        size_t onRead(uint8_t* data, size_t length) override {
+          for (size_t i = 0; i < length; i++){
+            data[i] = read_value + i;
+          }
+          transfers.push_back({name, 'R', std::vector<uint8_t>(data, data + length)});
+          return length;
+        };
+
+        uint8_t read_value = 0x10;
+
+      private:
+        char name;
+    };
+
+    RecordingDevice dac('D');
+    RecordingDevice adc('A');
+    RecordingDevice lcd('L');
+
+    I2cPort port(&Wire);
+    I2cBus bus(&port);
+    int8_t dac_device = -1;
+    int8_t adc_device = -1;
+    int8_t lcd_device = -1;
+
+    //  callback が呼ばれた順
+    std::string completed;
+
+    void on_complete(void* context, bool f_success){
+        completed += *static_cast<const char*>(context);
+        completed += f_success ? "" : "!";
+    }
+
+    //  届いた転送のデバイス名を順に並べる
+    std::string order(void){
+        std::string names;
+        for (const Transfer& transfer : transfers){
+            names += transfer.device;
+        }
+        return names;
+    }
+
+    void reset(void){
+        bus.flush();
+        transfers.clear();
+        completed.clear();
+    }
+
+    //  デバイスをまたいでもキューの順に転送し、callback も同じ順に呼ぶ
+    void fifo_across_devices(void){
+        reset();
+        static const char names[] = "DALD";
+        const uint8_t dac_data[3] = {0x40, 0x12, 0x34};
+        const uint8_t adc_data[3] = {0x01, 0x85, 0x83};
+        const uint8_t lcd_data[2] = {0x40, 'A'};
+        uint8_t result[2] = {};
+
+        SIM_CHECK(bus.submit(dac_device, dac_data, 3, I2C_MERGE_NONE, on_complete, (void*)&names[0]));
+        SIM_CHECK(bus.submitRead(adc_device, adc_data, 1, result, 2, on_complete, (void*)&names[1]));
+        SIM_CHECK(bus.submit(lcd_device, lcd_data, 2, I2C_MERGE_NONE, on_complete, (void*)&names[2]));
+        SIM_CHECK(bus.submit(dac_device, dac_data, 3, I2C_MERGE_NONE, on_complete, (void*)&names[3]));
+        //  最初の要求だけが始まっている
+        SIM_CHECK_EQ(transfers.size(), 1);
+        bus.flush();
+
+        //  ADC はレジスタの書き込みの後にリピートスタートで読む
+        SIM_CHECK(order() == "DAALD");
+        SIM_CHECK_EQ(transfers[2].direction, 'R');
+        SIM_CHECK(completed == "DALD");
+        SIM_CHECK_EQ(result[0], 0x10);
+        SIM_CHECK_EQ(result[1], 0x11);
+        SIM_CHECK(bus.isIdle());
+    }
+
+    //  まだ始まっていないDACの書き込みは、同じコマンドなら最後の値1回にまとめる  違うコマンドはまとめない
+    void replace_collapses_dac_writes(void){
+        reset();
+        const uint32_t merged = bus.getMerged();
+        //  ADC の転送中に DAC の書き込みを入れる
+        const uint8_t adc_data[3] = {0x01, 0x85, 0x83};
+        SIM_CHECK(bus.submit(adc_device, adc_data, 3));
+        for (uint16_t value = 0x100; value <= 0x500; value += 0x100){
+            const uint8_t data[3] = {0x40, (uint8_t)(value >> 8), (uint8_t)(value & 0xFF)};
+            SIM_CHECK(bus.submit(dac_device, data, 3, I2C_MERGE_REPLACE));
+        }
+        const uint8_t other[3] = {0x60, 0x0A, 0xBC};
+        SIM_CHECK(bus.submit(dac_device, other, 3, I2C_MERGE_REPLACE));
+        bus.flush();
+
+        SIM_CHECK(order() == "ADD");
+        SIM_CHECK_EQ(bus.getMerged() - merged, 4);
+        if (transfers.size() == 3){
+            SIM_CHECK(transfers[1].data == std::vector<uint8_t>({0x40, 0x05, 0x00}));
+            SIM_CHECK(transfers[2].data == std::vector<uint8_t>({0x60, 0x0A, 0xBC}));
+        }
+
+        //  転送中の書き込みにはまとめない（もう送っている）
+        reset();
+        const uint8_t first[3] = {0x40, 0x01, 0x00};
+        const uint8_t second[3] = {0x40, 0x02, 0x00};
+        SIM_CHECK(bus.submit(dac_device, first, 3, I2C_MERGE_REPLACE));
+        SIM_CHECK(bus.submit(dac_device, second, 3, I2C_MERGE_REPLACE));
+        bus.flush();
+        SIM_CHECK(order() == "DD");
+    }
+
+    //  カーソル移動（Co=1）に表示データをつなげて1回で送る  続きが来なければ service() まで待つ
+    void continue_appends_lcd_data(void){
+        reset();
+        const uint8_t cursor[2] = {0x80, 0x85};
+        const uint8_t data[3] = {0x40, 'O', 'K'};
+
+        SIM_CHECK(bus.submit(lcd_device, cursor, 2, I2C_MERGE_CONTINUE));
+        //  続きを待っている  時間が経っても送らない
+        sim_clock.advance(1000);
+        SIM_CHECK_EQ(transfers.size(), 0);
+        SIM_CHECK(!bus.isIdle());
+
+        SIM_CHECK(bus.submit(lcd_device, data, 3));
+        bus.flush();
+        SIM_CHECK_EQ(transfers.size(), 1);
+        if (transfers.size() == 1){
+            SIM_CHECK(transfers[0].data == std::vector<uint8_t>({0x80, 0x85, 0x40, 'O', 'K'}));
+        }
+
+        //  続きが来なければ service() で送る
+        reset();
+        SIM_CHECK(bus.submit(lcd_device, cursor, 2, I2C_MERGE_CONTINUE));
+        sim_clock.advance(1000);
+        SIM_CHECK_EQ(transfers.size(), 0);
+        bus.service();
+        SIM_CHECK_EQ(transfers.size(), 1);
+        bus.flush();
+        SIM_CHECK(bus.isIdle());
+
+        //  他のデバイスの書き込みが間に入ればつなげない
+        reset();
+        const uint8_t dac_data[3] = {0x40, 0x12, 0x34};
+        SIM_CHECK(bus.submit(lcd_device, cursor, 2, I2C_MERGE_CONTINUE));
+        SIM_CHECK(bus.submit(dac_device, dac_data, 3));
+        SIM_CHECK(bus.submit(lcd_device, data, 3));
+        bus.flush();
+        SIM_CHECK(order() == "LDL");
+    }
+
+    //  write() / read() は先に入っている要求の後に転送し、終わってから戻る
+    void sync_transfers_wait_behind_queue(void){
+        reset();
+        static const char names[] = "DL";
+        const uint8_t dac_data[3] = {0x40, 0x12, 0x34};
+        const uint8_t lcd_data[2] = {0x40, 'A'};
+        const uint8_t adc_data[3] = {0x01, 0x85, 0x83};
+
+        SIM_CHECK(bus.submit(dac_device, dac_data, 3, I2C_MERGE_NONE, on_complete, (void*)&names[0]));
+        SIM_CHECK(bus.submit(lcd_device, lcd_data, 2, I2C_MERGE_NONE, on_complete, (void*)&names[1]));
+        SIM_CHECK(bus.write(adc_device, adc_data, 3));
+        SIM_CHECK(order() == "DLA");
+        SIM_CHECK(completed == "DL");
+
+        reset();
+        uint8_t result[2] = {};
+        adc.read_value = 0x7E;
+        SIM_CHECK(bus.submit(dac_device, dac_data, 3));
+        SIM_CHECK(bus.read(adc_device, result, 2));
+        SIM_CHECK(order() == "DA");
+        SIM_CHECK_EQ(result[0], 0x7E);
+        SIM_CHECK_EQ(result[1], 0x7F);
+        SIM_CHECK(bus.isIdle());
+        adc.read_value = 0x10;
+    }
+
+    //  ライブラリの転送の完了（このポートの転送でないもの）はキューを進めない
+    void stray_completion_ignored(void){
+        reset();
+        port.onComplete(true);
+        port.onComplete(false);
+        SIM_CHECK(bus.isIdle());
+
+        static const char names[] = "DA";
+        const uint8_t dac_data[3] = {0x40, 0x12, 0x34};
+        const uint8_t adc_data[3] = {0x01, 0x85, 0x83};
+        SIM_CHECK(bus.submit(dac_device, dac_data, 3, I2C_MERGE_NONE, on_complete, (void*)&names[0]));
+        SIM_CHECK(bus.submit(adc_device, adc_data, 3, I2C_MERGE_NONE, on_complete, (void*)&names[1]));
+        bus.flush();
+        port.onComplete(true);
+        bus.service();
+        SIM_CHECK(order() == "DA");
+        SIM_CHECK(completed == "DA");
+        SIM_CHECK(bus.isIdle());
+    }
+}
+
+int main(void){
+    Wire.attach(DAC_ADDRESS, &dac);
+    Wire.attach(ADC_ADDRESS, &adc);
+    Wire.attach(LCD_ADDRESS_7BIT, &lcd);
+    dac_device = bus.addDevice(DAC_ADDRESS, I2C_CLOCK_FAST_PLUS, "DAC");
+    adc_device = bus.addDevice(ADC_ADDRESS, I2C_CLOCK_FAST_PLUS, "ADC");
+    lcd_device = bus.addDevice(LCD_ADDRESS_7BIT, I2C_CLOCK_FAST, "LCD");
+    bus.start();
+
+    SIM_RUN(fifo_across_devices);
+    SIM_RUN(replace_collapses_dac_writes);
+    SIM_RUN(continue_appends_lcd_data);
+    SIM_RUN(sync_transfers_wait_behind_queue);
+    SIM_RUN(stray_completion_ignored);
+    return simTestResult();
+}
@@ -0,0 +1,261 @@
+/**************************************************************************/
+/*!
+    @file     test_lcd_traffic.cpp
+    @author   Masa
+
+        LCD traffic per frame (0x3E): shadow framebuffer vs. the per-character drawing it replaced
+
+        Eh_display の表示1回ごとに LCD（0x3E）へ出るI2Cの転送回数とバイト数を Wire の統計で数え、
+        フレームバッファ以前の描き方（1文字・1カーソル移動ごとに rgb_lcd で送る. 下の legacy_*()）と比べる.
+            変化なし（100msの周期表示）      何も送らない
+            ブリンクの切り替わり              変わった1桁だけ
+            液面の1桁だけが変わった          変わった1桁だけ
+            全体の描き直し（showMeter 以降）  基準より少ない
+        基準の描き方で同じ内容を描き直し、LCDの表示が変わらない（同じものを描いている）ことも確かめる.
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include <string>
+
+#include <Arduino.h>
+#include <Wire.h>
+#include "SimClock.h"
+#include "SimBoard.h"
+#include "SimTest.h"
+
+#include "eh900_class.h"
+#include "display_class.h"
+
+//  ファームウエア（sketch.cpp）の中のもの
+extern eh900 level_meter;
+extern Eh_display lcd_display;
+void setup(void);
+
+namespace{
+    //  LCDのアドレス
+    constexpr uint8_t LCD_BUS_ADDRESS = 0x3E;
+
+    SimBoard* board = nullptr;
+
+    struct Traffic {
+        uint32_t transactions;
+        uint32_t bytes;
+    };
+
+    //  LCD への転送  キューに残っている表示データを送り終えてから数える
+    Traffic lcd_traffic(void){
+        i2c_bus.flush();
+        const SimI2cStats& stats = Wire.getStats(LCD_BUS_ADDRESS);
+        return {stats.transactions, stats.bytes};
+    }
+
+    Traffic since(const Traffic& before){
+        const Traffic now = lcd_traffic();
+        return {now.transactions - before.transactions, now.bytes - before.bytes};
+    }
+
+    //  LCDの表示（2行）
+    std::string screen(void){
+        i2c_bus.flush();
+        return board->lcd.getLine(0) + "|" + board->lcd.getLine(1);
+    }
+
+    //  フレームバッファ以前の描き方  1文字・1カーソル移動ごとに送る
+    rgb_lcd& legacy_lcd(void){
+        return lcd_display;
+    }
+
+    void legacy_print_number(int32_t value, uint8_t width, uint8_t decimals = 0){
+        char buf[8];
+        format_number(buf, value, width, decimals);
+        legacy_lcd().print(buf);
+    }
+
+    //  旧 showMode() + showTimer()  100msごとに呼ばれていた
+    void legacy_tick(void){
+        rgb_lcd& lcd = legacy_lcd();
+        lcd.setCursor(0, 0);
+        if ((level_meter.getMode() == Continuous) && (millis() % 1000 < 500)){
+            lcd.print(" ");
+        } else {
+            lcd.print(ModeNames[level_meter.getMode()]);
+        }
+        lcd.setCursor(1, 0);
+        if ((level_meter.getMode() == Timer) && (millis() % 2000 < 1000) && !(level_meter.getTimerPeriod() == 0)){
+            lcd.write(" ");
+        } else {
+            lcd.write(":");
+        }
+        lcd.setCursor(0, 0);
+
+        lcd.setCursor(2, 0);
+        legacy_print_number(level_meter.getTimerElasped() / 60, 2);
+        lcd.setCursor(0, 0);
+    }
+
+    //  旧 showLevel()  バーグラフを消してから描き直す
+    void legacy_level(void){
+        rgb_lcd& lcd = legacy_lcd();
+        const uint16_t value = level_meter.getLiquidLevel();
+
+        lcd.setCursor(10, 1);
+        legacy_print_number(value, 5, 1);
+        lcd.print("%");
+
+        lcd.setCursor(10, 0);
+        lcd.print("    ");
+        const uint16_t fine = (value % 250) / 50;
+        const uint16_t coarse = value / 250;
+        uint16_t x_pos = 0;
+        for (x_pos = 0; x_pos < coarse; x_pos++){
+            lcd.setCursor(10 + x_pos, 0);
+            lcd.write((uint8_t)4);
+        }
+        if (fine > 0){
+            lcd.setCursor(10 + x_pos, 0);
+            lcd.write((uint8_t)(fine - 1));
+        }
+
+        lcd.setCursor(1, 1);
+        legacy_print_number(level_meter.getSensorLength(), 2);
+        lcd.print("inch   ");
+    }
+
+    //  旧 showMeter()
+    void legacy_meter(void){
+        rgb_lcd& lcd = legacy_lcd();
+        lcd.clear();
+        lcd.setCursor(0, 0);
+        lcd.print(" :  /   E:    :F");
+        lcd.setCursor(5, 0);
+        legacy_print_number(level_meter.getTimerPeriod() / 60, 2);
+        lcd.setCursor(1, 1);
+        legacy_print_number(level_meter.getSensorLength(), 2);
+        lcd.print("inch   ");
+    }
+
+    //  ファームウエアの起動時と同じ順で全体を描く
+    void draw_all(void){
+        lcd_display.showMeter();
+        lcd_display.showMode();
+        lcd_display.showTimer();
+        lcd_display.showLevel();
+    }
+
+    void legacy_draw_all(void){
+        legacy_meter();
+        legacy_tick();
+        legacy_level();
+    }
+
+    //  ブリンクしない時刻（タイマモードの : が出ている  2秒周期の後半）
+    void to_steady_time(void){
+        while (millis() % 2000 < 1200){
+            sim_clock.advance(100000);
+        }
+    }
+
+    //  変化がなければ周期表示は何も送らない
+    void unchanged_frame_sends_nothing(void){
+        to_steady_time();
+        draw_all();
+        const std::string shown = screen();
+
+        const Traffic before = lcd_traffic();
+        for (uint8_t i = 0; i < 10; i++){
+            lcd_display.showMode();
+            lcd_display.showTimer();
+        }
+        const Traffic frame = since(before);
+
+        const Traffic legacy_before = lcd_traffic();
+        legacy_tick();
+        const Traffic legacy = since(legacy_before);
+
+        printf("  100 ms tick: legacy %u transactions / %u bytes, framebuffer %u / %u (x10)\n",
+            legacy.transactions, legacy.bytes, frame.transactions, frame.bytes);
+        SIM_CHECK_EQ(frame.transactions, 0);
+        SIM_CHECK_EQ(frame.bytes, 0);
+        SIM_CHECK(legacy.transactions > 0);
+        SIM_CHECK(screen() == shown);
+    }
+
+    //  ブリンクの切り替わりは : の1桁だけ  カーソル移動と表示データを1回の転送で
+    void blink_edge_sends_one_cell(void){
+        to_steady_time();
+        draw_all();
+        while (millis() % 2000 >= 1000){
+            sim_clock.advance(100000);
+        }
+
+        const Traffic before = lcd_traffic();
+        lcd_display.showMode();
+        const Traffic frame = since(before);
+
+        printf("  blink edge: framebuffer %u transactions / %u bytes\n", frame.transactions, frame.bytes);
+        SIM_CHECK_EQ(frame.transactions, 1);
+        SIM_CHECK(frame.bytes <= 4);
+        SIM_CHECK_EQ(board->lcd.getLine(0)[1], ' ');
+    }
+
+    //  液面の1桁だけが変わった時は、その1桁だけ  旧版は液面・バーグラフ・センサ長をすべて書き直す
+    void one_digit_sends_one_cell(void){
+        to_steady_time();
+        level_meter.setLiquidLevel(523);
+        draw_all();
+
+        level_meter.setLiquidLevel(524);
+        const Traffic before = lcd_traffic();
+        lcd_display.showLevel();
+        const Traffic frame = since(before);
+        const std::string shown = screen();
+
+        const Traffic legacy_before = lcd_traffic();
+        legacy_level();
+        const Traffic legacy = since(legacy_before);
+
+        printf("  one digit: legacy %u transactions / %u bytes, framebuffer %u / %u\n",
+            legacy.transactions, legacy.bytes, frame.transactions, frame.bytes);
+        SIM_CHECK_EQ(frame.transactions, 1);
+        SIM_CHECK(frame.bytes <= 4);
+        SIM_CHECK(frame.bytes * 10 < legacy.bytes);
+        SIM_CHECK(screen() == shown);
+        SIM_CHECK(board->lcd.getLine(1).find("52.4%") != std::string::npos);
+    }
+
+    //  全体の描き直し  クリアの後は空白でない桁だけを、行ごとにまとめて送る
+    void full_redraw_is_cheaper(void){
+        to_steady_time();
+        level_meter.setLiquidLevel(876);
+
+        const Traffic before = lcd_traffic();
+        draw_all();
+        const Traffic frame = since(before);
+        const std::string shown = screen();
+
+        const Traffic legacy_before = lcd_traffic();
+        legacy_draw_all();
+        const Traffic legacy = since(legacy_before);
+
+        printf("  full redraw: legacy %u transactions / %u bytes, framebuffer %u / %u\n",
+            legacy.transactions, legacy.bytes, frame.transactions, frame.bytes);
+        SIM_CHECK(frame.transactions * 4 < legacy.transactions);
+        SIM_CHECK(frame.bytes * 2 < legacy.bytes);
+        SIM_CHECK(screen() == shown);
+    }
+}
+
+int main(void){
+    static SimBoard sim_board(20, 0.0, 1);
+    board = &sim_board;
+    board->seedParameters(20, 1800);
+    setup();
+
+    SIM_RUN(unchanged_frame_sends_nothing);
+    SIM_RUN(blink_edge_sends_one_cell);
+    SIM_RUN(one_digit_sends_one_cell);
+    SIM_RUN(full_redraw_is_cheaper);
+    return simTestResult();
+}
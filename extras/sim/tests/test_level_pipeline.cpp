@@ -0,0 +1,176 @@
+/**************************************************************************/
+/*!
+    @file     test_level_pipeline.cpp
+    @author   Masa
+
+        Fixed-point (Q16) vs float level calculation over the 6-24 inch sensor range
+
+        雑音のないボードでセンサ長 6〜24inch・液面 0〜100% を振り、同じ入力のAD変換から
+        固定小数点演算と浮動小数点演算の液面を求めて比べる（差は 0.1% = 1count 以内）.
+        ブロックと交互の両方のサンプリングで確かめる.
+        電流が流れていない時は、どちらも 0% になること（-2% が uint16_t で回り込まない）も確かめる.
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include <stdlib.h>
+
+#include <Arduino.h>
+#include "SimClock.h"
+#include "SimBoard.h"
+#include "SimTest.h"
+
+#include "eh900_class.h"
+#include "measurement.h"
+#include "MeasurementEngine.h"
+
+//  ファームウエア（sketch.cpp）の中のもの
+extern eh900 level_meter;
+extern MeasurementEngine meas_unit;
+void setup(void);
+
+namespace{
+    //  熱伝導を待つ時間 [us]（24inch がすべて常伝導になるのに約3秒）
+    constexpr uint64_t PROPAGATION_WAIT = 4000000;
+    //  readLevel() を呼ぶ周期 [us]
+    constexpr uint32_t POLL_PERIOD = 1000;
+
+    SimBoard* board = nullptr;
+
+    //  電流をOnにして安定するまで待つ（startCurrent() -> updateCurrent()）
+    bool current_on(Measurement& meas){
+        meas.startCurrent();
+        while (meas.updateCurrent() < CurrentReady){
+            sim_clock.advance(POLL_PERIOD);
+        }
+        return meas.getCurrentState() == CurrentReady;
+    }
+
+    //  AD変換して液面 [0.1%] を返す  失敗なら -1
+    int32_t acquire(Measurement& meas, boolean f_fixed_point){
+        meas.setFixedPoint(f_fixed_point);
+        if (!meas.startAcquisition()){
+            return -1;
+        }
+        for (uint32_t t = 0; t < 1000000; t += POLL_PERIOD){
+            sim_clock.advance(POLL_PERIOD);
+            if (meas.readLevel()){
+                return level_meter.getLiquidLevel(meas.getChannel());
+            }
+        }
+        return -1;
+    }
+
+    //  センサ長 6〜24inch, 液面 0〜100%  固定小数点と浮動小数点の差は 1count 以内
+    void fixed_agrees_with_float(void){
+        Measurement& meas = meas_unit.getMeasurement(0);
+        int32_t max_diff = 0;
+        uint32_t points = 0;
+
+        for (uint16_t length = 6; length <= 24; length++){
+            level_meter.setSensorLength(length, 0);
+            meas_unit.renew_sensor_parameter();
+            board->sensor.setLength(length);
+
+            for (uint16_t percent = 0; percent <= 100; percent += 5){
+                board->sensor.setLevel(percent);
+                SIM_CHECK(current_on(meas));
+                sim_clock.advance(PROPAGATION_WAIT);
+
+                for (SamplingModes mode : {Block, Interleaved}){
+                    meas.setSamplingMode(mode);
+                    //  1回目は自動レンジのゲインを合わせるため
+                    acquire(meas, true);
+                    const int32_t fixed = acquire(meas, true);
+                    const int32_t floating = acquire(meas, false);
+
+                    SIM_CHECK(fixed >= 0 && fixed <= 1000);
+                    SIM_CHECK(floating >= 0 && floating <= 1000);
+                    const int32_t diff = abs(fixed - floating);
+                    if (!SIM_CHECK(diff <= 1)){
+                        printf("    %u inch %u %% %s: fixed %d float %d\n", length, percent,
+                               (mode == Block) ? "block" : "interleaved", fixed, floating);
+                    }
+                    max_diff = (diff > max_diff) ? diff : max_diff;
+                    points++;
+                }
+                meas.currentOff();
+            }
+        }
+        printf("  %u points, max difference %d count(s)\n", points, max_diff);
+    }
+
+    //  満液（抵抗 0）は 100%  電流なしの扱いにしない
+    void full_level_is_100(void){
+        Measurement& meas = meas_unit.getMeasurement(0);
+        board->sensor.setLevel(100.0);
+        SIM_CHECK(current_on(meas));
+        sim_clock.advance(PROPAGATION_WAIT);
+        for (SamplingModes mode : {Block, Interleaved}){
+            meas.setSamplingMode(mode);
+            SIM_CHECK_EQ(acquire(meas, true), 1000);
+            SIM_CHECK_EQ(acquire(meas, false), 1000);
+        }
+        meas.currentOff();
+    }
+
+    //  振り切れた変換は捨てて、下げたゲインで変換し直した液面だけを出す
+    void clipped_sample_is_retried(void){
+        Measurement& meas = meas_unit.getMeasurement(0);
+        meas.setSamplingMode(Block);
+
+        //  満液（電圧が小さい）で電圧チャネルのゲインを上げておく
+        board->sensor.setLevel(100.0);
+        SIM_CHECK(current_on(meas));
+        sim_clock.advance(PROPAGATION_WAIT);
+        acquire(meas, true);
+        acquire(meas, true);
+        const uint32_t changes = meas.getGainChanges();
+        const uint32_t retries = meas.getClipRetries();
+        const uint32_t conversions = board->adc.getConversions();
+
+        //  液面が下がると電圧はそのゲインのフルスケールを超える
+        board->sensor.setLevel(30.0);
+        sim_clock.advance(PROPAGATION_WAIT);
+        const int32_t level = acquire(meas, true);
+        SIM_CHECK_EQ(meas.getClipRetries(), retries + 1);
+        SIM_CHECK(meas.getGainChanges() > changes);
+        //  ブロック 20回 x 2シーケンス
+        SIM_CHECK_EQ(board->adc.getConversions() - conversions, 40);
+
+        //  次の変換（ゲインは合っている）と同じ液面
+        const int32_t next = acquire(meas, true);
+        SIM_CHECK_EQ(meas.getClipRetries(), retries + 1);
+        SIM_CHECK(abs(level - next) <= 1);
+        printf("  level after retry %d, next %d\n", level, next);
+        meas.currentOff();
+    }
+
+    //  電流が流れていない  どちらの演算も 0%
+    void no_current_is_zero(void){
+        Measurement& meas = meas_unit.getMeasurement(0);
+        board->sensor.setLevel(50.0);
+        meas.currentOff();
+        for (SamplingModes mode : {Block, Interleaved}){
+            meas.setSamplingMode(mode);
+            SIM_CHECK_EQ(acquire(meas, true), 0);
+            SIM_CHECK_EQ(acquire(meas, false), 0);
+        }
+    }
+}
+
+int main(void){
+    //  雑音なし
+    static SimBoard sim_board(20, 0.0, 1);
+    board = &sim_board;
+    board->sensor.setLevel(50.0);
+    board->seedParameters(20, 1800);
+    setup();
+
+    SIM_RUN(fixed_agrees_with_float);
+    SIM_RUN(full_level_is_100);
+    SIM_RUN(no_current_is_zero);
+    SIM_RUN(clipped_sample_is_retried);
+    return simTestResult();
+}
@@ -0,0 +1,156 @@
+/**************************************************************************/
+/*!
+    @file     test_param_store.cpp
+    @author   Masa
+
+        Parameter store traffic on the simulated FRAM (0x50), counted per call
+
+        storeParameter() / recallParameter() が FRAM（0x50）に出すI2Cの転送回数とバイト数を
+        Wire の統計で数える. 基準は ParamStore 以前の保存・読み出し（Meter_parameters を1byteずつ
+        write8 / read8）で、同じ長さを別の FramModel（0x51）に対して実際に行って数える.
+            変わっていない    何も書かない（転送0回）
+            1項目だけ変えた   変わった範囲とヘッダだけ（2回）
+            読み出し          起動時に両方のスロットのヘッダとパラメタ（recallParameter() は読まない）
+        保存した後に読み出して値が戻ることも確かめる.
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include <Arduino.h>
+#include <Wire.h>
+#include <Adafruit_FRAM_I2C.h>
+#include "SimClock.h"
+#include "SimBoard.h"
+#include "SimTest.h"
+
+#include "eh900_class.h"
+
+//  ファームウエア（sketch.cpp）の中のもの
+extern eh900 level_meter;
+void setup(void);
+
+namespace{
+    //  基準の保存・読み出しに使うFRAM
+    constexpr uint8_t REFERENCE_ADDRESS = 0x51;
+    //  旧版のパラメタ領域
+    constexpr uint16_t LEGACY_PARM_ADDR = 0x0100;
+
+    FramModel reference_fram;
+
+    //  FRAM（0x50）への転送  キューに残っている書き込みを終えてから数える
+    struct Traffic {
+        uint32_t transactions;
+        uint32_t bytes;
+    };
+
+    Traffic fram_traffic(uint8_t address){
+        i2c_bus.flush();
+        const SimI2cStats& stats = Wire.getStats(address);
+        return {stats.transactions, stats.bytes};
+    }
+
+    //  before から今までの転送
+    Traffic since(const Traffic& before, uint8_t address = SIM_ADDR_FRAM){
+        const Traffic now = fram_traffic(address);
+        return {now.transactions - before.transactions, now.bytes - before.bytes};
+    }
+
+    //  ParamStore 以前の保存  構造体を1byteずつ write8
+    Traffic legacy_store(Adafruit_FRAM_I2C& fram){
+        const Traffic before = fram_traffic(REFERENCE_ADDRESS);
+        for (size_t i = 0; i < METER_PARAMETERS_LEGACY_SIZE; i++){
+            fram.write8(LEGACY_PARM_ADDR + i, (uint8_t)i);
+        }
+        return since(before, REFERENCE_ADDRESS);
+    }
+
+    //  ParamStore 以前の読み出し  構造体を1byteずつ read8
+    Traffic legacy_recall(Adafruit_FRAM_I2C& fram){
+        const Traffic before = fram_traffic(REFERENCE_ADDRESS);
+        for (size_t i = 0; i < METER_PARAMETERS_LEGACY_SIZE; i++){
+            fram.read8(LEGACY_PARM_ADDR + i);
+        }
+        return since(before, REFERENCE_ADDRESS);
+    }
+
+    Adafruit_FRAM_I2C* reference = nullptr;
+
+    //  前回と同じ内容なら FRAM には何も書かない
+    void unchanged_writes_nothing(void){
+        SIM_CHECK(level_meter.storeParameter());
+        const Traffic before = fram_traffic(SIM_ADDR_FRAM);
+        for (uint8_t i = 0; i < 10; i++){
+            SIM_CHECK(level_meter.storeParameter());
+        }
+        const Traffic unchanged = since(before);
+        printf("  unchanged x10: %u transactions, %u bytes\n", unchanged.transactions, unchanged.bytes);
+        SIM_CHECK_EQ(unchanged.transactions, 0);
+        SIM_CHECK_EQ(unchanged.bytes, 0);
+    }
+
+    //  1項目だけ変えた時は変わった範囲とヘッダの2回  1byteずつ書いていた頃と比べる
+    void changed_field_writes_the_difference(void){
+        const Traffic legacy = legacy_store(*reference);
+
+        //  書き込み先（古い方）のスロットとは周期の2byteだけが違う
+        level_meter.setTimerPeriod(1200);
+        SIM_CHECK(level_meter.storeParameter());
+        level_meter.setTimerPeriod(1800);
+        SIM_CHECK(level_meter.storeParameter());
+
+        level_meter.setTimerPeriod(900);
+        const Traffic before = fram_traffic(SIM_ADDR_FRAM);
+        SIM_CHECK(level_meter.storeParameter());
+        const Traffic changed = since(before);
+
+        printf("  store: legacy %u transactions / %u bytes, ParamStore %u transactions / %u bytes\n",
+            legacy.transactions, legacy.bytes, changed.transactions, changed.bytes);
+        SIM_CHECK_EQ(legacy.transactions, METER_PARAMETERS_LEGACY_SIZE);
+        SIM_CHECK_EQ(changed.transactions, 2);
+        SIM_CHECK(changed.bytes * 4 < legacy.bytes);
+    }
+
+    //  読み出しは起動時の begin() で両方のスロットのヘッダとパラメタを読むだけ（転送の回数は1/3以下）
+    //  recallParameter() は写しから取り出すので FRAM は読まない  値は保存したものに戻る
+    void recall_reads_in_bursts(void){
+        const Traffic legacy = legacy_recall(*reference);
+
+        level_meter.setTimerPeriod(600);
+        SIM_CHECK(level_meter.storeParameter());
+
+        FramStorage storage(&i2c_bus);
+        storage.begin(SIM_ADDR_FRAM);
+        ParamStore store(&storage);
+        const Traffic before = fram_traffic(SIM_ADDR_FRAM);
+        SIM_CHECK(store.begin(LEGACY_PARM_ADDR, LEGACY_PARM_ADDR + PARAM_STORE_SLOT_SIZE));
+        const Traffic boot = since(before);
+
+        level_meter.setTimerPeriod(1800);
+        const Traffic recall_before = fram_traffic(SIM_ADDR_FRAM);
+        SIM_CHECK(level_meter.recallParameter());
+        const Traffic recall = since(recall_before);
+        SIM_CHECK_EQ(level_meter.getTimerPeriod(), 600);
+
+        printf("  recall: legacy %u transactions / %u bytes, ParamStore begin() %u transactions / %u bytes\n",
+            legacy.transactions, legacy.bytes, boot.transactions, boot.bytes);
+        SIM_CHECK_EQ(recall.transactions, 0);
+        SIM_CHECK(boot.transactions * 3 < legacy.transactions);
+    }
+}
+
+int main(void){
+    static SimBoard board(20, 0.0, 1);
+    board.seedParameters(20, 1800);
+    setup();
+
+    Wire.attach(REFERENCE_ADDRESS, &reference_fram);
+    static Adafruit_FRAM_I2C legacy_fram;
+    legacy_fram.begin(REFERENCE_ADDRESS);
+    reference = &legacy_fram;
+
+    SIM_RUN(unchanged_writes_nothing);
+    SIM_RUN(changed_field_writes_the_difference);
+    SIM_RUN(recall_reads_in_bursts);
+    return simTestResult();
+}
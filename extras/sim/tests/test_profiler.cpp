@@ -0,0 +1,191 @@
+/**************************************************************************/
+/*!
+    @file     test_profiler.cpp
+    @author   Masa
+
+        Profiler statistics from a scripted cycle counter and memory probe
+
+        サイクル数とメモリの読み取りを台本どおりの値を返す関数で与え、Profiler の記録を確かめる.
+            区間ごとの回数・最小・平均・最大  ProfileScope は生成から破棄までのサイクル数
+            PROF_SECTION_NUM 以上の区間は記録せず、getStats() は区間0を返す
+            スタックの一番低い位置・ヒープの一番高い位置  記録のたびに読む
+            reset() で統計と最大使用位置がクリアされる
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include <string.h>
+
+#include <Arduino.h>
+#include "SimTest.h"
+
+#include "Profiler.h"
+
+namespace{
+    //  サイクルカウンタ  呼ばれるたびに cycle_steps を順に進める（最後の値をくり返す）
+    uint32_t cycle_counter = 0;
+    const uint32_t* cycle_steps = nullptr;
+    size_t cycle_step_num = 0;
+    size_t cycle_step = 0;
+
+    uint32_t scripted_cycles(void){
+        const uint32_t now = cycle_counter;
+        if (cycle_step_num != 0){
+            cycle_counter += cycle_steps[cycle_step < cycle_step_num ? cycle_step : cycle_step_num - 1];
+            cycle_step++;
+        }
+        return now;
+    }
+
+    void script_cycles(const uint32_t* steps, size_t num){
+        cycle_steps = steps;
+        cycle_step_num = num;
+        cycle_step = 0;
+    }
+
+    //  スタックポインタとヒープの先頭  呼ばれるたびに次の組を返す
+    struct MemorySample {
+        uint32_t stack;
+        uint32_t heap;
+    };
+    const MemorySample MEMORY_SCRIPT[] = {
+        {0x20017F00, 0x20001000},
+        {0x20017E80, 0x20001200},
+        {0x20017F40, 0x20001100},
+        {0x20017E00, 0x20001080},
+    };
+    constexpr size_t MEMORY_SCRIPT_NUM = sizeof(MEMORY_SCRIPT) / sizeof(MEMORY_SCRIPT[0]);
+    size_t memory_reads = 0;
+
+    void scripted_memory(uint32_t& stack, uint32_t& heap){
+        const MemorySample& sample = MEMORY_SCRIPT[memory_reads % MEMORY_SCRIPT_NUM];
+        stack = sample.stack;
+        heap = sample.heap;
+        memory_reads++;
+    }
+
+    //  回数・最小・平均・最大  区間ごとに別々に数える
+    void stats_per_section(void){
+        Profiler prof(scripted_cycles);
+        const uint32_t cycles[] = {120, 80, 400, 100};
+        for (const uint32_t c : cycles){
+            prof.record(PROF_READ_LEVEL, c);
+        }
+        prof.record(PROF_FRAM, 7);
+
+        const ProfileStats& level = prof.getStats(PROF_READ_LEVEL);
+        SIM_CHECK_EQ(level.count, 4);
+        SIM_CHECK_EQ(level.min, 80);
+        SIM_CHECK_EQ(level.max, 400);
+        SIM_CHECK_EQ(level.total, 700);
+        SIM_CHECK_EQ(prof.getAverage(PROF_READ_LEVEL), 175);
+
+        SIM_CHECK_EQ(prof.getStats(PROF_FRAM).count, 1);
+        SIM_CHECK_EQ(prof.getAverage(PROF_FRAM), 7);
+        //  記録のない区間
+        SIM_CHECK_EQ(prof.getStats(PROF_SHOW_LEVEL).count, 0);
+        SIM_CHECK_EQ(prof.getAverage(PROF_SHOW_LEVEL), 0);
+    }
+
+    //  ProfileScope はサイクルカウンタの生成時と破棄時の差を記録する
+    void scope_measures_cycles(void){
+        Profiler prof(scripted_cycles);
+        const uint32_t steps[] = {250, 0, 900, 0, 40, 0};
+        script_cycles(steps, sizeof(steps) / sizeof(steps[0]));
+        for (uint8_t i = 0; i < 3; i++){
+            ProfileScope scope(prof, PROF_SHOW_METER);
+        }
+        script_cycles(nullptr, 0);
+
+        const ProfileStats& meter = prof.getStats(PROF_SHOW_METER);
+        SIM_CHECK_EQ(meter.count, 3);
+        SIM_CHECK_EQ(meter.min, 40);
+        SIM_CHECK_EQ(meter.max, 900);
+        SIM_CHECK_EQ(prof.getAverage(PROF_SHOW_METER), (250 + 900 + 40) / 3);
+        SIM_CHECK(strcmp(profile_name(PROF_SHOW_METER), "showMeter") == 0);
+    }
+
+    //  範囲外の区間は記録しない  getStats() は区間0を返し、名前は "?"
+    void section_bounds(void){
+        Profiler prof(scripted_cycles);
+        prof.record(PROF_READ_LEVEL, 10);
+        prof.record(PROF_SECTION_NUM, 5000);
+        prof.record(UINT8_MAX, 5000);
+
+        SIM_CHECK(&prof.getStats(PROF_SECTION_NUM) == &prof.getStats(PROF_READ_LEVEL));
+        SIM_CHECK_EQ(prof.getStats(PROF_SECTION_NUM).count, 1);
+        SIM_CHECK_EQ(prof.getStats(PROF_READ_LEVEL).max, 10);
+        uint32_t recorded = 0;
+        for (uint8_t i = 0; i < PROF_SECTION_NUM; i++){
+            recorded += prof.getStats(i).count;
+        }
+        SIM_CHECK_EQ(recorded, 1);
+        SIM_CHECK(strcmp(profile_name(PROF_SECTION_NUM), "?") == 0);
+        SIM_CHECK(strcmp(profile_name(PROF_SECTION_NUM - 1), "fram") == 0);
+    }
+
+    //  記録のたびにメモリを読み、スタックの一番低い位置とヒープの一番高い位置を残す
+    void memory_high_water(void){
+        memory_reads = 0;
+        Profiler prof(scripted_cycles, scripted_memory);
+        SIM_CHECK_EQ(prof.getStackLow(), UINT32_MAX);
+        SIM_CHECK_EQ(prof.getHeapHigh(), 0);
+
+        prof.record(PROF_SET_VMON, 1);
+        SIM_CHECK_EQ(prof.getStackLow(), 0x20017F00);
+        SIM_CHECK_EQ(prof.getHeapHigh(), 0x20001000);
+        prof.record(PROF_SET_VMON, 1);
+        prof.record(PROF_SET_VMON, 1);
+        //  範囲外の区間ではメモリも読まない
+        prof.record(PROF_SECTION_NUM, 1);
+        SIM_CHECK_EQ(memory_reads, 3);
+        SIM_CHECK_EQ(prof.getStackLow(), 0x20017E80);
+        SIM_CHECK_EQ(prof.getHeapHigh(), 0x20001200);
+
+        prof.sampleMemory();
+        SIM_CHECK_EQ(memory_reads, 4);
+        SIM_CHECK_EQ(prof.getStackLow(), 0x20017E00);
+        SIM_CHECK_EQ(prof.getHeapHigh(), 0x20001200);
+
+        //  読み取りの関数がなければ何もしない
+        Profiler no_probe(scripted_cycles);
+        no_probe.record(PROF_SET_VMON, 1);
+        no_probe.sampleMemory();
+        SIM_CHECK_EQ(no_probe.getStackLow(), UINT32_MAX);
+        SIM_CHECK_EQ(no_probe.getHeapHigh(), 0);
+    }
+
+    //  reset() で統計と最大使用位置をクリアし、その後の記録から数え直す
+    void reset_clears_everything(void){
+        memory_reads = 0;
+        Profiler prof(scripted_cycles, scripted_memory);
+        prof.record(PROF_SUBMIT_STATUS, 300);
+        prof.record(PROF_SUBMIT_STATUS, 500);
+        prof.reset();
+
+        const ProfileStats& submit = prof.getStats(PROF_SUBMIT_STATUS);
+        SIM_CHECK_EQ(submit.count, 0);
+        SIM_CHECK_EQ(submit.min, UINT32_MAX);
+        SIM_CHECK_EQ(submit.max, 0);
+        SIM_CHECK_EQ(submit.total, 0);
+        SIM_CHECK_EQ(prof.getStackLow(), UINT32_MAX);
+        SIM_CHECK_EQ(prof.getHeapHigh(), 0);
+
+        prof.record(PROF_SUBMIT_STATUS, 900);
+        SIM_CHECK_EQ(submit.min, 900);
+        SIM_CHECK_EQ(submit.max, 900);
+        SIM_CHECK_EQ(prof.getAverage(PROF_SUBMIT_STATUS), 900);
+        SIM_CHECK_EQ(prof.getStackLow(), MEMORY_SCRIPT[2].stack);
+        SIM_CHECK_EQ(prof.getHeapHigh(), MEMORY_SCRIPT[2].heap);
+    }
+}
+
+int main(void){
+    SIM_RUN(stats_per_section);
+    SIM_RUN(scope_measures_cycles);
+    SIM_RUN(section_bounds);
+    SIM_RUN(memory_high_water);
+    SIM_RUN(reset_clears_everything);
+    return simTestResult();
+}
@@ -0,0 +1,154 @@
+/**************************************************************************/
+/*!
+    @file     test_sampling_modes.cpp
+    @author   Masa
+
+        Noise and latency of interleaved vs block sampling on the simulated board
+
+        ファームウエアを起動（setup()）し、1回計測と同じ手順（電流を流す -> 熱伝導を待つ -> AD変換 -> 液面）を
+        ブロック（電流10回 -> 電圧10回, ADC_AVERAGE_DEFAULT）と交互（6組）で繰り返して比べる.
+            雑音      ADの入力に雑音を加え、液面のばらつき（標準偏差）を比べる
+                      readLevel() がサンプルから見積もる雑音（整数演算）とも比べる
+            待ち時間  AD変換の開始から液面が出るまでの時間と変換回数
+            ドリフト  電流源が時間とともに変わる時の液面のずれ（ドリフトなしの平均との差）
+        ブロックは電流と電圧の平均の時刻が約100msずれるので、ドリフトがそのまま液面に入る.
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include <math.h>
+#include <vector>
+
+#include <Arduino.h>
+#include "SimClock.h"
+#include "SimBoard.h"
+#include "SimTest.h"
+
+#include "eh900_class.h"
+#include "measurement.h"
+#include "MeasurementEngine.h"
+
+//  ファームウエア（sketch.cpp）の中のもの
+extern eh900 level_meter;
+extern MeasurementEngine meas_unit;
+void setup(void);
+
+namespace{
+    //  繰り返す回数
+    constexpr uint32_t SHOTS = 100;
+    //  熱伝導を待つ時間 [us]（20inchの半分が常伝導になるのに約1.3秒）
+    constexpr uint64_t PROPAGATION_WAIT = 2000000;
+    //  readLevel() を呼ぶ周期 [us]
+    constexpr uint32_t POLL_PERIOD = 1000;
+    //  電流源のドリフト [1/s]
+    constexpr double CURRENT_DRIFT = 0.02;
+
+    //  ボード  Wire などの後に作るので main() の中で作る
+    SimBoard* board = nullptr;
+
+    //  電流をOnにして安定するまで待つ（startCurrent() -> updateCurrent()）
+    bool current_on(Measurement& meas){
+        meas.startCurrent();
+        while (meas.updateCurrent() < CurrentReady){
+            sim_clock.advance(POLL_PERIOD);
+        }
+        return meas.getCurrentState() == CurrentReady;
+    }
+
+    struct Statistics {
+        double mean;        //  液面の平均 [0.1%]
+        double stddev;      //  液面の標準偏差 [0.1%]
+        double latency;     //  AD変換の開始から液面が出るまで [ms]
+        double conversions; //  液面1回あたりのAD変換の回数
+        double estimated;   //  readLevel() が見積もった雑音の平均 [0.1%]
+    };
+
+    //  1回計測と同じ手順を繰り返す
+    Statistics run(SamplingModes mode, double drift){
+        Measurement& meas = meas_unit.getMeasurement(0);
+        std::vector<double> levels;
+        uint64_t latency = 0;
+        double estimated = 0.0;
+        const uint32_t conversions = board->adc.getConversions();
+
+        meas.setSamplingMode(mode);
+        board->getChannel(0).setCurrentDrift(drift);
+        for (uint32_t shot = 0; shot < SHOTS; shot++){
+            if (!SIM_CHECK(current_on(meas))){
+                break;
+            }
+            sim_clock.advance(PROPAGATION_WAIT);
+
+            const uint64_t start = sim_clock.now();
+            SIM_CHECK(meas.startAcquisition());
+            bool f_done = false;
+            while (!f_done && sim_clock.now() - start < 1000000){
+                sim_clock.advance(POLL_PERIOD);
+                f_done = meas.readLevel();
+            }
+            SIM_CHECK(f_done);
+            latency += sim_clock.now() - start;
+            levels.push_back(level_meter.getLiquidLevel(0));
+            estimated += meas.getLevelNoise() / 10.0;
+
+            meas.currentOff();
+            sim_clock.advance(1000000);
+        }
+
+        Statistics stat = {};
+        for (double level : levels){
+            stat.mean += level;
+        }
+        stat.mean /= levels.size();
+        for (double level : levels){
+            stat.stddev += (level - stat.mean) * (level - stat.mean);
+        }
+        stat.stddev = sqrt(stat.stddev / (levels.size() - 1));
+        stat.latency = latency / 1000.0 / SHOTS;
+        stat.conversions = (double)(board->adc.getConversions() - conversions) / SHOTS;
+        stat.estimated = estimated / SHOTS;
+        return stat;
+    }
+
+    void print(const char* name, const Statistics& stat, const Statistics& drifted){
+        printf("  %-12s noise %.3f %% (x sqrt(conversions) %.3f %%, estimated %.3f %%)  latency %.0f ms  %.0f conversions  drift error %+.3f %%\n",
+               name, stat.stddev / 10.0, stat.stddev * sqrt(stat.conversions) / 10.0, stat.estimated / 10.0,
+               stat.latency, stat.conversions, (drifted.mean - stat.mean) / 10.0);
+    }
+
+    void noise_and_latency(void){
+        const Statistics block = run(Block, 0.0);
+        const Statistics block_drift = run(Block, CURRENT_DRIFT);
+        const Statistics interleaved = run(Interleaved, 0.0);
+        const Statistics interleaved_drift = run(Interleaved, CURRENT_DRIFT);
+
+        print("block", block, block_drift);
+        print("interleaved", interleaved, interleaved_drift);
+
+        //  変換の回数と時間は 20回 -> 12回
+        SIM_CHECK_EQ(block.conversions, 20);
+        SIM_CHECK_EQ(interleaved.conversions, 12);
+        SIM_CHECK(interleaved.latency < block.latency * 0.7);
+        //  変換1回あたりの雑音（標準偏差 x √変換回数）は同じ程度
+        //  交互は組ごとの比の中央値なので、平均より √(π/2) = 1.25倍 ばらつく分を見込む
+        SIM_CHECK(interleaved.stddev * sqrt(interleaved.conversions) < block.stddev * sqrt(block.conversions) * 1.35);
+        //  サンプルのばらつきからの見積り（整数演算）は実際のばらつきと合う
+        SIM_CHECK(fabs(block.estimated - block.stddev) < block.stddev * 0.3);
+        SIM_CHECK(fabs(interleaved.estimated - interleaved.stddev) < interleaved.stddev * 0.3);
+        //  ドリフトの影響はブロックの方が大きい
+        SIM_CHECK(fabs(interleaved_drift.mean - interleaved.mean) < fabs(block_drift.mean - block.mean));
+    }
+}
+
+int main(void){
+    //  液面50%, 20inch, ADの入力に 2mV rms の雑音（液面の分解能 0.1% より大きくばらつかせる）
+    static SimBoard sim_board(20, 2000.0, 7);
+    board = &sim_board;
+    board->sensor.setLevel(50.0);
+    board->seedParameters(20, 1800);
+    setup();
+
+    SIM_RUN(noise_and_latency);
+    return simTestResult();
+}
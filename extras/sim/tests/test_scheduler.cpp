@@ -0,0 +1,245 @@
+/**************************************************************************/
+/*!
+    @file     test_scheduler.cpp
+    @author   Masa
+
+        Scheduler on a virtual clock: periods, priorities, triggers and overruns
+
+        時刻源に仮想時計（ClockFunction）を与えた Scheduler で、タスクを実行する時刻と順番を確かめる.
+        run() は実行可能なタスクを1つだけ実行するので、loop() と同じく戻り値が False になるまで呼ぶ.
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include <vector>
+
+#include <Arduino.h>
+#include "SimTest.h"
+
+#include "scheduler_class.h"
+
+namespace{
+    //  仮想時計 [ms]
+    uint32_t virtual_time = 0;
+
+    uint32_t virtual_clock(void){
+        return virtual_time;
+    }
+
+    //  実行したタスクの記録  （タスク番号, 時刻）
+    struct Run {
+        int id;
+        uint32_t time;
+    };
+    std::vector<Run> runs;
+
+    //  何もしないタスク  番号と時刻を記録する
+    template <int ID> void task(void){
+        runs.push_back({ID, virtual_time});
+    }
+
+    //  実行可能なタスクをすべて実行する
+    void run_all(Scheduler& scheduler){
+        while (scheduler.run()){
+        }
+    }
+
+    //  仮想時計を 1ms ずつ進めながら実行する
+    void run_until(Scheduler& scheduler, uint32_t time){
+        while (virtual_time < time){
+            virtual_time++;
+            run_all(scheduler);
+        }
+    }
+
+    uint32_t count(int id){
+        uint32_t n = 0;
+        for (const Run& run : runs){
+            n += (run.id == id) ? 1 : 0;
+        }
+        return n;
+    }
+
+    void reset(void){
+        virtual_time = 0;
+        runs.clear();
+    }
+
+    //  周期タスクは登録した時刻に1回、以降は周期ごと  期限は処理時間でずれない
+    void periodic(void){
+        reset();
+        Scheduler scheduler(virtual_clock);
+        SIM_CHECK_EQ(scheduler.addTask(task<0>, 10, 1), 0);
+        SIM_CHECK_EQ(scheduler.addTask(task<1>, 25, 1), 1);
+
+        run_all(scheduler);
+        run_until(scheduler, 100);
+        //  0,10,...,100 と 0,25,...,100
+        SIM_CHECK_EQ(count(0), 11);
+        SIM_CHECK_EQ(count(1), 5);
+        SIM_CHECK_EQ(scheduler.getPeriod(1), 25);
+        SIM_CHECK_EQ(scheduler.getOverrun(0), 0);
+    }
+
+    //  同時に実行可能なら優先度の高い順、同じ優先度なら期限の早い順
+    void priority_order(void){
+        reset();
+        Scheduler scheduler(virtual_clock);
+        scheduler.addTask(task<0>, 10, 1);
+        scheduler.addTask(task<1>, 10, 3);
+        scheduler.addTask(task<2>, 10, 2);
+
+        run_all(scheduler);
+        SIM_CHECK_EQ(runs.size(), 3);
+        SIM_CHECK_EQ(runs[0].id, 1);
+        SIM_CHECK_EQ(runs[1].id, 2);
+        SIM_CHECK_EQ(runs[2].id, 0);
+
+        //  同じ優先度  期限が5ms早いタスクが先
+        reset();
+        Scheduler same(virtual_clock);
+        same.addTask(task<0>, 20, 1);
+        virtual_time = 5;
+        same.addTask(task<1>, 20, 1);
+        virtual_time = 30;
+        run_all(same);
+        SIM_CHECK_EQ(runs.size(), 2);
+        SIM_CHECK_EQ(runs[0].id, 0);
+        SIM_CHECK_EQ(runs[1].id, 1);
+    }
+
+    //  周期0のタスクは trigger() された時だけ1回実行  周期タスクは trigger() から数え直す
+    void trigger_task(void){
+        reset();
+        Scheduler scheduler(virtual_clock);
+        const int8_t on_demand = scheduler.addTask(task<0>, 0, 1);
+        const int8_t periodic = scheduler.addTask(task<1>, 100, 1);
+
+        run_until(scheduler, 50);
+        SIM_CHECK_EQ(count(0), 0);
+        scheduler.trigger(on_demand);
+        scheduler.trigger(on_demand);
+        run_all(scheduler);
+        SIM_CHECK_EQ(count(0), 1);
+
+        //  登録直後に実行済み  時刻50に trigger() すると次は150
+        runs.clear();
+        scheduler.trigger(periodic);
+        run_all(scheduler);
+        run_until(scheduler, 200);
+        SIM_CHECK_EQ(count(1), 2);
+        SIM_CHECK_EQ(runs[0].time, 50);
+        SIM_CHECK_EQ(runs[1].time, 150);
+    }
+
+    //  setPeriod() は今から1周期後に次を実行
+    void set_period(void){
+        reset();
+        Scheduler scheduler(virtual_clock);
+        const int8_t id = scheduler.addTask(task<0>, 100, 1);
+        run_all(scheduler);
+        virtual_time = 30;
+        scheduler.setPeriod(id, 20);
+        run_until(scheduler, 90);
+        SIM_CHECK_EQ(count(0), 4);
+        SIM_CHECK_EQ(runs[1].time, 50);
+        SIM_CHECK_EQ(runs[3].time, 90);
+        SIM_CHECK_EQ(scheduler.getPeriod(id), 20);
+    }
+
+    //  無効にしたタスクは実行しない（trigger() も取り消す）  有効にするとすぐ実行可能
+    void enable_disable(void){
+        reset();
+        Scheduler scheduler(virtual_clock);
+        const int8_t id = scheduler.addTask(task<0>, 10, 1);
+        scheduler.disable(id);
+        scheduler.trigger(id);
+        scheduler.disable(id);
+        run_until(scheduler, 100);
+        SIM_CHECK_EQ(count(0), 0);
+        SIM_CHECK_EQ(scheduler.timeToNext(), UINT32_MAX);
+
+        scheduler.enable(id);
+        SIM_CHECK_EQ(scheduler.timeToNext(), 0);
+        run_all(scheduler);
+        SIM_CHECK_EQ(count(0), 1);
+        SIM_CHECK_EQ(runs[0].time, 100);
+    }
+
+    //  次に実行可能になるまでの時間  一番近い期限
+    void time_to_next(void){
+        reset();
+        Scheduler scheduler(virtual_clock);
+        scheduler.addTask(task<0>, 40, 1);
+        scheduler.addTask(task<1>, 15, 1);
+        scheduler.addTask(task<2>, 0, 1);
+        SIM_CHECK_EQ(scheduler.timeToNext(), 0);
+        run_all(scheduler);
+        SIM_CHECK_EQ(scheduler.timeToNext(), 15);
+        virtual_time = 10;
+        SIM_CHECK_EQ(scheduler.timeToNext(), 5);
+    }
+
+    //  1周期以上遅れたら追いつこうとせず、今から1周期後  遅れを数える
+    void overrun(void){
+        reset();
+        Scheduler scheduler(virtual_clock);
+        const int8_t id = scheduler.addTask(task<0>, 10, 1);
+        run_all(scheduler);
+        virtual_time = 35;
+        run_all(scheduler);
+        SIM_CHECK_EQ(count(0), 2);
+        SIM_CHECK_EQ(scheduler.getOverrun(id), 1);
+        run_until(scheduler, 50);
+        SIM_CHECK_EQ(count(0), 3);
+        SIM_CHECK_EQ(runs[2].time, 45);
+
+        //  1周期以内の遅れは期限どおり（前回の期限＋周期）
+        virtual_time = 58;
+        run_all(scheduler);
+        run_until(scheduler, 65);
+        SIM_CHECK_EQ(runs[4].time, 65);
+        SIM_CHECK_EQ(scheduler.getOverrun(id), 1);
+    }
+
+    //  眠っていた後の resync() は期限を今に合わせ、遅れには数えない
+    void resync_after_sleep(void){
+        reset();
+        Scheduler scheduler(virtual_clock);
+        const int8_t id = scheduler.addTask(task<0>, 10, 1);
+        run_all(scheduler);
+        virtual_time = 1000;
+        scheduler.resync();
+        run_all(scheduler);
+        SIM_CHECK_EQ(count(0), 2);
+        SIM_CHECK_EQ(scheduler.getOverrun(id), 0);
+        run_until(scheduler, 1010);
+        SIM_CHECK_EQ(runs[2].time, 1010);
+    }
+
+    //  タスク表がいっぱいなら -1  ファームウエアのタスク（8個）より余裕がある
+    void table_full(void){
+        reset();
+        Scheduler scheduler(virtual_clock);
+        SIM_CHECK(SCHEDULER_MAX_TASKS > 8);
+        for (uint8_t i = 0; i < SCHEDULER_MAX_TASKS; i++){
+            SIM_CHECK_EQ(scheduler.addTask(task<0>, 10, 1), i);
+        }
+        SIM_CHECK_EQ(scheduler.addTask(task<0>, 10, 1), -1);
+        SIM_CHECK_EQ(Scheduler(virtual_clock).addTask(nullptr, 10, 1), -1);
+    }
+}
+
+int main(void){
+    SIM_RUN(periodic);
+    SIM_RUN(priority_order);
+    SIM_RUN(trigger_task);
+    SIM_RUN(set_period);
+    SIM_RUN(enable_disable);
+    SIM_RUN(time_to_next);
+    SIM_RUN(overrun);
+    SIM_RUN(resync_after_sleep);
+    SIM_RUN(table_full);
+    return simTestResult();
+}
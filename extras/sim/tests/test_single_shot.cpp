@@ -0,0 +1,132 @@
+/**************************************************************************/
+/*!
+    @file     test_single_shot.cpp
+    @author   Masa
+
+        Multi-channel single shot: all current sources switched on together
+
+        3チャネルのボードで1回計測（MeasurementEngine::startSingle() / updateSingle()）を行い、
+        各チャネルが熱伝導待ち（SinglePropagation）に入る時刻を調べる. 全チャネルの電流を同時にOnにし、
+        負荷の判定と電流の安定待ち（110ms）を1回で済ませるので、どのチャネルも開始から約110msで入る.
+        （チャネルごとに立ち上げを待つと、チャネル k は k x 110ms 遅れる）
+        全体の時間はチャネル0だけの1回計測と並べて表示する（収束判定で数十ms変わるので比べない）.
+        負荷に異常のあるチャネルはそのチャネルだけをセンサエラーにすることも確かめる.
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include <Arduino.h>
+#include "SimClock.h"
+#include "SimBoard.h"
+#include "SimTest.h"
+
+#include "eh900_class.h"
+#include "measurement.h"
+#include "MeasurementEngine.h"
+
+//  ファームウエア（sketch.cpp）の中のもの
+extern eh900 level_meter;
+extern MeasurementEngine meas_unit;
+void setup(void);
+
+namespace{
+    //  チャネルの数
+    constexpr uint8_t CHANNELS = 3;
+    //  updateSingle() を呼ぶ周期 [us]
+    constexpr uint32_t POLL_PERIOD = 1000;
+    //  1回計測の時間の上限 [us]
+    constexpr uint64_t SHOT_TIMEOUT = 30000000;
+
+    SimBoard* board = nullptr;
+
+    //  チャネルごとの熱伝導待ちに入った時刻 [ms]
+    uint32_t propagation_time[CHANNELS] = {};
+
+    //  全チャネルの1回計測  かかった時間 [ms]  終わらなければ 0
+    uint32_t engine_shot(void){
+        const uint64_t start = sim_clock.now();
+        for (uint8_t ch = 0; ch < CHANNELS; ch++){
+            propagation_time[ch] = 0;
+        }
+        if (!SIM_CHECK(meas_unit.startSingle())){
+            return 0;
+        }
+        while (sim_clock.now() - start < SHOT_TIMEOUT){
+            sim_clock.advance(POLL_PERIOD);
+            for (uint8_t ch = 0; ch < CHANNELS; ch++){
+                if (propagation_time[ch] == 0 && meas_unit.getMeasurement(ch).getSingleState() == SinglePropagation){
+                    propagation_time[ch] = (uint32_t)((sim_clock.now() - start) / 1000);
+                }
+            }
+            if (meas_unit.updateSingle()){
+                return (uint32_t)((sim_clock.now() - start) / 1000);
+            }
+        }
+        return 0;
+    }
+
+    //  チャネル0だけの1回計測  かかった時間 [ms]  終わらなければ 0
+    uint32_t channel_shot(void){
+        Measurement& meas = meas_unit.getMeasurement(0);
+        const uint64_t start = sim_clock.now();
+        if (!SIM_CHECK(meas.startSingle())){
+            return 0;
+        }
+        while (sim_clock.now() - start < SHOT_TIMEOUT){
+            sim_clock.advance(POLL_PERIOD);
+            if (meas.updateSingle()){
+                return (uint32_t)((sim_clock.now() - start) / 1000);
+            }
+        }
+        return 0;
+    }
+
+    //  電流の立ち上げ（110ms）は全チャネルで1回  どのチャネルも同時に熱伝導待ちに入る
+    void channels_share_current_wait(void){
+        SIM_CHECK_EQ(meas_unit.getChannelCount(), CHANNELS);
+
+        const uint32_t single = channel_shot();
+        sim_clock.advance(10000000);
+        const uint32_t all = engine_shot();
+        printf("  1 channel %u ms, %u channels %u ms\n", single, CHANNELS, all);
+
+        SIM_CHECK(single > 0);
+        SIM_CHECK(all > 0);
+        SIM_CHECK(meas_unit.hasSingleSucceeded());
+        for (uint8_t ch = 0; ch < CHANNELS; ch++){
+            SIM_CHECK(!level_meter.isSensorError(ch));
+        }
+        for (uint8_t ch = 0; ch < CHANNELS; ch++){
+            printf("  channel %u propagation from %u ms\n", ch, propagation_time[ch]);
+            SIM_CHECK(propagation_time[ch] >= 110);
+            SIM_CHECK(propagation_time[ch] <= 115);
+        }
+    }
+
+    //  負荷に異常のあるチャネルだけセンサエラー  他のチャネルは計測する
+    void failed_channel_is_flagged(void){
+        board->getChannel(1).setSensorOpen(true);
+        sim_clock.advance(10000000);
+        SIM_CHECK(engine_shot() > 0);
+        SIM_CHECK(!meas_unit.hasSingleSucceeded());
+        SIM_CHECK(!level_meter.isSensorError(0));
+        SIM_CHECK(level_meter.isSensorError(1));
+        SIM_CHECK(!level_meter.isSensorError(2));
+        board->getChannel(1).setSensorOpen(false);
+    }
+}
+
+int main(void){
+    static SimBoard sim_board(20, 0.0, 1, CHANNELS);
+    board = &sim_board;
+    for (uint8_t ch = 0; ch < CHANNELS; ch++){
+        board->getChannel(ch).sensor.setLevel(50.0);
+    }
+    board->seedParameters(20, 1800);
+    setup();
+
+    SIM_RUN(channels_share_current_wait);
+    SIM_RUN(failed_channel_is_flagged);
+    return simTestResult();
+}
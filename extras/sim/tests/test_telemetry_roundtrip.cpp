@@ -0,0 +1,292 @@
+/**************************************************************************/
+/*!
+    @file     test_telemetry_roundtrip.cpp
+    @author   Masa
+
+        Binary telemetry round trip: IotGateway frames decoded with TelemetryFrame
+
+        IotGateway をバイナリフォーマットにしてステータス・履歴レコードを送り、UARTに出たバイト列を
+        ゲートウエイ側と同じく 0x00 で区切って TelemetryFrame でデコードし、送った内容に戻るかを確かめる.
+        0x00 や 0xFF を含む値（COBS）、壊れたフレームを捨てること、途中から受信しても次の区切りから
+        読めること、トレース（trace_decode と同じ手順）も確かめる.
+        バイナリフォーマットで送るJSONの行（コマンドの応答）が 0x00 で区切られることも確かめる.
+        同じ内容のJSONとバイト数も比べる（9600baudで3倍以上の頻度で送れること）.
+
+        @section  HISTORY
+
+*/
+/**************************************************************************/
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+#include "SimClock.h"
+#include "SimTest.h"
+
+#include "IotGateway.h"
+#include "TelemetryFrame.h"
+#include "TraceLog.h"
+
+namespace{
+    //  ゲートウエイのリンク  UARTに出たバイト列を受け取る
+    IotGateway* gateway = nullptr;
+    std::vector<uint8_t> wire;
+
+    //  送信キューとUARTのバッファが空になるまで仮想時計を進める
+    void drain(void){
+        for (uint32_t t = 0; t < 10000 && gateway->getTxPending() != 0; t++){
+            gateway->service();
+            sim_clock.advance(1000);
+        }
+        //  UARTのバッファに残ったバイトを送り終える（出力先に渡すのは読み書きした時）
+        gateway->flush();
+    }
+
+    //  受信したバイト列を 0x00 で区切る（区切りは含めない）
+    std::vector<std::vector<uint8_t>> split_frames(const std::vector<uint8_t>& bytes){
+        std::vector<std::vector<uint8_t>> frames;
+        std::vector<uint8_t> frame;
+        for (uint8_t c : bytes){
+            if (c == 0x00){
+                if (!frame.empty()){
+                    frames.push_back(frame);
+                }
+                frame.clear();
+            } else {
+                frame.push_back(c);
+            }
+        }
+        return frames;
+    }
+
+    bool same_history(const HistoryRecord& a, const HistoryRecord& b){
+        return a.seq == b.seq && a.timestamp == b.timestamp && a.liquid_level == b.liquid_level
+            && a.raw_voltage == b.raw_voltage && a.raw_current == b.raw_current && a.flags == b.flags;
+    }
+
+    //  ステータスレコード  内容とシーケンス番号（送信ごとに1つ増え、255の次は0）が戻る
+    void status_round_trip(void){
+        const StatusRecord sent[] = {
+            {0, 0x00, 20, 1800, 500},
+            {0, TELEMETRY_FLAG_SENSOR_ERROR | (2 << TELEMETRY_FLAG_MODE_SHIFT) | (3 << TELEMETRY_FLAG_CHANNEL_SHIFT), 6, 0, 0},
+            {0, 0x02, 255, 0xFFFF, 1000},
+            {0, 0x00, 0, 0x0100, 0x0001},    //  0x00 の多いレコード
+        };
+        constexpr size_t RECORDS = 300;
+
+        wire.clear();
+        gateway->setFormat(IotGateway::FORMAT_BINARY);
+        std::vector<uint8_t> seqs;
+        for (size_t i = 0; i < RECORDS; i++){
+            StatusRecord record = sent[i % 4];
+            SIM_CHECK(gateway->sendRecord(record));
+            seqs.push_back(record.seq);
+            drain();
+        }
+
+        const auto frames = split_frames(wire);
+        SIM_CHECK_EQ(frames.size(), RECORDS);
+        for (size_t i = 0; i < frames.size() && i < RECORDS; i++){
+            StatusRecord got = {};
+            if (!SIM_CHECK(telemetry_unpack_status(frames[i].data(), frames[i].size(), got))){
+                continue;
+            }
+            const StatusRecord& want = sent[i % 4];
+            SIM_CHECK_EQ(got.seq, seqs[i]);
+            SIM_CHECK_EQ(got.seq, (seqs[0] + i) & 0xFF);
+            SIM_CHECK_EQ(got.flags, want.flags);
+            SIM_CHECK_EQ(got.sensor_length, want.sensor_length);
+            SIM_CHECK_EQ(got.timer_period, want.timer_period);
+            SIM_CHECK_EQ(got.liquid_level, want.liquid_level);
+            //  区切りまで含めて最大長以内
+            SIM_CHECK(frames[i].size() + 1 <= TELEMETRY_FRAME_SIZE);
+        }
+    }
+
+    //  履歴レコード  負の読み値、32bitの時刻も戻る
+    void history_round_trip(void){
+        const HistoryRecord sent[] = {
+            {0, 0, 0, 0, 0, 0},
+            {1, 86400, 523, 12345, 6789, 0x04},
+            {0xFFFF, 0xFFFFFFFF, 1000, -32768, 32767, 0x1F},
+            {0x0100, 0x00010000, 0x0100, -1, -256, 0x01},
+        };
+
+        wire.clear();
+        gateway->setFormat(IotGateway::FORMAT_BINARY);
+        for (const HistoryRecord& record : sent){
+            SIM_CHECK(gateway->sendHistory(record));
+        }
+        drain();
+
+        const auto frames = split_frames(wire);
+        SIM_CHECK_EQ(frames.size(), 4);
+        for (size_t i = 0; i < frames.size() && i < 4; i++){
+            HistoryRecord got = {};
+            SIM_CHECK(telemetry_unpack_history(frames[i].data(), frames[i].size(), got));
+            SIM_CHECK(same_history(got, sent[i]));
+            //  種別が違うものとしては読めない
+            StatusRecord status;
+            SIM_CHECK(!telemetry_unpack_status(frames[i].data(), frames[i].size(), status));
+        }
+    }
+
+    //  壊れたフレームは捨てる  1byte化け・短い・長い
+    void corrupted_frames_rejected(void){
+        const StatusRecord record = {42, 0x02, 20, 1800, 500};
+        uint8_t frame[TELEMETRY_FRAME_SIZE];
+        const size_t length = telemetry_pack_status(record, frame);
+        StatusRecord got;
+
+        SIM_CHECK(telemetry_unpack_status(frame, length, got));
+        SIM_CHECK(telemetry_unpack_status(frame, length - 1, got));
+        uint32_t rejected = 0;
+        for (size_t i = 0; i + 1 < length; i++){
+            for (uint8_t bit = 0; bit < 8; bit++){
+                uint8_t broken[TELEMETRY_FRAME_SIZE];
+                memcpy(broken, frame, length);
+                broken[i] ^= (uint8_t)(1 << bit);
+                rejected += telemetry_unpack_status(broken, length, got) ? 0 : 1;
+            }
+        }
+        SIM_CHECK_EQ(rejected, (length - 1) * 8);
+        SIM_CHECK(!telemetry_unpack_status(frame, length - 2, got));
+        uint8_t longer[TELEMETRY_FRAME_SIZE + 1];
+        memcpy(longer, frame, length - 1);
+        longer[length - 1] = 0x01;
+        longer[length] = 0x00;
+        SIM_CHECK(!telemetry_unpack_status(longer, length + 1, got));
+    }
+
+    //  途中から受信を始めても、次の区切りから正しく読める
+    void resync_after_partial_frame(void){
+        const StatusRecord record = {7, 0x02, 20, 1800, 321};
+        uint8_t frame[TELEMETRY_FRAME_SIZE];
+        const size_t length = telemetry_pack_status(record, frame);
+
+        std::vector<uint8_t> bytes(frame + 4, frame + length);  //  前半を取りこぼした
+        bytes.insert(bytes.end(), frame, frame + length);
+        const auto frames = split_frames(bytes);
+        SIM_CHECK_EQ(frames.size(), 2);
+        StatusRecord got = {};
+        SIM_CHECK(!telemetry_unpack_status(frames[0].data(), frames[0].size(), got));
+        SIM_CHECK(telemetry_unpack_status(frames[1].data(), frames[1].size(), got));
+        SIM_CHECK_EQ(got.liquid_level, 321);
+    }
+
+    //  トレース  リングバッファから出して、文字のログと混ざったバイト列からデコードする
+    void trace_round_trip(void){
+        TraceRing ring;
+        SIM_CHECK(ring.push(TRACE_LEVEL, 523, 1000));
+        SIM_CHECK(ring.push(TRACE_RESISTANCE, -1, 0xFFFFFFFF));
+        SIM_CHECK(ring.push(TRACE_PGA_RANGE, 0, 0));
+
+        std::vector<uint8_t> bytes;
+        const char text[] = "Level = 52.3\r\n";
+        TraceEvent event;
+        while (ring.pop(event)){
+            uint8_t frame[TELEMETRY_FRAME_SIZE];
+            const size_t length = telemetry_pack_trace(event, frame);
+            bytes.insert(bytes.end(), text, text + sizeof(text) - 1);
+            bytes.push_back(0x00);
+            bytes.insert(bytes.end(), frame, frame + length);
+        }
+
+        std::vector<TraceEvent> decoded;
+        uint32_t text_chunks = 0;
+        for (const auto& chunk : split_frames(bytes)){
+            TraceEvent got;
+            if (telemetry_unpack_trace(chunk.data(), chunk.size(), got)){
+                decoded.push_back(got);
+            } else {
+                text_chunks++;
+            }
+        }
+        SIM_CHECK_EQ(text_chunks, 3);
+        SIM_CHECK_EQ(decoded.size(), 3);
+        if (decoded.size() == 3){
+            SIM_CHECK_EQ(decoded[0].id, TRACE_LEVEL);
+            SIM_CHECK_EQ(decoded[0].value, 523);
+            SIM_CHECK_EQ(decoded[0].time, 1000);
+            SIM_CHECK_EQ(decoded[1].value, -1);
+            SIM_CHECK_EQ(decoded[1].time, 0xFFFFFFFF);
+            SIM_CHECK_EQ(decoded[2].id, TRACE_PGA_RANGE);
+            SIM_CHECK(strcmp(trace_name(decoded[0].id), "") != 0);
+        }
+    }
+
+    //  バイナリフォーマットでもコマンドの応答はJSONの行  0x00 で区切られ、前後のフレームを壊さない
+    void json_reply_between_frames(void){
+        const HistoryRecord history = {5, 3600, 523, 1234, 567, 0x02};
+        StatusRecord status = {0, 0x02, 20, 1800, 499};
+
+        wire.clear();
+        gateway->setFormat(IotGateway::FORMAT_BINARY);
+        SIM_CHECK(gateway->sendHistory(history));
+        gateway->clearPayload();
+        gateway->addPayload("ack", "hist");
+        gateway->addPayload("count", (int32_t)1);
+        SIM_CHECK(gateway->sendPayload());
+        gateway->clearPayload();
+        SIM_CHECK(gateway->sendRecord(status));
+        drain();
+
+        const auto frames = split_frames(wire);
+        SIM_CHECK_EQ(frames.size(), 3);
+        if (frames.size() == 3){
+            HistoryRecord got_history = {};
+            SIM_CHECK(telemetry_unpack_history(frames[0].data(), frames[0].size(), got_history));
+            SIM_CHECK(same_history(got_history, history));
+            const std::string reply(frames[1].begin(), frames[1].end());
+            SIM_CHECK(reply == "{\"ack\":\"hist\",\"count\":1}\r\n");
+            StatusRecord got_status = {};
+            SIM_CHECK(!telemetry_unpack_status(frames[1].data(), frames[1].size(), got_status));
+            SIM_CHECK(telemetry_unpack_status(frames[2].data(), frames[2].size(), got_status));
+            SIM_CHECK_EQ(got_status.liquid_level, 499);
+        }
+    }
+
+    //  同じステータスのJSONとのバイト数  バイナリは1/3以下
+    void binary_is_compact(void){
+        wire.clear();
+        gateway->setFormat(IotGateway::FORMAT_JSON);
+        gateway->clearPayload();
+        gateway->addPayload("status", "NORMAL");
+        gateway->addPayload("mode", "C");
+        gateway->addPayload("length", (int32_t)20);
+        gateway->addPayload("period", (int32_t)1800);
+        gateway->addPayload("level", (int32_t)523, (uint8_t)1);
+        SIM_CHECK(gateway->sendPayload());
+        drain();
+        const size_t json_bytes = wire.size();
+
+        wire.clear();
+        gateway->setFormat(IotGateway::FORMAT_BINARY);
+        StatusRecord record = {0, 2 << TELEMETRY_FLAG_MODE_SHIFT, 20, 1800, 523};
+        SIM_CHECK(gateway->sendRecord(record));
+        drain();
+        const size_t binary_bytes = wire.size();
+
+        printf("  status: JSON %zu bytes, binary %zu bytes\n", json_bytes, binary_bytes);
+        SIM_CHECK(binary_bytes * 3 <= json_bytes);
+    }
+}
+
+int main(void){
+    static IotGateway link(D0, D1);
+    gateway = &link;
+    gateway->begin(9600);
+    gateway->setSink([](const uint8_t* data, size_t length){
+        wire.insert(wire.end(), data, data + length);
+    });
+
+    SIM_RUN(status_round_trip);
+    SIM_RUN(history_round_trip);
+    SIM_RUN(corrupted_frames_rejected);
+    SIM_RUN(resync_after_partial_frame);
+    SIM_RUN(trace_round_trip);
+    SIM_RUN(json_reply_between_frames);
+    SIM_RUN(binary_is_compact);
+    return simTestResult();
+}
@@ -0,0 +1,56 @@
+/**************************************************************************/
+/*!
+    @file     trace_decode.cpp
+
+    デバグ用シリアルの出力（文字のログとトレースのフレームが混ざったもの）を
+    読みやすい文字に戻すホスト用のツール
+
+    ビルド（スケッチのフォルダで）:
+        g++ -I. -o trace_decode extras/trace_decode.cpp TraceLog.cpp TelemetryFrame.cpp
+    使い方:
+        trace_decode < capture.bin
+*/
+/**************************************************************************/
+#include <stdio.h>
+#include "TraceLog.h"
+
+namespace{
+    //  1区切りの最大長[byte]  これより長い文字のログは分けて出す
+    constexpr size_t CHUNK_MAX = 256;
+}
+
+/*!
+    @brief  0x00で区切られた1つの塊を出力する. トレースのフレームならデコードし、それ以外は文字のまま出す
+*/
+static void emit(const uint8_t* chunk, size_t length){
+    TraceEvent event;
+
+    if (length == 0){
+        return;
+    }
+    if (telemetry_unpack_trace(chunk, length, event)){
+        printf("[%10lu us] %-16s %ld\n", (unsigned long)event.time, trace_name(event.id), (long)event.value);
+        return;
+    }
+    fwrite(chunk, 1, length, stdout);
+}
+
+int main(void){
+    uint8_t chunk[CHUNK_MAX];
+    size_t length = 0;
+    int c;
+
+    while ((c = getchar()) != EOF){
+        if (c == 0x00 || length == sizeof(chunk)){
+            emit(chunk, length);
+            length = 0;
+            if (c == 0x00){
+                continue;
+            }
+        }
+        chunk[length++] = (uint8_t)c;
+    }
+    emit(chunk, length);
+
+    return 0;
+}
@@ -1,2 +1,4 @@
 #define HSE_VALUE    (16000000U) /*!< Value of the External oscillator in Hz */
 
+//  I2cPort の割り込み転送の完了を受け取るため（I2cPortStm32.cpp）
+#define USE_HAL_I2C_REGISTER_CALLBACKS  1U
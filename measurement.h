@@ -5,14 +5,28 @@
 #ifndef _MEASUREMENT_H_
 #define _MEASUREMENT_H_
 
-#include <Adafruit_ADS1015.h>   // ADC 16bit diff - 2ch
-#include <Adafruit_MCP23008.h>  // PIO 8bit
-#include <Adafruit_MCP4725.h>   // DAC  12bit 
+#include "AdcEngine.h"          // ADC 16bit diff - 2ch (ADS1115)
+#include "I2cBus.h"            // 共有I2Cバス
+#include "MCP23008.h"           // PIO 8bit
 #include "DAC80501.h"           // DAC 16bit for Analog Mon Out
 
 #include "eh900_class.h"
+#include "LevelEstimator.h"
+#include "Log.h"
+#include "Profiler.h"
 
 
+//  AD変換のサンプリング方式
+//      Block : 電流をまとめて計測した後に電圧をまとめて計測し、それぞれの平均値の比を取る
+//      Interleaved : 電流と電圧を交互に計測し、隣り合う組ごとの比の中央値を取る
+enum SamplingModes{Block, Interleaved};
+
+//  1回計測のステート
+enum SingleStates{SingleIdle, SingleCurrentCheck, SingleStabilize, SinglePropagation, SingleFlush, SingleFinal};
+
+//  電流源の立ち上げのステート（startCurrent() / updateCurrent()）  順に進む
+enum CurrentStates{CurrentOff, CurrentChecking, CurrentStabilizing, CurrentReady, CurrentFailed};
+
 /*!
  * @brief Class that stores state and functions for controlling measuement module
  * 
@@ -21,13 +35,12 @@ class Measurement {
 
     public:
 
-        Measurement(eh900* pModel) : LevelMeter(pModel) {
+        Measurement(eh900* pModel, uint8_t channel = 0) : LevelMeter(pModel), channel(channel) {
  
         }
 
         ~Measurement(){
             Serial.println("~ Mesasurement ----");
-            if(current_adj_dac){ delete current_adj_dac; }
             if(v_mon_dac){ delete v_mon_dac; }
             if(pio){ delete pio; }
             if(adconverter){ delete adconverter; }
@@ -35,50 +48,247 @@ class Measurement {
     //  初期化
     
         boolean init(void);
+        boolean isConnected(void);
         void renew_sensor_parameter(void);
 
+        //  計測チャネルの番号（eh900 のパラメタとI2Cアドレスの選択）
+        uint8_t getChannel(void) const {
+            return channel;
+        };
+
     //  電流源制御
  
-        boolean currentOn(void);
+        void startCurrent(void);
+        CurrentStates updateCurrent(void);
         void currentOff(void);
+
+        //  電流源の立ち上げのステート
+        CurrentStates getCurrentState(void) const {
+            return current_state;
+        };
+
         void setCurrent(uint16_t current = 750);
         boolean getStatus(void);
 
     //  計測
 
         boolean measSingle(void);
-        void readLevel(void);
+        boolean startSingle(void);
+        boolean updateSingle(void);
+
+        //  1回計測のステート
+        SingleStates getSingleState(void) const {
+            return single_state;
+        };
+
+        //  1回計測の途中かどうか
+        boolean isSingleRunning(void) const {
+            return single_state != SingleIdle;
+        };
+
+        //  直前の1回計測が正常に終了したか
+        boolean hasSingleSucceeded(void) const {
+            return !f_sensor_error;
+        };
+        boolean startAcquisition(boolean f_continuous = false);
+        void poll(void);
+        boolean readLevel(boolean f_estimate = false);
+
+        //  AD変換シーケンスの途中か、完了して readLevel() を待っているか
+        boolean isAcquiring(void) const {
+            return adconverter && (adconverter->isBusy() || adconverter->isComplete());
+        };
+
+    //  連続計測の液面推定
+
+        void resetEstimator(void);
+
+        //  液面推定を使うか（resetEstimator() で eh900 のパラメタを読んだ後に有効）
+        boolean isEstimating(void) const {
+            return estimator.getFilter() != LevelEstimator::FILTER_NONE;
+        };
+
+        //  液面推定の状態（変化率など）
+        const LevelEstimator& getEstimator(void) const {
+            return estimator;
+        };
+
+    //  連続計測の高速ストリーミング
+
+        void configureStream(void);
+
+        //  ストリーミングを使うか（configureStream() で eh900 のパラメタを読んだ後に有効）
+        boolean isStreaming(void) const {
+            return stream.oversampling != 0;
+        };
+
+        uint32_t getUpdatePeriod(uint32_t poll_period) const;
+
+        //  直前の液面の雑音の見積り（標準偏差） [0.01%]  サンプルのばらつきから求める
+        uint16_t getLevelNoise(void) const {
+            return level_noise;
+        };
+
+        //  サンプリング方式の設定
+        void setSamplingMode(SamplingModes mode){
+            sampling_mode = mode;
+        };
+
+        //  サンプリング方式の読み取り
+        SamplingModes getSamplingMode(void) const {
+            return sampling_mode;
+        };
+
+        //  熱伝導の収束判定の有効/無効を設定
+        void setSettlingDetection(boolean enable){
+            f_settling_detection = enable;
+        };
+
+        //  熱伝導の収束判定のしきい値を設定  [0.1%/s]
+        void setSettlingThreshold(uint16_t value){
+            if ( 0 < value ){
+                settling_threshold = value;
+            }
+        };
 
-    //  モニタ出力制御
+        //  熱伝導の収束判定のしきい値を得る  [0.1%/s]
+        uint16_t getSettlingThreshold(void) const {
+            return settling_threshold;
+        };
+
+        //  液面計算を固定小数点演算（Q16）で行うか  False:浮動小数点演算  次の readLevel() から有効
+        void setFixedPoint(boolean enable){
+            f_fixed_point = enable;
+        };
+
+        //  液面計算を固定小数点演算で行っているか
+        boolean isFixedPoint(void) const {
+            return f_fixed_point;
+        };
+
+    //  PGAの自動レンジ
+
+        adsGain_t getGain(AdcEngine::Channel ch) const;
+
+        //  自動レンジでゲインを変えた回数
+        uint32_t getGainChanges(void) const {
+            return pga_changes;
+        };
+
+        //  振り切れたために捨てて変換し直した回数
+        uint32_t getClipRetries(void) const {
+            return clip_retries;
+        };
+
+        //  直前の液面計算に使った電圧チャネルの平均値（オフセット補正後, GAIN_TWO 換算） [LSB]
+        int16_t getRawVoltage(void) const {
+            return raw_voltage;
+        };
+
+        //  直前の液面計算に使った電流チャネルの平均値（オフセット補正後, GAIN_TWO 換算） [LSB]
+        int16_t getRawCurrent(void) const {
+            return raw_current;
+        };
+
+    //  モニタ出力制御（アナログモニタ用DACはチャネル0だけが持つ）
     
         void setVmon(uint16_t);
         void setVmonFailed(void);
 
     private:
-        //  電流設定用DAコンバータ
-        Adafruit_MCP4725*   current_adj_dac = nullptr;
+        //  電流設定用DAコンバータ（MCP4725）  共有I2Cバスのデバイス番号
+        int8_t              current_adj_dac = -1;
         //  アナログモニタ出力用DAコンバータ
         DAC80501*           v_mon_dac = nullptr;
         //  電流源制御用    GPIO
-        Adafruit_MCP23008*  pio = nullptr;
+        MCP23008*           pio = nullptr;
         //  電圧・電流読み取り用ADコンバータ
-        Adafruit_ADS1115*   adconverter = nullptr;
+        AdcEngine*          adconverter = nullptr;
 
         //  液面計パラメタクラス
         eh900* LevelMeter = nullptr;
+        //  計測チャネルの番号
+        uint8_t channel = 0;
 
         //  電圧・電流値の読み取り
 
         uint32_t read_voltage(void);
         uint32_t read_current(void);
+        boolean read_resistance_pairs(float&);
+
+        //  固定小数点演算（Q16）による液面計算
+
+        uint16_t calc_level_float(void);
+        uint16_t calc_level_fixed(void);
+        int32_t read_voltage_fixed(void);
+        int32_t read_current_fixed(void);
+        boolean read_resistance_pairs_fixed(int32_t&);
+        int32_t q16_from_float(const float);
+        boolean update_settling(uint32_t);
+        void finish_single(void);
+        void next_single_state(SingleStates);
+        int16_t average_raw(AdcEngine::Channel);
+        int32_t adc_offset(AdcEngine::Channel);
+        void update_pga_range(void);
+        boolean is_clipped(void) const;
+        uint16_t estimate_noise(uint16_t);
+        uint16_t continuous_samples(void) const;
 
         //  センサ抵抗値[ohm]
         float sensor_resistance = 0.0;
+        //  センサ抵抗値[milliOhm]（固定小数点演算用）
+        uint32_t sensor_resistance_mohm = 0;
+        //  ADコンバータの補正系数 Q16（固定小数点演算用）  電圧計測, 電流計測
+        int32_t adc_err_comp01_q16 = 0;
+        int32_t adc_err_comp23_q16 = 0;
         //  熱伝導待ち時間 [ms]
         uint16_t delay_time = 0;
 
         //  センサエラーフラグ
         boolean f_sensor_error = false;
+
+        //  AD変換のサンプリング方式
+        SamplingModes sampling_mode = Interleaved;
+
+        //  液面計算の方式  init() で FIXED_POINT_PIPELINE にする
+        boolean f_fixed_point = true;
+
+        //  熱伝導の収束判定  有効フラグとしきい値 [0.1%/s]
+        boolean f_settling_detection = true;
+        uint16_t settling_threshold = 10;
+
+        //  1回計測のステートとその開始時刻 [ms]
+        SingleStates single_state = SingleIdle;
+        uint32_t single_state_start = 0;
+
+        //  電流源の立ち上げのステートとその開始時刻 [ms]
+        CurrentStates current_state = CurrentOff;
+        uint32_t current_state_start = 0;
+
+        //  熱伝導の収束判定用  前回の液面[0.1%]・時刻[ms]と、しきい値未満が続いた回数
+        int32_t settling_prev_level = -1;
+        uint32_t settling_prev_time = 0;
+        uint16_t settling_count = 0;
+
+        //  連続計測の液面推定
+        LevelEstimator estimator;
+
+        //  連続計測の高速ストリーミングの設定と、直前の液面の雑音 [0.01%]
+        AdcStreamConfig stream = {AdcEngine::RATE_128SPS, 0};
+        uint16_t level_noise = 0;
+
+        //  直前の液面計算に使ったAD変換値の平均 [LSB]（履歴の記録用）
+        int16_t raw_voltage = 0;
+        int16_t raw_current = 0;
+
+        //  PGAの自動レンジ  ADのチャネルごとの PGA_RANGES の添字  次の変換に使うものと、変換中・直前の変換に使ったもの
+        uint8_t pga_range[AdcEngine::CH_NUM] = {};
+        uint8_t acq_range[AdcEngine::CH_NUM] = {};
+        uint32_t pga_changes = 0;
+        uint32_t clip_retries = 0;
+
+        //  変換中・直前の変換シーケンスが連続計測のものか（振り切れた時に同じ設定で変換し直す）
+        boolean f_acq_continuous = false;
 };
 
 #endif // _MEASUREMENT_H_
\ No newline at end of file
@@ -2,10 +2,22 @@
 
 
 namespace{  //  I2C adress 
-    constexpr uint16_t I2C_ADDR_ADC            = 0x48;
-    constexpr uint16_t I2C_ADDR_CURRENT_ADJ    = 0x60;
+    //  計測チャネルごとのADコンバータ・電流源設定用DAC・PIO
+    //      チャネル0は従来のアドレス. 増設のチャネルは同じデバイスのアドレスピンを変える
+    //      （ADS1115 ADDR=SDA/SCL, MCP4725 A0=1 / MCP4725A1 A0=1, MCP23008 A2-A0）
+    //      0x49 はアナログモニタ用DAC, 0x62 はLCDのバックライトが使う
+    struct ChannelAddress {
+        uint16_t adc;
+        uint16_t current_adj;
+        uint16_t pio;
+    };
+    constexpr ChannelAddress I2C_ADDR_CHANNEL[METER_CHANNEL_MAX] = {
+        {0x48, 0x60, 0x20},
+        {0x4A, 0x61, 0x21},
+        {0x4B, 0x63, 0x22},
+    };
+    //  アナログモニタ出力はチャネル0だけが持つ
     constexpr uint16_t I2C_ADDR_V_MON          = 0x49;
-    constexpr uint16_t I2C_ADDR_PIO            = 0x20;
 }
 
 // ADの読み値から電圧値を計算するための系数 [/ micro Volts/LSB]
@@ -46,6 +58,46 @@ namespace{
     // AD変換時の平均化回数 １回測るのに10msかかるので注意  10回で100ms
     constexpr uint16_t ADC_AVERAGE_DEFAULT = 10;
 
+    // 交互サンプリング時の電流・電圧の組数  1組20msかかる  6組で120ms
+    constexpr uint16_t ADC_INTERLEAVE_PAIRS = 6;
+
+    //  液面推定を使う連続計測での1回のサンプル数  推定が前回までの結果と合わせるので少なくてよい
+    //      従来の1/3にして3倍の頻度で計測する（AD変換の量は同じ）
+    constexpr uint16_t ADC_ESTIMATE_DIVISION = 3;
+
+    //  中央値の分散の平均値の分散に対する比（正規分布で π/2）  Q16
+    constexpr uint32_t MEDIAN_VARIANCE_RATIO_Q16 = 102944;
+
+    //  AD変換のデータレート  ストリーミング以外（平均化回数・組数はこのレートでの時間）
+    constexpr AdcEngine::DataRate ADC_DATA_RATE_DEFAULT = AdcEngine::RATE_128SPS;
+
+    //  PGAの自動レンジ  チャネルごとに、直前の読み値が振り切れない最も高いゲインを選ぶ（false:従来の GAIN_TWO 固定）
+    constexpr boolean PGA_AUTO_RANGE = true;
+
+    //  ゲインを上げるのは、上げた後の最大値がフルスケールのこの割合 [%] 以下に収まる時
+    constexpr int32_t PGA_RANGE_UP_PERCENT = 75;
+
+    //  ゲインを下げるのは、最大値がフルスケールのこの割合 [%] を超えた時（上げる側との差がヒステリシス）
+    constexpr int32_t PGA_RANGE_DOWN_PERCENT = 90;
+
+    //  ADの読み値のフルスケール [LSB]
+    constexpr int32_t ADC_FULL_SCALE = 32767;
+
+    //  熱伝導の収束判定  液面の変化率がしきい値未満の計測がこの回数続いたら収束とみなす
+    constexpr uint16_t SETTLING_COUNT = 2;
+
+    //  熱伝導の収束判定を始めるまでの最短時間 [ms]
+    constexpr uint32_t SETTLING_MIN_TIME = 500;
+
+    //  電流On後、エラー判定が可能になるまでの時間 [ms]
+    constexpr uint32_t CURRENT_CHECK_WAIT = 10;
+
+    //  電流On後、電流が安定するまでの時間 [ms]
+    constexpr uint32_t CURRENT_STABLE_WAIT = 100;
+
+    //  AD変換シーケンス完了待ちのタイムアウト [ms]
+    constexpr uint32_t ADC_ACQUISITION_TIMEOUT = 1000;
+
     //  電流源設定用DAC MCP4725 1Vあたりの電流[0.1mA]  A/V
     constexpr uint16_t  CURRENT_SORCE_VI_COEFF  = 56;
 
@@ -56,6 +108,86 @@ namespace{
     constexpr uint16_t VMON_COUNT_PER_VOLT = 26214;
 }
 
+//  固定小数点演算（Q16）用の定数  係数はすべてコンパイル時に計算する
+namespace{
+    //  液面計算を固定小数点で行う（false:従来の浮動小数点演算）  setFixedPoint() で切り替えられる
+    constexpr boolean FIXED_POINT_PIPELINE = true;
+
+    constexpr uint16_t Q16_SHIFT = 16;
+    constexpr int32_t  Q16_ONE   = (int32_t)1 << Q16_SHIFT;
+
+    //  正の実数をQ16に変換（四捨五入）
+    constexpr int32_t to_q16(const float value){
+        return (int32_t)(value * (float)Q16_ONE + 0.5f);
+    }
+
+    //  整数の平方根（切り捨て）  1ビットずつ決める
+    uint32_t isqrt64(uint64_t value){
+        uint64_t root = 0;
+        uint64_t bit = (uint64_t)1 << 62;
+
+        while (bit > value){
+            bit >>= 2;
+        }
+        while (bit != 0){
+            if (value >= root + bit){
+                value -= root + bit;
+                root = (root >> 1) + bit;
+            } else {
+                root >>= 1;
+            }
+            bit >>= 2;
+        }
+        return (uint32_t)root;
+    }
+
+    //  PGAの設定ごとの読み取り系数  添字はゲインの低い順（PGA_RANGE_DEFAULT が従来の固定の GAIN_TWO）
+    //      電圧・電流チャネルの系数はアッテネータ・電流電圧変換係数を掛けておく
+    struct PgaRange {
+        adsGain_t gain;
+        float readout;          //  ADの読み取り系数 [microVolt/LSB]
+        float voltage;          //  電圧チャネル  ADゲイン x アッテネータ [microVolt/LSB]
+        float current;          //  電流チャネル  ADゲイン / 電流電圧変換係数 [microAmp/LSB]
+        int32_t readout_q16;    //  以下 Q16
+        int32_t voltage_q16;
+        int32_t current_q16;
+        int32_t lsb_q16;        //  GAIN_TWO の1LSBに対するこのゲインの1LSBの大きさ
+        int32_t ofs_q16;        //  GAIN_TWO で校正したオフセット補正値 [LSB] をこのゲインのLSBにする倍率
+        int64_t up_limit_q16;   //  自動レンジでこのゲインに上げられる最大値  GAIN_TWO 換算 [LSB]
+    };
+
+    constexpr PgaRange make_pga_range(const adsGain_t gain, const float readout){
+        return {gain, readout, readout * ATTENUATOR_COEFF, readout / CURRENT_MEASURE_COEFF,
+                to_q16(readout), to_q16(readout * ATTENUATOR_COEFF), to_q16(readout / CURRENT_MEASURE_COEFF),
+                to_q16(readout / ADC_READOUT_VOLTAGE_COEFF_GAIN_TWO), to_q16(ADC_READOUT_VOLTAGE_COEFF_GAIN_TWO / readout),
+                (int64_t)ADC_FULL_SCALE * PGA_RANGE_UP_PERCENT / 100 * to_q16(readout / ADC_READOUT_VOLTAGE_COEFF_GAIN_TWO)};
+    }
+
+    constexpr PgaRange PGA_RANGES[] = {
+        make_pga_range(GAIN_TWOTHIRDS, ADC_READOUT_VOLTAGE_COEFF_GAIN_TWOTHIRDS),
+        make_pga_range(GAIN_ONE,       ADC_READOUT_VOLTAGE_COEFF_GAIN_ONE),
+        make_pga_range(GAIN_TWO,       ADC_READOUT_VOLTAGE_COEFF_GAIN_TWO),
+        make_pga_range(GAIN_FOUR,      ADC_READOUT_VOLTAGE_COEFF_GAIN_FOUR),
+        make_pga_range(GAIN_EIGHT,     ADC_READOUT_VOLTAGE_COEFF_GAIN_EIGHT),
+        make_pga_range(GAIN_SIXTEEN,   ADC_READOUT_VOLTAGE_COEFF_GAIN_SIXTEEN),
+    };
+    constexpr uint8_t PGA_RANGE_NUM = sizeof(PGA_RANGES) / sizeof(PGA_RANGES[0]);
+    constexpr uint8_t PGA_RANGE_DEFAULT = 2;
+    static_assert(PGA_RANGES[PGA_RANGE_DEFAULT].lsb_q16 == Q16_ONE, "PGA_RANGE_DEFAULT must be GAIN_TWO");
+
+    //  自動レンジでゲインを下げる最大値 [LSB]
+    constexpr int32_t PGA_RANGE_DOWN_LIMIT = ADC_FULL_SCALE * PGA_RANGE_DOWN_PERCENT / 100;
+
+    //  電圧/電流のカウント比から抵抗値への換算系数 [ohm] Q16
+    constexpr int32_t RESISTANCE_COEFF_Q16 = to_q16(ATTENUATOR_COEFF * CURRENT_MEASURE_COEFF);
+
+    //  センサの単位長あたりのインピーダンス [milliOhm/inch]
+    constexpr uint32_t SENSOR_UNIT_IMP_MOHM = (uint32_t)(SENSOR_UNIT_IMP * 1000.0 + 0.5);
+
+    //  センサの抵抗値誤差のマージン 2%  [0.1%]
+    constexpr int32_t LEVEL_MARGIN_PERMIL = 1020;
+}
+
 // Measurement::Measurement(eh900* pModel) : LevelMeter(pModel) {}
 /*!
  * @brief 計測モジュールの初期化
@@ -70,64 +202,64 @@ boolean Measurement::init(void){
 
     boolean f_init_succeed = true;
     boolean status = false;
+    const ChannelAddress& address = I2C_ADDR_CHANNEL[channel];
 
-    Serial.print("Meas init -- ");
+    Serial.print("Meas init ch"); Serial.print(channel); Serial.print(" -- ");
 
     // //  必要なパラメタの設定 LevelMeterから読み込む
     Measurement::renew_sensor_parameter();
 
     // //      センサの抵抗値
-    // sensor_resistance = 11.6 * (float)LevelMeter->getSensorLength();
+    // sensor_resistance = 11.6 * (float)LevelMeter->getSensorLength(channel);
     // //      センサ長に応じた計測待ち時間[ms]を設定   マージンとして1.2倍
-    // delay_time = LevelMeter->getSensorLength() * (uint16_t)(1/HEAT_PROPERGATION_VEROCITY * 1000.0 * 1.2);
+    // delay_time = LevelMeter->getSensorLength(channel) * (uint16_t)(1/HEAT_PROPERGATION_VEROCITY * 1000.0 * 1.2);
     
-    // Serial.print("Sensor Length:"); Serial.println(LevelMeter->getSensorLength());
+    // Serial.print("Sensor Length:"); Serial.println(LevelMeter->getSensorLength(channel));
     // Serial.print("Delay Time:"); Serial.println(delay_time);
     // Serial.print("Sensor R:"); Serial.println(sensor_resistance);
 
-    Serial.print("AD Error Comp 01: "); Serial.println(LevelMeter->getAdcErrComp01()*100);
-    Serial.print("AD Error Comp 23: "); Serial.println(LevelMeter->getAdcErrComp23()*100);
-    Serial.print("AD OFFSET Comp 01: "); Serial.println(LevelMeter->getAdcOfsComp01());
-    Serial.print("AD OFFSET Comp 23: "); Serial.println(LevelMeter->getAdcOfsComp23());
+    Serial.print("AD Error Comp 01: "); Serial.println(LevelMeter->getAdcErrComp01(channel)*100);
+    Serial.print("AD Error Comp 23: "); Serial.println(LevelMeter->getAdcErrComp23(channel)*100);
+    Serial.print("AD OFFSET Comp 01: "); Serial.println(LevelMeter->getAdcOfsComp01(channel));
+    Serial.print("AD OFFSET Comp 23: "); Serial.println(LevelMeter->getAdcOfsComp23(channel));
 
-    Serial.print("Current Sorce setting: "); Serial.println(LevelMeter->getCurrentSetting());
+    Serial.print("Current Sorce setting: "); Serial.println(LevelMeter->getCurrentSetting(channel));
     Serial.print("Vmon Offset [LSB]: "); Serial.println(LevelMeter->getVmonOffset());
 
-    // 電流源設定用DAC  初期化
-    if(current_adj_dac){
-        delete current_adj_dac;
-    }
-
-    current_adj_dac = new Adafruit_MCP4725;
+    // 電流源設定用DAC  初期化   書き込みだけなのでバスに直接書く
+    current_adj_dac = i2c_bus.addDevice(address.current_adj, I2C_CLOCK_FAST, "DAC-Current");
 
-    status = current_adj_dac->begin(I2C_ADDR_CURRENT_ADJ, &Wire);
+    status = i2c_bus.probe(current_adj_dac);
     if (!status) { 
         Serial.println("error on Current Source DAC.  ");
         f_init_succeed = false;
     } else {
         // 電流値設定
-        Measurement::setCurrent(LevelMeter->getCurrentSetting());
+        Measurement::setCurrent(LevelMeter->getCurrentSetting(channel));
     }
 
-    // アナログモニタ用DAC  初期化
+    // アナログモニタ用DAC  初期化（チャネル0だけ）
     if(v_mon_dac){
         delete v_mon_dac;
+        v_mon_dac = nullptr;
     }
 
-    v_mon_dac = new DAC80501;
+    if (channel == 0){
+        v_mon_dac = new DAC80501;
 
-    status = v_mon_dac->begin(I2C_ADDR_V_MON, &Wire);
-    if (!status) { 
-        Serial.println("error on Analog Monitor DAC.  ");
-        f_init_succeed = false;
-    } else {
-        status = v_mon_dac->init();
-         if (!status) { 
+        status = v_mon_dac->begin(I2C_ADDR_V_MON, &i2c_bus);
+        if (!status) { 
             Serial.println("error on Analog Monitor DAC.  ");
             f_init_succeed = false;
         } else {
-            // アナログモニタ出力   リセット 
-            Measurement::setVmon(0);
+            status = v_mon_dac->init();
+             if (!status) { 
+                Serial.println("error on Analog Monitor DAC.  ");
+                f_init_succeed = false;
+            } else {
+                // アナログモニタ出力   リセット 
+                Measurement::setVmon(0);
+            }
         }
     }
 
@@ -136,9 +268,9 @@ boolean Measurement::init(void){
         delete pio;
     }
 
-    pio = new Adafruit_MCP23008;
+    pio = new MCP23008;
 
-    status = pio->begin(I2C_ADDR_PIO, &Wire); 
+    status = pio->begin(address.pio, &i2c_bus);
     if (!status) { 
         Serial.println("error on PIO.  ");
         f_init_succeed = false;
@@ -156,15 +288,26 @@ boolean Measurement::init(void){
         delete adconverter;
     }
 
-    adconverter = new Adafruit_ADS1115(I2C_ADDR_ADC);
-    adconverter->begin();
-    adconverter->setGain(GAIN_TWO); 
+    adconverter = new AdcEngine;
+
+    status = adconverter->begin(address.adc, &i2c_bus);
+    if (!status) { 
+        Serial.println("error on ADC.  ");
+        f_init_succeed = false;
+    } else {
+        adconverter->setGain(GAIN_TWO); 
+    }
+    for (uint8_t ch = 0; ch < AdcEngine::CH_NUM; ch++){
+        pga_range[ch] = PGA_RANGE_DEFAULT;
+        acq_range[ch] = PGA_RANGE_DEFAULT;
+    }
+    f_fixed_point = FIXED_POINT_PIPELINE;
 
-    Serial.print("DA-current:"); Serial.print((uint32_t)current_adj_dac,HEX); Serial.print("/");Serial.println(sizeof(*current_adj_dac));
-    Serial.print("DA-Vmon:"); Serial.print((uint32_t)v_mon_dac,HEX); Serial.print("/");Serial.println(sizeof(*v_mon_dac));
-    Serial.print("PIO:"); Serial.print((uint32_t)pio,HEX); Serial.print("/");Serial.println(sizeof(*pio));
-    Serial.print("ADC:"); Serial.print((uint32_t)adconverter,HEX); Serial.print("/");Serial.println(sizeof(*adconverter));
-    Serial.print("eh900:"); Serial.print((uint32_t)LevelMeter,HEX); Serial.print("/");Serial.println(sizeof(*LevelMeter));
+    Serial.print("DA-current: device "); Serial.println(current_adj_dac);
+    Serial.print("DA-Vmon:"); Serial.print((uintptr_t)v_mon_dac,HEX); Serial.print("/");Serial.println(sizeof(*v_mon_dac));
+    Serial.print("PIO:"); Serial.print((uintptr_t)pio,HEX); Serial.print("/");Serial.println(sizeof(*pio));
+    Serial.print("ADC:"); Serial.print((uintptr_t)adconverter,HEX); Serial.print("/");Serial.println(sizeof(*adconverter));
+    Serial.print("eh900:"); Serial.print((uintptr_t)LevelMeter,HEX); Serial.print("/");Serial.println(sizeof(*LevelMeter));
 
     Serial.println("Measurement::init  Fin. --"); 
 
@@ -172,19 +315,32 @@ boolean Measurement::init(void){
 
 }
 
+/*!
+ * @brief このチャネルのADコンバータがつながっているか確かめる（init() の前に使える）
+ * @returns True：ADコンバータが応答した
+ */
+boolean Measurement::isConnected(void){
+    return i2c_bus.probeAddress(I2C_ADDR_CHANNEL[channel].adc);
+}
+
 /*!
  * @brief センサ長の設定に基づき、抵抗値やディレイを設定する
- * 
+ *          固定小数点演算で使うADコンバータの補正系数（Q16）もここで変換しておく
  */
 void Measurement::renew_sensor_parameter(void){
 
     //      センサの抵抗値
-    sensor_resistance = SENSOR_UNIT_IMP * (float)LevelMeter->getSensorLength();
+    sensor_resistance = SENSOR_UNIT_IMP * (float)LevelMeter->getSensorLength(channel);
+    sensor_resistance_mohm = SENSOR_UNIT_IMP_MOHM * LevelMeter->getSensorLength(channel);
+
+    //      ADコンバータの補正系数  計測のたびに浮動小数点から変換しない
+    adc_err_comp01_q16 = Measurement::q16_from_float(LevelMeter->getAdcErrComp01(channel));
+    adc_err_comp23_q16 = Measurement::q16_from_float(LevelMeter->getAdcErrComp23(channel));
 
     //      センサ長に応じた計測待ち時間[ms]を設定   マージンとして1.2倍
-    delay_time = LevelMeter->getSensorLength() * (uint16_t)(1/HEAT_PROPERGATION_VEROCITY * 1000.0 * 1.2);
+    delay_time = LevelMeter->getSensorLength(channel) * (uint16_t)(1/HEAT_PROPERGATION_VEROCITY * 1000.0 * 1.2);
     
-    Serial.print("Sensor Length:"); Serial.println(LevelMeter->getSensorLength());
+    Serial.print("Sensor Length ch"); Serial.print(channel); Serial.print(":"); Serial.println(LevelMeter->getSensorLength(channel));
     Serial.print("Delay Time:"); Serial.println(delay_time);
     Serial.print("Sensor R:"); Serial.println(sensor_resistance);
 
@@ -192,36 +348,65 @@ void Measurement::renew_sensor_parameter(void){
 }
 
 /*!
- * @brief 電流源をOnにする
- * @returns True 負荷に異常なしでOnできた, False 負荷に異常がありOnできなかった
+ * @brief 電流源をOnにする. ブロックしない
+ *          以降は updateCurrent() を頻繁に呼び、CurrentReady（電流が安定した）か CurrentFailed（負荷異常）を待つ
  */
-boolean Measurement::currentOn(void){
-
-    Serial.print("currentCtrl:ON -- "); 
+void Measurement::startCurrent(void){
     pio->digitalWrite(PIO_CURRENT_ENABLE, CURRENT_ON);
-    delay(10); // エラー判定が可能になるまで10ms待つ
-    
-    if (pio->digitalRead(PIO_CURRENT_ERRFLAG) == LOW){
-        f_sensor_error = true;
-        pio->digitalWrite(PIO_CURRENT_ENABLE,CURRENT_OFF);
-        Serial.print(" FAIL.  ");
-    } else {
-        f_sensor_error = false;
-        delay(100); // issue1: 電流のステイブルを待つ
-        Serial.print(" OK.  ");
+    current_state = CurrentChecking;
+    current_state_start = millis();
+}
+
+/*!
+ * @brief 電流源の立ち上げを1ステップ進める. ブロックしない
+ *          電流On -> エラー判定が可能になるまで待つ（10ms） -> 負荷の判定 -> 電流の安定待ち（100ms）
+ *          負荷に異常があれば電流をOffにしてセンサエラーにする
+ * @returns 処理後のステート
+ */
+CurrentStates Measurement::updateCurrent(void){
+    const uint32_t elapsed = millis() - current_state_start;
+
+    switch (current_state){
+        case CurrentChecking:       // エラー判定が可能になるまで10ms待つ
+            if (elapsed < CURRENT_CHECK_WAIT){
+                break;
+            }
+            if (pio->digitalRead(PIO_CURRENT_ERRFLAG) == LOW){
+                f_sensor_error = true;
+                pio->digitalWrite(PIO_CURRENT_ENABLE, CURRENT_OFF);
+                current_state = CurrentFailed;
+                TRACE(TRACE_CURRENT_ON, 0);
+                LOG_ERRORLN("currentCtrl:ON -- FAIL.");
+                break;
+            }
+            f_sensor_error = false;
+            TRACE(TRACE_CURRENT_ON, 1);
+            current_state = CurrentStabilizing;
+            current_state_start = millis();
+            break;
+
+        case CurrentStabilizing:    // issue1: 電流のステイブルを待つ
+            if (elapsed >= CURRENT_STABLE_WAIT){
+                current_state = CurrentReady;
+            }
+            break;
+
+        default:
+            break;
     }
-    Serial.println("Fin. --");
 
-    return !f_sensor_error;
+    return current_state;
 }
 
 /*!
  * @brief 電流源をOffにする
  */
 void Measurement::currentOff(void){
-    Serial.print("currentCtrl:OFF  -- ");
+    //  途中のAD変換は捨てる（ストリーミングならADCも止める）
+    adconverter->stop();
     pio->digitalWrite(PIO_CURRENT_ENABLE, CURRENT_OFF);      
-    Serial.println(" Fin. --");
+    current_state = CurrentOff;
+    TRACE(TRACE_CURRENT_OFF, 0);
 }
 
 /*!
@@ -232,14 +417,14 @@ void Measurement::currentOff(void){
  */
 void Measurement::setCurrent(uint16_t current){  // current in [0.1milliAmp]
 
-    Serial.print("currentSet: -- "); 
     if ( 670 < current && current < 830){
         uint16_t value = (( current - 666 ) * DAC_COUNT_PER_VOLT) / CURRENT_SORCE_VI_COEFF;
         // current -> vref converting function
-        current_adj_dac->setVoltage(value, false);
-        Serial.print(" DAC changed. " ); 
+        //  MCP4725 ファストモードの書き込み  PD=00, 12bit
+        const uint8_t packet[2] = {(uint8_t)((value >> 8) & 0x0F), (uint8_t)(value & 0xFF)};
+        i2c_bus.write(current_adj_dac, packet, 2);
+        TRACE(TRACE_CURRENT_SET, current);
       }
-    Serial.println("Fin. --" ); 
 }
 
 /*!
@@ -253,167 +438,755 @@ boolean Measurement::getStatus(void){
 
 }
 /*!
- * @brief 液面計測を1回行う.
+ * @brief 液面計測を1回行う. 終了するまでブロックする.
  *          熱伝導速度も考慮して時間待ちする.
  * @returns True:正常に終了, False:電流源が動作せず計測不可
  */
 boolean Measurement::measSingle(void){
-    
-    // boolean flag = false;
-    Serial.println("singleShot: -- "); 
-    
 
-    if (!Measurement::currentOn()){
-        Measurement::currentOff();
-    } else {
-        Serial.print("meas start..  ");
+    if (Measurement::startSingle()){
+        while (!Measurement::updateSingle()){
+        }
+    }
+
+    return !f_sensor_error;
+}
 
-        //  センサへの熱伝導待ち時間の間に3回計測する（動いていますというフィードバックのため）
-        for (uint16_t i =0 ; i < 3; i++){
+/*!
+ * @brief 1回計測を開始する. 以降は updateSingle() を頻繁に呼んで進める
+ * @returns True:開始した, False:計測中で開始できなかった
+ */
+boolean Measurement::startSingle(void){
+
+    if (single_state != SingleIdle){
+        return false;
+    }
+
+    LOG_DEBUGLN("singleShot: -- ");
+    TRACE(TRACE_SINGLE_START, 0);
+    Measurement::startCurrent();
+    Measurement::next_single_state(SingleCurrentCheck);
+
+    return true;
+}
+
+/*!
+ * @brief 1回計測のステートマシンを1ステップ進める. ブロックしない
+ *          電流On -> エラー判定 -> 電流の安定待ち -> 熱伝導待ち -> 確定値の計測 -> 電流Off
+ * @returns True:このステップで計測が終了した, False:計測中もしくは計測していない
+ */
+boolean Measurement::updateSingle(void){
+    const uint32_t elapsed = millis() - single_state_start;
+
+    switch (single_state){
+        case SingleCurrentCheck:    // 電流源の立ち上げ  負荷の判定 -> 電流の安定待ち
+        case SingleStabilize:
+            switch (Measurement::updateCurrent()){
+                case CurrentFailed:
+                    Measurement::finish_single();
+                    return true;
+                case CurrentStabilizing:
+                    single_state = SingleStabilize;
+                    break;
+                default:
+                    break;
+            }
+            if (current_state != CurrentReady){
+                break;
+            }
+            LOG_DEBUGLN("meas start..");
+            //  センサへの熱伝導待ちの間も計測を続ける（動いていますというフィードバックのため）
+            Measurement::startAcquisition();
+            settling_prev_level = -1;
+            settling_count = 0;
+            Measurement::next_single_state(SinglePropagation);
+            break;
+
+        case SinglePropagation:     // 熱伝導待ち  収束判定が有効なら液面が落ち着いた時点で終える（delay_timeが上限）
+            if (f_settling_detection){
+                if (Measurement::update_settling(elapsed)){
+                    TRACE(TRACE_SETTLED, elapsed);
+                    LOG_DEBUGLN(" settled in ", elapsed, " ms ");
+                    Measurement::next_single_state(SingleFlush);
+                    break;
+                }
+            } else {
+                Measurement::readLevel();
+            }
+            if (elapsed >= delay_time){
+                Measurement::next_single_state(SingleFlush);
+                break;
+            }
+            if (!adconverter->isBusy()){
+                Measurement::startAcquisition();
+            }
+            break;
+
+        case SingleFlush:           // 熱伝導待ちの間に開始したシーケンスは完了を待って破棄する
+            adconverter->poll();
+            if (adconverter->isBusy() && elapsed < ADC_ACQUISITION_TIMEOUT){
+                break;
+            }
+            adconverter->release();
+            //  確定値の計測
             f_sensor_error = (pio->digitalRead(PIO_CURRENT_ERRFLAG) == LOW);
-            Measurement::readLevel();
-            delay(delay_time/3);
-        }
-        //  確定値の計測
-        f_sensor_error = (pio->digitalRead(PIO_CURRENT_ERRFLAG) == LOW);
-        Measurement::readLevel();
-        Measurement::currentOff();
+            Measurement::startAcquisition();
+            Measurement::next_single_state(SingleFinal);
+            break;
+
+        case SingleFinal:
+            if (Measurement::readLevel()){
+                Measurement::finish_single();
+                return true;
+            }
+            //  エラーで停止した  もしくはタイムアウト
+            if ((!adconverter->isBusy() && !adconverter->isComplete()) || elapsed >= ADC_ACQUISITION_TIMEOUT){
+                TRACE(TRACE_ADC_ERROR, 2);
+                LOG_ERRORLN(" ADC acquisition failed. ");
+                f_sensor_error = true;
+                Measurement::finish_single();
+                return true;
+            }
+            break;
 
-        Serial.println("single: meas end.");
+        default:
+            break;
     }
-    
-    Serial.println("singleShot: Fin. --"); 
 
-    return !f_sensor_error;
+    return false;
 }
 
 /*!
- * @brief 液面を計測し結果を保存
- * 電流のon/offは感知しない 
+ * @brief 熱伝導待ちの間の液面を評価し、収束したか判定する (private)
+ *          液面の変化率が settling_threshold 未満の計測が SETTLING_COUNT 回続いたら収束とみなす
+ * @param elapsed 熱伝導待ちを始めてからの時間 [ms]
+ * @returns True:収束した, False:まだ収束していない
  */
-void Measurement::readLevel(void){
-    // uint32_t vout = Measurement::read_voltage(); // [micro Volt]
-    uint32_t iout = Measurement::read_current(); // [micro Amp]
+boolean Measurement::update_settling(uint32_t elapsed){
+
+    if (!Measurement::readLevel()){
+        return false;
+    }
+
+    const int32_t level = LevelMeter->getLiquidLevel(channel);
+    boolean f_settled = false;
+
+    if (settling_prev_level >= 0 && elapsed != settling_prev_time){
+        //  液面の変化率 [0.1%/s]
+        const int32_t slope = abs(level - settling_prev_level) * 1000 / (int32_t)(elapsed - settling_prev_time);
+        settling_count = (slope < settling_threshold) ? settling_count + 1 : 0;
+
+        f_settled = (settling_count >= SETTLING_COUNT) && (elapsed >= SETTLING_MIN_TIME);
+    }
+    settling_prev_level = level;
+    settling_prev_time = elapsed;
+
+    return f_settled;
+}
+
+/*!
+ * @brief 1回計測を終了する (private)
+ */
+void Measurement::finish_single(void){
+    Measurement::currentOff();
+    single_state = SingleIdle;
+    TRACE(TRACE_SINGLE_FIN, !f_sensor_error);
+    LOG_DEBUGLN("singleShot: Fin. --");
+}
+
+/*!
+ * @brief 1回計測のステートを遷移させる (private)
+ */
+void Measurement::next_single_state(SingleStates state){
+    single_state = state;
+    single_state_start = millis();
+}
+
+/*!
+ * @brief AD変換シーケンスを開始する. 結果は readLevel() で受け取る
+ *          連続計測では、ストリーミングならその設定で、液面推定を使うなら少ないサンプル数で変換する
+ * @param f_continuous True:連続計測の変換
+ * @returns True:開始した, False:変換中で開始できなかった
+ */
+boolean Measurement::startAcquisition(boolean f_continuous){
+    if (adconverter->isBusy()){
+        return false;
+    }
+
+    f_acq_continuous = f_continuous;
+    const boolean f_streaming = f_continuous && isStreaming();
+    const uint16_t samples = f_continuous ? Measurement::continuous_samples()
+                            : ((sampling_mode == Interleaved) ? ADC_INTERLEAVE_PAIRS : ADC_AVERAGE_DEFAULT);
+
+    adconverter->setDataRate(f_streaming ? (AdcEngine::DataRate)stream.data_rate : ADC_DATA_RATE_DEFAULT);
+    adconverter->setStreaming(f_streaming);
+
+    //  自動レンジで選んだゲインで変換する  readLevel() はこのシーケンスのゲインで計算する
+    for (uint8_t ch = 0; ch < AdcEngine::CH_NUM; ch++){
+        acq_range[ch] = pga_range[ch];
+        adconverter->setGain((AdcEngine::Channel)ch, PGA_RANGES[acq_range[ch]].gain);
+    }
+
+    if (sampling_mode == Interleaved){
+        return adconverter->start(samples, AdcEngine::SEQ_INTERLEAVED);
+    }
+    return adconverter->start(samples, AdcEngine::SEQ_BLOCK);
+}
+
+/*!
+ * @brief 連続計測の1回のチャネルあたりのサンプル数 (private)
+ */
+uint16_t Measurement::continuous_samples(void) const {
+    if (isStreaming()){
+        return stream.oversampling;
+    }
+
+    const uint16_t samples = (sampling_mode == Interleaved) ? ADC_INTERLEAVE_PAIRS : ADC_AVERAGE_DEFAULT;
+    return isEstimating() ? samples / ADC_ESTIMATE_DIVISION : samples;
+}
+
+/*!
+ * @brief AD変換シーケンスを進める. ブロックしないのでループから頻繁に呼ぶこと
+ */
+void Measurement::poll(void){
+    adconverter->poll();
+}
+
+/*!
+ * @brief 完了した電圧・電流の平均値から液面を計算し結果を保存
+ * 電流のon/offは感知しない. AD変換が完了していなければ何もしない（ブロックしない）
+ * @param f_estimate True:液面推定を通した値を保存する（連続計測）
+ * @returns True:新しい液面を保存した, False:変換中もしくはエラー
+ */
+boolean Measurement::readLevel(boolean f_estimate){
+
+    Measurement::poll();
+
+    if (adconverter->hasError()){
+        TRACE(TRACE_ADC_ERROR, 1);
+        LOG_ERRORLN(" ADC sequence error. ");
+        adconverter->release();
+        return false;
+    }
+
+    if (!adconverter->isComplete()){
+        return false;
+    }
+
+    //  振り切れたサンプルは捨てて、下げたゲインで変換し直す（液面も収束判定も更新しない）
+    if (PGA_AUTO_RANGE && Measurement::is_clipped()){
+        Measurement::update_pga_range();
+        adconverter->release();
+        clip_retries++;
+        LOG_DEBUGLN(" ADC clipped. retry ");
+        Measurement::startAcquisition(f_acq_continuous);
+        return false;
+    }
+
+    PROFILE_SCOPE(PROF_READ_LEVEL);
 
     // calc L-He level from the mesurement
+    uint16_t result = 0;  // [0.1%]
+    if (f_fixed_point){
+        result = Measurement::calc_level_fixed();
+    } else {
+        result = Measurement::calc_level_float();
+    }
+    raw_voltage = Measurement::average_raw(AdcEngine::CH_DIFF_0_1);
+    raw_current = Measurement::average_raw(AdcEngine::CH_DIFF_2_3);
+    level_noise = Measurement::estimate_noise(result);
+    if (PGA_AUTO_RANGE){
+        Measurement::update_pga_range();
+    }
+    adconverter->release();
+
+    TRACE(TRACE_LEVEL, result);
+    LOG_DEBUGLN(" Level = ", result);
+    if (f_estimate){
+        result = estimator.update(result, millis());
+        TRACE(TRACE_ESTIMATE, result);
+    }
+    LevelMeter->setLiquidLevel(result, channel);
+
+    return true;
+}
+
+/*!
+ * @brief 液面推定のパラメタを eh900 から読み、推定をやり直す（連続計測の開始時と、パラメタが変わった時に呼ぶ）
+ */
+void Measurement::resetEstimator(void){
+    estimator.configure(LevelMeter->getEstimatorConfig());
+}
+
+/*!
+ * @brief ストリーミングのパラメタを eh900 から読む（連続計測の開始時と、パラメタが変わった時に変換の合間に呼ぶ）
+ */
+void Measurement::configureStream(void){
+    stream = LevelMeter->getStreamConfig();
+}
+
+/*!
+ * @brief 連続計測の液面の更新周期の見積り
+ *          ストリーミングでは前の変換が終わるとすぐ次を始めるので、変換シーケンスの時間がそのまま周期になる
+ * @param poll_period readLevel() を呼ぶ周期 [us]
+ * @returns 変換シーケンス1回の時間 [us]
+ */
+uint32_t Measurement::getUpdatePeriod(uint32_t poll_period) const {
+    const AdcEngine::DataRate rate = isStreaming() ? (AdcEngine::DataRate)stream.data_rate : ADC_DATA_RATE_DEFAULT;
+
+    return AdcEngine::getSequenceTime(rate, isStreaming(), Measurement::continuous_samples(), poll_period);
+}
+
+/*!
+ * @brief サンプルのばらつきから液面の雑音（標準偏差）を見積もる (private)
+ *          液面 L = 1000 - R/R0 x 1020 なので  σL = (1000 - L) x σR/R,
+ *          σR/R は電圧・電流それぞれの平均値の相対標準誤差の2乗和の平方根
+ *          交互サンプリングは組ごとの比の中央値なので、平均値より √(π/2) 倍ばらつく
+ *          液面の計算と同じく整数だけで計算する（相対分散は Q32, 1 で頭打ち）
+ * @param level AD変換1回分の液面 [0.1%]
+ * @returns [0.01%]  サンプルが2つ未満なら0
+ */
+uint16_t Measurement::estimate_noise(uint16_t level){
+    uint64_t relative_q32 = 0;
+
+    for (uint8_t ch = 0; ch < AdcEngine::CH_NUM; ch++){
+        int32_t num = adconverter->getCount((AdcEngine::Channel)ch);
+        if (num > ADC_RING_SIZE){
+            num = ADC_RING_SIZE;
+        }
+        if (num < 2){
+            return 0;
+        }
+
+        //  整数で和と2乗和を取る  σ^2/(n・平均^2) = (n・Σx^2 - (Σx)^2) / ((n-1)・(Σx)^2)
+        int64_t sum = 0;
+        int64_t sum2 = 0;
+        for (int32_t i = 0; i < num; i++){
+            const int32_t value = adconverter->getSample((AdcEngine::Channel)ch, i);
+            sum += value;
+            sum2 += value * value;
+        }
+        if (sum <= 0){
+            return 0;
+        }
+        const int64_t spread = num * sum2 - sum * sum;
+        const int64_t denominator = (num - 1) * sum * sum;
+        if (spread <= 0){
+            continue;
+        }
+        if (spread >= denominator){
+            relative_q32 += (uint64_t)1 << 32;
+            continue;
+        }
+        //  分母を31ビットに収め、その分だけ分子のシフトを減らす（分子 < 分母 なので溢れない）
+        uint8_t shift = 0;
+        while ((denominator >> shift) > INT32_MAX){
+            shift++;
+        }
+        relative_q32 += ((uint64_t)spread << (32 - shift)) / (uint64_t)(denominator >> shift);
+    }
+
+    if (adconverter->getSequence() == AdcEngine::SEQ_INTERLEAVED){
+        relative_q32 = (relative_q32 * MEDIAN_VARIANCE_RATIO_Q16) >> Q16_SHIFT;
+    }
+    //  √相対分散 は Q16
+    const uint64_t noise = (uint64_t)(1000 - level) * 10 * isqrt64(relative_q32);
+    return (uint16_t)((noise + (Q16_ONE / 2)) >> Q16_SHIFT);
+}
+
+/*!
+ * @brief 完了したAD変換の、チャネルごとの平均値を返す (private)
+ *          ゲインによらず比べられるように GAIN_TWO のLSBに換算する
+ * @param channel チャネル
+ * @returns オフセット補正後の平均値 [LSB]  変換していなければ0
+ */
+int16_t Measurement::average_raw(AdcEngine::Channel channel){
+    const int32_t num = adconverter->getCount(channel);
+    if (num == 0){
+        return 0;
+    }
+    const int64_t average = adconverter->getSum(channel) / num - Measurement::adc_offset(channel);
+    const int64_t scaled = (average * PGA_RANGES[acq_range[channel]].lsb_q16 + (Q16_ONE / 2)) >> Q16_SHIFT;
+    //  GAIN_TWO より低いゲインでは int16 に入らないことがある
+    return (int16_t)((scaled > INT16_MAX) ? INT16_MAX : (scaled < INT16_MIN) ? INT16_MIN : scaled);
+}
+
+/*!
+ * @brief 変換したゲインでのオフセット補正値を返す (private)
+ *          オフセットは入力換算の電圧なので、GAIN_TWO で校正したLSBの値をゲインに合わせて換算する
+ * @param channel チャネル
+ * @returns オフセット補正値 [LSB]
+ */
+int32_t Measurement::adc_offset(AdcEngine::Channel channel){
+    const int32_t offset = (channel == AdcEngine::CH_DIFF_0_1) ? LevelMeter->getAdcOfsComp01(Measurement::channel)
+                                                               : LevelMeter->getAdcOfsComp23(Measurement::channel);
+    if (acq_range[channel] == PGA_RANGE_DEFAULT){
+        return offset;
+    }
+    const int64_t scaled = (int64_t)offset * PGA_RANGES[acq_range[channel]].ofs_q16;
+    return (int32_t)((scaled + ((scaled < 0) ? -(Q16_ONE / 2) : (Q16_ONE / 2))) / Q16_ONE);
+}
+
+/*!
+ * @brief 完了したAD変換のサンプルの最大値から、次の変換のゲインをチャネルごとに選ぶ (private)
+ *          振り切れていたら2段下げる. 最大値がフルスケールの PGA_RANGE_DOWN_PERCENT を超えていたら、
+ *          PGA_RANGE_UP_PERCENT に収まるまで下げる. 上げた後も PGA_RANGE_UP_PERCENT に収まるなら上げる.
+ *          新しいゲインは次の startAcquisition() から使う
+ */
+void Measurement::update_pga_range(void){
+    for (uint8_t ch = 0; ch < AdcEngine::CH_NUM; ch++){
+        if (adconverter->getCount((AdcEngine::Channel)ch) == 0){
+            continue;
+        }
+
+        const uint8_t current = acq_range[ch];
+        const int32_t peak = adconverter->getPeak((AdcEngine::Channel)ch);
+        uint8_t range = current;
+        if (peak >= ADC_FULL_SCALE){
+            range = (current > 2) ? current - 2 : 0;
+        } else {
+            //  最大値を GAIN_TWO のLSBに換算して、収まる最も高いゲインを探す
+            const int64_t peak_q16 = (int64_t)peak * PGA_RANGES[current].lsb_q16;
+            uint8_t fit = 0;
+            while (fit + 1 < PGA_RANGE_NUM && peak_q16 <= PGA_RANGES[fit + 1].up_limit_q16){
+                fit++;
+            }
+            if (fit > current || peak > PGA_RANGE_DOWN_LIMIT){
+                range = fit;
+            }
+        }
+
+        if (range != pga_range[ch]){
+            TRACE(TRACE_PGA_RANGE, ch * 16 + range);
+            LOG_DEBUGLN(" PGA range ch", ch, " -> ", range);
+            pga_range[ch] = range;
+            pga_changes++;
+        }
+    }
+}
+
+/*!
+ * @brief 完了したAD変換が振り切れていて、ゲインを下げられるチャネルがあるか (private)
+ *          最も低いゲインで振り切れている時は変換し直しても変わらないので、そのまま使う
+ */
+boolean Measurement::is_clipped(void) const {
+    for (uint8_t ch = 0; ch < AdcEngine::CH_NUM; ch++){
+        if (adconverter->getCount((AdcEngine::Channel)ch) != 0 && acq_range[ch] > 0
+            && adconverter->getPeak((AdcEngine::Channel)ch) >= ADC_FULL_SCALE){
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief 次の変換に使うPGAのゲイン
+ * @param ch ADのチャネル
+ */
+adsGain_t Measurement::getGain(AdcEngine::Channel ch) const {
+    return PGA_RANGES[pga_range[ch]].gain;
+}
+
+/*!
+ * @brief 完了したAD変換の結果から浮動小数点演算で液面を計算する
+ * @returns 液面 [0.1%]
+ */
+uint16_t Measurement::calc_level_float(void){
     float ratio =1.0;
-    // 電流が計測されていない場合[1mA以下]   0%  にする。
-    if (iout != 0){
-        ratio = ((float)Measurement::read_voltage()/(float)iout) / sensor_resistance ;
-        Serial.print(" Resistance = "); Serial.println( ratio * sensor_resistance);
-        Serial.print(" Ratio = "); Serial.println( ratio );
-    } else { 
-        Serial.print(" No current flow! ");
+
+    if (adconverter->getSequence() == AdcEngine::SEQ_INTERLEAVED){
+        // 組ごとの抵抗値の中央値  有効な組がなければ 0%  にする。
+        float resistance = 0.0; // [ohm]
+        if (Measurement::read_resistance_pairs(resistance)){
+            ratio = resistance / sensor_resistance ;
+            TRACE(TRACE_RESISTANCE, resistance * 1000);
+            LOG_DEBUGLN(" Resistance = ", resistance, " Ratio = ", ratio);
+        } else {
+            TRACE(TRACE_RESISTANCE, 0);
+            LOG_DEBUGLN(" No current flow! ");
+        }
+    } else {
+        uint32_t iout = Measurement::read_current(); // [micro Amp]
+
+        // 電流が計測されていない場合[1mA以下]   0%  にする。
+        if (iout != 0){
+            ratio = ((float)Measurement::read_voltage()/(float)iout) / sensor_resistance ;
+            TRACE(TRACE_RESISTANCE, ratio * sensor_resistance * 1000);
+            LOG_DEBUGLN(" Resistance = ", ratio * sensor_resistance, " Ratio = ", ratio);
+        } else { 
+            TRACE(TRACE_RESISTANCE, 0);
+            LOG_DEBUGLN(" No current flow! ");
+        }
     }
-    // センサの抵抗値誤差のマージンとして　2%　少な目に表示する
-    uint16_t result = round(( 1.0 - ratio*1.02) * 1000);  // [0.1%]
-    Serial.print(" Level = "); Serial.println( result);
-    LevelMeter->setLiquidLevel(result);
 
+    // センサの抵抗値誤差のマージンとして　2%　少な目に表示する
+    // 電流なし（ratio = 1 で -2%）や雑音で範囲を外れた値は 0〜100% に収める（uint16_t で回り込ませない）
+    const float level = round(( 1.0 - ratio*1.02) * 1000);  // [0.1%]
+    if (level < 0.0){
+        return 0;
+    }
+    return (level > 1000.0) ? 1000 : (uint16_t)level;
 }
+
 /*!
- * @brief センサの電圧を計測する
- * @returns 計測した電圧    [microVolt]
+ * @brief 完了したAD変換の結果から固定小数点演算（Q16）で液面を計算する
+ *          FPUのないCortex-M3向け. 途中の積は64bitで計算する
+ * @returns 液面 [0.1%]
  */
-uint32_t Measurement::read_voltage(void){  
+uint16_t Measurement::calc_level_fixed(void){
+    int32_t resistance = 0;  // [milliOhm]
+    boolean f_current = false;
 
-    float results = 0.0;
-    float readout = 0.0;
-    uint16_t   avg = ADC_AVERAGE_DEFAULT;     // averaging
+    if (adconverter->getSequence() == AdcEngine::SEQ_INTERLEAVED){
+        f_current = Measurement::read_resistance_pairs_fixed(resistance);
+    } else {
+        const int32_t iout = Measurement::read_current_fixed(); // [micro Amp]
+        if (iout > 0){
+            resistance = (int32_t)(((int64_t)Measurement::read_voltage_fixed() * 1000 + iout / 2) / iout);
+            f_current = true;
+        }
+    }
+
+    // 電流が計測されていない場合は 0%  にする。（抵抗 0 は満液で 100%）
+    TRACE(TRACE_RESISTANCE, resistance);
+    if (!f_current){
+        LOG_DEBUGLN(" No current flow! ");
+        return 0;
+    }
+    LOG_DEBUGLN(" Resistance = ", resistance, " mohm");
 
-    Serial.print("Voltage Meas: read_voltage(0-1): ");
+    // センサの抵抗値誤差のマージンとして　2%　少な目に表示する
+    const int32_t level = 1000 - (int32_t)(((int64_t)resistance * LEVEL_MARGIN_PERMIL + sensor_resistance_mohm / 2)
+                                            / sensor_resistance_mohm);  // [0.1%]
 
-    for (uint16_t i = 0; i < avg; i++){
-    //   results += (float)adconverter.readADC_Differential_0_1();
-        readout = (float)(adconverter->readADC_Differential_0_1() - LevelMeter->getAdcOfsComp01());
-        Serial.print(", "); Serial.print(readout);  
-        results += readout;
+    if (level < 0){
+        return 0;
     }
+    return (level > 1000) ? 1000 : (uint16_t)level;
+}
 
-//    uint16_t gain_setting = ads.getGain();
-    float adc_gain_coeff=0.0;
-    switch (adconverter->getGain()){
-        case GAIN_TWOTHIRDS:
-            adc_gain_coeff = ADC_READOUT_VOLTAGE_COEFF_GAIN_TWOTHIRDS;
-        break;
+/*!
+ * @brief センサの電圧を計算する（AD変換完了後に呼ぶこと）
+ * @returns 計測した電圧    [microVolt]
+ */
+uint32_t Measurement::read_voltage(void){  
+    PROFILE_SCOPE(PROF_READ_VOLTAGE);
 
-        case GAIN_ONE:
-            adc_gain_coeff = ADC_READOUT_VOLTAGE_COEFF_GAIN_ONE;
-        break;
+    float results = 0.0;
+    const uint16_t avg = adconverter->getCount(AdcEngine::CH_DIFF_0_1);     // averaging
+    const int32_t offset = Measurement::adc_offset(AdcEngine::CH_DIFF_0_1);
 
-        default:
-            adc_gain_coeff = ADC_READOUT_VOLTAGE_COEFF_GAIN_TWO;
-        break;
+    for (uint16_t i = 0; i < avg && i < ADC_RING_SIZE; i++){
+        TRACE(TRACE_RAW_V, adconverter->getSample(AdcEngine::CH_DIFF_0_1, i) - offset);
     }
+    results = (float)(adconverter->getSum(AdcEngine::CH_DIFF_0_1) - (int32_t)avg * offset);
 
-    results = results / (float)avg * adc_gain_coeff * LevelMeter->getAdcErrComp01() * ATTENUATOR_COEFF;
+    results = results / (float)avg * PGA_RANGES[acq_range[AdcEngine::CH_DIFF_0_1]].voltage * LevelMeter->getAdcErrComp01(channel);
 
 // Lower limmit 
     // if (results < 1.0){
     //     results = 1.0;
     // }
 
-    Serial.print(" "); Serial.print(results); Serial.println(" uV: Fin. --");
+    TRACE(TRACE_VOLTAGE, results);
+    LOG_DEBUGLN("Voltage Meas: ", results, " uV");
 
     return round(results);
 }
 
 /*!
- * @brief センサに流れている電流を計測
+ * @brief センサに流れている電流を計算する（AD変換完了後に呼ぶこと）
  * @returns 計測した電流    [microAmp]
  */
 uint32_t Measurement::read_current(void){  // return measured current in [microAmp]
+    PROFILE_SCOPE(PROF_READ_CURRENT);
 
     float results = 0.0;
-    float readout = 0.0;
-    uint16_t avg = ADC_AVERAGE_DEFAULT;  // averaging
+    const uint16_t avg = adconverter->getCount(AdcEngine::CH_DIFF_2_3);  // averaging
+    const int32_t offset = Measurement::adc_offset(AdcEngine::CH_DIFF_2_3);
 
-    Serial.print("Current Meas: read_voltage(2-3): ");
+    for (uint16_t i = 0; i < avg && i < ADC_RING_SIZE; i++){
+        TRACE(TRACE_RAW_I, adconverter->getSample(AdcEngine::CH_DIFF_2_3, i) - offset);
+    }
+    results = (float)(adconverter->getSum(AdcEngine::CH_DIFF_2_3) - (int32_t)avg * offset);
 
-    for (uint16_t i = 0; i < avg; i++){
-        readout = (float)(adconverter->readADC_Differential_2_3() - LevelMeter->getAdcOfsComp23());
-        Serial.print(", "); Serial.print(readout);  
-        results += readout;
+    // 読み取り系数は電流電圧変換係数で割ってある
+    results = results / (float)avg * PGA_RANGES[acq_range[AdcEngine::CH_DIFF_2_3]].current * LevelMeter->getAdcErrComp23(channel);
+    TRACE(TRACE_CURRENT, results);
+    LOG_DEBUGLN("Current Meas: ", results, " uA");
+    
+  return round(results);
+}
+/*!
+ * @brief 交互サンプリングの電流・電圧の組ごとに抵抗値を計算し、その中央値を返す
+ *          電圧・電流のゲインが同じならADの読み取り系数は比を取ると消える
+ * @param median センサの抵抗値 [ohm]  有効な組がなければ変えない
+ * @returns True:有効な組（電流が流れている組）があった
+ */
+boolean Measurement::read_resistance_pairs(float& median){
+    float resistance[ADC_RING_SIZE];
+    uint16_t valid = 0;
+
+    //  電圧/電流のカウント比から抵抗値への換算系数
+    const float coeff = PGA_RANGES[acq_range[AdcEngine::CH_DIFF_0_1]].voltage * LevelMeter->getAdcErrComp01(channel)
+                            / (PGA_RANGES[acq_range[AdcEngine::CH_DIFF_2_3]].current * LevelMeter->getAdcErrComp23(channel));
+    const int32_t v_offset = Measurement::adc_offset(AdcEngine::CH_DIFF_0_1);
+    const int32_t c_offset = Measurement::adc_offset(AdcEngine::CH_DIFF_2_3);
+
+    uint16_t pairs = adconverter->getCount(AdcEngine::CH_DIFF_0_1);
+    if (pairs > ADC_RING_SIZE){
+        pairs = ADC_RING_SIZE;
     }
 
-    float adc_gain_coeff=0.0;
-    switch (adconverter->getGain()){
-      case GAIN_TWOTHIRDS:
-        adc_gain_coeff = ADC_READOUT_VOLTAGE_COEFF_GAIN_TWOTHIRDS;
-        break;
+    for (uint16_t i = 0; i < pairs; i++){
+        const int32_t v = adconverter->getSample(AdcEngine::CH_DIFF_0_1, i) - v_offset;
+        const int32_t c = adconverter->getSample(AdcEngine::CH_DIFF_2_3, i) - c_offset;
 
-      case GAIN_ONE:
-        adc_gain_coeff = ADC_READOUT_VOLTAGE_COEFF_GAIN_ONE;
-        break;
+        //  電流が流れていない組は除外
+        if (c <= 0){
+            continue;
+        }
 
-      default:
-        adc_gain_coeff = ADC_READOUT_VOLTAGE_COEFF_GAIN_TWO;
-        break;
+        //  挿入ソートで昇順に並べながら格納
+        const float r = (float)v / (float)c * coeff;
+        uint16_t j = valid;
+        while (j > 0 && resistance[j-1] > r){
+            resistance[j] = resistance[j-1];
+            j--;
+        }
+        resistance[j] = r;
+        valid++;
+
+        TRACE(TRACE_PAIR_RESISTANCE, r * 1000);
     }
 
-    Serial.print("reading conveted to Current Out(2-3):");
-    // results = results / (float)avg * coeff * ADC_ERR_COMPENSATION; // reading in microVolt
-    results = results / (float)avg * adc_gain_coeff * LevelMeter->getAdcErrComp23(); // reading in microVolt
-    results = results / (float)CURRENT_MEASURE_COEFF; // convert voltage to current.
-    Serial.print(results);
-    Serial.println(" uA: Fin. --");
-    
-  return round(results);
+    if (valid == 0){
+        return false;
+    }
+    median = (valid % 2) ? resistance[valid/2]
+                         : (resistance[valid/2 - 1] + resistance[valid/2]) / 2.0;
+
+    LOG_DEBUGLN("Pair Meas: median ", median, " ohm");
+
+    return true;
 }
+
+/*!
+ * @brief センサの電圧を固定小数点演算で計算する（AD変換完了後に呼ぶこと）
+ * @returns 計測した電圧    [microVolt]
+ */
+int32_t Measurement::read_voltage_fixed(void){
+    PROFILE_SCOPE(PROF_READ_VOLTAGE);
+    const int32_t avg = adconverter->getCount(AdcEngine::CH_DIFF_0_1);
+    const int64_t counts = adconverter->getSum(AdcEngine::CH_DIFF_0_1) - avg * Measurement::adc_offset(AdcEngine::CH_DIFF_0_1);
+    //  補正系数込みの読み取り系数 Q16
+    const int64_t coeff = ((int64_t)PGA_RANGES[acq_range[AdcEngine::CH_DIFF_0_1]].voltage_q16 * adc_err_comp01_q16) >> Q16_SHIFT;
+
+    const int32_t results = (int32_t)(((counts * coeff) / avg + (Q16_ONE / 2)) >> Q16_SHIFT);
+
+    TRACE(TRACE_VOLTAGE, results);
+    LOG_DEBUGLN("Voltage Meas(fixed): ", results, " uV");
+
+    return results;
+}
+
+/*!
+ * @brief センサに流れている電流を固定小数点演算で計算する（AD変換完了後に呼ぶこと）
+ * @returns 計測した電流    [microAmp]
+ */
+int32_t Measurement::read_current_fixed(void){
+    PROFILE_SCOPE(PROF_READ_CURRENT);
+    const int32_t avg = adconverter->getCount(AdcEngine::CH_DIFF_2_3);
+    const int64_t counts = adconverter->getSum(AdcEngine::CH_DIFF_2_3) - avg * Measurement::adc_offset(AdcEngine::CH_DIFF_2_3);
+    //  補正系数込みの読み取り系数 Q16
+    const int64_t coeff = ((int64_t)PGA_RANGES[acq_range[AdcEngine::CH_DIFF_2_3]].current_q16 * adc_err_comp23_q16) >> Q16_SHIFT;
+
+    const int32_t results = (int32_t)(((counts * coeff) / avg + (Q16_ONE / 2)) >> Q16_SHIFT);
+
+    TRACE(TRACE_CURRENT, results);
+    LOG_DEBUGLN("Current Meas(fixed): ", results, " uA");
+
+    return results;
+}
+
+/*!
+ * @brief 交互サンプリングの組ごとの抵抗値の中央値を固定小数点演算で求める
+ * @param median センサの抵抗値 [milliOhm]  有効な組がなければ変えない
+ * @returns True:有効な組（電流が流れている組）があった
+ */
+boolean Measurement::read_resistance_pairs_fixed(int32_t& median){
+    int32_t resistance[ADC_RING_SIZE];
+    uint16_t valid = 0;
+
+    //  補正系数込みの換算系数 Q16  ゲインが電圧・電流で違えば読み取り系数の比を掛ける（同じなら1）
+    const int64_t gain_ratio = ((int64_t)PGA_RANGES[acq_range[AdcEngine::CH_DIFF_0_1]].readout_q16 << Q16_SHIFT)
+                                / PGA_RANGES[acq_range[AdcEngine::CH_DIFF_2_3]].readout_q16;
+    const int64_t coeff = (((int64_t)RESISTANCE_COEFF_Q16 * gain_ratio) >> Q16_SHIFT)
+                            * adc_err_comp01_q16 / adc_err_comp23_q16;
+    const int32_t v_offset = Measurement::adc_offset(AdcEngine::CH_DIFF_0_1);
+    const int32_t c_offset = Measurement::adc_offset(AdcEngine::CH_DIFF_2_3);
+
+    uint16_t pairs = adconverter->getCount(AdcEngine::CH_DIFF_0_1);
+    if (pairs > ADC_RING_SIZE){
+        pairs = ADC_RING_SIZE;
+    }
+
+    for (uint16_t i = 0; i < pairs; i++){
+        const int32_t v = adconverter->getSample(AdcEngine::CH_DIFF_0_1, i) - v_offset;
+        const int32_t c = adconverter->getSample(AdcEngine::CH_DIFF_2_3, i) - c_offset;
+
+        //  電流が流れていない組は除外
+        if (c <= 0){
+            continue;
+        }
+
+        //  挿入ソートで昇順に並べながら格納
+        const int32_t r = (int32_t)((((int64_t)v * coeff * 1000) / c + (Q16_ONE / 2)) >> Q16_SHIFT);
+        uint16_t j = valid;
+        while (j > 0 && resistance[j-1] > r){
+            resistance[j] = resistance[j-1];
+            j--;
+        }
+        resistance[j] = r;
+        valid++;
+
+        TRACE(TRACE_PAIR_RESISTANCE, r);
+    }
+
+    if (valid == 0){
+        return false;
+    }
+    median = (valid % 2) ? resistance[valid/2]
+                         : (resistance[valid/2 - 1] + resistance[valid/2]) / 2;
+    return true;
+}
+
+/*!
+ * @brief 補正系数（0.9〜1.1）をQ16に変換する (private)  renew_sensor_parameter() で使う
+ */
+int32_t Measurement::q16_from_float(const float value){
+    return (int32_t)(value * (float)Q16_ONE + 0.5f);
+}
+
 /*!
  * @brief アナログモニタ出力の電圧を設定する(100%=1.1V, 0%=0.1V)
  *        センサエラーの判断も含んで出力
  * @param value     液面 [0.1%]    上限：100.0%
  */
 void Measurement::setVmon(uint16_t value){
+    PROFILE_SCOPE(PROF_SET_VMON);
     uint16_t da_value=0;
 
     // debug
     // return;
 
     //  sensorErrorのときは0Vを出力
-    if (LevelMeter->isSensorError()) {
-        v_mon_dac->setVoltage((uint16_t) 0);
+    //  書き込みはキューに入れて待たない（送る前の古い値は上書きされる）
+    if (!v_mon_dac){
+        return;
+    }
+    if (LevelMeter->isSensorError(channel)) {
+        v_mon_dac->postVoltage(0);
     } else {
         //  正常に計測できていて
         //  100.0%以下の値ならそのまま設定、それ以外は更新しない
@@ -422,7 +1195,7 @@ void Measurement::setVmon(uint16_t value){
             da_value = (( VMON_COUNT_PER_VOLT * value ) / 1000) + (uint16_t)((VMON_COUNT_PER_VOLT / 10) - LevelMeter->getVmonOffset());
 
         //     100.0% = 1.1V, 0%=0.1V 
-            v_mon_dac->setVoltage(da_value);
+            v_mon_dac->postVoltage(da_value);
         }
     }
 }
@@ -433,7 +1206,9 @@ void Measurement::setVmon(uint16_t value){
  */
 void Measurement::setVmonFailed(void){
 
-    v_mon_dac->setVoltage((uint16_t) 0);
+    if (v_mon_dac){
+        v_mon_dac->postVoltage(0);
+    }
 
 }
 
@@ -0,0 +1,72 @@
+#ifndef _SCHEDULER_CLASS_H_
+#define _SCHEDULER_CLASS_H_
+
+//  登録できるタスクの最大数  ファームウエアは8個を使うので余裕を持たせる
+constexpr uint8_t SCHEDULER_MAX_TASKS = 12;
+
+//  タスクの関数  最後まで実行して戻ること（ブロックしない）
+typedef void (*TaskFunction)(void);
+
+//  時刻を返す関数 [ms]
+typedef uint32_t (*ClockFunction)(void);
+
+/*! @class Scheduler
+    @brief  周期と優先度を持つタスクを順に実行する協調型スケジューラ
+            loop() から run() を呼び続けて使う
+*/
+class Scheduler
+{
+public:
+    // clock: 時刻源  nullptrなら millis() を使う（ホストでは仮想時計を与えられる）
+    Scheduler(ClockFunction clock = nullptr) : clock_source(clock) {};
+
+    int8_t addTask(TaskFunction func, uint32_t period, uint8_t priority);
+
+    boolean run(void);
+
+    void trigger(int8_t id);
+    void setPeriod(int8_t id, uint32_t period);
+    void enable(int8_t id);
+    void disable(int8_t id);
+    void resync(void);
+
+    uint32_t timeToNext(void);
+
+    //  タスクの周期を返す[ms]
+    uint32_t getPeriod(int8_t id) const {
+        return (0 <= id && id < num_tasks) ? tasks[id].period : 0;
+    };
+
+    //  期限に間に合わなかった回数を返す
+    uint32_t getOverrun(int8_t id) const {
+        return (0 <= id && id < num_tasks) ? tasks[id].overrun : 0;
+    };
+
+private:
+    struct Task {
+        TaskFunction func;
+        //  実行周期[ms]  0の時は trigger() された時だけ実行
+        uint32_t period;
+        //  次に実行する時刻（期限）[ms]
+        uint32_t deadline;
+        //  期限に間に合わず周期を飛ばした回数
+        uint32_t overrun;
+        //  優先度  大きいほど優先
+        uint8_t priority;
+        boolean enabled;
+        boolean triggered;
+    };
+
+    Task tasks[SCHEDULER_MAX_TASKS] = {};
+    uint8_t num_tasks = 0;
+
+    ClockFunction clock_source = nullptr;
+
+    uint32_t now(void) const {
+        return clock_source ? clock_source() : millis();
+    };
+
+    boolean is_ready(const Task& task, uint32_t time) const;
+};
+
+#endif // _SCHEDULER_CLASS_H_
@@ -0,0 +1,172 @@
+#include <Arduino.h>
+#include "scheduler_class.h"
+
+/*!
+ * @brief タスクを登録する. 最初の実行は登録した時刻
+ * @param func タスクの関数
+ * @param period 実行周期[ms]  0なら trigger() された時だけ実行
+ * @param priority 優先度  大きいほど優先
+ * @returns タスクID, 登録できなければ -1
+ */
+int8_t Scheduler::addTask(TaskFunction func, uint32_t period, uint8_t priority){
+
+    if (num_tasks >= SCHEDULER_MAX_TASKS || !func){
+        return -1;
+    }
+
+    Task& task = tasks[num_tasks];
+    task.func = func;
+    task.period = period;
+    task.deadline = now();
+    task.overrun = 0;
+    task.priority = priority;
+    task.enabled = true;
+    task.triggered = false;
+
+    return num_tasks++;
+}
+
+/*!
+ * @brief 実行可能なタスクを1つ実行する.
+ *          優先度の高いものから、同じ優先度なら期限の早いものから選ぶ.
+ *          次の期限は「前回の期限＋周期」とし、処理時間で周期がずれないようにする
+ * @returns True:タスクを実行した, False:実行可能なタスクがなかった
+ */
+boolean Scheduler::run(void){
+    const uint32_t time = now();
+    int8_t selected = -1;
+
+    for (uint8_t i = 0; i < num_tasks; i++){
+        if (!is_ready(tasks[i], time)){
+            continue;
+        }
+        if (selected < 0
+            || tasks[i].priority > tasks[selected].priority
+            || (tasks[i].priority == tasks[selected].priority
+                && (int32_t)(tasks[i].deadline - tasks[selected].deadline) < 0)){
+            selected = i;
+        }
+    }
+
+    if (selected < 0){
+        return false;
+    }
+
+    Task& task = tasks[selected];
+    task.triggered = false;
+
+    if (task.period != 0){
+        task.deadline += task.period;
+        //  1周期以上遅れた時は追いつこうとせず、今から1周期後に合わせる
+        if ((int32_t)(time - task.deadline) >= 0){
+            task.overrun++;
+            task.deadline = time + task.period;
+        }
+    }
+
+    task.func();
+
+    return true;
+}
+
+/*!
+ * @brief タスクをすぐに実行可能にする. 周期タスクはここから周期を数え直す
+ * @param id タスクID
+ */
+void Scheduler::trigger(int8_t id){
+    if (id < 0 || id >= num_tasks){
+        return;
+    }
+    tasks[id].triggered = true;
+    tasks[id].deadline = now();
+}
+
+/*!
+ * @brief タスクの実行周期を変更する. 次の実行は今から1周期後
+ * @param id タスクID
+ * @param period 実行周期[ms]
+ */
+void Scheduler::setPeriod(int8_t id, uint32_t period){
+    if (id < 0 || id >= num_tasks){
+        return;
+    }
+    tasks[id].period = period;
+    tasks[id].deadline = now() + period;
+}
+
+/*!
+ * @brief タスクを有効にする. 周期タスクはすぐに実行可能になる
+ * @param id タスクID
+ */
+void Scheduler::enable(int8_t id){
+    if (id < 0 || id >= num_tasks){
+        return;
+    }
+    if (!tasks[id].enabled){
+        tasks[id].enabled = true;
+        tasks[id].deadline = now();
+    }
+}
+
+/*!
+ * @brief タスクを無効にする
+ * @param id タスクID
+ */
+void Scheduler::disable(int8_t id){
+    if (id < 0 || id >= num_tasks){
+        return;
+    }
+    tasks[id].enabled = false;
+    tasks[id].triggered = false;
+}
+
+/*!
+ * @brief CPUが眠っていた後に呼ぶ. 眠っている間に過ぎた周期タスクの期限を今に合わせる
+ *          眠っていた間の周期は飛ばすだけで、期限に間に合わなかった回数には数えない
+ */
+void Scheduler::resync(void){
+    const uint32_t time = now();
+
+    for (uint8_t i = 0; i < num_tasks; i++){
+        Task& task = tasks[i];
+        if (task.period != 0 && (int32_t)(time - task.deadline) > 0){
+            task.deadline = time;
+        }
+    }
+}
+
+/*!
+ * @brief 次にタスクが実行可能になるまでの時間を返す
+ * @returns 時間[ms]  実行可能なタスクがあれば0, 予定がなければ UINT32_MAX
+ */
+uint32_t Scheduler::timeToNext(void){
+    const uint32_t time = now();
+    uint32_t wait = UINT32_MAX;
+
+    for (uint8_t i = 0; i < num_tasks; i++){
+        const Task& task = tasks[i];
+        if (is_ready(task, time)){
+            return 0;
+        }
+        if (task.enabled && task.period != 0){
+            const uint32_t remain = task.deadline - time;
+            if (remain < wait){
+                wait = remain;
+            }
+        }
+    }
+    return wait;
+}
+
+/*!
+ * @brief タスクが実行可能か判定する (private)
+ */
+boolean Scheduler::is_ready(const Task& task, uint32_t time) const {
+    if (!task.enabled){
+        return false;
+    }
+    if (task.triggered){
+        return true;
+    }
+    return (task.period != 0) && ((int32_t)(time - task.deadline) >= 0);
+}